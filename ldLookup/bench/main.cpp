@@ -0,0 +1,941 @@
+#include <algorithm>   // std::max, std::shuffle
+#include <chrono>      // std::chrono::steady_clock
+#include <cstdlib>     // std::free
+#include <filesystem>  // std::filesystem
+#include <fstream>     // std::ifstream
+#include <iostream>    // std::cout
+#include <numeric>     // std::iota
+#include <random>      // std::mt19937, uniform_int_distribution, uniform_real_distribution
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stddef.h>    // size_t
+#include <stdint.h>    // uint32_t
+#include <fcntl.h>     // open, posix_fadvise
+#include <unistd.h>    // close, fdatasync, getpid
+
+#include "CLI11.hpp"
+#include "diskhash/src/diskhash.h"
+#include "line_reader.hpp"
+#include "parse_variants.hpp"
+#include "posting_codec.hpp"
+#include "string_ops.hpp"
+#include "tokenize.hpp"
+#include "vdh.hpp"
+
+using std::string;
+using std::vector;
+
+/*************************************************/
+/*************************************************/
+/***                  Options                  ***/
+/*************************************************/
+/*************************************************/
+
+struct BenchOptsParse {
+    string src = "";
+    size_t n_lines = 2000000;
+    size_t repeats = 3;
+};
+
+struct BenchOptsPostings {
+    string src = "";
+    size_t n_lines = 2000000;
+    size_t repeats = 3;
+};
+
+struct BenchOptsHash {
+    string src = "";
+    size_t n_lines = 2000000;
+    size_t repeats = 3;
+};
+
+struct BenchOptsProbes {
+    string src = "";
+    size_t column = 5;
+    string tmp_dir = std::filesystem::temp_directory_path();
+    size_t n_keys = 15000000;
+};
+
+struct BenchOptsIndex {
+    string tmp_dir = std::filesystem::temp_directory_path();
+    size_t n_keys = 1000000;
+    size_t repeats = 3;
+};
+
+struct BenchOptsResidency {
+    string tmp_dir = std::filesystem::temp_directory_path();
+    size_t n_keys = 1000000;
+    size_t n_lookups = 1000;
+};
+
+/*************************************************/
+/*************************************************/
+/***                  Helpers                  ***/
+/*************************************************/
+/*************************************************/
+
+/* Columns of a PLINK .ld file: SNP_A, MAF_A, SNP_B, R2. */
+const LDPairParser PLINK_PARSER{ ' ', 3, 7, 4, 9, 0.0, 0 };
+
+/* Prevents the compiler from discarding benchmarked work. */
+volatile size_t sink;
+
+string random_variant_id(std::mt19937& gen, size_t pos) {
+    std::uniform_int_distribution<> rsid(1, 99999999);
+    if (gen() % 2) {
+        return "rs" + std::to_string(rsid(gen)) + ":" + std::to_string(pos) + ":A:G";
+    }
+    return "1:" + std::to_string(pos) + ":C:T";
+}
+
+/* Returns lines in the format of PLINK --r2 output. */
+vector<string> generate_plink_lines(size_t n_lines) {
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<> maf(0.0, 0.5);
+    std::uniform_real_distribution<> r2(0.0, 1.0);
+
+    vector<string> lines;
+    lines.reserve(n_lines);
+    size_t pos = 10000;
+    while (lines.size() < n_lines) {
+        pos += gen() % 500;
+        string index_id = random_variant_id(gen, pos);
+        string index_maf = std::to_string(maf(gen));
+        for (size_t i = 0; i < 5 && lines.size() < n_lines; i++) {
+            size_t ld_pos = pos + gen() % 100000;
+            lines.push_back(
+                "1 " + std::to_string(pos) + " " + index_id + " " + index_maf +
+                " 1 " + std::to_string(ld_pos) + " " + random_variant_id(gen, ld_pos) +
+                " " + std::to_string(maf(gen)) + " " + std::to_string(r2(gen)) + " ");
+        }
+    }
+    return lines;
+}
+
+vector<string> read_lines(const string& path, size_t n_lines) {
+    vector<string> lines;
+    LineReader reader(path);
+    std::string_view line;
+    while (lines.size() < n_lines && reader.next(line)) {
+        lines.emplace_back(line);
+    }
+    return lines;
+}
+
+/* The split()- and std::stod()-based parser that LDPairParser replaced. */
+bool legacy_parse_pair(const string& s, LDPair& pair) {
+    vector<std::string_view> vec(split(std::string_view(s), PLINK_PARSER.delimiter));
+    if (vec.size() < PLINK_PARSER.get_max_column()) {
+        return false;
+    }
+    try {
+        pair.index_variant_maf = std::stod(string(vec.at(PLINK_PARSER.index_variant_maf_column-1)));
+        pair.r2 = std::stod(string(vec.at(PLINK_PARSER.r2_column-1)));
+    } catch (std::invalid_argument& ignore) {
+        return false;
+    }
+    pair.index_variant_id = string(vec.at(PLINK_PARSER.index_variant_id_column-1));
+    pair.ld_variant_id = string(vec.at(PLINK_PARSER.ld_variant_id_column-1));
+    return true;
+}
+
+/* Drops the file at 'path' from the page cache, so it is next read from the
+ * disk. */
+void evict_from_page_cache(const string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+/* Reads the file at 'path' through, so it is in the page cache. */
+void read_into_page_cache(const string& path) {
+    std::ifstream file(path, std::ios::binary);
+    vector<char> buffer(1 << 20);
+    while (file.read(buffer.data(), buffer.size()) || file.gcount()) {}
+}
+
+/* Reports the best of 'repeats' runs of 'f' over 'lines'. */
+template <typename F>
+void run_benchmark(
+    const string& name,
+    const vector<string>& lines,
+    size_t repeats,
+    F f) {
+    double best = 0;
+    for (size_t r = 0; r < repeats; r++) {
+        size_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const string& line : lines) {
+            checksum += f(line);
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        sink = checksum;
+        if (r == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+
+    std::cout << name << '\t' << lines.size() << '\t' << best << '\t';
+    std::cout << static_cast<size_t>(lines.size() / best) << '\n';
+}
+
+/*
+ * Posting lists of LD variant IDs, the same lists as ordinals, and the
+ * quantize_r2() value of each posting.
+ */
+struct PostingLists {
+    vector<vector<string>> ids;
+    vector<vector<uint32_t>> ordinals;
+    vector<vector<uint16_t>> r2s;
+    size_t n_postings = 0;
+};
+
+/*
+ * Groups 'lines' by index variant as setup does, numbering LD variants in
+ * the order they first appear.
+ */
+PostingLists build_posting_lists(const vector<string>& lines) {
+    PostingLists lists;
+    std::unordered_map<string, uint32_t> ordinals;
+    string index_variant_id;
+    LDPairView pair;
+    for (const string& line : lines) {
+        if (!PLINK_PARSER.parse_pair(std::string_view(line), pair)) {
+            continue;
+        }
+        if (lists.ids.empty() || pair.index_variant_id != index_variant_id) {
+            index_variant_id = string(pair.index_variant_id);
+            lists.ids.emplace_back();
+            lists.ordinals.emplace_back();
+            lists.r2s.emplace_back();
+        }
+        auto inserted = ordinals.emplace(pair.ld_variant_id, ordinals.size());
+        lists.ids.back().emplace_back(pair.ld_variant_id);
+        lists.ordinals.back().push_back(inserted.first->second);
+        lists.r2s.back().push_back(quantize_r2(pair.r2));
+        lists.n_postings++;
+    }
+    return lists;
+}
+
+/* Reports the best of 'repeats' runs of 'decode' over 'encoded'. */
+template <typename F>
+void run_codec_benchmark(
+    const string& name,
+    const vector<string>& encoded,
+    size_t n_postings,
+    size_t repeats,
+    F decode) {
+    size_t n_bytes = 0;
+    for (const string& list : encoded) {
+        n_bytes += list.size();
+    }
+
+    double best = 0;
+    for (size_t r = 0; r < repeats; r++) {
+        size_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (const string& list : encoded) {
+            checksum += decode(list);
+        }
+        std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        sink = checksum;
+        if (r == 0 || elapsed.count() < best) {
+            best = elapsed.count();
+        }
+    }
+
+    std::cout << name << '\t' << n_postings << '\t';
+    std::cout << static_cast<double>(n_bytes) / n_postings << '\t' << best << '\t';
+    std::cout << static_cast<size_t>(n_postings / best) << '\t';
+    std::cout << n_bytes / best / 1e9 << '\n';
+}
+
+/*************************************************/
+/*************************************************/
+/***                 Benchmarks                ***/
+/*************************************************/
+/*************************************************/
+
+void bench_parse(std::shared_ptr<BenchOptsParse> opts) {
+    vector<string> lines = opts->src.size()
+        ? read_lines(opts->src, opts->n_lines)
+        : generate_plink_lines(opts->n_lines);
+
+    std::cout << "Benchmark\tLines\tSeconds\tLines/Second\n";
+
+    run_benchmark("split", lines, opts->repeats, [](const string& line) {
+        return split(std::string_view(line), ' ').size();
+    });
+
+    run_benchmark("for_each_column", lines, opts->repeats, [](const string& line) {
+        size_t bytes = 0;
+        for_each_column(line, ' ', PLINK_PARSER.get_max_column(),
+            [&](size_t column, std::string_view text) {
+                bytes += column + text.size();
+            });
+        return bytes;
+    });
+
+    LDPair legacy_pair;
+    run_benchmark("legacy_parse_pair", lines, opts->repeats, [&](const string& line) {
+        return static_cast<size_t>(legacy_parse_pair(line, legacy_pair));
+    });
+
+    LDPair pair;
+    run_benchmark("parse_pair(LDPair)", lines, opts->repeats, [&](const string& line) {
+        return static_cast<size_t>(PLINK_PARSER.parse_pair(line, pair));
+    });
+
+    LDPairView view;
+    run_benchmark("parse_pair(LDPairView)", lines, opts->repeats, [&](const string& line) {
+        return static_cast<size_t>(PLINK_PARSER.parse_pair(std::string_view(line), view));
+    });
+}
+
+void bench_postings(std::shared_ptr<BenchOptsPostings> opts) {
+    vector<string> lines = opts->src.size()
+        ? read_lines(opts->src, opts->n_lines)
+        : generate_plink_lines(opts->n_lines);
+    PostingLists lists = build_posting_lists(lines);
+    if (!lists.n_postings) {
+        throw std::runtime_error("No LD Pairs to Encode");
+    }
+
+    std::cout << "Codec\tPostings\tBytes/Posting\tSeconds\tPostings/Second\tGB/Second\n";
+
+    // IDs separated by tabs, as in tables made before dictionaries existed.
+    vector<string> text;
+    for (const vector<string>& ids : lists.ids) {
+        text.push_back(join(ids, '\t', true));
+    }
+    run_codec_benchmark("text", text, lists.n_postings, opts->repeats,
+        [](const string& list) {
+            size_t bytes = 0;
+            for (std::string_view id : ValueRange(list, '\t')) {
+                bytes += id.size();
+            }
+            return bytes;
+        });
+
+    // 4-byte ordinals, as in tables made before postings were compressed.
+    vector<string> u32;
+    for (const vector<uint32_t>& ordinals : lists.ordinals) {
+        u32.emplace_back();
+        for (uint32_t ordinal : ordinals) {
+            append_uint32(u32.back(), ordinal);
+        }
+    }
+    run_codec_benchmark("u32", u32, lists.n_postings, opts->repeats,
+        [](const string& list) {
+            size_t sum = 0;
+            for (size_t i = 0; i < list.size(); i += sizeof(uint32_t)) {
+                sum += read_uint32(&list[i]);
+            }
+            return sum;
+        });
+
+    vector<string> delta_bp128;
+    for (const vector<uint32_t>& ordinals : lists.ordinals) {
+        delta_bp128.emplace_back();
+        encode_postings(ordinals, delta_bp128.back());
+    }
+    run_codec_benchmark("delta-bp128", delta_bp128, lists.n_postings, opts->repeats,
+        [](const string& list) {
+            size_t sum = 0;
+            decode_postings(list, [&](uint32_t ordinal) { sum += ordinal; });
+            return sum;
+        });
+
+    // Tables with r2 sort each list by descending r2, as LDTable does, so
+    // ordinals no longer ascend and their deltas grow. Their r2 values are
+    // a second list of 2-byte values.
+    vector<string> r2_order_bp128;
+    vector<string> r2s;
+    vector<size_t> order;
+    vector<uint32_t> sorted_ordinals;
+    for (size_t l = 0; l < lists.ordinals.size(); l++) {
+        const vector<uint16_t>& list_r2s = lists.r2s[l];
+        order.resize(list_r2s.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return list_r2s[a] > list_r2s[b];
+        });
+
+        sorted_ordinals.clear();
+        r2s.emplace_back();
+        for (size_t i : order) {
+            sorted_ordinals.push_back(lists.ordinals[l][i]);
+            append_uint16(r2s.back(), list_r2s[i]);
+        }
+        r2_order_bp128.emplace_back();
+        encode_postings(sorted_ordinals, r2_order_bp128.back());
+    }
+    run_codec_benchmark("delta-bp128/r2-order", r2_order_bp128, lists.n_postings,
+        opts->repeats,
+        [](const string& list) {
+            size_t sum = 0;
+            decode_postings(list, [&](uint32_t ordinal) { sum += ordinal; });
+            return sum;
+        });
+    run_codec_benchmark("r2", r2s, lists.n_postings, opts->repeats,
+        [](const string& list) {
+            size_t sum = 0;
+            for (size_t i = 0; i < list.size(); i += sizeof(uint16_t)) {
+                sum += read_uint16(&list[i]);
+            }
+            return sum;
+        });
+}
+
+void bench_hash(std::shared_ptr<BenchOptsHash> opts) {
+    vector<string> lines = opts->src.size()
+        ? read_lines(opts->src, opts->n_lines)
+        : generate_plink_lines(opts->n_lines);
+
+    // Hash every variant ID as it appears, as setup and lookups do.
+    vector<string> ids;
+    size_t n_bytes = 0;
+    LDPairView pair;
+    for (const string& line : lines) {
+        if (PLINK_PARSER.parse_pair(std::string_view(line), pair)) {
+            ids.emplace_back(pair.index_variant_id);
+            ids.emplace_back(pair.ld_variant_id);
+            n_bytes += pair.index_variant_id.size() + pair.ld_variant_id.size();
+        }
+    }
+    if (ids.empty()) {
+        throw std::runtime_error("No Variant IDs Parsed");
+    }
+
+    std::cout << "Mean ID Length: " << static_cast<double>(n_bytes) / ids.size() << "\n\n";
+    std::cout << "Hash\tIDs\tSeconds\tIDs/Second\n";
+    run_benchmark("djb2(1.0)", ids, opts->repeats, [](const string& id) {
+        return static_cast<size_t>(dht_hash_key(id.data(), id.size(), 10));
+    });
+    run_benchmark("djb2+rtable(1.1)", ids, opts->repeats, [](const string& id) {
+        return static_cast<size_t>(dht_hash_key(id.data(), id.size(), 11));
+    });
+    run_benchmark("wyhash(1.2-1.6)", ids, opts->repeats, [](const string& id) {
+        return static_cast<size_t>(dht_hash_key(id.data(), id.size(), 12));
+    });
+}
+
+/* Prints the mean, 99th percentile and maximum of 'probes', which it sorts. */
+void print_probe_stats(vector<size_t>& probes) {
+    std::sort(probes.begin(), probes.end());
+    double sum = 0;
+    for (size_t p : probes) {
+        sum += p;
+    }
+    std::cout << sum / probes.size() << '\t' << probes[(probes.size() - 1) * 99 / 100];
+    std::cout << '\t' << probes.back();
+}
+
+void bench_probes(std::shared_ptr<BenchOptsProbes> opts) {
+    // Keys are rsIDs: a column of snp150Common.txt, or else generated with
+    // about the density of dbSNP.
+    vector<string> keys;
+    if (opts->src.size()) {
+        vector<string> lines = read_lines(opts->src, opts->n_keys);
+        std::unordered_set<string> seen;
+        for (const string& line : lines) {
+            vector<string> fields = split(line, '\t');
+            if (fields.size() >= opts->column
+                && seen.insert(fields[opts->column - 1]).second) {
+                keys.push_back(fields[opts->column - 1]);
+            }
+        }
+    } else {
+        std::mt19937 gen(42);
+        size_t rsid = 0;
+        for (size_t i = 0; i < opts->n_keys; i++) {
+            rsid += 1 + gen() % 20;
+            keys.push_back("rs" + std::to_string(rsid));
+        }
+    }
+    if (keys.empty()) {
+        throw std::runtime_error("No Keys Read");
+    }
+    size_t max_key_size = 0;
+    for (const string& key : keys) {
+        max_key_size = std::max(max_key_size, key.size());
+    }
+
+    std::filesystem::path dir = std::filesystem::path(opts->tmp_dir)
+        / ("ldLookup_bench_probes_" + std::to_string(getpid()));
+    std::filesystem::create_directory(dir);
+    try {
+        std::cout << "Keys: " << keys.size() << "\n\n";
+        std::cout << "Max Load\tBytes/Key\tMean\tP99\tMax\t";
+        std::cout << "Mean(absent)\tP99(absent)\tMax(absent)\n";
+
+        // Tables of version 1.1 can no longer be made, so their probes are
+        // counted on their slots alone, filled by plain linear probing.
+        HashTableOpts legacy_opts;
+        legacy_opts.key_maxlen = max_key_size + 1;
+        legacy_opts.object_datalen = sizeof(uint64_t);
+        uint64_t n_slots;
+        size_t legacy_size = dht_legacy_size(legacy_opts, keys.size(), &n_slots);
+        {
+            vector<uint32_t> slots(n_slots, 0);
+            auto probe = [&](const string& key, bool insert) {
+                uint64_t h = dht_hash_key(key.data(), key.size(), 11) % n_slots;
+                size_t n_probes = 1;
+                while (slots[h] && (insert || keys[slots[h] - 1] != key)) {
+                    h = h + 1 == n_slots ? 0 : h + 1;
+                    n_probes++;
+                }
+                if (insert) {
+                    slots[h] = &key - keys.data() + 1;
+                }
+                return n_probes;
+            };
+            for (const string& key : keys) {
+                probe(key, true);
+            }
+
+            vector<size_t> probes;
+            vector<size_t> absent_probes;
+            for (const string& key : keys) {
+                probes.push_back(probe(key, false));
+                absent_probes.push_back(probe("ss" + key, false));
+            }
+            std::cout << "50%(1.1)\t";
+            std::cout << static_cast<double>(legacy_size) / keys.size() << '\t';
+            print_probe_stats(probes);
+            std::cout << '\t';
+            print_probe_stats(absent_probes);
+            std::cout << '\n';
+        }
+
+        for (size_t load : { 50, 70, 80, 90 }) {
+            string path = dir / ("probes_" + std::to_string(load) + ".dht");
+            HashTableOpts table_opts;
+            table_opts.key_maxlen = max_key_size + 1;
+            table_opts.object_datalen = sizeof(uint64_t);
+            char* err = nullptr;
+            HashTable* ht = dht_create(path.c_str(), table_opts, keys.size(), load, &err);
+            if (!ht) {
+                string error = err ? err : "Out of Memory";
+                std::free(err);
+                throw std::runtime_error(error);
+            }
+
+            vector<size_t> probes;
+            vector<size_t> absent_probes;
+            for (uint64_t i = 0; i < keys.size(); i++) {
+                dht_insert(ht, keys[i].c_str(), &i, nullptr);
+            }
+            for (const string& key : keys) {
+                probes.push_back(dht_probe_length(ht, key.data(), key.size()));
+                string absent_key = "ss" + key;
+                absent_probes.push_back(
+                    dht_probe_length(ht, absent_key.data(), absent_key.size()));
+            }
+            dht_free(ht);
+
+            std::cout << load << "%\t";
+            std::cout << static_cast<double>(std::filesystem::file_size(path)) / keys.size() << '\t';
+            print_probe_stats(probes);
+            std::cout << '\t';
+            print_probe_stats(absent_probes);
+            std::cout << '\n';
+            std::filesystem::remove(path);
+        }
+    } catch (...) {
+        std::filesystem::remove_all(dir);
+        throw;
+    }
+    std::filesystem::remove_all(dir);
+}
+
+void bench_index(std::shared_ptr<BenchOptsIndex> opts) {
+    // Positions increase, so the generated IDs are distinct. Absent IDs are
+    // on another chromosome.
+    std::mt19937 gen(42);
+    vector<string> keys;
+    vector<string> absent_keys;
+    size_t max_key_size = 0;
+    size_t pos = 10000;
+    for (size_t i = 0; i < opts->n_keys; i++) {
+        pos += 1 + gen() % 500;
+        keys.push_back(random_variant_id(gen, pos));
+        absent_keys.push_back("2" + random_variant_id(gen, pos));
+        max_key_size = std::max(max_key_size, keys.back().size());
+    }
+
+    // Queries arrive in no particular order, unlike the keys in the table.
+    vector<string> queries(keys);
+    std::shuffle(queries.begin(), queries.end(), gen);
+
+    std::filesystem::path dir = std::filesystem::path(opts->tmp_dir)
+        / ("ldLookup_bench_index_" + std::to_string(getpid()));
+    std::filesystem::create_directory(dir);
+    Options table_opts = { dir / "bench.vdhdat", dir / "bench.vdhdht", 0, false };
+    try {
+        {
+            Options create_opts = table_opts;
+            create_opts.max_key_size = max_key_size;
+            create_opts.create = true;
+            VectorDiskHash table(create_opts);
+            for (const string& key : keys) {
+                table.append(key, "");
+            }
+        }
+
+        std::cout << "Index\tLookups\tSeconds\tLookups/Second\n";
+        auto run_lookups = [&](const string& name, VectorDiskHash& table) {
+            run_benchmark(name + "(present)", queries, opts->repeats,
+                [&](const string& key) {
+                    return static_cast<size_t>(table.is_member(key));
+                });
+            run_benchmark(name + "(absent)", absent_keys, opts->repeats,
+                [&](const string& key) {
+                    return static_cast<size_t>(table.is_member(key));
+                });
+        };
+        {
+            VectorDiskHash table(table_opts);
+            run_lookups("diskhash", table);
+            table.build_static_index();
+        }
+        {
+            VectorDiskHash table(table_opts);
+            run_lookups("static", table);
+        }
+
+        // The index holds only the map; keys are compared in the table.
+        std::cout << "\nIndex\tBits/Key\n";
+        std::cout << "diskhash\t" << 8.0
+            * std::filesystem::file_size(table_opts.table_path) / keys.size() << '\n';
+        std::cout << "static\t" << 8.0 * std::filesystem::file_size(
+            VectorDiskHash::get_static_index_path(table_opts.table_path))
+            / keys.size() << '\n';
+    } catch (...) {
+        std::filesystem::remove_all(dir);
+        throw;
+    }
+    std::filesystem::remove_all(dir);
+}
+
+void bench_residency(std::shared_ptr<BenchOptsResidency> opts) {
+    // Each key holds the IDs of a few LD surrogates, as the postings of
+    // tables made before the variant dictionary did.
+    std::mt19937 gen(42);
+    vector<string> keys;
+    size_t max_key_size = 0;
+    size_t pos = 10000;
+    for (size_t i = 0; i < opts->n_keys; i++) {
+        pos += 1 + gen() % 500;
+        keys.push_back(random_variant_id(gen, pos));
+        max_key_size = std::max(max_key_size, keys.back().size());
+    }
+    std::uniform_int_distribution<size_t> key_index(0, keys.size() - 1);
+    vector<string> queries;
+    for (size_t i = 0; i < opts->n_lookups; i++) {
+        queries.push_back(keys[key_index(gen)]);
+    }
+
+    std::filesystem::path dir = std::filesystem::path(opts->tmp_dir)
+        / ("ldLookup_bench_residency_" + std::to_string(getpid()));
+    std::filesystem::create_directory(dir);
+    Options table_opts = { dir / "bench.vdhdat", dir / "bench.vdhdht", 0, false };
+    try {
+        {
+            Options create_opts = table_opts;
+            create_opts.max_key_size = max_key_size;
+            create_opts.create = true;
+            create_opts.expected_n_keys = keys.size();
+            VectorDiskHash table(create_opts);
+            for (const string& key : keys) {
+                for (size_t i = 0; i < 5; i++) {
+                    table.push(key, random_variant_id(gen, pos + gen() % 100000));
+                }
+            }
+        }
+        std::cout << "Table MB: "
+            << std::filesystem::file_size(table_opts.table_path) / 1e6 << "\n\n";
+
+        // A cold start reads the table from the disk; a warm one finds it in
+        // the page cache, as a later run on the same table would.
+        std::cout << "Residency\tCache\tOpen Seconds\tLookups\tLookup Seconds"
+            "\tMicroseconds/Lookup\n";
+        const vector<std::pair<string, dht::Residency>> residencies = {
+            { "readahead", dht::DHDefault },
+            { "lazy", dht::DHLazy },
+            { "populate", dht::DHPopulate },
+            { "locked", dht::DHLocked },
+            { "hugepages", dht::DHHugePages }
+        };
+        for (const auto& [name, residency] : residencies) {
+            for (const string cache : { "cold", "warm" }) {
+                if (cache == "cold") {
+                    evict_from_page_cache(table_opts.table_path);
+                } else {
+                    read_into_page_cache(table_opts.table_path);
+                }
+
+                Options open_opts = table_opts;
+                open_opts.residency = residency;
+                auto start = std::chrono::steady_clock::now();
+                std::unique_ptr<VectorDiskHash> table;
+                try {
+                    table.reset(new VectorDiskHash(open_opts));
+                } catch (vdh_error& e) {
+                    // Locking fails beyond the limit of locked memory.
+                    std::cout << name << '\t' << cache << "\tunavailable\n";
+                    continue;
+                }
+                auto opened = std::chrono::steady_clock::now();
+                size_t checksum = 0;
+                for (const string& key : queries) {
+                    checksum += table->lookup_range(key).size();
+                }
+                auto looked_up = std::chrono::steady_clock::now();
+                sink = checksum;
+
+                std::chrono::duration<double> open_elapsed = opened - start;
+                std::chrono::duration<double> lookup_elapsed = looked_up - opened;
+                std::cout << name << '\t' << cache << '\t'
+                    << open_elapsed.count() << '\t' << queries.size() << '\t'
+                    << lookup_elapsed.count() << '\t'
+                    << 1e6 * lookup_elapsed.count() / queries.size() << '\n';
+            }
+        }
+    } catch (...) {
+        std::filesystem::remove_all(dir);
+        throw;
+    }
+    std::filesystem::remove_all(dir);
+}
+
+/*************************************************/
+/*************************************************/
+/***                    CLI                    ***/
+/*************************************************/
+/*************************************************/
+
+void subcommand_parse(CLI::App& app) {
+    auto opts(std::make_shared<BenchOptsParse>());
+    auto cmd(app.add_subcommand(
+        "parse",
+        "Measure LD data parsing throughput in lines per second"
+    ));
+
+    cmd->add_option(
+        "src,-s,--src",
+        opts->src,
+        "PLINK .ld file to parse (defaults to generated PLINK-format lines)"
+    )->check(CLI::ExistingFile);
+
+    cmd->add_option(
+        "-n,--n-lines",
+        opts->n_lines,
+        "Number of lines to parse"
+    )->check(CLI::PositiveNumber);
+
+    cmd->add_option(
+        "-r,--repeats",
+        opts->repeats,
+        "Number of timed runs (the fastest is reported)"
+    )->check(CLI::PositiveNumber);
+
+    cmd->callback([opts]() {
+        bench_parse(opts);
+    });
+}
+
+void subcommand_postings(CLI::App& app) {
+    auto opts(std::make_shared<BenchOptsPostings>());
+    auto cmd(app.add_subcommand(
+        "postings",
+        "Compare the size and decoding speed of posting list codecs"
+    ));
+
+    cmd->add_option(
+        "src,-s,--src",
+        opts->src,
+        "PLINK .ld file to build posting lists from (defaults to generated PLINK-format lines)"
+    )->check(CLI::ExistingFile);
+
+    cmd->add_option(
+        "-n,--n-lines",
+        opts->n_lines,
+        "Number of lines to build posting lists from"
+    )->check(CLI::PositiveNumber);
+
+    cmd->add_option(
+        "-r,--repeats",
+        opts->repeats,
+        "Number of timed runs (the fastest is reported)"
+    )->check(CLI::PositiveNumber);
+
+    cmd->callback([opts]() {
+        bench_postings(opts);
+    });
+}
+
+void subcommand_hash(CLI::App& app) {
+    auto opts(std::make_shared<BenchOptsHash>());
+    auto cmd(app.add_subcommand(
+        "hash",
+        "Compare the throughput of the hash functions of each diskhash version"
+    ));
+
+    cmd->add_option(
+        "src,-s,--src",
+        opts->src,
+        "PLINK .ld file whose variant IDs are hashed (defaults to generated PLINK-format lines)"
+    )->check(CLI::ExistingFile);
+
+    cmd->add_option(
+        "-n,--n-lines",
+        opts->n_lines,
+        "Number of lines to take variant IDs from"
+    )->check(CLI::PositiveNumber);
+
+    cmd->add_option(
+        "-r,--repeats",
+        opts->repeats,
+        "Number of timed runs (the fastest is reported)"
+    )->check(CLI::PositiveNumber);
+
+    cmd->callback([opts]() {
+        bench_hash(opts);
+    });
+}
+
+void subcommand_probes(CLI::App& app) {
+    auto opts(std::make_shared<BenchOptsProbes>());
+    auto cmd(app.add_subcommand(
+        "probes",
+        "Compare the size and probe lengths of diskhash tables at each maximum load"
+    ));
+
+    cmd->add_option(
+        "src,-s,--src",
+        opts->src,
+        "Tab-separated file of keys, such as UCSC's snp150Common.txt (defaults to generated rsIDs)"
+    )->check(CLI::ExistingFile);
+
+    cmd->add_option(
+        "-c,--column",
+        opts->column,
+        "Column of src that holds the keys, counting from 1 (rsIDs in snp150Common.txt)"
+    )->check(CLI::PositiveNumber);
+
+    cmd->add_option(
+        "--tmp-dir",
+        opts->tmp_dir,
+        "Directory in which to build the benchmarked tables"
+    )->check(CLI::ExistingDirectory);
+
+    cmd->add_option(
+        "-n,--n-keys",
+        opts->n_keys,
+        "Number of keys to insert (at most, when read from src)"
+    )->check(CLI::PositiveNumber);
+
+    cmd->callback([opts]() {
+        bench_probes(opts);
+    });
+}
+
+void subcommand_index(CLI::App& app) {
+    auto opts(std::make_shared<BenchOptsIndex>());
+    auto cmd(app.add_subcommand(
+        "index",
+        "Compare key lookups through diskhash and through a static index"
+    ));
+
+    cmd->add_option(
+        "--tmp-dir",
+        opts->tmp_dir,
+        "Directory in which to build the benchmarked tables"
+    )->check(CLI::ExistingDirectory);
+
+    cmd->add_option(
+        "-n,--n-keys",
+        opts->n_keys,
+        "Number of keys to look up"
+    )->check(CLI::PositiveNumber);
+
+    cmd->add_option(
+        "-r,--repeats",
+        opts->repeats,
+        "Number of timed runs (the fastest is reported)"
+    )->check(CLI::PositiveNumber);
+
+    cmd->callback([opts]() {
+        bench_index(opts);
+    });
+}
+
+void subcommand_residency(CLI::App& app) {
+    auto opts(std::make_shared<BenchOptsResidency>());
+    auto cmd(app.add_subcommand(
+        "residency",
+        "Compare the latency of key lookups from a cold and a warm start at each table residency"
+    ));
+
+    cmd->add_option(
+        "--tmp-dir",
+        opts->tmp_dir,
+        "Directory in which to build the benchmarked table (not on tmpfs, whose files cannot be evicted)"
+    )->check(CLI::ExistingDirectory);
+
+    cmd->add_option(
+        "-n,--n-keys",
+        opts->n_keys,
+        "Number of keys in the table"
+    )->check(CLI::PositiveNumber);
+
+    cmd->add_option(
+        "-l,--n-lookups",
+        opts->n_lookups,
+        "Number of random keys to look up after opening the table"
+    )->check(CLI::PositiveNumber);
+
+    cmd->callback([opts]() {
+        bench_residency(opts);
+    });
+}
+
+/************************************************/
+/************************************************/
+/***                   MAIN                   ***/
+/************************************************/
+/************************************************/
+
+int main(int argc, char** argv) {
+    CLI::App app("ldLookup benchmarks");
+    app.option_defaults()->always_capture_default();
+    app.require_subcommand(1);
+
+    subcommand_parse(app);
+    subcommand_postings(app);
+    subcommand_hash(app);
+    subcommand_probes(app);
+    subcommand_index(app);
+    subcommand_residency(app);
+
+    try {
+        CLI11_PARSE(app, argc, argv);
+    } catch (std::exception &e) {
+        std::cout << "ERROR:\n" << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
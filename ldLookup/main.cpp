@@ -1,16 +1,24 @@
-#include <algorithm>   // std::find
+#include <algorithm>   // std::find, std::max, std::sort, std::unique
+#include <deque>       // std::deque
 #include <filesystem>  // std::filesystem::create_directory
+#include <future>      // std::async, std::future
 #include <iostream>    // std::cout
-#include <fstream>     // std::ifstream
 #include <memory>      // std::shared_ptr
+#include <numeric>     // std::iota
 #include <utility>     // std::pair
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <stddef.h>    // size_t
 
 #include "CLI11.hpp"
+#include "external_sort.hpp"
+#include "parallel_ingest.hpp"
 #include "parse_variants.hpp"
+#include "segments.hpp"
+#include "shards.hpp"
+#include "spill.hpp"
 #include "stratify.hpp"
 #include "tables.hpp"
 
@@ -25,11 +33,18 @@ using std::vector;
 
 const string LD_TABLE_FILE_PATH = "ld.vdhdat";
 const string LD_TABLE_TABLE_PATH = "ld.vdhdht";
+const string LD_DICTIONARY_FILE_PATH = "ld_dictionary.vdhdat";
+const string LD_DICTIONARY_TABLE_PATH = "ld_dictionary.vdhdht";
 const string STRATA_TABLE_FILE_PATH = "strata.vdhdat";
 const string STRATA_TABLE_TABLE_PATH = "strata.vdhdht";
+const string R2_STRATA_TABLE_PREFIX = "strata_r2_";
 const string SUMMARY_TABLE_FILE_PATH = "summary.vdhdat";
 const string SUMMARY_TABLE_TABLE_PATH = "summary.vdhdht";
 
+// Key variants are looked up this many at a time, so the memory accesses of
+// a batch overlap.
+const size_t KEY_VARIANT_BATCH_SIZE = 256;
+
 /*************************************************/
 /*************************************************/
 /***                  Options                  ***/
@@ -39,12 +54,37 @@ const string SUMMARY_TABLE_TABLE_PATH = "summary.vdhdht";
 struct SubcommandOptsSetup {
     string dir;
     string src;
+    string tmp_dir = "";
+    size_t n_threads = 1;
+    bool ungrouped = false;
+    bool symmetric = false;
+    bool append = false;
+    string strata = "frozen";
+    size_t n_shards = 0;
+    vector<size_t> shards = vector<size_t>();
+    size_t sort_memory_mb = DEFAULT_SORT_MEMORY >> 20;
     char delimiter = ' ';
     std::string index_variant_id_column = "SNP_A";
     std::string ld_variant_id_column = "SNP_B";
     std::string index_variant_maf_column = "MAF_A";
+    std::string ld_variant_maf_column = "MAF_B";
     std::string r2_column = "R2";
     double r2_threshold_for_ld = 0.0;
+    vector<double> r2_cutoffs = vector<double>();
+    bool static_index = false;
+    size_t index_variants_per_ld_bin = 0;
+    size_t n_ld_bins = 0;
+    size_t index_variants_per_maf_bin = 0;
+    size_t n_maf_bins = 0;
+};
+
+struct SubcommandOptsCompact {
+    string dir;
+};
+
+struct SubcommandOptsStratify {
+    string dir;
+    size_t n_threads = 1;
     size_t index_variants_per_ld_bin = 0;
     size_t n_ld_bins = 0;
     size_t index_variants_per_maf_bin = 0;
@@ -55,24 +95,32 @@ struct SubcommandOptsGetVariantsInLDWith {
     string dir;
     string key_variants_file = "";
     vector<string> key_variants = vector<string>();
+    double min_r2 = 0.0;
+    string residency = "readahead";
 };
 
 struct SubcommandOptsGetVariantsSimilarTo {
     string dir;
     string key_variants_file = "";
     vector<string> key_variants = vector<string>();
+    double min_r2 = 0.0;
+    string residency = "readahead";
 };
 
 struct SubcommandOptsGetVariantsWithStatsLike {
     string dir;
     double target_maf;
     size_t target_surrogate_count;
+    double min_r2 = 0.0;
+    string residency = "readahead";
 };
 
 struct SubcommandOptsGetVariantStatistics {
     string dir;
     string key_variants_file = "";
     vector<string> key_variants = vector<string>();
+    double min_r2 = 0.0;
+    string residency = "readahead";
 };
 
 struct SubcommandOptsSample {
@@ -80,6 +128,8 @@ struct SubcommandOptsSample {
     string key_variants_file = "";
     vector<string> key_variants = vector<string>();
     size_t n_samples = 1;
+    double min_r2 = 0.0;
+    string residency = "readahead";
 };
 
 /*************************************************/
@@ -94,10 +144,20 @@ struct SetupFirstIterationResults {
     size_t max_index_variant_size;
 };
 
+struct Segments {
+    std::shared_ptr<SegmentedLDTable> ld_t;
+    std::shared_ptr<SegmentedSummaryTable> summary_t;
+};
+
 struct Tables {
-    std::shared_ptr<LDTable> ld_t;
+    std::shared_ptr<ShardedLDTable> ld_t;
     std::shared_ptr<StrataTable> strata_t;
-    std::shared_ptr<SummaryTable> summary_t;
+    std::shared_ptr<ShardedSummaryTable> summary_t;
+
+    // Position in R2Cutoffs of the cutoff that strata_t stratifies, if
+    // is_at_r2_cutoff. Otherwise, strata_t is at the setup threshold.
+    bool is_at_r2_cutoff;
+    size_t r2_cutoff;
 };
 
 /*************************************************/
@@ -106,51 +166,277 @@ struct Tables {
 /*************************************************/
 /*************************************************/
 
-void on_invalid_cb(const string& line) {
+void on_invalid_cb(std::string_view line) {
     std::cout << "Ignoring Invalid Line: " << line << std::endl;
 }
 
-Tables open_tables(const std::string& dir_str) {
-    std::filesystem::path dir(dir_str);
+std::string get_tmp_dir(std::shared_ptr<SubcommandOptsSetup> opts) {
+    return opts->tmp_dir.size() ? opts->tmp_dir : opts->dir;
+}
+
+dht::Residency get_residency(const std::string& residency) {
+    if (residency == "lazy") {
+        return dht::DHLazy;
+    } else if (residency == "populate") {
+        return dht::DHPopulate;
+    } else if (residency == "locked") {
+        return dht::DHLocked;
+    } else if (residency == "hugepages") {
+        return dht::DHHugePages;
+    }
+    return dht::DHDefault;
+}
+
+std::filesystem::path get_segment_dir(
+    const std::string& dir,
+    const string& segment) {
+    return (std::filesystem::path(dir) / segment).lexically_normal();
+}
+
+std::shared_ptr<SegmentedSummaryTable> open_summary_table(
+    const std::string& dir,
+    const vector<string>& segments,
+    dht::Residency residency = dht::DHDefault) {
+    vector<std::shared_ptr<SummaryTable>> summary_segments;
+    for (const string& segment : segments) {
+        std::filesystem::path segment_dir = get_segment_dir(dir, segment);
+        summary_segments.emplace_back(new SummaryTable(
+            {segment_dir / SUMMARY_TABLE_FILE_PATH,
+             segment_dir / SUMMARY_TABLE_TABLE_PATH,
+             0,
+             false,
+             0,
+             residency}));
+    }
+    return std::make_shared<SegmentedSummaryTable>(summary_segments);
+}
+
+Segments open_segments(
+    const std::string& dir,
+    const vector<string>& segments,
+    dht::Residency residency = dht::DHDefault) {
+    vector<std::shared_ptr<LDTable>> ld_segments;
+    for (const string& segment : segments) {
+        std::filesystem::path segment_dir = get_segment_dir(dir, segment);
+        ld_segments.emplace_back(new LDTable(
+            {segment_dir / LD_TABLE_FILE_PATH,
+             segment_dir / LD_TABLE_TABLE_PATH,
+             0,
+             false,
+             0,
+             residency},
+            segment_dir / LD_DICTIONARY_FILE_PATH,
+            segment_dir / LD_DICTIONARY_TABLE_PATH));
+    }
+
+	Segments ret;
+	ret.ld_t.reset(new SegmentedLDTable(ld_segments));
+	ret.summary_t = open_summary_table(dir, segments, residency);
+
+	return ret;
+}
+
+/*
+ * Opens the StrataTable at 'file_path' and 'table_path' in the lookup table
+ * 'dir', telling how to rebuild strata of an unsupported version.
+ */
+std::shared_ptr<StrataTable> open_strata_table(
+    const std::filesystem::path& dir,
+    const std::filesystem::path& file_path,
+    const std::filesystem::path& table_path,
+    dht::Residency residency) {
+    try {
+        return std::make_shared<StrataTable>(file_path, table_path, residency);
+    } catch (strata_version_error& e) {
+        // Only sharded lookup tables can be restratified in place.
+        string hint = ShardLayout(dir).is_sharded()
+            ? "Run 'stratify' to rebuild the strata."
+            : "Run 'setup --append --strata recompute' to rebuild the strata.";
+        throw std::runtime_error(string(e.what()) + "\n" + hint);
+    }
+}
+
+std::shared_ptr<StrataTable> open_strata_table(
+    const std::filesystem::path& dir,
+    dht::Residency residency = dht::DHDefault) {
+    return open_strata_table(
+        dir,
+        dir / STRATA_TABLE_FILE_PATH,
+        dir / STRATA_TABLE_TABLE_PATH,
+        residency);
+}
+
+std::filesystem::path get_r2_strata_file_path(
+    const std::filesystem::path& dir,
+    size_t r2_cutoff) {
+    return dir / (R2_STRATA_TABLE_PREFIX + std::to_string(r2_cutoff) + ".vdhdat");
+}
+
+std::filesystem::path get_r2_strata_table_path(
+    const std::filesystem::path& dir,
+    size_t r2_cutoff) {
+    return dir / (R2_STRATA_TABLE_PREFIX + std::to_string(r2_cutoff) + ".vdhdht");
+}
+
+std::shared_ptr<StrataTable> open_r2_strata_table(
+    const std::filesystem::path& dir,
+    size_t r2_cutoff,
+    dht::Residency residency = dht::DHDefault) {
+    return open_strata_table(
+        dir,
+        get_r2_strata_file_path(dir, r2_cutoff),
+        get_r2_strata_table_path(dir, r2_cutoff),
+        residency);
+}
+
+std::shared_ptr<ShardedSummaryTable> open_summary_table(const ShardLayout& layout) {
+    vector<std::shared_ptr<SegmentedSummaryTable>> summary_shards;
+    for (size_t shard = 0; shard < layout.get_n_shards(); shard++) {
+        string shard_dir = layout.get_shard_dir(shard);
+        summary_shards.push_back(
+            open_summary_table(shard_dir, Manifest(shard_dir).get_segments()));
+    }
+    return std::make_shared<ShardedSummaryTable>(layout, summary_shards);
+}
+
+// Opens the tables in 'dir', bringing each into memory as 'residency' says.
+Tables open_tables(
+    const std::string& dir,
+    double min_r2 = 0.0,
+    dht::Residency residency = dht::DHDefault) {
+    ShardLayout layout(dir);
+    vector<std::shared_ptr<SegmentedLDTable>> ld_shards;
+    vector<std::shared_ptr<SegmentedSummaryTable>> summary_shards;
+    std::filesystem::path strata_dir = dir;
+    for (size_t shard = 0; shard < layout.get_n_shards(); shard++) {
+        string shard_dir = layout.get_shard_dir(shard);
+        vector<string> segments = Manifest(shard_dir).get_segments();
+        Segments shard_segments = open_segments(shard_dir, segments, residency);
+        ld_shards.push_back(shard_segments.ld_t);
+        summary_shards.push_back(shard_segments.summary_t);
+
+        // The strata of an unsharded table are in its newest segment.
+        if (!layout.is_sharded()) {
+            strata_dir = get_segment_dir(shard_dir, segments.back());
+        }
+    }
 
 	Tables ret;
-	ret.ld_t.reset(new LDTable(
-	    {dir / LD_TABLE_FILE_PATH,
-	     dir / LD_TABLE_TABLE_PATH,
-	     0,
-	     false}));
-	ret.strata_t.reset(new StrataTable(
-	    dir / STRATA_TABLE_FILE_PATH,
-	    dir / STRATA_TABLE_TABLE_PATH));
-	ret.summary_t.reset(new SummaryTable(
-	    {dir / SUMMARY_TABLE_FILE_PATH,
-	     dir / SUMMARY_TABLE_TABLE_PATH,
-	     0,
-	     false}));
+	ret.ld_t.reset(new ShardedLDTable(layout, ld_shards));
+	ret.summary_t.reset(new ShardedSummaryTable(layout, summary_shards));
+
+    // Every stored pair has an r2 of at least 0, so a minimum r2 of 0 selects
+    // the strata at the setup threshold.
+    ret.is_at_r2_cutoff = min_r2 > 0;
+    ret.r2_cutoff = ret.is_at_r2_cutoff ? R2Cutoffs(dir).find(min_r2) : 0;
+    ret.strata_t = ret.is_at_r2_cutoff
+        ? open_r2_strata_table(strata_dir, ret.r2_cutoff, residency)
+        : open_strata_table(strata_dir, residency);
 
 	return ret;
 }
 
-void print_to_columns(
-    const string& first_col,
-    const vector<string>& second_col) {
-    for (const string& s : second_col) {
-        std::cout << first_col << '\t' << s << '\n';
+bool is_table_path(const std::filesystem::path& path) {
+    return path.extension() == std::filesystem::path(STRATA_TABLE_TABLE_PATH).extension();
+}
+
+// Returns whether any table directly in 'dir' has a static index.
+bool has_static_indexes(const std::filesystem::path& dir) {
+    if (!std::filesystem::is_directory(dir)) {
+        return false;
+    }
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        if (is_table_path(entry.path())
+            && std::filesystem::exists(
+                VectorDiskHash::get_static_index_path(entry.path()))) {
+            return true;
+        }
     }
+    return false;
 }
 
-string read_first_line(string path) {
-    // Open the source input file.
-    std::ifstream file(path);
-    if (!file.is_open()) {
-        throw std::runtime_error("Failed to open '" + path + "'");
+// Builds a static index for each table directly in 'dir' that lacks one.
+void build_static_indexes(const std::filesystem::path& dir) {
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+        if (!is_table_path(entry.path())) {
+            continue;
+        }
+        std::filesystem::path file_path = entry.path();
+        file_path.replace_extension(
+            std::filesystem::path(STRATA_TABLE_FILE_PATH).extension());
+        VectorDiskHash table({ file_path, entry.path(), 0, false });
+        if (!table.has_static_index()) {
+            table.build_static_index();
+        }
     }
+}
+
+template <typename T>
+bool has_bin_options(std::shared_ptr<T> opts) {
+    return (opts->n_ld_bins != 0 || opts->index_variants_per_ld_bin != 0)
+        && (opts->n_maf_bins != 0 || opts->index_variants_per_maf_bin != 0);
+}
+
+template <typename F>
+void for_each_parallel(const vector<size_t>& items, size_t n_threads, F on_item) {
+    // Waiting in order rethrows the first task's exception first; the
+    // remaining futures wait for their tasks when destroyed.
+    std::deque<std::future<void>> in_flight;
+    for (size_t item : items) {
+        if (in_flight.size() >= n_threads) {
+            std::future<void> future = std::move(in_flight.front());
+            in_flight.pop_front();
+            future.get();
+        }
+        in_flight.push_back(std::async(std::launch::async, on_item, item));
+    }
+    while (!in_flight.empty()) {
+        std::future<void> future = std::move(in_flight.front());
+        in_flight.pop_front();
+        future.get();
+    }
+}
+
+template <typename Range>
+void print_to_columns(const string& first_col, const Range& second_col) {
+    for (const auto& s : second_col) {
+        std::cout << first_col << '\t' << s << '\n';
+    }
+}
 
-    // Read the header row of file.
-    string header;
-    std::getline(file, header);
+IndexVariantSummary at_r2_cutoff(
+    const IndexVariantSummary& summary,
+    size_t r2_cutoff) {
+    IndexVariantSummary ret = summary;
+    ret.n_surrogates = summary.n_surrogates_at_r2_cutoffs.at(r2_cutoff);
+    return ret;
+}
+
+IndexVariantSummary lookup_summary(Tables& tables, const string& variant_id) {
+    IndexVariantSummary summary = tables.summary_t->lookup(variant_id);
+    return tables.is_at_r2_cutoff
+        ? at_r2_cutoff(summary, tables.r2_cutoff)
+        : summary;
+}
 
-    return header;
+// Calls on_variant(variant) with each key variant, as iterate_variants()
+// does, prefetching them from 'table' a batch at a time.
+template <typename T, typename F>
+void iterate_key_variants(
+    const string& key_variants_file,
+    const vector<string>& key_variants,
+    T& table,
+    F on_variant) {
+    iterate_variant_batches(
+        key_variants_file,
+        key_variants,
+        KEY_VARIANT_BATCH_SIZE,
+        [&](const vector<string>& variants) {
+            table.prefetch(variants);
+            for (const string& variant : variants) {
+                on_variant(variant);
+            }
+        });
 }
 
 /*************************************************/
@@ -159,15 +445,20 @@ string read_first_line(string path) {
 /*************************************************/
 /*************************************************/
 
-LDPairParser create_parser(std::shared_ptr<SubcommandOptsSetup> opts) {
-    // Read column names from the header row.
-    string header = read_first_line(opts->src);
-    vector<string> col_names = split(header, opts->delimiter);
+LDPairParser create_parser(
+    std::shared_ptr<SubcommandOptsSetup> opts,
+    LineReader& ld_data) {
+    // Read column names from the header row. The header row is left
+    // unread, so it is reported as invalid like any other line.
+    std::string_view header;
+    ld_data.peek(header);
+    vector<string> col_names = split(string(header), opts->delimiter);
 
     // This is the parser we will return.
     LDPairParser parser;
     parser.delimiter = opts->delimiter;
     parser.r2_threshold_for_ld = opts->r2_threshold_for_ld;
+    parser.ld_variant_maf_column = 0;
 
     // Convert column strings to column indices.
     vector<string> str_args = {
@@ -184,6 +475,12 @@ LDPairParser create_parser(std::shared_ptr<SubcommandOptsSetup> opts) {
         &parser.r2_column
     };
 
+    // LD variant MAFs are only needed to summarize LD variants.
+    if (opts->symmetric) {
+        str_args.push_back(opts->ld_variant_maf_column);
+        col_idx_fields.push_back(&parser.ld_variant_maf_column);
+    }
+
     for (size_t i = 0; i < str_args.size(); i++) {
         string arg = str_args[i];
         try {
@@ -204,61 +501,314 @@ LDPairParser create_parser(std::shared_ptr<SubcommandOptsSetup> opts) {
     return parser;  
 }
 
+template <typename F1, typename F2>
+void iterate_setup_source(
+    LineReader& ld_data,
+    const LDPairParser& parser,
+    std::shared_ptr<SubcommandOptsSetup> opts,
+    const std::string& tmp_dir,
+    F1 on_ld_pair,
+    F2 on_index_variant_summary) {
+    if (opts->symmetric) {
+        // Shuffle both directions of each pair through an external sort,
+        // so LD variants are grouped with the pairs that name them.
+        // Every pair must be seen to summarize LD variants without
+        // surrogates, so SymmetricPairWriter applies the r2 threshold.
+        IndexVariantSorter sorter(
+            tmp_dir,
+            opts->sort_memory_mb << 20,
+            opts->n_threads);
+        SymmetricPairWriter writer(sorter, parser.r2_threshold_for_ld);
+        LDPairParser all_pairs_parser = parser;
+        all_pairs_parser.r2_threshold_for_ld = 0.0;
+        iterate_ld_data_parallel(
+            ld_data,
+            all_pairs_parser,
+            opts->n_threads,
+            [&](const LDPairView& pair) { writer.add(pair); },
+            [&](const IndexVariantSummary& summary) { writer.add(summary); },
+            on_invalid_cb);
+        sorter.merge(on_ld_pair, on_index_variant_summary, true);
+    } else if (opts->ungrouped) {
+        // Group the LD data by index variant with an external sort
+        // before spilling it.
+        IndexVariantSorter sorter(
+            tmp_dir,
+            opts->sort_memory_mb << 20,
+            opts->n_threads);
+        iterate_ld_data_parallel(
+            ld_data,
+            parser,
+            opts->n_threads,
+            [&](const LDPairView& pair) { sorter.append(pair); },
+            [&](const IndexVariantSummary& summary) { sorter.append(summary); },
+            on_invalid_cb);
+        sorter.merge(on_ld_pair, on_index_variant_summary);
+    } else {
+        iterate_ld_data_parallel(
+            ld_data,
+            parser,
+            opts->n_threads,
+            on_ld_pair,
+            on_index_variant_summary,
+            on_invalid_cb);
+    }
+}
+
+void update_first_iteration_results(
+    SetupFirstIterationResults& results,
+    const IndexVariantSummary& summary) {
+    // Update maximum variant size.
+    if (summary.variant_id.size() > results.max_index_variant_size) {
+        results.max_index_variant_size = summary.variant_id.size();
+    }
+
+    // Update distribution information for StrataTable.
+    results.maf_hist.increase_count(summary.maf);
+    results.n_surrogates_hist.increase_count(summary.n_surrogates);
+}
+
 SetupFirstIterationResults do_setup_first_iteration(
+    LineReader& ld_data,
     const LDPairParser& parser,
-    std::shared_ptr<SubcommandOptsSetup> opts
+    std::shared_ptr<SubcommandOptsSetup> opts,
+    SetupSpill& spill
 ) {
     SetupFirstIterationResults results;
     results.max_index_variant_size = 0;
 
-	auto it1_on_ld_pair_cb = [](const LDPair& pair) {
-        (void)pair;
+	auto it1_on_ld_pair_cb = [&](const LDPairView& pair) {
+        spill.append(pair);
     };
 
 	auto it1_on_new_index_variant_cb = [&](const IndexVariantSummary& summary) {
-        // Update maximum variant size.
-        if (summary.variant_id.size() > results.max_index_variant_size) {
-            results.max_index_variant_size = summary.variant_id.size();
-        }
-
-        // Update distribution information for StrataTable.
-        results.maf_hist.increase_count(summary.maf);
-        results.n_surrogates_hist.increase_count(summary.n_surrogates);
+        update_first_iteration_results(results, summary);
+        spill.append(summary);
     };
 
-	iterate_ld_data(
-	    opts->src,
-	    parser,
-	    it1_on_ld_pair_cb,
-	    it1_on_new_index_variant_cb,
-	    on_invalid_cb);
+    iterate_setup_source(
+        ld_data,
+        parser,
+        opts,
+        get_tmp_dir(opts),
+        it1_on_ld_pair_cb,
+        it1_on_new_index_variant_cb);
+    spill.finish();
 
+    return results;
+}
+
+template <typename T>
+void stratify_histograms(
+    Histogram<size_t>& n_surrogates_hist,
+    Histogram<double>& maf_hist,
+    std::shared_ptr<T> opts) {
     // Determine strata for MAF.
     size_t n_maf_bins = opts->n_maf_bins;
     if (opts->index_variants_per_maf_bin != 0) {
-        auto total = results.maf_hist.total_count();
+        auto total = maf_hist.total_count();
 		n_maf_bins = total / opts->index_variants_per_maf_bin;
 	}
-    results.maf_hist = results.maf_hist.stratify(n_maf_bins);
+    maf_hist = maf_hist.stratify(n_maf_bins);
 
     // Determine strata for number of LD surrogates.
     size_t n_ld_bins = opts->n_ld_bins;
     if (opts->index_variants_per_ld_bin != 0) {
-        auto total = results.n_surrogates_hist.total_count();
+        auto total = n_surrogates_hist.total_count();
         n_ld_bins = total / opts->index_variants_per_ld_bin;
     }
-    results.n_surrogates_hist = results.n_surrogates_hist.stratify(n_ld_bins);
+    n_surrogates_hist = n_surrogates_hist.stratify(n_ld_bins);
+}
 
-    return results;
+void write_segment(
+    const std::filesystem::path& dir,
+    SetupSpill& spill,
+    size_t max_index_variant_size,
+    SegmentedSummaryTable* existing,
+    const R2Cutoffs& r2_cutoffs) {
+    // Size both tables for every index variant up front, so they are not
+    // grown as index variants are added.
+    LDTable ld_t(
+        { dir / LD_TABLE_FILE_PATH,
+          dir / LD_TABLE_TABLE_PATH,
+          max_index_variant_size,
+          true,
+          spill.size() },
+        dir / LD_DICTIONARY_FILE_PATH,
+        dir / LD_DICTIONARY_TABLE_PATH);
+    SummaryTable summary_t({
+        dir / SUMMARY_TABLE_FILE_PATH,
+        dir / SUMMARY_TABLE_TABLE_PATH,
+        max_index_variant_size,
+        true,
+        spill.size() });
+
+    // Iterate Over Spilled Records:
+    // - Populate LDTable and SummaryTable.
+    // - Check that each index variant appeared in only one group.
+    auto check_grouped = [&](const string& index_variant_id) {
+        if (ld_t.is_member(index_variant_id)
+            || summary_t.is_member(index_variant_id)) {
+            throw std::runtime_error(
+                "LD Data Not Grouped by Index Variant: " + index_variant_id
+                + "\nRerun with --ungrouped to sort the LD data first.");
+        }
+    };
+
+    // Count surrogates at each cutoff, comparing r2 values as they are
+    // stored, so counts agree with get_variants_in_ld_with --min-r2.
+    vector<uint16_t> quantized_cutoffs;
+    for (double cutoff : r2_cutoffs.get_cutoffs()) {
+        quantized_cutoffs.push_back(quantize_r2(cutoff));
+    }
+    vector<size_t> n_surrogates_at_r2_cutoffs(quantized_cutoffs.size(), 0);
+
+    bool group_checked = false;
+    auto on_ld_pair_cb = [&](const IndexVariantSummary& summary,
+                             const string& ld_variant_id,
+                             double r2) {
+        if (!group_checked) {
+            check_grouped(summary.variant_id);
+            group_checked = true;
+        }
+        ld_t.push(summary.variant_id, ld_variant_id, r2);
+
+        uint16_t quantized = quantize_r2(r2);
+        for (size_t i = 0; i < quantized_cutoffs.size(); i++) {
+            if (quantized < quantized_cutoffs[i]) {
+                break;
+            }
+            n_surrogates_at_r2_cutoffs[i]++;
+        }
+	};
+
+	auto on_new_index_variant_cb = [&](const IndexVariantSummary& summary) {
+        if (!group_checked) {
+            check_grouped(summary.variant_id);
+        }
+        group_checked = false;
+
+        // Index variants already in the lookup table keep their MAF and
+        // gain the new surrogates.
+        IndexVariantSummary merged = summary;
+        merged.n_surrogates_at_r2_cutoffs = n_surrogates_at_r2_cutoffs;
+        if (existing && existing->is_member(summary.variant_id)) {
+            IndexVariantSummary existing_summary = existing->lookup(summary.variant_id);
+            merged.maf = existing_summary.maf;
+            merged.n_surrogates += existing_summary.n_surrogates;
+            for (size_t i = 0; i < merged.n_surrogates_at_r2_cutoffs.size(); i++) {
+                merged.n_surrogates_at_r2_cutoffs[i] +=
+                    existing_summary.n_surrogates_at_r2_cutoffs.at(i);
+            }
+        }
+        summary_t.append(merged);
+        std::fill(
+            n_surrogates_at_r2_cutoffs.begin(),
+            n_surrogates_at_r2_cutoffs.end(),
+            0);
+    };
+
+    spill.iterate(on_ld_pair_cb, on_new_index_variant_cb);
+    ld_t.flush();
+    summary_t.flush();
 }
 
-void do_setup(std::shared_ptr<SubcommandOptsSetup> opts) {
-    // Create an string-to-LDPair parser based on opts.
-    LDPairParser parser = create_parser(opts);
+template <typename F>
+void build_strata_table(
+    const std::filesystem::path& file_path,
+    const std::filesystem::path& table_path,
+    const Histogram<size_t>& n_surrogates_strata,
+    const Histogram<double>& maf_strata,
+    F for_each_summary) {
+    StrataTable strata_t(
+        file_path,
+        table_path,
+        n_surrogates_strata,
+        maf_strata);
+
+    // First Iteration Over Summaries:
+    // - Determine space needed for strata.
+    Histogram<StrataTable::Stratum> strata_counts;
+    Histogram<StrataTable::Stratum> strata_bytes;
+    for_each_summary([&](const IndexVariantSummary& summary) {
+        StrataTable::Stratum stratum = strata_t.get_stratum(summary);
+        strata_counts.increase_count(stratum, 1);
+        strata_bytes.increase_count(stratum, summary.variant_id.size());
+    });
+
+    // Reserve strata on-disk.
+    strata_t.reserve(strata_counts, strata_bytes);
 
-    // Do first iteration.
-    SetupFirstIterationResults results = do_setup_first_iteration(parser, opts);
+    // Second Iteration Over Summaries:
+    // - Populate StrataTable.
+    for_each_summary([&](const IndexVariantSummary& summary) {
+        strata_t.append(summary);
+    });
+    strata_t.flush();
+}
+
+/*
+ * Builds the StrataTable of each cutoff in 'r2_cutoffs' in 'dir', stratifying
+ * index variants by their number of LD surrogates at that cutoff.
+ * get_strata(r2_cutoff, for_each_summary_at_cutoff, n_surrogates_strata,
+ * maf_strata) sets the strata of each cutoff.
+ */
+template <typename F1, typename F2>
+void build_r2_strata_tables(
+    const std::filesystem::path& dir,
+    const R2Cutoffs& r2_cutoffs,
+    F1 get_strata,
+    F2 for_each_summary) {
+    for (size_t i = 0; i < r2_cutoffs.get_cutoffs().size(); i++) {
+        auto for_each_summary_at_cutoff = [&](auto on_index_variant_summary) {
+            for_each_summary([&](const IndexVariantSummary& summary) {
+                on_index_variant_summary(at_r2_cutoff(summary, i));
+            });
+        };
+
+        Histogram<size_t> n_surrogates_strata;
+        Histogram<double> maf_strata;
+        get_strata(i, for_each_summary_at_cutoff, n_surrogates_strata, maf_strata);
+        build_strata_table(
+            get_r2_strata_file_path(dir, i),
+            get_r2_strata_table_path(dir, i),
+            n_surrogates_strata,
+            maf_strata,
+            for_each_summary_at_cutoff);
+    }
+}
+
+/* Stratifies every summary at a cutoff as set by 'opts'. */
+template <typename T>
+auto stratify_r2_cutoff(std::shared_ptr<T> opts) {
+    return [opts](size_t,
+                  auto for_each_summary_at_cutoff,
+                  Histogram<size_t>& n_surrogates_strata,
+                  Histogram<double>& maf_strata) {
+        for_each_summary_at_cutoff([&](const IndexVariantSummary& summary) {
+            n_surrogates_strata.increase_count(summary.n_surrogates);
+            maf_strata.increase_count(summary.maf);
+        });
+        stratify_histograms(n_surrogates_strata, maf_strata, opts);
+    };
+}
+
+/* Keeps the strata at each cutoff of the StrataTables in 'dir'. */
+auto keep_r2_cutoff_strata(const std::filesystem::path& dir) {
+    return [dir](size_t r2_cutoff,
+                 auto,
+                 Histogram<size_t>& n_surrogates_strata,
+                 Histogram<double>& maf_strata) {
+        std::shared_ptr<StrataTable> strata_t = open_r2_strata_table(dir, r2_cutoff);
+        n_surrogates_strata = strata_t->get_n_surrogates_strata();
+        maf_strata = strata_t->get_maf_strata();
+    };
+}
 
+void do_setup_new(
+    std::shared_ptr<SubcommandOptsSetup> opts,
+    LineReader& ld_data,
+    const LDPairParser& parser) {
     // Create the output directory.
     std::filesystem::path dir(opts->dir);
     if (std::filesystem::exists(dir)) {
@@ -266,110 +816,595 @@ void do_setup(std::shared_ptr<SubcommandOptsSetup> opts) {
     }
     std::filesystem::create_directory(dir);
 
-    // Initialize LDTable, StrataTable, and SummaryTable.
-    Options ld_table_options{
-        dir / LD_TABLE_FILE_PATH,
-        dir / LD_TABLE_TABLE_PATH,
-        results.max_index_variant_size,
-        true };
-    
-    Options summary_table_options{
-        dir / SUMMARY_TABLE_FILE_PATH,
-        dir / SUMMARY_TABLE_TABLE_PATH,
-        results.max_index_variant_size,
-        true };
-    
-    LDTable ld_t(ld_table_options);
-    StrataTable strata_t(
-        dir / STRATA_TABLE_FILE_PATH,
-        dir / STRATA_TABLE_TABLE_PATH,
-        results.n_surrogates_hist,
-        results.maf_hist);
-    SummaryTable summary_t(summary_table_options);
+    // Remove the directory if setup fails, for example on unparsable LD
+    // data, so setup can be run again.
+    try {
+        R2Cutoffs r2_cutoffs(opts->dir, opts->r2_cutoffs);
+        r2_cutoffs.save();
+
+        // First (and only) Iteration Over Data:
+        // - Determine strata and spill parsed records to disk. Later
+        //   iterations replay the spill instead of re-parsing the source.
+        SetupSpill spill(get_tmp_dir(opts));
+        SetupFirstIterationResults results = do_setup_first_iteration(
+            ld_data, parser, opts, spill);
+        stratify_histograms(results.n_surrogates_hist, results.maf_hist, opts);
+
+        // Populate LDTable and SummaryTable from the spill.
+        write_segment(dir, spill, results.max_index_variant_size, nullptr, r2_cutoffs);
+
+        // Populate StrataTable from the spilled summaries.
+        build_strata_table(
+            dir / STRATA_TABLE_FILE_PATH,
+            dir / STRATA_TABLE_TABLE_PATH,
+            results.n_surrogates_hist,
+            results.maf_hist,
+            [&](auto on_index_variant_summary) {
+                spill.iterate_summaries(on_index_variant_summary);
+            });
+
+        // Only the SummaryTable holds the counts at each cutoff.
+        std::shared_ptr<SegmentedSummaryTable> summary_t =
+            open_summary_table(opts->dir, { "." });
+        build_r2_strata_tables(
+            dir,
+            r2_cutoffs,
+            stratify_r2_cutoff(opts),
+            [&](auto on_index_variant_summary) {
+                summary_t->for_each_summary(on_index_variant_summary);
+            });
+
+        if (opts->static_index) {
+            build_static_indexes(dir);
+        }
+    } catch (...) {
+        std::filesystem::remove_all(dir);
+        throw;
+    }
+}
 
-    // Second Iteration Over Data:
-    // - Determine space needed for strata.
-    Histogram<StrataTable::Stratum> strata_sizes;
-	auto it2_on_ld_pair_cb = [](const LDPair& pair) {
-        (void)pair;
-    };
+void do_setup_append(
+    std::shared_ptr<SubcommandOptsSetup> opts,
+    LineReader& ld_data,
+    const LDPairParser& parser) {
+    std::filesystem::path dir(opts->dir);
+    if (!std::filesystem::is_directory(dir)) {
+        throw std::runtime_error("Directory Does Not Exist: " + opts->dir);
+    }
+    if (ShardLayout(opts->dir).is_sharded()) {
+        throw std::runtime_error(
+            "Cannot Append to a Sharded Lookup Table: " + opts->dir
+            + "\nRebuild the affected shards with --shard instead.");
+    }
 
-	auto it2_on_new_index_variant_cb = [&](const IndexVariantSummary& summary) {
-        StrataTable::Stratum stratum = strata_t.get_stratum(summary);
-        size_t variant_size = summary.variant_id.size()+1;
-        strata_sizes.increase_count(stratum, variant_size);
-    };
+    // Readers keep using the old segments until the new segment is listed.
+    DirectoryLock lock(opts->dir);
+    Manifest manifest(opts->dir);
+    Segments existing = open_segments(opts->dir, manifest.get_segments());
+    std::filesystem::path existing_strata_dir =
+        get_segment_dir(opts->dir, manifest.get_segments().back());
+
+    // Recomputed strata never read the existing ones, so they also replace
+    // strata of an unsupported version.
+    std::shared_ptr<StrataTable> existing_strata_t;
+    if (opts->strata != "recompute") {
+        existing_strata_t = open_strata_table(existing_strata_dir);
+    }
 
-    iterate_ld_data(
-	    opts->src,
-	    parser,
-	    it2_on_ld_pair_cb,
-	    it2_on_new_index_variant_cb,
-	    on_invalid_cb);
-    
-    // Reserve strata on-disk.
-    strata_t.reserve(strata_sizes);
+    // New surrogates are counted at the lookup table's own cutoffs.
+    R2Cutoffs r2_cutoffs(opts->dir);
+    if (opts->r2_cutoffs.size()
+        && R2Cutoffs(opts->dir, opts->r2_cutoffs).get_cutoffs()
+            != r2_cutoffs.get_cutoffs()) {
+        throw std::invalid_argument(
+            "Lookup Table Has Different r2 Cutoffs: " + opts->dir);
+    }
+    string segment = manifest.create_segment();
+    std::filesystem::path segment_dir = dir / segment;
 
-    // Third Iteration Over Data:
-    // - Populate LDTable, StatsTable, and StrataTable.
-    auto it3_on_ld_pair_cb = [&](const LDPair& pair) {
-        ld_t.append(pair.index_variant_id, pair.ld_variant_id);
-	};
+    try {
+        SetupSpill spill(get_tmp_dir(opts));
+        SetupFirstIterationResults results = do_setup_first_iteration(
+            ld_data, parser, opts, spill);
+
+        // Write the new postings and merged summaries to the new segment.
+        write_segment(
+            segment_dir,
+            spill,
+            results.max_index_variant_size,
+            existing.summary_t.get(),
+            r2_cutoffs);
+
+        manifest.add_segment(segment);
+        std::shared_ptr<SegmentedSummaryTable> updated_summary_t =
+            open_summary_table(opts->dir, manifest.get_segments());
+
+        // Keep the existing strata, or recompute them from every summary.
+        Histogram<size_t> n_surrogates_strata;
+        Histogram<double> maf_strata;
+        if (opts->strata != "recompute") {
+            n_surrogates_strata = existing_strata_t->get_n_surrogates_strata();
+            maf_strata = existing_strata_t->get_maf_strata();
+        } else {
+            updated_summary_t->for_each_summary(
+                [&](const IndexVariantSummary& summary) {
+                    n_surrogates_strata.increase_count(summary.n_surrogates);
+                    maf_strata.increase_count(summary.maf);
+                });
+            stratify_histograms(n_surrogates_strata, maf_strata, opts);
+        }
 
-	auto it3_on_new_index_variant_cb = [&](const IndexVariantSummary& summary) {
-        strata_t.append(summary);
-        summary_t.append(summary);
-    };
+        build_strata_table(
+            segment_dir / STRATA_TABLE_FILE_PATH,
+            segment_dir / STRATA_TABLE_TABLE_PATH,
+            n_surrogates_strata,
+            maf_strata,
+            [&](auto on_index_variant_summary) {
+                updated_summary_t->for_each_summary(on_index_variant_summary);
+            });
+
+        auto for_each_updated_summary = [&](auto on_index_variant_summary) {
+            updated_summary_t->for_each_summary(on_index_variant_summary);
+        };
+        if (opts->strata == "recompute") {
+            build_r2_strata_tables(
+                segment_dir,
+                r2_cutoffs,
+                stratify_r2_cutoff(opts),
+                for_each_updated_summary);
+        } else {
+            build_r2_strata_tables(
+                segment_dir,
+                r2_cutoffs,
+                keep_r2_cutoff_strata(existing_strata_dir),
+                for_each_updated_summary);
+        }
+
+        if (opts->static_index) {
+            build_static_indexes(segment_dir);
+        }
+        manifest.save();
+    } catch (...) {
+        std::filesystem::remove_all(segment_dir);
+        throw;
+    }
+}
+
+void do_setup_sharded(
+    std::shared_ptr<SubcommandOptsSetup> opts,
+    LineReader& ld_data,
+    const LDPairParser& parser) {
+    ShardLayout layout(opts->dir, opts->n_shards);
+
+    // Build every shard, or only the requested ones.
+    vector<size_t> shards = opts->shards;
+    bool all_shards = shards.empty();
+    if (all_shards) {
+        shards.resize(layout.get_n_shards());
+        std::iota(shards.begin(), shards.end(), 0);
+    }
+    std::sort(shards.begin(), shards.end());
+    shards.erase(std::unique(shards.begin(), shards.end()), shards.end());
+    if (shards.back() >= layout.get_n_shards()) {
+        throw std::invalid_argument(
+            "Invalid Shard: " + std::to_string(shards.back()));
+    }
+
+    // Create the output directory. Workers building different shards of
+    // the same table share it.
+    std::filesystem::path dir(opts->dir);
+    if (all_shards && std::filesystem::exists(dir)) {
+        throw std::runtime_error("Directory Already Exists: " + opts->dir);
+    }
+    std::filesystem::create_directories(dir);
+    layout.save();
+    R2Cutoffs r2_cutoffs(opts->dir, opts->r2_cutoffs);
+    r2_cutoffs.save();
+    for (size_t shard : shards) {
+        if (std::filesystem::exists(layout.get_shard_dir(shard))) {
+            throw std::runtime_error(
+                "Directory Already Exists: " + layout.get_shard_dir(shard));
+        }
+    }
+
+    vector<SetupFirstIterationResults> results(layout.get_n_shards());
+    try {
+        for (size_t shard : shards) {
+            std::filesystem::create_directory(layout.get_shard_dir(shard));
+        }
+
+        // First (and only) Iteration Over Data:
+        // - Route each index variant to its shard's spill, skipping
+        //   shards that are not being built.
+        string tmp_dir = opts->tmp_dir.size()
+            ? opts->tmp_dir
+            : layout.get_shard_dir(shards.front());
+        vector<std::shared_ptr<SetupSpill>> spills(layout.get_n_shards());
+        for (size_t shard : shards) {
+            spills[shard].reset(new SetupSpill(
+                tmp_dir,
+                "setup_shard_" + std::to_string(shard)));
+            results[shard].max_index_variant_size = 0;
+        }
+
+        auto it1_on_ld_pair_cb = [&](const LDPairView& pair) {
+            auto& spill = spills[layout.get_shard(pair.index_variant_id)];
+            if (spill) {
+                spill->append(pair);
+            }
+        };
+
+        auto it1_on_new_index_variant_cb = [&](const IndexVariantSummary& summary) {
+            size_t shard = layout.get_shard(summary.variant_id);
+            if (spills[shard]) {
+                update_first_iteration_results(results[shard], summary);
+                spills[shard]->append(summary);
+            }
+        };
+
+        iterate_setup_source(
+            ld_data,
+            parser,
+            opts,
+            tmp_dir,
+            it1_on_ld_pair_cb,
+            it1_on_new_index_variant_cb);
+        for (size_t shard : shards) {
+            spills[shard]->finish();
+        }
+
+        // Populate each shard's LDTable and SummaryTable in parallel.
+        for_each_parallel(shards, opts->n_threads, [&](size_t shard) {
+            write_segment(
+                layout.get_shard_dir(shard),
+                *spills[shard],
+                results[shard].max_index_variant_size,
+                nullptr,
+                r2_cutoffs);
+            if (opts->static_index) {
+                build_static_indexes(layout.get_shard_dir(shard));
+            }
+        });
+    } catch (...) {
+        // Other workers may be building shards in a directory shared with
+        // them, so only a directory of every shard is removed.
+        if (all_shards) {
+            std::filesystem::remove_all(dir);
+        } else {
+            for (size_t shard : shards) {
+                std::filesystem::remove_all(layout.get_shard_dir(shard));
+            }
+        }
+        throw;
+    }
+
+    // Strata span every shard, so they are built once all shards exist.
+    if (all_shards) {
+        Histogram<size_t> n_surrogates_hist;
+        Histogram<double> maf_hist;
+        for (size_t shard : shards) {
+            n_surrogates_hist.merge(results[shard].n_surrogates_hist);
+            maf_hist.merge(results[shard].maf_hist);
+        }
+        stratify_histograms(n_surrogates_hist, maf_hist, opts);
+
+        std::shared_ptr<ShardedSummaryTable> summary_t = open_summary_table(layout);
+        auto for_each_summary = [&](auto on_index_variant_summary) {
+            summary_t->for_each_summary(on_index_variant_summary);
+        };
+        build_strata_table(
+            dir / STRATA_TABLE_FILE_PATH,
+            dir / STRATA_TABLE_TABLE_PATH,
+            n_surrogates_hist,
+            maf_hist,
+            for_each_summary);
+        build_r2_strata_tables(
+            dir,
+            r2_cutoffs,
+            stratify_r2_cutoff(opts),
+            for_each_summary);
+        if (opts->static_index) {
+            build_static_indexes(dir);
+        }
+    }
+}
+
+void do_setup(std::shared_ptr<SubcommandOptsSetup> opts) {
+    // Strata are computed for new tables, unless only some shards are
+    // built, and for appends when asked to.
+    bool builds_strata = opts->append
+        ? opts->strata == "recompute"
+        : opts->shards.empty();
+    if (builds_strata && !has_bin_options(opts)) {
+        throw std::invalid_argument(
+            "Missing Strata Options: give one of --n-ld-bins or "
+            "--index-variants-per-ld-bin, and one of --n-maf-bins or "
+            "--index-variants-per-maf-bin");
+    }
+
+    // Pairs below the setup threshold are not stored, so they cannot be
+    // counted at lower cutoffs.
+    for (double cutoff : opts->r2_cutoffs) {
+        if (cutoff < opts->r2_threshold_for_ld) {
+            throw std::invalid_argument(
+                "r2 Cutoffs Must Be at Least --r2-threshold-for-ld");
+        }
+    }
+
+    // Open the LD data and create a string-to-LDPair parser based on opts.
+    LineReader ld_data(opts->src, opts->n_threads);
+    LDPairParser parser = create_parser(opts, ld_data);
+
+    if (opts->append) {
+        do_setup_append(opts, ld_data, parser);
+    } else if (opts->n_shards != 0) {
+        do_setup_sharded(opts, ld_data, parser);
+    } else {
+        do_setup_new(opts, ld_data, parser);
+    }
+}
+
+void do_compact(std::shared_ptr<SubcommandOptsCompact> opts) {
+    std::filesystem::path dir(opts->dir);
+    DirectoryLock lock(opts->dir);
+    Manifest manifest(opts->dir);
+    vector<string> old_segments = manifest.get_segments();
+    if (old_segments.size() == 1) {
+        std::cout << "Nothing to Compact\n";
+        return;
+    }
+
+    Segments tables = open_segments(opts->dir, old_segments);
+    std::filesystem::path strata_dir =
+        get_segment_dir(opts->dir, old_segments.back());
+    std::shared_ptr<StrataTable> strata_t = open_strata_table(strata_dir);
+    R2Cutoffs r2_cutoffs(opts->dir);
+    bool static_index = has_static_indexes(strata_dir);
+    string segment = manifest.create_segment();
+    std::filesystem::path segment_dir = dir / segment;
+
+    try {
+        // Size keys for the longest index variant ID, and tables for every
+        // index variant.
+        size_t max_index_variant_size = 0;
+        size_t n_index_variants = 0;
+        tables.summary_t->for_each_summary(
+            [&](const IndexVariantSummary& summary) {
+                max_index_variant_size = std::max(
+                    max_index_variant_size,
+                    summary.variant_id.size());
+                n_index_variants++;
+            });
+
+        // Copy every index variant's postings and summary into one segment.
+        // r2 values are kept only if every segment has them.
+        {
+            bool store_r2 = tables.ld_t->has_r2();
+            LDTable ld_t(
+                { segment_dir / LD_TABLE_FILE_PATH,
+                  segment_dir / LD_TABLE_TABLE_PATH,
+                  max_index_variant_size,
+                  true,
+                  n_index_variants },
+                segment_dir / LD_DICTIONARY_FILE_PATH,
+                segment_dir / LD_DICTIONARY_TABLE_PATH,
+                store_r2);
+            SummaryTable summary_t({
+                segment_dir / SUMMARY_TABLE_FILE_PATH,
+                segment_dir / SUMMARY_TABLE_TABLE_PATH,
+                max_index_variant_size,
+                true,
+                n_index_variants });
+            tables.summary_t->for_each_summary(
+                [&](const IndexVariantSummary& summary) {
+                    if (tables.ld_t->is_member(summary.variant_id) && store_r2) {
+                        tables.ld_t->for_each_posting(
+                            summary.variant_id,
+                            0.0,
+                            [&](std::string_view posting, double r2) {
+                                ld_t.push(summary.variant_id, posting, r2);
+                            });
+                    } else if (tables.ld_t->is_member(summary.variant_id)) {
+                        tables.ld_t->for_each_posting(
+                            summary.variant_id,
+                            [&](std::string_view posting) {
+                                ld_t.push(summary.variant_id, posting, 0.0);
+                            });
+                    }
+                    summary_t.append(summary);
+                });
+            ld_t.flush();
+            summary_t.flush();
+        }
+
+        auto for_each_summary = [&](auto on_index_variant_summary) {
+            tables.summary_t->for_each_summary(on_index_variant_summary);
+        };
+        build_strata_table(
+            segment_dir / STRATA_TABLE_FILE_PATH,
+            segment_dir / STRATA_TABLE_TABLE_PATH,
+            strata_t->get_n_surrogates_strata(),
+            strata_t->get_maf_strata(),
+            for_each_summary);
+        build_r2_strata_tables(
+            segment_dir,
+            r2_cutoffs,
+            keep_r2_cutoff_strata(strata_dir),
+            for_each_summary);
+        if (static_index) {
+            build_static_indexes(segment_dir);
+        }
+
+        manifest.set_segments({ segment });
+        manifest.save();
+    } catch (...) {
+        std::filesystem::remove_all(segment_dir);
+        throw;
+    }
+
+    // Remove the merged segments. The original table's files live in the
+    // lookup table directory itself, next to the other segments.
+    for (const string& old_segment : old_segments) {
+        if (old_segment == ".") {
+            for (const string& path : {
+                     LD_TABLE_FILE_PATH, LD_TABLE_TABLE_PATH,
+                     LD_DICTIONARY_FILE_PATH, LD_DICTIONARY_TABLE_PATH,
+                     STRATA_TABLE_FILE_PATH, STRATA_TABLE_TABLE_PATH,
+                     SUMMARY_TABLE_FILE_PATH, SUMMARY_TABLE_TABLE_PATH }) {
+                std::filesystem::remove(dir / path);
+                if (is_table_path(path)) {
+                    std::filesystem::remove(
+                        VectorDiskHash::get_static_index_path(dir / path));
+                }
+            }
+            for (size_t i = 0; i < r2_cutoffs.get_cutoffs().size(); i++) {
+                std::filesystem::remove(get_r2_strata_file_path(dir, i));
+                std::filesystem::remove(get_r2_strata_table_path(dir, i));
+                std::filesystem::remove(VectorDiskHash::get_static_index_path(
+                    get_r2_strata_table_path(dir, i)));
+            }
+        } else {
+            std::filesystem::remove_all(dir / old_segment);
+        }
+    }
+}
+
+void do_stratify(std::shared_ptr<SubcommandOptsStratify> opts) {
+    ShardLayout layout(opts->dir);
+    if (!layout.is_sharded()) {
+        throw std::runtime_error("Not a Sharded Lookup Table: " + opts->dir);
+    }
+    if (!has_bin_options(opts)) {
+        throw std::invalid_argument(
+            "Missing Strata Options: give one of --n-ld-bins or "
+            "--index-variants-per-ld-bin, and one of --n-maf-bins or "
+            "--index-variants-per-maf-bin");
+    }
+
+    DirectoryLock lock(opts->dir);
+    vector<size_t> shards(layout.get_n_shards());
+    std::iota(shards.begin(), shards.end(), 0);
+    for (size_t shard : shards) {
+        if (!std::filesystem::is_directory(layout.get_shard_dir(shard))) {
+            throw std::runtime_error(
+                "Missing Shard: " + layout.get_shard_dir(shard));
+        }
+    }
+
+    // Count each shard's index variants in parallel, then merge the counts.
+    std::shared_ptr<ShardedSummaryTable> summary_t = open_summary_table(layout);
+    vector<Histogram<size_t>> n_surrogates_hists(shards.size());
+    vector<Histogram<double>> maf_hists(shards.size());
+    for_each_parallel(shards, opts->n_threads, [&](size_t shard) {
+        string shard_dir = layout.get_shard_dir(shard);
+        open_summary_table(shard_dir, Manifest(shard_dir).get_segments())
+            ->for_each_summary([&](const IndexVariantSummary& summary) {
+                n_surrogates_hists[shard].increase_count(summary.n_surrogates);
+                maf_hists[shard].increase_count(summary.maf);
+            });
+    });
+
+    Histogram<size_t> n_surrogates_hist;
+    Histogram<double> maf_hist;
+    for (size_t shard : shards) {
+        n_surrogates_hist.merge(n_surrogates_hists[shard]);
+        maf_hist.merge(maf_hists[shard]);
+    }
+    stratify_histograms(n_surrogates_hist, maf_hist, opts);
+
+    // Replace the old strata, if any. They get static indexes if the shards
+    // have them.
+    std::filesystem::path dir(opts->dir);
+    R2Cutoffs r2_cutoffs(opts->dir);
+    bool static_index = has_static_indexes(layout.get_shard_dir(0));
+    std::filesystem::remove(dir / STRATA_TABLE_FILE_PATH);
+    std::filesystem::remove(dir / STRATA_TABLE_TABLE_PATH);
+    for (size_t i = 0; i < r2_cutoffs.get_cutoffs().size(); i++) {
+        std::filesystem::remove(get_r2_strata_file_path(dir, i));
+        std::filesystem::remove(get_r2_strata_table_path(dir, i));
+    }
 
-    iterate_ld_data(
-	    opts->src,
-	    parser,
-	    it3_on_ld_pair_cb,
-	    it3_on_new_index_variant_cb,
-	    on_invalid_cb);
+    auto for_each_summary = [&](auto on_index_variant_summary) {
+        summary_t->for_each_summary(on_index_variant_summary);
+    };
+    build_strata_table(
+        dir / STRATA_TABLE_FILE_PATH,
+        dir / STRATA_TABLE_TABLE_PATH,
+        n_surrogates_hist,
+        maf_hist,
+        for_each_summary);
+    build_r2_strata_tables(
+        dir,
+        r2_cutoffs,
+        stratify_r2_cutoff(opts),
+        for_each_summary);
+    if (static_index) {
+        build_static_indexes(dir);
+    }
 }
 
 void do_get_variants_in_ld_with(
     std::shared_ptr<SubcommandOptsGetVariantsInLDWith> opts) {
     
-    Tables tables = open_tables(opts->dir);
+    Tables tables = open_tables(opts->dir, 0.0, get_residency(opts->residency));
+    if (opts->min_r2 > 0 && !tables.ld_t->has_r2()) {
+        throw std::invalid_argument(
+            "Lookup Table Has No r2 Values: " + opts->dir
+            + "\nRebuild it with setup to use --min-r2.");
+    }
+
     std::cout << "Variant ID\tVariant ID of LD Surrogate\n";
     auto on_variant = [&](string variant) {
-        print_to_columns(variant, tables.ld_t->lookup(variant));
+        if (opts->min_r2 > 0) {
+            tables.ld_t->for_each_posting(
+                variant,
+                opts->min_r2,
+                [&](std::string_view s, double) {
+                    std::cout << variant << '\t' << s << '\n';
+                });
+            return;
+        }
+        tables.ld_t->for_each_posting(variant, [&](std::string_view s) {
+            std::cout << variant << '\t' << s << '\n';
+        });
     };
 
-    iterate_variants(
+    iterate_key_variants(
         opts->key_variants_file,
         opts->key_variants,
+        *tables.ld_t,
         on_variant);
 }
 
 void do_get_variants_similar_to(
     std::shared_ptr<SubcommandOptsGetVariantsSimilarTo> opts) {
     
-    Tables tables = open_tables(opts->dir);
+    Tables tables = open_tables(
+        opts->dir, opts->min_r2, get_residency(opts->residency));
     std::cout << "Variant ID\tVariant ID of Similar Variant\n";
     auto on_variant = [&](string variant) {
-        IndexVariantSummary stats = tables.summary_t->lookup(variant);
-        print_to_columns(variant, tables.strata_t->lookup(stats));
+        IndexVariantSummary stats = lookup_summary(tables, variant);
+        print_to_columns(variant, tables.strata_t->lookup_range(stats));
     };
 
-    iterate_variants(
+    iterate_key_variants(
         opts->key_variants_file,
         opts->key_variants,
+        *tables.summary_t,
         on_variant);
 }
 
 void do_get_variants_with_stats_like(
     std::shared_ptr<SubcommandOptsGetVariantsWithStatsLike> opts) {
     
-    Tables tables = open_tables(opts->dir);
+    Tables tables = open_tables(
+        opts->dir, opts->min_r2, get_residency(opts->residency));
     IndexVariantSummary stats;
     stats.n_surrogates = opts->target_surrogate_count;
     stats.maf = opts->target_maf;
     
     std::cout << "Target MAF\tTarget # LD Surrogates\tVariant ID\n";
-    for (auto &s : tables.strata_t->lookup(stats)) {
+    for (std::string_view s : tables.strata_t->lookup_range(stats)) {
         std::cout << opts->target_maf << '\t';
         std::cout << opts->target_surrogate_count << '\t';
         std::cout << s << '\n';
@@ -379,34 +1414,38 @@ void do_get_variants_with_stats_like(
 void do_get_variant_statistics(
     std::shared_ptr<SubcommandOptsGetVariantStatistics> opts) {
     
-    Tables tables = open_tables(opts->dir);
+    Tables tables = open_tables(
+        opts->dir, opts->min_r2, get_residency(opts->residency));
     std::cout << "Variant ID\t# LD Surrogates\tMAF\n";
     auto on_variant = [&](string variant) {
-        IndexVariantSummary stats = tables.summary_t->lookup(variant);
+        IndexVariantSummary stats = lookup_summary(tables, variant);
         std::cout << variant << '\t' << stats.n_surrogates << '\t';
         std::cout << stats.maf << '\n';
     };
 
-    iterate_variants(
+    iterate_key_variants(
         opts->key_variants_file,
         opts->key_variants,
+        *tables.summary_t,
         on_variant);
 }
 
 void do_sample(std::shared_ptr<SubcommandOptsSample> opts) {
-    Tables tables = open_tables(opts->dir);
+    Tables tables = open_tables(
+        opts->dir, opts->min_r2, get_residency(opts->residency));
     std::cout << "Sample #\tVariant ID\tVariant ID of Similar Variant\n";
     auto on_variant = [&](string variant) {
-        IndexVariantSummary stats = tables.summary_t->lookup(variant);
+        IndexVariantSummary stats = lookup_summary(tables, variant);
         auto sampled = tables.strata_t->lookup_sample(stats, opts->n_samples);
         for (size_t i = 0; i < sampled.size(); i++) {
             std::cout << i+1 << '\t' << variant << '\t' << sampled.at(i) << '\n';
         }
     };
 
-    iterate_variants(
+    iterate_key_variants(
         opts->key_variants_file,
         opts->key_variants,
+        *tables.summary_t,
         on_variant);
 }
 
@@ -416,6 +1455,61 @@ void do_sample(std::shared_ptr<SubcommandOptsSample> opts) {
 /*************************************************/
 /*************************************************/
 
+template <typename T>
+void add_bin_options(CLI::App* cmd, std::shared_ptr<T> opts) {
+    // LD Bin Group
+    auto ld_group = cmd->add_option_group("ld_bins");
+    ld_group->add_option(
+        "--index-variants-per-ld-bin",
+        opts->index_variants_per_ld_bin,
+        "Approximate size of each strata when index variants are stratified by number of LD surrogates"
+    )->check(CLI::PositiveNumber);
+
+    ld_group->add_option(
+        "--n-ld-bins",
+        opts->n_ld_bins,
+        "Approximate number of strata when index variants are stratified by number of LD surrogates"
+    )->check(CLI::PositiveNumber);
+
+    ld_group->require_option(0, 1);
+    // End LD Bin Group
+
+    // MAF Bin Group
+    auto maf_group = cmd->add_option_group("maf_bins");
+    maf_group->add_option(
+        "--index-variants-per-maf-bin",
+        opts->index_variants_per_maf_bin,
+        "Approximate size of each strata when index variants are stratified by MAF"
+    )->check(CLI::PositiveNumber);
+
+    maf_group->add_option(
+        "--n-maf-bins",
+        opts->n_maf_bins,
+        "Approximate number of strata when index variants are stratified by MAF"
+    )->check(CLI::PositiveNumber);
+
+    maf_group->require_option(0, 1);
+    // End MAF Bin Group
+}
+
+template <typename T>
+void add_r2_cutoff_option(CLI::App* cmd, std::shared_ptr<T> opts) {
+    cmd->add_option(
+        "--min-r2",
+        opts->min_r2,
+        "Count LD surrogates at this r-squared cutoff, one of those passed to setup --r2-cutoffs (defaults to --r2-threshold-for-ld)"
+    )->check(CLI::Range(0.0, 1.0));
+}
+
+template <typename T>
+void add_residency_option(CLI::App* cmd, std::shared_ptr<T> opts) {
+    cmd->add_option(
+        "--residency",
+        opts->residency,
+        "How much of the lookup table to read into memory when it is opened: readahead (none; lookups read the pages they touch and the kernel reads ahead around them), lazy (none, without reading ahead, best for a few variants of a large table), populate (all of it, best for many), locked (all of it, locked in memory), or hugepages (a copy on transparent huge pages)"
+    )->check(CLI::IsMember({"readahead", "lazy", "populate", "locked", "hugepages"}));
+}
+
 void subcommand_setup(CLI::App& app) {
     auto opts(std::make_shared<SubcommandOptsSetup>());
     auto cmd(app.add_subcommand("setup", "Create a new lookup table"));
@@ -423,14 +1517,68 @@ void subcommand_setup(CLI::App& app) {
     cmd->add_option(
         "dir,--dir",
         opts->dir,
-        "Directory in which to store the lookup table"
-    )->check(CLI::NonexistentPath)->required();
+        "Directory in which to store the lookup table (must not exist unless --append)"
+    )->required();
 
     cmd->add_option(
         "src,-s,--src",
         opts->src,
-        "File from which to read LD data"
-    )->check(CLI::ExistingFile)->required();
+        "File from which to read LD data ('-' for standard input)"
+    )->check(CLI::ExistingFile | CLI::IsMember({"-"}))->required();
+
+    cmd->add_option(
+        "--tmp-dir",
+        opts->tmp_dir,
+        "Directory in which to store temporary files (defaults to dir)"
+    )->check(CLI::ExistingDirectory);
+
+    cmd->add_option(
+        "-j,--threads",
+        opts->n_threads,
+        "Number of threads used to parse or decompress LD data and to build shards"
+    )->check(CLI::PositiveNumber);
+
+    cmd->add_flag(
+        "--ungrouped",
+        opts->ungrouped,
+        "Sort LD data by index variant before building the lookup table"
+    );
+
+    cmd->add_flag(
+        "--symmetric",
+        opts->symmetric,
+        "Also treat each LD variant as an index variant in LD with its index variant"
+    );
+
+    auto append_flag = cmd->add_flag(
+        "--append",
+        opts->append,
+        "Add the LD data to an existing lookup table as a new segment"
+    );
+
+    cmd->add_option(
+        "--strata",
+        opts->strata,
+        "With --append, keep the existing strata ('frozen') or recompute them from every index variant ('recompute')"
+    )->check(CLI::IsMember({"frozen", "recompute"}));
+
+    auto shards_opt = cmd->add_option(
+        "--shards",
+        opts->n_shards,
+        "Split the lookup table into this many shards by a hash of index variant IDs"
+    )->check(CLI::Range(1, 256))->excludes(append_flag);
+
+    cmd->add_option(
+        "--shard",
+        opts->shards,
+        "Build only these shards (numbered from 0), for example to rebuild one shard or to spread a build across machines"
+    )->needs(shards_opt);
+
+    cmd->add_option(
+        "--sort-memory",
+        opts->sort_memory_mb,
+        "Megabytes of memory used to sort LD data with --ungrouped or --symmetric"
+    )->check(CLI::PositiveNumber);
 
     cmd->add_option(
         "-d,--delimiter",
@@ -456,6 +1604,12 @@ void subcommand_setup(CLI::App& app) {
         "Column of LD data containing MAFs of index variants"
     );
 
+    cmd->add_option(
+        "--ld-maf-column",
+        opts->ld_variant_maf_column,
+        "Column of LD data containing MAFs of LD variants (used with --symmetric)"
+    );
+
     cmd->add_option(
         "-R,--r2-column",
         opts->r2_column,
@@ -468,42 +1622,66 @@ void subcommand_setup(CLI::App& app) {
         "Minimum r-squared value for a variant pair to be considered 'in LD'"
     )->check(CLI::Range(0.0, 1.0));
 
-    // LD Bin Group
-    auto ld_group = cmd->add_option_group("ld_bins");
-    ld_group->add_option(
-        "--index-variants-per-ld-bin",
-        opts->index_variants_per_ld_bin,
-        "Approximate size of each strata when index variants are stratified by number of LD surrogates"
-    )->check(CLI::PositiveNumber);
+    cmd->add_option(
+        "--r2-cutoffs",
+        opts->r2_cutoffs,
+        "Minimum r-squared values at which to also count and stratify LD surrogates"
+    )->check(CLI::Range(0.0, 1.0));
 
-    ld_group->add_option(
-        "--n-ld-bins",
-        opts->n_ld_bins,
-        "Approximate number of strata when index variants are stratified by number of LD surrogates"
-    )->check(CLI::PositiveNumber);
+    cmd->add_flag(
+        "--static-index",
+        opts->static_index,
+        "Also index each table with a minimal perfect hash, for faster lookups"
+    );
 
-    ld_group->require_option(1);
-    // End LD Bin Group
+    add_bin_options(cmd, opts);
 
-    // MAF Bin Group
-    auto maf_group = cmd->add_option_group("maf_bins");
-    maf_group->add_option(
-        "--index-variants-per-maf-bin",
-        opts->index_variants_per_maf_bin,
-        "Approximate size of each strata when index variants are stratified by MAF"
-    )->check(CLI::PositiveNumber);
+    cmd->callback([opts]() {
+        do_setup(opts);
+    });
+}
 
-    maf_group->add_option(
-        "--n-maf-bins",
-        opts->n_maf_bins,
-        "Approximate number of strata when index variants are stratified by MAF"
+void subcommand_compact(CLI::App& app) {
+    auto opts(std::make_shared<SubcommandOptsCompact>());
+    auto cmd(app.add_subcommand(
+        "compact",
+        "Merge the segments added by setup --append into one"
+    ));
+
+    cmd->add_option(
+        "dir,--dir",
+        opts->dir,
+        "Directory where lookup table is stored"
+    )->check(CLI::ExistingDirectory)->required();
+
+    cmd->callback([opts]() {
+        do_compact(opts);
+    });
+}
+
+void subcommand_stratify(CLI::App& app) {
+    auto opts(std::make_shared<SubcommandOptsStratify>());
+    auto cmd(app.add_subcommand(
+        "stratify",
+        "Compute the strata of a sharded lookup table once its shards are built"
+    ));
+
+    cmd->add_option(
+        "dir,--dir",
+        opts->dir,
+        "Directory where lookup table is stored"
+    )->check(CLI::ExistingDirectory)->required();
+
+    cmd->add_option(
+        "-j,--threads",
+        opts->n_threads,
+        "Number of shards read at once"
     )->check(CLI::PositiveNumber);
 
-    maf_group->require_option(1);
-    // End MAF Bin Group
+    add_bin_options(cmd, opts);
 
     cmd->callback([opts]() {
-        do_setup(opts);
+        do_stratify(opts);
     });
 }
 
@@ -532,6 +1710,14 @@ void subcommand_get_variants_in_ld_with(CLI::App& app) {
         "Space-separated index variant IDs"
     );
 
+    cmd->add_option(
+        "--min-r2",
+        opts->min_r2,
+        "Minimum r-squared value for an LD surrogate to be reported"
+    )->check(CLI::Range(0.0, 1.0));
+
+    add_residency_option(cmd, opts);
+
     cmd->callback([opts]() {
         do_get_variants_in_ld_with(opts);
     });
@@ -562,6 +1748,10 @@ void subcommand_get_variants_similar_to(CLI::App& app) {
         "Space-separated index variant IDs"
     );
 
+    add_r2_cutoff_option(cmd, opts);
+
+    add_residency_option(cmd, opts);
+
     cmd->callback([opts]() {
         do_get_variants_similar_to(opts);
     });
@@ -592,6 +1782,10 @@ void subcommand_get_variants_with_stats_like(CLI::App& app) {
         "Target number of LD surrogates"
     )->required();
 
+    add_r2_cutoff_option(cmd, opts);
+
+    add_residency_option(cmd, opts);
+
     cmd->callback([opts]() {
         do_get_variants_with_stats_like(opts);
     });
@@ -622,6 +1816,10 @@ void subcommand_get_variant_statistics(CLI::App& app) {
         "Space-separated index variant IDs"
     );
 
+    add_r2_cutoff_option(cmd, opts);
+
+    add_residency_option(cmd, opts);
+
     cmd->callback([opts]() {
         do_get_variant_statistics(opts);
     });
@@ -658,6 +1856,10 @@ void subcommand_sample(CLI::App& app) {
         "Number of samples to take for each variant"
     );
 
+    add_r2_cutoff_option(cmd, opts);
+
+    add_residency_option(cmd, opts);
+
     cmd->callback([opts]() {
         do_sample(opts);
     });
@@ -675,6 +1877,8 @@ int main(int argc, char** argv) {
     app.require_subcommand(1);
 
     subcommand_setup(app);
+    subcommand_compact(app);
+    subcommand_stratify(app);
     subcommand_get_variants_in_ld_with(app);
     subcommand_get_variants_similar_to(app);
     subcommand_get_variants_with_stats_like(app);
@@ -20,8 +20,52 @@ enum {
     HT_FLAG_CAN_WRITE = 1,
     HT_FLAG_HASH_2 = 2,
     HT_FLAG_IS_LOADED = 4,
+    /* Version 1.2: wyhash over stored key lengths */
+    HT_FLAG_HASH_3 = 8,
+    /* Version 1.3: as 1.2, and slots hold fingerprints */
+    HT_FLAG_TAGS = 16,
+    /* Version 1.4: as 1.3, with Robin Hood probing up to a stored load */
+    HT_FLAG_ROBIN_HOOD = 32,
+    /* Version 1.5: as 1.4, with keys packed into a heap after the nodes */
+    HT_FLAG_KEY_HEAP = 64,
+    /* Versions 1.5 and 1.6: the file ends in a heap */
+    HT_FLAG_HEAP = 128,
 };
 
+/* Tables are created in the newest version: 1.5 for long keys, and 1.4 for
+ * short ones, which take no more space when padded to the same length than
+ * when referenced from the heap, and are read without another seek. Short
+ * keys of tables created with a heap (for blobs) are likewise kept in their
+ * nodes, in version 1.6. */
+static const char* CURRENT_MAGIC = "DiskBasedHash14";
+static const int CURRENT_FLAGS = HT_FLAG_HASH_2 | HT_FLAG_HASH_3 | HT_FLAG_TAGS | HT_FLAG_ROBIN_HOOD;
+static const char* CURRENT_KEY_HEAP_MAGIC = "DiskBasedHash15";
+static const char* CURRENT_HEAP_MAGIC = "DiskBasedHash16";
+#define KEY_HEAP_MIN_MAXLEN 32
+
+/* Tagged slots are 32 bits wide (a 24-bit node index and an 8-bit tag) in
+ * tables of up to 2^24 slots, and 64 bits wide (a 48-bit node index and a
+ * 16-bit tag) in larger ones. */
+#define TAGGED_32BIT_MAX_SIZE (1L << 24)
+
+/* Robin Hood slots are 64 bits wide: a 40-bit node index, the 8-bit distance
+ * of the slot from the key's home slot, then a 16-bit tag. Elements are never
+ * placed further than MAX_PROBE_LENGTH slots from home; the table grows
+ * instead. */
+#define RH_DISTANCE_SHIFT 40
+#define RH_TAG_SHIFT 48
+#define MAX_PROBE_LENGTH 255
+
+/* Tables before version 1.4 are at most half full. Later ones are filled to
+ * a load chosen when they are created. */
+#define LEGACY_MAX_LOAD_PERCENT 50
+#define DEFAULT_MAX_LOAD_PERCENT 80
+#define MIN_MAX_LOAD_PERCENT 10
+#define MAX_MAX_LOAD_PERCENT 90
+
+/* Transparent huge pages on x86-64 and most other 64-bit platforms. */
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
 typedef struct HashTableHeader {
     char magic[16];
     HashTableOpts opts_;
@@ -29,18 +73,35 @@ typedef struct HashTableHeader {
     size_t slots_used_;
 } HashTableHeader;
 
+/* Follows the header in version 1.4 tables, which only have its first field,
+ * and in version 1.5 tables. */
+typedef struct HashTableHeaderExt {
+    uint64_t max_load_percent_;
+    uint64_t heap_used_;
+} HashTableHeaderExt;
+
 typedef struct HashTableEntry {
     const char* ht_key;
     void* ht_data;
 } HashTableEntry;
 
+/* Passed as the heap offset of a key not yet in the heap. */
+#define NEW_KEY UINT64_MAX
+
+static
+int insert_len(HashTable* ht, const char* key, size_t len, const void* data, char** err);
+
+static
+int insert_entry(HashTable* ht, const char* key, size_t len, const void* data, uint64_t key_ix, char** err);
+
 static
-uint64_t hash_key(const char* k, int use_hash_2) {
+uint64_t hash_djb2(const char* k, size_t len, int use_hash_2) {
     /* Taken from http://www.cse.yorku.ca/~oz/hash.html */
     const unsigned char* ku = (const unsigned char*)k;
+    const unsigned char* end = ku + len;
     uint64_t hash = 5381;
     uint64_t next;
-    for ( ; *ku; ++ku) {
+    for ( ; ku != end; ++ku) {
         hash *= 33;
         next = *ku;
         if (use_hash_2) {
@@ -51,6 +112,93 @@ uint64_t hash_key(const char* k, int use_hash_2) {
     return hash;
 }
 
+/* wyhash (final version 4, released into the public domain by Wang Yi),
+ * which reads keys 4 or 8 bytes at a time. Words are read in host byte order,
+ * as is the rest of the table. */
+static const uint64_t wyhash_secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
+
+inline static
+void wymum(uint64_t* a, uint64_t* b) {
+    __uint128_t r = *a;
+    r *= *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+inline static
+uint64_t wymix(uint64_t a, uint64_t b) {
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+inline static
+uint64_t wyr8(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline static
+uint64_t wyr4(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static
+uint64_t hash_wyhash(const char* k, size_t len) {
+    const uint64_t* secret = wyhash_secret;
+    const unsigned char* p = (const unsigned char*)k;
+    uint64_t seed = wymix(secret[0], secret[1]);
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ secret[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ secret[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ secret[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+static
+uint64_t hash_key(const char* k, size_t len, int flags) {
+    if (flags & HT_FLAG_HASH_3) {
+        return hash_wyhash(k, len);
+    }
+    return hash_djb2(k, len, flags & HT_FLAG_HASH_2);
+}
+
 inline static
 size_t aligned_size(size_t s) {
     size_t s_8bytes = s & ~0x7;
@@ -67,19 +215,152 @@ const HashTableHeader* cheader_of(const HashTable* ht) {
     return (const HashTableHeader*)ht->data_;
 }
 
+inline static
+size_t header_size(int flags) {
+    if (flags & HT_FLAG_HEAP) return sizeof(HashTableHeader) + sizeof(HashTableHeaderExt);
+    if (flags & HT_FLAG_ROBIN_HOOD) return sizeof(HashTableHeader) + offsetof(HashTableHeaderExt, heap_used_);
+    return sizeof(HashTableHeader);
+}
+
+inline static
+HashTableHeaderExt* header_ext_of(HashTable* ht) {
+    return (HashTableHeaderExt*)((char*)ht->data_ + sizeof(HashTableHeader));
+}
+
+inline static
+const HashTableHeaderExt* cheader_ext_of(const HashTable* ht) {
+    return (const HashTableHeaderExt*)((const char*)ht->data_ + sizeof(HashTableHeader));
+}
+
+/* The flags and magic number of new tables of keys shorter than key_maxlen,
+ * which have a heap if `with_heap` is set or their keys are long. */
+inline static
+int creation_flags(HashTableOpts opts, int with_heap) {
+    if (opts.key_maxlen >= KEY_HEAP_MIN_MAXLEN) return CURRENT_FLAGS | HT_FLAG_KEY_HEAP | HT_FLAG_HEAP;
+    if (with_heap) return CURRENT_FLAGS | HT_FLAG_HEAP;
+    return CURRENT_FLAGS;
+}
+
+inline static
+const char* creation_magic(int flags) {
+    if (flags & HT_FLAG_KEY_HEAP) return CURRENT_KEY_HEAP_MAGIC;
+    return (flags & HT_FLAG_HEAP) ? CURRENT_HEAP_MAGIC : CURRENT_MAGIC;
+}
+
+inline static
+uint64_t max_load_percent(const HashTable* ht) {
+    if (!(ht->flags_ & HT_FLAG_ROBIN_HOOD)) return LEGACY_MAX_LOAD_PERCENT;
+    return cheader_ext_of(ht)->max_load_percent_;
+}
+
+/* The number of elements a table of `cursize` slots holds. */
+inline static
+uint64_t capacity_for(uint64_t cursize, uint64_t load_percent) {
+    return cursize * load_percent / 100;
+}
+
+inline static
+uint64_t capacity_of(const HashTable* ht) {
+    return capacity_for(cheader_of(ht)->cursize_, max_load_percent(ht));
+}
+
+inline static
+int is_64bit_size(uint64_t cursize, int flags) {
+    if (flags & HT_FLAG_ROBIN_HOOD) return 1;
+    if (flags & HT_FLAG_TAGS) return cursize > TAGGED_32BIT_MAX_SIZE;
+    return cursize > (1L << 32);
+}
+
 inline static
 int is_64bit(const HashTable* ht) {
-    return cheader_of(ht)->cursize_ > (1L << 32);
+    return is_64bit_size(cheader_of(ht)->cursize_, ht->flags_);
+}
+
+inline static
+int tag_shift(const HashTable* ht) {
+    return is_64bit(ht) ? 48 : 24;
+}
+
+/* The index + 1 of the node in a slot, or 0 if it is empty. */
+inline static
+uint64_t slot_node(const HashTable* ht, uint64_t slot) {
+    if (!(ht->flags_ & HT_FLAG_TAGS)) return slot;
+    if (ht->flags_ & HT_FLAG_ROBIN_HOOD) return slot & ((UINT64_C(1) << RH_DISTANCE_SHIFT) - 1);
+    return slot & ((UINT64_C(1) << tag_shift(ht)) - 1);
+}
+
+/* Untagged slots all have tag 0. */
+inline static
+uint64_t slot_tag(const HashTable* ht, uint64_t slot) {
+    if (!(ht->flags_ & HT_FLAG_TAGS)) return 0;
+    return slot >> tag_shift(ht);
+}
+
+inline static
+uint64_t slot_distance(uint64_t slot) {
+    return (slot >> RH_DISTANCE_SHIFT) & MAX_PROBE_LENGTH;
 }
 
+/* Version 1.3 tags are the top bits of the hash, which pick the slot less than
+ * the low bits do. Version 1.4 picks slots by the top bits, so its tags are
+ * the low bits. */
 inline static
-size_t node_size_opts(HashTableOpts opts) {
-    return aligned_size(opts.key_maxlen + 1) + aligned_size(opts.object_datalen);
+uint64_t hash_tag(const HashTable* ht, uint64_t hash) {
+    if (!(ht->flags_ & HT_FLAG_TAGS)) return 0;
+    if (ht->flags_ & HT_FLAG_ROBIN_HOOD) return hash & 0xffff;
+    return hash >> (is_64bit(ht) ? 48 : 56);
+}
+
+/* Version 1.4 maps hashes onto any number of slots by multiplying, rather than
+ * onto a prime number of slots by dividing, so tables grow to exactly the
+ * size needed for their load. */
+inline static
+uint64_t home_slot(const HashTable* ht, uint64_t hash) {
+    if (ht->flags_ & HT_FLAG_ROBIN_HOOD) {
+        return (uint64_t)(((__uint128_t)hash * cheader_of(ht)->cursize_) >> 64);
+    }
+    return hash % cheader_of(ht)->cursize_;
+}
+
+/* Version 1.2 nodes start with the length of their key, so keys are
+ * compared and rehashed without scanning for their NUL. */
+inline static
+size_t key_offset(int flags) {
+    return (flags & HT_FLAG_HASH_3) ? sizeof(uint32_t) : 0;
+}
+
+/* In version 1.5, the key area holds the offset of the key in the heap. There,
+ * each key follows its length, as in the key area of version 1.2 to 1.4. */
+inline static
+size_t key_area_size(HashTableOpts opts, int flags) {
+    if (flags & HT_FLAG_KEY_HEAP) return sizeof(uint64_t);
+    return aligned_size(key_offset(flags) + opts.key_maxlen + 1);
+}
+
+inline static
+size_t heap_record_size(size_t len) {
+    return sizeof(uint32_t) + len + 1;
+}
+
+inline static
+size_t node_size_opts(HashTableOpts opts, int flags) {
+    return key_area_size(opts, flags) + aligned_size(opts.object_datalen);
 }
 
 inline static
 size_t node_size(const HashTable* ht) {
-    return node_size_opts(cheader_of(ht)->opts_);
+    return node_size_opts(cheader_of(ht)->opts_, ht->flags_);
+}
+
+/* The table size at which `cap` elements fill at most `load_percent` of it.
+ * Before version 1.4, that is a prime, and `load_percent` is 50. */
+static
+uint64_t table_size_for(size_t cap, uint64_t load_percent, int flags) {
+    const uint64_t min_slots = cap * 100 / load_percent + 1;
+    if (flags & HT_FLAG_ROBIN_HOOD) return min_slots;
+    uint64_t i = 0;
+    while (primes[i] && primes[i] < min_slots) ++i;
+    return primes[i];
 }
 
 inline static
@@ -87,8 +368,25 @@ int entry_empty(const HashTableEntry et) {
     return !et.ht_key;
 }
 
+inline static
+size_t entry_key_len(const HashTable* ht, const HashTableEntry et) {
+    if (ht->flags_ & HT_FLAG_HASH_3) {
+        uint32_t len;
+        memcpy(&len, et.ht_key - sizeof(uint32_t), sizeof(len));
+        return len;
+    }
+    return strlen(et.ht_key);
+}
+
+/* `len` must be less than key_maxlen, so the key area is not overrun. */
+inline static
+int entry_has_key(const HashTable* ht, const HashTableEntry et, const char* key, size_t len) {
+    if ((ht->flags_ & HT_FLAG_HASH_3) && entry_key_len(ht, et) != len) return 0;
+    return !memcmp(et.ht_key, key, len) && !et.ht_key[len];
+}
+
 void* hashtable_of(HashTable* ht) {
-    return (unsigned char*)ht->data_ + sizeof(HashTableHeader);
+    return (unsigned char*)ht->data_ + header_size(ht->flags_);
 }
 
 
@@ -129,25 +427,74 @@ void show_ht(const HashTable* ht) {
     fprintf(stderr, "}\n");
 }
 
+inline static
+size_t nodes_offset(const HashTable* ht) {
+    const size_t sizeof_table_elem = is_64bit(ht) ? sizeof(uint64_t) : sizeof(uint32_t);
+    return header_size(ht->flags_) + cheader_of(ht)->cursize_ * sizeof_table_elem;
+}
+
+/* The heap follows room for as many nodes as the table holds, and takes the
+ * rest of the file. */
+inline static
+size_t heap_offset(const HashTable* ht) {
+    return nodes_offset(ht) + capacity_of(ht) * node_size(ht);
+}
+
 static
-HashTableEntry entry_at(const HashTable* ht, size_t ix) {
-    ix = get_table_at(ht, ix);
+HashTableEntry node_at(const HashTable* ht, size_t node_ix) {
     HashTableEntry r;
-    if (ix == 0) {
-        r.ht_key = 0;
-        r.ht_data = 0;
-        return r;
+    const char* node = (const char*)ht->data_ + nodes_offset(ht) + node_ix * node_size(ht);
+    if (ht->flags_ & HT_FLAG_KEY_HEAP) {
+        uint64_t key_ix;
+        memcpy(&key_ix, node, sizeof(key_ix));
+        r.ht_key = (const char*)ht->data_ + heap_offset(ht) + key_ix;
+    } else {
+        r.ht_key = node + key_offset(ht->flags_);
     }
-    --ix;
-    const size_t sizeof_table_elem = is_64bit(ht) ? sizeof(uint64_t) : sizeof(uint32_t);
-    const char* node_data = (const char*)ht->data_
-                            + sizeof(HashTableHeader)
-                            + cheader_of(ht)->cursize_ * sizeof_table_elem;
-    r.ht_key = node_data + ix * node_size(ht);
-    r.ht_data = (void*)( node_data + ix * node_size(ht) + aligned_size(cheader_of(ht)->opts_.key_maxlen + 1) );
+    r.ht_data = (void*)( node + key_area_size(cheader_of(ht)->opts_, ht->flags_) );
     return r;
 }
 
+/* Finds the slot of `key`, or else the slot at which to insert it, and sets
+ * `distance` to how far that slot is from the key's home slot. Nodes are only
+ * read when their tag matches the key's.
+ *
+ * In Robin Hood tables, the slots after a key's home slot are ordered by the
+ * distance from their own home slots, so the search stops at the first slot
+ * nearer its home than the key would be. The key is inserted there. */
+static
+uint64_t find_slot_hashed(const HashTable* ht, uint64_t hash, const char* key, size_t len, HashTableEntry* et, uint64_t* tag, uint64_t* distance) {
+    const int robin_hood = ht->flags_ & HT_FLAG_ROBIN_HOOD;
+    uint64_t h = home_slot(ht, hash);
+    *tag = hash_tag(ht, hash);
+    uint64_t i;
+    for (i = 0; i < cheader_of(ht)->cursize_; ++i) {
+        const uint64_t slot = get_table_at(ht, h);
+        const uint64_t node = slot_node(ht, slot);
+        *distance = i;
+        if (!node || (robin_hood && slot_distance(slot) < i)) {
+            et->ht_key = 0;
+            et->ht_data = 0;
+            return h;
+        }
+        if (slot_tag(ht, slot) == *tag) {
+            *et = node_at(ht, node - 1);
+            if (entry_has_key(ht, *et, key, len)) return h;
+        }
+        ++h;
+        if (h == cheader_of(ht)->cursize_) h = 0;
+    }
+    fprintf(stderr, "dht_lookup: the code should never have reached this line.\n");
+    et->ht_key = 0;
+    et->ht_data = 0;
+    return h;
+}
+
+static
+uint64_t find_slot(const HashTable* ht, const char* key, size_t len, HashTableEntry* et, uint64_t* tag, uint64_t* distance) {
+    return find_slot_hashed(ht, hash_key(key, len, ht->flags_), key, len, et, tag, distance);
+}
+
 HashTableOpts dht_zero_opts() {
     HashTableOpts r;
     r.key_maxlen = 0;
@@ -155,6 +502,15 @@ HashTableOpts dht_zero_opts() {
     return r;
 }
 
+static
+char* errno_message(const char* what) {
+    char* message = (char*)malloc(256);
+    if (message) {
+        snprintf(message, 256, "%s Error: %s.", what, strerror(errno));
+    }
+    return message;
+}
+
 HashTable* dht_open(const char* fpath, HashTableOpts opts, int flags, char** err) {
     if (!fpath || !*fpath) return NULL;
     const int fd = open(fpath, flags, 0644);
@@ -179,9 +535,12 @@ HashTable* dht_open(const char* fpath, HashTableOpts opts, int flags, char** err
     struct stat st;
     fstat(rp->fd_, &st);
     rp->datasize_ = st.st_size;
+    const int init_flags = creation_flags(opts, 0);
     if (rp->datasize_ == 0) {
         needs_init = 1;
-        rp->datasize_ = sizeof(HashTableHeader) + 7 * sizeof(uint32_t) + 3 * node_size_opts(opts);
+        rp->datasize_ = header_size(init_flags)
+                        + 7 * sizeof(uint64_t)
+                        + capacity_for(7, DEFAULT_MAX_LOAD_PERCENT) * node_size_opts(opts, init_flags);
         if (ftruncate(fd, rp->datasize_) < 0) {
             if (err) {
                 *err = malloc(256);
@@ -214,26 +573,45 @@ HashTable* dht_open(const char* fpath, HashTableOpts opts, int flags, char** err
         return NULL;
     }
     if (needs_init) {
-        strcpy(header_of(rp)->magic, "DiskBasedHash11");
+        strcpy(header_of(rp)->magic, creation_magic(init_flags));
         header_of(rp)->opts_ = opts;
         header_of(rp)->cursize_ = 7;
         header_of(rp)->slots_used_ = 0;
-    } else if (strcmp(header_of(rp)->magic, "DiskBasedHash11")) {
-        if (!strcmp(header_of(rp)->magic, "DiskBasedHash10")) {
-            rp->flags_ &= ~HT_FLAG_HASH_2;
-        } else {
-            char start[16];
-            strncpy(start, header_of(rp)->magic, 14);
-            start[13] = '\0';
-            if (!strcmp(start, "DiskBasedHash")) {
-                if (err) { *err = strdup("Version mismatch. This code can only load version 1.0 or 1.1."); }
-            } else {
-                if (err) { *err = strdup("No magic number found."); }
-            }
+        rp->flags_ |= init_flags;
+        header_ext_of(rp)->max_load_percent_ = DEFAULT_MAX_LOAD_PERCENT;
+        if (init_flags & HT_FLAG_HEAP) header_ext_of(rp)->heap_used_ = 0;
+        return rp;
+    }
+    if (!strcmp(header_of(rp)->magic, "DiskBasedHash14")
+            || !strcmp(header_of(rp)->magic, "DiskBasedHash15")
+            || !strcmp(header_of(rp)->magic, "DiskBasedHash16")) {
+        rp->flags_ |= HT_FLAG_HASH_3 | HT_FLAG_TAGS | HT_FLAG_ROBIN_HOOD;
+        if (!strcmp(header_of(rp)->magic, "DiskBasedHash15")) rp->flags_ |= HT_FLAG_KEY_HEAP | HT_FLAG_HEAP;
+        if (!strcmp(header_of(rp)->magic, "DiskBasedHash16")) rp->flags_ |= HT_FLAG_HEAP;
+        if (max_load_percent(rp) < MIN_MAX_LOAD_PERCENT || max_load_percent(rp) > MAX_MAX_LOAD_PERCENT) {
+            if (err) { *err = strdup("Maximum load is out of range (the table is corrupted)."); }
             dht_free(rp);
             return 0;
         }
-    } else if ((header_of(rp)->opts_.key_maxlen != opts.key_maxlen && opts.key_maxlen != 0)
+    } else if (!strcmp(header_of(rp)->magic, "DiskBasedHash13")) {
+        rp->flags_ |= HT_FLAG_HASH_3 | HT_FLAG_TAGS;
+    } else if (!strcmp(header_of(rp)->magic, "DiskBasedHash12")) {
+        rp->flags_ |= HT_FLAG_HASH_3;
+    } else if (!strcmp(header_of(rp)->magic, "DiskBasedHash10")) {
+        rp->flags_ &= ~HT_FLAG_HASH_2;
+    } else if (strcmp(header_of(rp)->magic, "DiskBasedHash11")) {
+        char start[16];
+        strncpy(start, header_of(rp)->magic, 14);
+        start[13] = '\0';
+        if (!strcmp(start, "DiskBasedHash")) {
+            if (err) { *err = strdup("Version mismatch. This code can only load versions 1.0 to 1.6."); }
+        } else {
+            if (err) { *err = strdup("No magic number found."); }
+        }
+        dht_free(rp);
+        return 0;
+    }
+    if ((header_of(rp)->opts_.key_maxlen != opts.key_maxlen && opts.key_maxlen != 0)
                 || (header_of(rp)->opts_.object_datalen != opts.object_datalen && opts.object_datalen != 0)) {
         if (err) { *err = strdup("Options mismatch (diskhash table on disk was not created with the same options used to open it)."); }
         dht_free(rp);
@@ -242,36 +620,117 @@ HashTable* dht_open(const char* fpath, HashTableOpts opts, int flags, char** err
     return rp;
 }
 
+/* Copies the file of `ht` into anonymous memory, which then replaces its
+ * mapping. If `hugepages`, the copy starts on a huge page boundary and is
+ * advised to be backed by transparent huge pages. The table is left as it was
+ * on failure. */
+static
+int load_data(HashTable* ht, int hugepages, char** err) {
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t data_size = (ht->datasize_ + page_size - 1) & ~(page_size - 1);
+    const size_t map_size = hugepages ? data_size + HUGE_PAGE_SIZE : data_size;
+    char* mapped = (char*)mmap(NULL, map_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        if (err) { *err = errno_message("Could not allocate memory for the table."); }
+        return -ENOMEM;
+    }
+    char* data = mapped;
+    if (hugepages) {
+        /* Only the whole huge pages of a mapping can be backed by them. */
+        data = (char*)(((uintptr_t)mapped + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+        if (data > mapped) munmap(mapped, data - mapped);
+        if (mapped + map_size > data + data_size) {
+            munmap(data + data_size, mapped + map_size - (data + data_size));
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(data, data_size, MADV_HUGEPAGE);
+#endif
+    }
+    size_t done = 0;
+    while (done < ht->datasize_) {
+        const ssize_t n = pread(ht->fd_, data + done, ht->datasize_ - done, done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (err) {
+                *err = n < 0 ? errno_message("Could not read the table.")
+                             : strdup("Could not read the table. Error: File truncated.");
+            }
+            munmap(data, data_size);
+            return -EIO;
+        }
+        done += n;
+    }
+    mprotect(data, data_size, PROT_READ);
+    munmap(ht->data_, ht->datasize_);
+    ht->data_ = data;
+    ht->flags_ |= HT_FLAG_IS_LOADED;
+    return 0;
+}
+
 int dht_load_to_memory(HashTable* ht, char** err) {
     if (ht->flags_ & HT_FLAG_CAN_WRITE) {
-        if (err) *err = "Cannot call dht_load_to_memory on a read/write Diskhash";
+        if (err) { *err = strdup("Cannot call dht_load_to_memory on a read/write Diskhash"); }
         return 1;
     }
     if (ht->flags_ & HT_FLAG_IS_LOADED) {
-        if (err) *err = "dht_load_to_memory had already been called.";
+        if (err) { *err = strdup("dht_load_to_memory had already been called."); }
         return 1;
     }
-    munmap(ht->data_, ht->datasize_);
-    ht->data_ = malloc(ht->datasize_);
-    if (ht->data_) {
-        size_t n = read(ht->fd_, ht->data_, ht->datasize_);
-        if (n == ht->datasize_) return 0;
-        else if (err) *err = "dht_load_to_memory: could not read data from file";
-    } else {
-        if (err) *err = "dht_load_to_memory: could not allocate memory.";
-    }
-    free(ht->data_);
-    fsync(ht->fd_);
-    close(ht->fd_);
-    free((char*)ht->fname_);
-    free(ht);
-    return 2;
+    return load_data(ht, 0, err) ? 2 : 0;
+}
 
+int dht_set_residency(HashTable* ht, HashTableResidency residency, char** err) {
+    switch (residency) {
+        case DHT_RESIDENCY_DEFAULT:
+            return 0;
+        case DHT_RESIDENCY_LAZY:
+            madvise(ht->data_, ht->datasize_, MADV_RANDOM);
+            return 0;
+        case DHT_RESIDENCY_POPULATE: {
+#ifdef MADV_POPULATE_READ
+            if (!madvise(ht->data_, ht->datasize_, MADV_POPULATE_READ)) return 0;
+#endif
+            /* Older kernels read ahead on the hint, and each page is then
+             * faulted in by reading it. */
+            madvise(ht->data_, ht->datasize_, MADV_WILLNEED);
+            const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+            const volatile char* data = (const volatile char*)ht->data_;
+            size_t i;
+            for (i = 0; i < ht->datasize_; i += page_size) (void)data[i];
+            return 0;
+        }
+        case DHT_RESIDENCY_LOCKED:
+            if (mlock(ht->data_, ht->datasize_) < 0) {
+                const int mlock_errno = errno;
+                if (err) { *err = errno_message("mlock() call failed (see ulimit -l)."); }
+                return -mlock_errno;
+            }
+            return 0;
+        case DHT_RESIDENCY_HUGEPAGES:
+            if (ht->flags_ & HT_FLAG_CAN_WRITE) {
+                if (err) { *err = strdup("Hash table is writable. Cannot load it into huge pages."); }
+                return -EACCES;
+            }
+            if (ht->flags_ & HT_FLAG_IS_LOADED) {
+                if (err) { *err = strdup("Hash table is already loaded into memory."); }
+                return -EINVAL;
+            }
+            return load_data(ht, 1, err);
+    }
+    if (err) { *err = strdup("Unknown residency."); }
+    return -EINVAL;
 }
 
 void dht_free(HashTable* ht) {
     if (ht->flags_ & HT_FLAG_IS_LOADED) {
-        free(ht->data_);
+        munmap(ht->data_, ht->datasize_);
+    } else if ((ht->flags_ & HT_FLAG_HEAP) && (ht->flags_ & HT_FLAG_CAN_WRITE)) {
+        /* The heap grows ahead of its contents, so the room left is given back. */
+        const size_t used_size = heap_offset(ht) + cheader_ext_of(ht)->heap_used_;
+        munmap(ht->data_, ht->datasize_);
+        if (ftruncate(ht->fd_, used_size) < 0) {
+            /* The table is still valid with the room left. */
+        }
     } else {
         munmap(ht->data_, ht->datasize_);
     }
@@ -310,17 +769,17 @@ size_t dht_reserve(HashTable* ht, size_t cap, char** err) {
         if (err) { *err = strdup("Hash table is read-only. Cannot call dht_reserve."); }
         return -EACCES;
     }
-    if (header_of(ht)->cursize_ / 2 > cap) {
-        return header_of(ht)->cursize_ / 2;
+    if (capacity_of(ht) > cap) {
+        return capacity_of(ht);
     }
     const uint64_t starting_slots = cheader_of(ht)->slots_used_;
-    const uint64_t min_slots = cap * 2 + 1;
-    uint64_t i = 0;
-    while (primes[i] && primes[i] < min_slots) ++i;
-    const uint64_t n = primes[i];
-    cap = n / 2;
-    const size_t sizeof_table_elem = is_64bit(ht) ? sizeof(uint64_t) : sizeof(uint32_t);
-    const size_t total_size = sizeof(HashTableHeader) + n * sizeof_table_elem + cap * node_size(ht);
+    const uint64_t n = table_size_for(cap, max_load_percent(ht), ht->flags_);
+    uint64_t i;
+    cap = capacity_for(n, max_load_percent(ht));
+    const size_t sizeof_table_elem = is_64bit_size(n, ht->flags_) ? sizeof(uint64_t) : sizeof(uint32_t);
+    size_t total_size = header_size(ht->flags_) + n * sizeof_table_elem + cap * node_size(ht);
+    /* The heap is copied as it is, so blobs keep their offsets. */
+    if (ht->flags_ & HT_FLAG_HEAP) total_size += cheader_ext_of(ht)->heap_used_;
 
     HashTable* temp_ht = (HashTable*)malloc(sizeof(HashTable));
     while (1) {
@@ -367,9 +826,14 @@ size_t dht_reserve(HashTable* ht, size_t cap, char** err) {
         free(temp_ht);
         return 0;
     }
-    memcpy(header_of(temp_ht), header_of(ht), sizeof(HashTableHeader));
+    memcpy(header_of(temp_ht), header_of(ht), header_size(ht->flags_));
     header_of(temp_ht)->cursize_ = n;
     header_of(temp_ht)->slots_used_ = 0;
+    if (ht->flags_ & HT_FLAG_HEAP) {
+        memcpy((char*)temp_ht->data_ + heap_offset(temp_ht),
+                (const char*)ht->data_ + heap_offset(ht),
+                cheader_ext_of(ht)->heap_used_);
+    }
 
     if (!strcmp(header_of(temp_ht)->magic, "DiskBasedHash10")) {
         strcpy(header_of(temp_ht)->magic, "DiskBasedHash11");
@@ -378,9 +842,11 @@ size_t dht_reserve(HashTable* ht, size_t cap, char** err) {
 
     HashTableEntry et;
     for (i = 0; i < header_of(ht)->slots_used_; ++i) {
-        set_table_at(ht, 0, i + 1);
-        et = entry_at(ht, 0);
-        dht_insert(temp_ht, et.ht_key, et.ht_data, NULL);
+        et = node_at(ht, i);
+        const uint64_t key_ix = (ht->flags_ & HT_FLAG_KEY_HEAP)
+                                ? (uint64_t)(et.ht_key - ((const char*)ht->data_ + heap_offset(ht)))
+                                : NEW_KEY;
+        insert_entry(temp_ht, et.ht_key, entry_key_len(ht, et), et.ht_data, key_ix, NULL);
     }
 
     const char* temp_fname = strdup(temp_ht->fname_);
@@ -416,52 +882,455 @@ size_t dht_size(const HashTable* ht) {
     return cheader_of(ht)->slots_used_;
 }
 
+void* dht_indexed_lookup(const HashTable* ht, size_t ix, const char** key) {
+    /* Nodes are stored densely in insertion order. */
+    if (ix >= cheader_of(ht)->slots_used_) return NULL;
+    HashTableEntry et = node_at(ht, ix);
+    if (key) *key = et.ht_key;
+    return et.ht_data;
+}
+
 void* dht_lookup(const HashTable* ht, const char* key) {
-    uint64_t h = hash_key(key, ht->flags_ & HT_FLAG_HASH_2) % cheader_of(ht)->cursize_;
-    uint64_t i;
-    for (i = 0; i < cheader_of(ht)->cursize_; ++i) {
-        HashTableEntry et = entry_at(ht, h);
-        if (!et.ht_key) return NULL;
-        if (!strcmp(et.ht_key, key)) return et.ht_data;
-        ++h;
-        if (h == cheader_of(ht)->cursize_) h = 0;
+    return dht_lookup_len(ht, key, strlen(key));
+}
+
+void* dht_lookup_len(const HashTable* ht, const char* key, size_t len) {
+    /* No key that long fits in the table. */
+    if (len >= cheader_of(ht)->opts_.key_maxlen) return NULL;
+    HashTableEntry et;
+    uint64_t tag, distance;
+    find_slot(ht, key, len, &et, &tag, &distance);
+    return et.ht_data;
+}
+
+/* dht_lookup_many() resolves keys LOOKUP_BATCH at a time: it prefetches the
+ * home slots of the whole batch, then the nodes those slots point to (and, in
+ * version 1.5, their keys), and only then probes, so the cache misses (or
+ * page faults) of the keys of a batch overlap rather than follow each other. */
+#define LOOKUP_BATCH 16
+
+void dht_lookup_many(const HashTable* ht, const char* const* keys, const size_t* lens, size_t n, void** results) {
+    const size_t table_elem_size = is_64bit(ht) ? sizeof(uint64_t) : sizeof(uint32_t);
+    const char* table = (const char*)hashtable_of((HashTable*)ht);
+    const char* nodes = (const char*)ht->data_ + nodes_offset(ht);
+    uint64_t hashes[LOOKUP_BATCH];
+    const char* batch_nodes[LOOKUP_BATCH];
+    size_t start, i;
+    for (start = 0; start < n; start += LOOKUP_BATCH) {
+        const size_t batch_size = n - start < LOOKUP_BATCH ? n - start : LOOKUP_BATCH;
+        for (i = 0; i < batch_size; ++i) {
+            hashes[i] = hash_key(keys[start + i], lens[start + i], ht->flags_);
+            __builtin_prefetch(table + home_slot(ht, hashes[i]) * table_elem_size);
+        }
+        for (i = 0; i < batch_size; ++i) {
+            const uint64_t slot = get_table_at(ht, home_slot(ht, hashes[i]));
+            const uint64_t node = slot_node(ht, slot);
+            batch_nodes[i] = NULL;
+            if (node && slot_tag(ht, slot) == hash_tag(ht, hashes[i])) {
+                batch_nodes[i] = nodes + (node - 1) * node_size(ht);
+                __builtin_prefetch(batch_nodes[i]);
+            }
+        }
+        if (ht->flags_ & HT_FLAG_KEY_HEAP) {
+            const char* heap = (const char*)ht->data_ + heap_offset(ht);
+            for (i = 0; i < batch_size; ++i) {
+                uint64_t key_ix;
+                if (!batch_nodes[i]) continue;
+                memcpy(&key_ix, batch_nodes[i], sizeof(key_ix));
+                __builtin_prefetch(heap + key_ix);
+            }
+        }
+        for (i = 0; i < batch_size; ++i) {
+            HashTableEntry et;
+            uint64_t tag, distance;
+            results[start + i] = NULL;
+            /* No key that long fits in the table. */
+            if (lens[start + i] >= cheader_of(ht)->opts_.key_maxlen) continue;
+            find_slot_hashed(ht, hashes[i], keys[start + i], lens[start + i], &et, &tag, &distance);
+            results[start + i] = et.ht_data;
+        }
     }
-    fprintf(stderr, "dht_lookup: the code should never have reached this line.\n");
-    return NULL;
+}
+
+size_t dht_probe_length(const HashTable* ht, const char* key, size_t len) {
+    HashTableEntry et;
+    uint64_t tag, distance;
+    find_slot(ht, key, len, &et, &tag, &distance);
+    return distance + 1;
 }
 
 int dht_insert(HashTable* ht, const char* key, const void* data, char** err) {
+    return insert_len(ht, key, strlen(key), data, err);
+}
+
+/* Slot `h` of a Robin Hood table is made free for a key `distance` slots from
+ * its home by moving the run of slots from `h` up to the next empty slot
+ * forward by one. Sets `*end` to that empty slot, or returns 0 if the move
+ * would take any element further than MAX_PROBE_LENGTH slots from home. */
+static
+int find_room(const HashTable* ht, uint64_t h, uint64_t distance, uint64_t* end) {
+    if (distance > MAX_PROBE_LENGTH) return 0;
+    const uint64_t cursize = cheader_of(ht)->cursize_;
+    uint64_t slot;
+    *end = h;
+    while (slot_node(ht, slot = get_table_at(ht, *end))) {
+        if (slot_distance(slot) == MAX_PROBE_LENGTH) return 0;
+        ++*end;
+        if (*end == cursize) *end = 0;
+    }
+    return 1;
+}
+
+static
+void make_room(HashTable* ht, uint64_t h, uint64_t end) {
+    const uint64_t cursize = cheader_of(ht)->cursize_;
+    while (end != h) {
+        const uint64_t prev = end ? end - 1 : cursize - 1;
+        set_table_at(ht, end, get_table_at(ht, prev) + (UINT64_C(1) << RH_DISTANCE_SHIFT));
+        end = prev;
+    }
+}
+
+/* Extends the heap at the end of the file to fit `size` more bytes, at least
+ * doubling it so that it is remapped only a few times. */
+static
+int reserve_heap(HashTable* ht, size_t size, char** err) {
+    const size_t heap_start = heap_offset(ht);
+    const size_t heap_used = cheader_ext_of(ht)->heap_used_;
+    const size_t heap_size = ht->datasize_ - heap_start;
+    if (heap_size - heap_used >= size) return 1;
+    size_t new_heap_size = heap_size * 2 < 4096 ? 4096 : heap_size * 2;
+    if (new_heap_size < heap_used + size) new_heap_size = heap_used + size;
+    const size_t new_datasize = heap_start + new_heap_size;
+    if (ftruncate(ht->fd_, new_datasize) < 0) {
+        if (err) { *err = errno_message("Could not allocate disk space."); }
+        return 0;
+    }
+    void* data = mmap(NULL, new_datasize, PROT_READ|PROT_WRITE, MAP_SHARED, ht->fd_, 0);
+    if (data == MAP_FAILED) {
+        if (err) { *err = errno_message("mmap() call failed."); }
+        return 0;
+    }
+    munmap(ht->data_, ht->datasize_);
+    ht->data_ = data;
+    ht->datasize_ = new_datasize;
+    return 1;
+}
+
+static
+int insert_len(HashTable* ht, const char* key, size_t len, const void* data, char** err) {
+    return insert_entry(ht, key, len, data, NEW_KEY, err);
+}
+
+/* Inserts `key`, which is already in the heap at `key_ix` unless that is
+ * NEW_KEY. */
+static
+int insert_entry(HashTable* ht, const char* key, size_t len, const void* data, uint64_t key_ix, char** err) {
     if (!(ht->flags_ & HT_FLAG_CAN_WRITE)) {
         if (err) { *err = strdup("Hash table is read-only. Cannot insert."); }
         return -EACCES;
     }
-    if (strlen(key) >= header_of(ht)->opts_.key_maxlen) {
+    if (len >= header_of(ht)->opts_.key_maxlen) {
         if (err) { *err = strdup("Key is too long"); }
         return -EINVAL;
     }
-    /* Max load is 50% */
-    if (cheader_of(ht)->cursize_ / 2 <= cheader_of(ht)->slots_used_) {
-        if (!dht_reserve(ht, cheader_of(ht)->slots_used_ + 1, err)) return -ENOMEM;
+    if (capacity_of(ht) <= cheader_of(ht)->slots_used_) {
+        /* Prime table sizes already grow geometrically. */
+        const size_t used = cheader_of(ht)->slots_used_;
+        const size_t cap = (ht->flags_ & HT_FLAG_ROBIN_HOOD) ? 2 * used : used + 1;
+        if (!dht_reserve(ht, cap, err)) return -ENOMEM;
     }
-    uint64_t h = hash_key(key, ht->flags_ & HT_FLAG_HASH_2) % cheader_of(ht)->cursize_;
-    while (1) {
-        HashTableEntry et = entry_at(ht, h);
-        if (entry_empty(et)) break;
-        if (!strcmp(et.ht_key, key)) {
-            return 0;
-        }
-        ++h;
-        if (h == cheader_of(ht)->cursize_) {
-            h = 0;
+    HashTableEntry et;
+    uint64_t tag, distance;
+    uint64_t h = find_slot(ht, key, len, &et, &tag, &distance);
+    if (!entry_empty(et)) {
+        return 0;
+    }
+    uint64_t end = h;
+    if (ht->flags_ & HT_FLAG_ROBIN_HOOD) {
+        /* Probes are kept short by growing the table early if need be. */
+        while (!find_room(ht, h, distance, &end)) {
+            const size_t cap = capacity_of(ht);
+            if (!dht_reserve(ht, cap + cap / 4 + 1, err)) return -ENOMEM;
+            h = find_slot(ht, key, len, &et, &tag, &distance);
         }
     }
-    set_table_at(ht, h, header_of(ht)->slots_used_ + 1);
+    const int new_key = (ht->flags_ & HT_FLAG_KEY_HEAP) && key_ix == NEW_KEY;
+    if (new_key && !reserve_heap(ht, heap_record_size(len), err)) return -ENOMEM;
+    if (ht->flags_ & HT_FLAG_ROBIN_HOOD) make_room(ht, h, end);
+    const uint64_t node = header_of(ht)->slots_used_;
+    if (ht->flags_ & HT_FLAG_ROBIN_HOOD) {
+        set_table_at(ht, h, (tag << RH_TAG_SHIFT) | (distance << RH_DISTANCE_SHIFT) | (node + 1));
+    } else if (ht->flags_ & HT_FLAG_TAGS) {
+        set_table_at(ht, h, (tag << tag_shift(ht)) | (node + 1));
+    } else {
+        set_table_at(ht, h, node + 1);
+    }
     ++header_of(ht)->slots_used_;
-    HashTableEntry et = entry_at(ht, h);
+    if (new_key) {
+        key_ix = cheader_ext_of(ht)->heap_used_ + sizeof(uint32_t);
+        header_ext_of(ht)->heap_used_ += heap_record_size(len);
+    }
+    if (ht->flags_ & HT_FLAG_KEY_HEAP) {
+        memcpy((char*)ht->data_ + nodes_offset(ht) + node * node_size(ht), &key_ix, sizeof(key_ix));
+    }
+    et = node_at(ht, node);
+    if ((ht->flags_ & HT_FLAG_KEY_HEAP) && !new_key) {
+        memcpy(et.ht_data, data, cheader_of(ht)->opts_.object_datalen);
+        return 1;
+    }
 
-    strcpy((char*)et.ht_key, key);
+    if (ht->flags_ & HT_FLAG_HASH_3) {
+        const uint32_t len32 = len;
+        memcpy((char*)et.ht_key - sizeof(uint32_t), &len32, sizeof(len32));
+    }
+    memcpy((char*)et.ht_key, key, len);
+    ((char*)et.ht_key)[len] = '\0';
     memcpy(et.ht_data, data, cheader_of(ht)->opts_.object_datalen);
 
     return 1;
 }
 
+/* Sets `*load` to the default if it is 0. Returns 0 if it is out of range. */
+static
+int check_max_load_percent(size_t* load, char** err) {
+    if (!*load) *load = DEFAULT_MAX_LOAD_PERCENT;
+    if (*load < MIN_MAX_LOAD_PERCENT || *load > MAX_MAX_LOAD_PERCENT) {
+        if (err) { *err = strdup("Maximum load must be between 10% and 90%."); }
+        return 0;
+    }
+    return 1;
+}
+
+/* As dht_create, with room in the heap (if the table has one) for keys of
+ * `heap_size` bytes in all. */
+static
+HashTable* create_table(const char* fpath, HashTableOpts opts, size_t capacity, size_t max_load_percent, size_t heap_size, int with_heap, char** err) {
+    if (!fpath || !*fpath) return NULL;
+    if (!check_max_load_percent(&max_load_percent, err)) return NULL;
+    const int flags = creation_flags(opts, with_heap);
+    /* Never smaller than the table dht_open() starts with. */
+    const uint64_t n = table_size_for(capacity < 3 ? 3 : capacity, max_load_percent, flags);
+    if (n >= (UINT64_C(1) << RH_DISTANCE_SHIFT)) {
+        if (err) { *err = strdup("Capacity is too large."); }
+        return NULL;
+    }
+    const size_t sizeof_table_elem = is_64bit_size(n, flags) ? sizeof(uint64_t) : sizeof(uint32_t);
+    size_t total_size = header_size(flags)
+                                + n * sizeof_table_elem
+                                + capacity_for(n, max_load_percent) * node_size_opts(opts, flags);
+    if (flags & HT_FLAG_HEAP) total_size += heap_size;
+
+    HashTableHeader header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, creation_magic(flags));
+    header.opts_ = opts;
+    header.cursize_ = n;
+    header.slots_used_ = 0;
+    HashTableHeaderExt header_ext;
+    memset(&header_ext, 0, sizeof(header_ext));
+    header_ext.max_load_percent_ = max_load_percent;
+
+    const int fd = open(fpath, O_RDWR|O_CREAT|O_EXCL, 0644);
+    if (fd < 0) {
+        if (err) { *err = errno_message("open call failed."); }
+        return NULL;
+    }
+    /* The table is all zeros (empty), so it stays sparse until filled. */
+    if (ftruncate(fd, total_size) < 0
+            || pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+            || pwrite(fd, &header_ext, header_size(flags) - sizeof(header), sizeof(header))
+                    != (ssize_t)(header_size(flags) - sizeof(header))) {
+        if (err) { *err = errno_message("Could not allocate disk space."); }
+        close(fd);
+        unlink(fpath);
+        return NULL;
+    }
+    close(fd);
+    return dht_open(fpath, opts, O_RDWR, err);
+}
+
+HashTable* dht_create(const char* fpath, HashTableOpts opts, size_t capacity, size_t max_load_percent, char** err) {
+    return create_table(fpath, opts, capacity, max_load_percent, 0, 0, err);
+}
+
+HashTable* dht_create_with_heap(const char* fpath, HashTableOpts opts, size_t capacity, size_t max_load_percent, char** err) {
+    return create_table(fpath, opts, capacity, max_load_percent, 0, 1, err);
+}
+
+int dht_heap_append(HashTable* ht, const void* data, size_t len, uint64_t* offset, char** err) {
+    if (!(ht->flags_ & HT_FLAG_CAN_WRITE)) {
+        if (err) { *err = strdup("Hash table is read-only. Cannot append to its heap."); }
+        return -EACCES;
+    }
+    if (!(ht->flags_ & HT_FLAG_HEAP)) {
+        if (err) { *err = strdup("Hash table has no heap."); }
+        return -EINVAL;
+    }
+    if (!reserve_heap(ht, len, err)) return -ENOMEM;
+    *offset = cheader_ext_of(ht)->heap_used_;
+    char* p = (char*)ht->data_ + heap_offset(ht) + *offset;
+    if (data) {
+        memcpy(p, data, len);
+    } else {
+        memset(p, 0, len);
+    }
+    header_ext_of(ht)->heap_used_ += len;
+    return 0;
+}
+
+void* dht_heap_at(const HashTable* ht, uint64_t offset) {
+    if (!(ht->flags_ & HT_FLAG_HEAP) || offset > dht_heap_size(ht)) return NULL;
+    return (char*)ht->data_ + heap_offset(ht) + offset;
+}
+
+size_t dht_heap_size(const HashTable* ht) {
+    if (!(ht->flags_ & HT_FLAG_HEAP)) return 0;
+    return cheader_ext_of(ht)->heap_used_;
+}
+
+struct HashTableBuilder {
+    char* fname_;
+    char* nodes_fname_;
+    FILE* nodes_;
+    HashTableOpts opts_;
+    size_t max_load_percent_;
+    size_t n_nodes_;
+    size_t nodes_size_;
+    size_t heap_size_;
+};
+
+HashTableBuilder* dht_builder_open(const char* fpath, HashTableOpts opts, size_t max_load_percent, char** err) {
+    if (!fpath || !*fpath) return NULL;
+    if (!check_max_load_percent(&max_load_percent, err)) return NULL;
+    HashTableBuilder* b = (HashTableBuilder*)calloc(1, sizeof(HashTableBuilder));
+    if (!b) {
+        if (err) { *err = NULL; }
+        return NULL;
+    }
+    b->opts_ = opts;
+    b->max_load_percent_ = max_load_percent;
+    b->fname_ = strdup(fpath);
+    b->nodes_fname_ = generate_tempname_from(fpath);
+    if (!b->fname_ || !b->nodes_fname_) {
+        if (err) { *err = NULL; }
+        dht_builder_free(b);
+        return NULL;
+    }
+    const int fd = open(b->nodes_fname_, O_EXCL|O_CREAT|O_RDWR, 0600);
+    if (fd < 0 || !(b->nodes_ = fdopen(fd, "w+b"))) {
+        if (err) { *err = errno_message("Could not create temporary file."); }
+        if (fd >= 0) {
+            close(fd);
+            unlink(b->nodes_fname_);
+        }
+        dht_builder_free(b);
+        return NULL;
+    }
+    return b;
+}
+
+int dht_builder_add(HashTableBuilder* b, const char* key, const void* data, char** err) {
+    if (strlen(key) >= b->opts_.key_maxlen) {
+        if (err) { *err = strdup("Key is too long"); }
+        return -EINVAL;
+    }
+    /* Each element is written as its key length, its key, then its data, so
+     * keys take no more room than they need. */
+    const uint32_t len = strlen(key);
+    if (fwrite(&len, sizeof(len), 1, b->nodes_) != 1
+            || fwrite(key, 1, len, b->nodes_) != len
+            || fwrite(data, 1, b->opts_.object_datalen, b->nodes_) != b->opts_.object_datalen) {
+        if (err) { *err = errno_message("Could not write temporary file."); }
+        return -EIO;
+    }
+    ++b->n_nodes_;
+    b->nodes_size_ += sizeof(len) + len + b->opts_.object_datalen;
+    b->heap_size_ += heap_record_size(len);
+    return 1;
+}
+
+int dht_builder_finish(HashTableBuilder* b, char** err) {
+    int ret = 0;
+    const size_t nodes_size = b->nodes_size_;
+    void* nodes = MAP_FAILED;
+    HashTable* ht = NULL;
+    char* temp_fname = generate_tempname_from(b->fname_);
+    if (!temp_fname) {
+        if (err) { *err = NULL; }
+        ret = -ENOMEM;
+        goto done;
+    }
+    if (fflush(b->nodes_) != 0) {
+        if (err) { *err = errno_message("Could not write temporary file."); }
+        ret = -EIO;
+        goto done;
+    }
+    if (nodes_size) {
+        nodes = mmap(NULL, nodes_size, PROT_READ, MAP_SHARED, fileno(b->nodes_), 0);
+        if (nodes == MAP_FAILED) {
+            if (err) { *err = errno_message("mmap() call failed."); }
+            ret = -EIO;
+            goto done;
+        }
+        madvise(nodes, nodes_size, MADV_SEQUENTIAL);
+    }
+
+    /* The table is created at its final size, so it is rarely grown, and nodes
+     * are copied into it in order. */
+    ht = create_table(temp_fname, b->opts_, b->n_nodes_, b->max_load_percent_, b->heap_size_, 0, err);
+    if (!ht) {
+        ret = -EIO;
+        goto done;
+    }
+    size_t i;
+    const char* node = (const char*)nodes;
+    for (i = 0; i < b->n_nodes_; ++i) {
+        uint32_t len;
+        memcpy(&len, node, sizeof(len));
+        const int icode = insert_len(ht, node + sizeof(len), len, node + sizeof(len) + len, err);
+        if (icode < 0) {
+            ret = icode;
+            goto done;
+        }
+        node += sizeof(len) + len + b->opts_.object_datalen;
+    }
+    dht_free(ht);
+    ht = NULL;
+    if (rename(temp_fname, b->fname_) < 0) {
+        if (err) { *err = errno_message("rename() call failed."); }
+        ret = -EIO;
+    }
+
+done:
+    if (ht) dht_free(ht);
+    if (ret < 0 && temp_fname) unlink(temp_fname);
+    if (nodes != MAP_FAILED) munmap(nodes, nodes_size);
+    free(temp_fname);
+    dht_builder_free(b);
+    return ret;
+}
+
+void dht_builder_free(HashTableBuilder* b) {
+    if (b->nodes_) {
+        fclose(b->nodes_);
+        unlink(b->nodes_fname_);
+    }
+    free(b->nodes_fname_);
+    free(b->fname_);
+    free(b);
+}
+
+uint64_t dht_hash_key(const char* key, size_t len, int version) {
+    if (version >= 12) return hash_key(key, len, HT_FLAG_HASH_3);
+    return hash_key(key, len, version == 11 ? HT_FLAG_HASH_2 : 0);
+}
+
+size_t dht_legacy_size(HashTableOpts opts, size_t cap, uint64_t* slots) {
+    const int flags = HT_FLAG_HASH_2;
+    const uint64_t n = table_size_for(cap, LEGACY_MAX_LOAD_PERCENT, flags);
+    const size_t sizeof_table_elem = is_64bit_size(n, flags) ? sizeof(uint64_t) : sizeof(uint32_t);
+    if (slots) *slots = n;
+    return header_size(flags) + n * sizeof_table_elem
+        + capacity_for(n, LEGACY_MAX_LOAD_PERCENT) * node_size_opts(opts, flags);
+}
@@ -1,6 +1,7 @@
 #ifndef DISKHASH_H_INCLUDE_GUARD__
 #define DISKHASH_H_INCLUDE_GUARD__
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -8,13 +9,34 @@ extern "C" {
 
 
 /**
+ * Tables are created in version 1.4, which hashes keys with wyhash and stores
+ * the length of each key next to it. If key_maxlen is 32 or more, they are
+ * created in version 1.5 instead, which stores keys in a heap at the end of
+ * the file, packed end to end, rather than padding each key to key_maxlen.
+ * Tables of long keys then take space in proportion to the total length of
+ * their keys, however long the longest one is. Tables created by
+ * dht_create_with_heap() also end in a heap, which holds blobs, and are of
+ * version 1.6 if their keys are short, which keeps keys in their nodes as
+ * version 1.4 does.
+ *
+ * In both versions, each slot of the hash table also holds a few bits of the
+ * hash of its key, so probes only read keys whose bits match.
+ * Slots are filled by Robin Hood linear probing, which keeps probes short
+ * enough that tables can be filled to a maximum load of up to 90% (80% by
+ * default) chosen when they are created. No key is ever more than 255 slots
+ * past its first probe.
+ *
+ * Tables of versions 1.0 and 1.1, which hash keys with djb2, of version 1.2,
+ * which has no such bits, and of version 1.3, which is filled by plain linear
+ * probing, can still be opened, read and written. They are at most half full.
+ *
  * key_maxlen is the maximum key length not including the terminator NUL, i.e.,
  * diskhash will check that for every key you insert `strlen(key) <
  * opts.key_maxlen`.
  *
  * Internally, space is allocated on 8-Byte aligned boundaries, so numbers such
- * as 7, 15, 23, 31, ... (i.e., multiples of 8 minus 1 for NUL) are good
- * choices for key_maxlen.
+ * as 7, 15 and 23 (i.e., multiples of 8 minus 1 for NUL) are good choices for
+ * short key_maxlen.
  *
  * object_datalen is the number of Bytes that your data elements occupy.
  */
@@ -31,6 +53,8 @@ typedef struct HashTable {
     int flags_;
 } HashTable;
 
+typedef struct HashTableBuilder HashTableBuilder;
+
 
 /** Zero-valued options
  */
@@ -74,6 +98,9 @@ HashTableOpts dht_zero_opts(void);
 HashTable* dht_open(const char* fpath, HashTableOpts opts, int flags, char**);
 
 /** Load table into memory
+ *
+ * Copies a read-only table out of its file into memory, which dht_free()
+ * releases.
  *
  * Return:
  *   0 : success
@@ -81,10 +108,54 @@ HashTable* dht_open(const char* fpath, HashTableOpts opts, int flags, char**);
  *   1 : impossible operation: nothing has been done. Attempting to load a
  *   previously loaded table or a read/write table is impossible.
  *
- *   2 : error: the HashTable has been freed and must not be used.
+ *   2 : error: the table could not be read or memory allocated. Nothing has
+ *   been done, and the table is still read from its file.
  */
 int dht_load_to_memory(HashTable*, char**);
 
+/** How much of an open table is kept in memory
+ *
+ * DHT_RESIDENCY_DEFAULT: pages are read from the file as lookups touch them,
+ * along with the pages around them that the kernel reads ahead (what dht_open
+ * does). Best for reading a table through.
+ *
+ * DHT_RESIDENCY_LAZY: as DHT_RESIDENCY_DEFAULT, without reading ahead, so a
+ * lookup reads only the pages it touches. Best for a few lookups.
+ *
+ * DHT_RESIDENCY_POPULATE: the whole file is read into the page cache and
+ * mapped now, so no lookup waits on the disk while it stays cached.
+ *
+ * DHT_RESIDENCY_LOCKED: as DHT_RESIDENCY_POPULATE, and the pages are locked
+ * in memory (mlock), so they are never evicted. This fails beyond the
+ * RLIMIT_MEMLOCK limit of the process.
+ *
+ * DHT_RESIDENCY_HUGEPAGES: the table is copied into memory, as by
+ * dht_load_to_memory, advised to be backed by transparent huge pages, so
+ * lookups spread over a large table miss the TLB less. Read-only tables only.
+ */
+typedef enum HashTableResidency {
+    DHT_RESIDENCY_DEFAULT = 0,
+    DHT_RESIDENCY_LAZY = 1,
+    DHT_RESIDENCY_POPULATE = 2,
+    DHT_RESIDENCY_LOCKED = 3,
+    DHT_RESIDENCY_HUGEPAGES = 4
+} HashTableResidency;
+
+/** Bring a table into memory as `residency` says, up front
+ *
+ * Meant to be called right after dht_open. The residency applies to the
+ * current mapping of the table: a writable table that grows is remapped
+ * lazily.
+ *
+ * Returns 0 on success; -EACCES for DHT_RESIDENCY_HUGEPAGES on a writable
+ * table, -EINVAL if the table is already loaded into memory, or a negative
+ * errno if memory could not be allocated, read or locked. The table is left
+ * usable (and mapped as by dht_open) on failure.
+ *
+ * The last argument is an error output argument, as for dht_open.
+ */
+int dht_set_residency(HashTable*, HashTableResidency, char**);
+
 /** Lookup a value by key
  *
  * If the hash table was opened in read-write mode, then the memory returned
@@ -100,6 +171,23 @@ int dht_load_to_memory(HashTable*, char**);
  */
 void* dht_lookup(const HashTable*, const char* key);
 
+/** Lookup a value by key of a given length
+ *
+ * As dht_lookup, but `key` is the first `len` bytes of the argument, which
+ * need not be NUL-terminated. This saves scanning keys whose length is
+ * already known.
+ */
+void* dht_lookup_len(const HashTable*, const char* key, size_t len);
+
+/** Lookup the values of many keys
+ *
+ * Sets results[i] to dht_lookup_len(ht, keys[i], lens[i]) for each i < n, in
+ * order. The keys are resolved a batch at a time, whose memory accesses are
+ * prefetched together, which is faster than looking them up one by one when
+ * the table is not in the CPU cache.
+ */
+void dht_lookup_many(const HashTable*, const char* const* keys, const size_t* lens, size_t n, void** results);
+
 /** Insert a value.
  *
  * The hashtable must be opened in read write mode.
@@ -155,11 +243,121 @@ int dht_insert(HashTable*, const char* key, const void* data, char** err);
  */
 size_t dht_reserve(HashTable*, size_t capacity, char** err);
 
+/** Create a hash table sized for a known number of elements
+ *
+ * Creates a new read-write table at fpath (which must not exist), as
+ * dht_open() with O_RDWR|O_CREAT|O_EXCL would, except that it is created at
+ * the capacity for `capacity` elements. Inserting that many elements almost
+ * never grows the table, which otherwise rewrites it to a new file each time
+ * it is full (see dht_reserve). Unused capacity takes no disk space until it
+ * is written, on file systems that support sparse files.
+ *
+ * The table is filled to at most max_load_percent of its slots, from 10 to
+ * 90, before it is grown. Passing 0 picks the default (80). Higher loads make
+ * smaller tables with longer probes.
+ *
+ * Values returned from dht_create must be freed with dht_free.
+ *
+ * The last argument is an error output argument, as for dht_open.
+ */
+HashTable* dht_create(const char* fpath, HashTableOpts opts, size_t capacity, size_t max_load_percent, char** err);
+
+/** Create a hash table with a heap for values of any length
+ *
+ * As dht_create, but the file of the table ends in a heap of bytes, to which
+ * dht_heap_append() adds blobs, so that the (fixed size) objects of the table
+ * can hold the offsets of values of any length, which are then read from the
+ * same mapped file as the table. The table is of version 1.6, or 1.5 (which
+ * keeps its keys in the same heap) if key_maxlen is 32 or more.
+ */
+HashTable* dht_create_with_heap(const char* fpath, HashTableOpts opts, size_t capacity, size_t max_load_percent, char** err);
+
+/** Append a blob to the heap of a table
+ *
+ * Copies `len` bytes of data (or zeros, if data is NULL) to the end of the
+ * heap, and sets *offset to where they start, for dht_heap_at(). Offsets stay
+ * valid for the life of the file, including across dht_reserve(), but the
+ * table may be remapped, which invalidates the pointers returned by earlier
+ * calls of dht_lookup() and dht_heap_at().
+ *
+ * Returns 0 on success; -EACCES for read-only tables, -EINVAL for tables
+ * without a heap, and -ENOMEM if the file could not be grown.
+ *
+ * The last argument is an error output argument, as for dht_open.
+ */
+int dht_heap_append(HashTable*, const void* data, size_t len, uint64_t* offset, char** err);
+
+/** Return a pointer to the heap at `offset`, or NULL if the table has no heap
+ * or the offset is past its end.
+ */
+void* dht_heap_at(const HashTable*, uint64_t offset);
+
+/** Return the number of bytes used in the heap of a table (0 if it has none)
+ */
+size_t dht_heap_size(const HashTable*);
+
+/** Bulk-load a hash table from a stream of elements
+ *
+ * When the number of elements is not known in advance, a builder writes them
+ * in one sequential pass to a temporary file next to fpath. Then,
+ * dht_builder_finish() creates the table at its final size and the given
+ * maximum load (see dht_create),
+ * copies the elements into it in the order they were added, and renames it
+ * to fpath, replacing any file there.
+ *
+ * Example:
+ *
+ *      char* err;
+ *      HashTableBuilder* b = dht_builder_open("hashtable.dht", opts, 0, &err);
+ *      dht_builder_add(b, "key", &value, &err);
+ *      dht_builder_finish(b, &err);
+ *
+ * As for dht_insert, if a key is added more than once, only its first element
+ * is kept.
+ *
+ * Values returned from dht_builder_open must be freed with dht_builder_free,
+ * unless they are passed to dht_builder_finish. The last argument of each
+ * function is an error output argument, as for dht_open.
+ */
+HashTableBuilder* dht_builder_open(const char* fpath, HashTableOpts opts, size_t max_load_percent, char** err);
+
+/** Add an element to a builder
+ *
+ * Returns 1 if the element was added.
+ *         -EINVAL : key is too long
+ *         -EIO : the temporary file could not be written.
+ */
+int dht_builder_add(HashTableBuilder*, const char* key, const void* data, char** err);
+
+/** Write the table of a builder, and free it
+ *
+ * The builder is freed whether or not this succeeds. On failure, no file is
+ * left at fpath that was not already there.
+ *
+ * Returns 0 on success, or a negative error code.
+ */
+int dht_builder_finish(HashTableBuilder*, char** err);
+
+/** Abandon a builder, removing its temporary file.
+ */
+void dht_builder_free(HashTableBuilder*);
+
 /**
  * Return the number of elements
  */
 size_t dht_size(const HashTable*);
 
+/** Lookup a value by insertion order
+ *
+ * Elements are numbered from 0 to dht_size() - 1 in the order they were
+ * inserted. If ix is in range, sets *key (if key is not NULL) to the key of
+ * element ix and returns a pointer to its data, as dht_lookup() would.
+ * Otherwise, returns NULL.
+ *
+ * Together with dht_size(), this iterates over all elements of a table.
+ */
+void* dht_indexed_lookup(const HashTable*, size_t ix, const char** key);
+
 /** Free the hashtable and sync to disk.
  */
 void dht_free(HashTable*);
@@ -167,6 +365,22 @@ void dht_free(HashTable*);
 /** For debug use only */
 void show_ht(const HashTable*);
 
+/** Hash a key as tables of the given version do (10 to 16 for versions 1.0 to
+ * 1.6). For benchmarks only.
+ */
+uint64_t dht_hash_key(const char* key, size_t len, int version);
+
+/** Return the size of a version 1.1 table reserved for `cap` elements, and set
+ * *slots (if slots is not NULL) to its number of slots, as dht_reserve() made
+ * it. For benchmarks only.
+ */
+size_t dht_legacy_size(HashTableOpts opts, size_t cap, uint64_t* slots);
+
+/** Return the number of slots dht_lookup_len() reads to find a key, or to find
+ * that it is absent. For benchmarks only.
+ */
+size_t dht_probe_length(const HashTable*, const char* key, size_t len);
+
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,326 @@
+#include "external_sort.hpp"
+
+#include <algorithm>   // std::max, std::stable_sort
+#include <cstdio>      // std::remove
+#include <filesystem>  // std::filesystem::path
+#include <numeric>     // std::iota
+
+using std::string;
+using std::string_view;
+
+/*************************************************/
+/*************************************************/
+/***                  Helpers                  ***/
+/*************************************************/
+/*************************************************/
+
+void write_run_string(std::ofstream &file, string_view s) {
+	size_t size = s.size();
+	file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+	file.write(s.data(), size);
+}
+
+bool read_run_string(std::ifstream &file, string &s) {
+	size_t size;
+	if (!file.read(reinterpret_cast<char *>(&size), sizeof(size))) {
+		return false;
+	}
+	s.resize(size);
+	return static_cast<bool>(file.read(s.data(), size));
+}
+
+/*************************************************/
+/*************************************************/
+/***            IndexVariantSorter             ***/
+/*************************************************/
+/*************************************************/
+
+IndexVariantSorter::IndexVariantSorter(
+    const string &dir_in,
+    size_t memory,
+    size_t n_threads_in)
+    : dir(dir_in),
+      n_threads(std::max<size_t>(n_threads_in, 1)),
+      n_runs_created(0),
+      merged(false) {
+	// One buffer fills while the others are sorted.
+	memory_per_buffer = std::max<size_t>(memory / (n_threads + 1), 1);
+}
+
+IndexVariantSorter::~IndexVariantSorter() {
+	// Destructors must not throw, so discard errors from unfinished runs.
+	for (auto &future : in_flight) {
+		try {
+			future.get();
+		} catch (...) {}
+	}
+	remove_runs(0, runs.size());
+}
+
+void IndexVariantSorter::append(const LDPairView &pair) {
+	if (merged) {
+		throw sort_error("append() Called After merge()");
+	}
+	buffer.ld_variant_ids.emplace_back(pair.ld_variant_id);
+	buffer.r2s.push_back(pair.r2);
+	buffer.bytes += sizeof(string) + pair.ld_variant_id.size() + sizeof(double);
+}
+
+void IndexVariantSorter::append(const IndexVariantSummary &summary) {
+	if (merged) {
+		throw sort_error("append() Called After merge()");
+	}
+
+	size_t n_pairs = buffer.ld_variant_ids.size();
+	if (summary.n_surrogates > n_pairs) {
+		throw sort_error("Missing Pairs for " + summary.variant_id);
+	}
+	buffer.fragments.push_back({ summary, n_pairs - summary.n_surrogates });
+	buffer.bytes += sizeof(Fragment) + summary.variant_id.size();
+
+	if (buffer.bytes >= memory_per_buffer) {
+		flush_buffer();
+	}
+}
+
+IndexVariantSorter::RunReader::RunReader(const string &path_in, size_t buffer_size)
+    : path(path_in), buffer(buffer_size), summary{ "", 0.0, 0 }, pairs_read(0) {
+	file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+	file.open(path, std::ios_base::binary | std::ios_base::in);
+	if (!file) {
+		throw sort_error("Failed to Open '" + path + "'");
+	}
+}
+
+bool IndexVariantSorter::RunReader::next_fragment() {
+	// Skip any unread pairs of the current fragment.
+	string ld_variant_id;
+	double r2;
+	while (next_pair(ld_variant_id, r2)) {}
+
+	if (!read_run_string(file, summary.variant_id)) {
+		if (!file.eof()) {
+			throw sort_error("Truncated Run '" + path + "'");
+		}
+		return false;
+	}
+	file.read(reinterpret_cast<char *>(&summary.maf), sizeof(summary.maf));
+	file.read(
+	    reinterpret_cast<char *>(&summary.n_surrogates),
+	    sizeof(summary.n_surrogates));
+	if (!file) {
+		throw sort_error("Truncated Run '" + path + "'");
+	}
+	pairs_read = 0;
+	return true;
+}
+
+bool IndexVariantSorter::RunReader::next_pair(string &ld_variant_id, double &r2) {
+	if (pairs_read == summary.n_surrogates) {
+		return false;
+	}
+	if (!read_run_string(file, ld_variant_id)
+	    || !file.read(reinterpret_cast<char *>(&r2), sizeof(r2))) {
+		throw sort_error("Truncated Run '" + path + "'");
+	}
+	pairs_read++;
+	return true;
+}
+
+const IndexVariantSummary &IndexVariantSorter::RunReader::get_summary() const {
+	return summary;
+}
+
+string IndexVariantSorter::new_run_path() {
+	string name = "setup_run_" + std::to_string(n_runs_created++) + ".sort";
+	return std::filesystem::path(dir) / name;
+}
+
+void IndexVariantSorter::flush_buffer() {
+	if (buffer.fragments.empty()) {
+		return;
+	}
+
+	// Leave room for one more run in flight.
+	wait_for_runs(n_threads - 1);
+
+	auto run = std::make_shared<RunBuffer>(std::move(buffer));
+	buffer = RunBuffer();
+	string path = new_run_path();
+	runs.push_back(path);
+	in_flight.push_back(std::async(std::launch::async, [this, run, path]() {
+		write_run(*run, path);
+	}));
+}
+
+void IndexVariantSorter::wait_for_runs(size_t max_in_flight) {
+	while (in_flight.size() > max_in_flight) {
+		std::future<void> future = std::move(in_flight.front());
+		in_flight.pop_front();
+		future.get();
+	}
+}
+
+void IndexVariantSorter::write_run(const RunBuffer &run, const string &path) const {
+	// Sort fragments by index variant ID, keeping input order among equals.
+	std::vector<size_t> order(run.fragments.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return run.fragments[a].summary.variant_id
+		    < run.fragments[b].summary.variant_id;
+	});
+
+	std::vector<char> file_buffer;
+	std::ofstream file;
+	open_for_writing(file, path, file_buffer);
+	for (size_t i : order) {
+		const Fragment &fragment = run.fragments[i];
+		write_fragment_header(file, fragment.summary);
+		size_t end = fragment.pairs_begin + fragment.summary.n_surrogates;
+		for (size_t j = fragment.pairs_begin; j < end; j++) {
+			write_pair(file, run.ld_variant_ids[j], run.r2s[j]);
+		}
+	}
+	file.close();
+}
+
+string IndexVariantSorter::merge_runs(size_t begin, size_t end) {
+	std::vector<std::shared_ptr<RunReader>> readers;
+	for (size_t i = begin; i < end; i++) {
+		readers.emplace_back(new RunReader(runs[i], BUFFER_SIZE));
+	}
+
+	std::vector<char> file_buffer;
+	std::ofstream file;
+	string path = new_run_path();
+	open_for_writing(file, path, file_buffer);
+
+	// Copy fragments in order without combining them; merge() combines
+	// them in the final pass.
+	using Entry = std::pair<string, size_t>;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+	for (size_t i = 0; i < readers.size(); i++) {
+		if (readers[i]->next_fragment()) {
+			queue.emplace(readers[i]->get_summary().variant_id, i);
+		}
+	}
+
+	string ld_variant_id;
+	double r2;
+	while (!queue.empty()) {
+		size_t i = queue.top().second;
+		queue.pop();
+
+		write_fragment_header(file, readers[i]->get_summary());
+		while (readers[i]->next_pair(ld_variant_id, r2)) {
+			write_pair(file, ld_variant_id, r2);
+		}
+
+		if (readers[i]->next_fragment()) {
+			queue.emplace(readers[i]->get_summary().variant_id, i);
+		}
+	}
+	file.close();
+
+	return path;
+}
+
+void IndexVariantSorter::remove_runs(size_t begin, size_t end) {
+	for (size_t i = begin; i < end; i++) {
+		std::remove(runs[i].c_str());
+	}
+}
+
+void IndexVariantSorter::open_for_writing(
+    std::ofstream &file,
+    const string &path,
+    std::vector<char> &file_buffer) const {
+	file_buffer.resize(BUFFER_SIZE);
+	file.rdbuf()->pubsetbuf(file_buffer.data(), file_buffer.size());
+	auto mask = std::ios_base::binary | std::ios_base::out | std::ios_base::trunc;
+	file.open(path, mask);
+	if (!file) {
+		throw sort_error("Failed to Create '" + path + "'");
+	}
+
+	// Streams should throw on failure to simplify error checking.
+	file.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+}
+
+void IndexVariantSorter::write_fragment_header(
+    std::ofstream &file,
+    const IndexVariantSummary &summary) {
+	write_run_string(file, summary.variant_id);
+	file.write(
+	    reinterpret_cast<const char *>(&summary.maf),
+	    sizeof(summary.maf));
+	file.write(
+	    reinterpret_cast<const char *>(&summary.n_surrogates),
+	    sizeof(summary.n_surrogates));
+}
+
+void IndexVariantSorter::write_pair(
+    std::ofstream &file,
+    string_view ld_variant_id,
+    double r2) {
+	write_run_string(file, ld_variant_id);
+	file.write(reinterpret_cast<const char *>(&r2), sizeof(r2));
+}
+
+/*************************************************/
+/*************************************************/
+/***            SymmetricPairWriter            ***/
+/*************************************************/
+/*************************************************/
+
+SymmetricPairWriter::SymmetricPairWriter(
+    IndexVariantSorter &sorter_in,
+    double r2_threshold_in)
+    : sorter(sorter_in),
+      r2_threshold(r2_threshold_in),
+      n_in_ld(0),
+      n_reversed(0) {}
+
+void SymmetricPairWriter::add(const LDPairView &pair) {
+	bool in_ld = pair.is_in_ld(r2_threshold);
+	if (in_ld) {
+		sorter.append(pair);
+		n_in_ld++;
+	}
+	if (pair.ld_variant_id == pair.index_variant_id) {
+		return;
+	}
+
+	// Views into the line may not outlive it, so copy the reversed pair.
+	// Entries are reused to avoid reallocating their strings.
+	if (n_reversed == reversed.size()) {
+		reversed.emplace_back();
+	}
+	ReversedPair &rev = reversed[n_reversed++];
+	rev.variant_id.assign(pair.ld_variant_id);
+	rev.ld_variant_id.assign(in_ld ? pair.index_variant_id : string_view());
+	rev.maf = pair.ld_variant_maf;
+	rev.r2 = pair.r2;
+	rev.in_ld = in_ld;
+}
+
+void SymmetricPairWriter::add(const IndexVariantSummary &summary) {
+	sorter.append({ summary.variant_id, summary.maf, n_in_ld });
+	n_in_ld = 0;
+
+	LDPairView pair;
+	for (size_t i = 0; i < n_reversed; i++) {
+		const ReversedPair &rev = reversed[i];
+		size_t n_surrogates = 0;
+		if (rev.in_ld) {
+			pair.index_variant_id = rev.variant_id;
+			pair.ld_variant_id = rev.ld_variant_id;
+			pair.index_variant_maf = rev.maf;
+			pair.r2 = rev.r2;
+			sorter.append(pair);
+			n_surrogates = 1;
+		}
+		sorter.append({ rev.variant_id, rev.maf, n_surrogates });
+	}
+	n_reversed = 0;
+}
@@ -0,0 +1,293 @@
+#ifndef _LDLOOKUP_EXTERNAL_SORT_HPP_
+#define _LDLOOKUP_EXTERNAL_SORT_HPP_
+
+#include <stddef.h>  // size_t
+
+#include <deque>      // std::deque
+#include <fstream>    // std::ifstream, std::ofstream
+#include <future>     // std::future
+#include <memory>     // std::shared_ptr
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parse_variants.hpp"
+
+/* Custom Exception for IndexVariantSorter */
+struct sort_error : std::runtime_error {
+	sort_error(const std::string &msg="")
+	    : std::runtime_error("Sort Error: " + msg) {}
+};
+
+/* Default number of bytes of parsed LD data held in memory while sorting. */
+const size_t DEFAULT_SORT_MEMORY = size_t(1) << 30;
+
+/**
+ * Bounded-memory external sort that groups LD data by index variant, for
+ * LD data that lists the pairs of an index variant in several places.
+ *
+ * Input arrives as fragments: the pairs in LD of one index variant, followed
+ * by their IndexVariantSummary, exactly as reported by iterate_ld_data().
+ * Fragments are buffered in memory. Each full buffer is sorted by index
+ * variant ID and written to a run file in 'dir' by its own task, while the
+ * next buffer fills. merge() then k-way merges the runs and combines the
+ * fragments of each index variant.
+ *
+ * Sorting is stable: the pairs of an index variant keep their input order,
+ * and its MAF is taken from its first fragment. Run files are removed as
+ * soon as they are merged, and when the IndexVariantSorter is destroyed.
+ */
+class IndexVariantSorter {
+   public:
+	/**
+	 * EFFECTS: Creates an empty sorter whose run files are stored in 'dir'.
+	 *          Up to 'memory' bytes of fragments are buffered, and up to
+	 *          'n_threads' buffers are sorted concurrently.
+	 */
+	IndexVariantSorter(
+	    const std::string &dir,
+	    size_t memory = DEFAULT_SORT_MEMORY,
+	    size_t n_threads = 1);
+
+	~IndexVariantSorter();
+
+	/**
+	 * EFFECTS: Records a pair in LD. Must be called before the summary of
+	 *          the pair's index variant is recorded.
+	 * THROWS: sort_error if merge() was called.
+	 */
+	void append(const LDPairView &pair);
+
+	/**
+	 * EFFECTS: Records the summary of an index variant, ending a fragment.
+	 * THROWS: sort_error if merge() was called or a run cannot be written.
+	 */
+	void append(const IndexVariantSummary &summary);
+
+	/**
+	 * EFFECTS: For each index variant in order of variant ID, calls
+	 *          on_ld_pair(pair) for each of its pairs in LD, then
+	 *          on_index_variant_summary(summary) with the combined summary
+	 *          of its fragments. If 'deduplicate', only the first pair with
+	 *          each LD variant is reported and counted. May be called only
+	 *          once.
+	 * THROWS: sort_error if a run cannot be read or written.
+	 */
+	template <typename F1, typename F2>
+	void merge(
+	    F1 on_ld_pair,
+	    F2 on_index_variant_summary,
+	    bool deduplicate = false);
+
+	IndexVariantSorter(const IndexVariantSorter&) = delete;
+	IndexVariantSorter& operator=(const IndexVariantSorter&) = delete;
+
+   private:
+	/* Maximum number of runs merged at once. */
+	const size_t MAX_MERGE_WIDTH = 64;
+	const size_t BUFFER_SIZE = 1 << 20;
+
+	/* Fragment held in memory. Its pairs are stored in the owning RunBuffer. */
+	struct Fragment {
+		IndexVariantSummary summary;
+		size_t pairs_begin;
+	};
+
+	/* Fragments waiting to be sorted and written as one run. */
+	struct RunBuffer {
+		std::vector<Fragment> fragments;
+		std::vector<std::string> ld_variant_ids;
+		std::vector<double> r2s;
+		size_t bytes = 0;
+	};
+
+	/* Reads a run file one fragment at a time. */
+	class RunReader {
+	   public:
+		RunReader(const std::string &path, size_t buffer_size);
+		bool next_fragment();
+		bool next_pair(std::string &ld_variant_id, double &r2);
+		const IndexVariantSummary &get_summary() const;
+
+	   private:
+		std::string path;
+		std::vector<char> buffer;
+		std::ifstream file;
+		IndexVariantSummary summary;
+		size_t pairs_read;
+	};
+
+	std::string dir;
+	size_t memory_per_buffer;
+	size_t n_threads;
+	size_t n_runs_created;
+	bool merged;
+
+	RunBuffer buffer;
+	std::deque<std::future<void>> in_flight;
+	std::vector<std::string> runs;
+
+	std::string new_run_path();
+	void flush_buffer();
+	void wait_for_runs(size_t max_in_flight);
+	void write_run(const RunBuffer &run, const std::string &path) const;
+	std::string merge_runs(size_t begin, size_t end);
+	void remove_runs(size_t begin, size_t end);
+	void open_for_writing(
+	    std::ofstream &file,
+	    const std::string &path,
+	    std::vector<char> &file_buffer) const;
+
+	static void write_fragment_header(
+	    std::ofstream &file,
+	    const IndexVariantSummary &summary);
+	static void write_pair(
+	    std::ofstream &file,
+	    std::string_view ld_variant_id,
+	    double r2);
+};
+
+/**
+ * Writes both directions of each pair in LD to an IndexVariantSorter, so
+ * that LD variants are indexed along with index variants.
+ *
+ * add() takes every parsed pair, in LD or not, as reported by
+ * iterate_ld_data() with an r2 threshold of 0, and applies 'r2_threshold'
+ * itself. When an index variant's summary arrives, its fragment is ended
+ * and one single-pair fragment per LD variant follows. LD variants whose
+ * pairs are not in LD get empty fragments, so they are summarized like
+ * index variants without surrogates. Pairs of a variant with itself are
+ * not reversed.
+ */
+class SymmetricPairWriter {
+   public:
+	SymmetricPairWriter(IndexVariantSorter &sorter, double r2_threshold);
+
+	/**
+	 * EFFECTS: Records 'pair' in the index variant's direction, and queues
+	 *          the reversed pair until the index variant's summary arrives.
+	 */
+	void add(const LDPairView &pair);
+
+	/**
+	 * EFFECTS: Records the summary of an index variant, counting only its
+	 *          pairs in LD, followed by its queued reversed pairs.
+	 */
+	void add(const IndexVariantSummary &summary);
+
+   private:
+	struct ReversedPair {
+		std::string variant_id;
+		std::string ld_variant_id;
+		double maf;
+		double r2;
+		bool in_ld;
+	};
+
+	IndexVariantSorter &sorter;
+	double r2_threshold;
+	size_t n_in_ld;
+	std::vector<ReversedPair> reversed;
+	size_t n_reversed;
+};
+
+/*************************************************/
+/*************************************************/
+/****         Template Implementation         ****/
+/*************************************************/
+/*************************************************/
+
+#include <algorithm>   // std::min
+#include <functional>  // std::greater
+#include <queue>       // std::priority_queue
+#include <unordered_set>
+#include <utility>     // std::pair
+
+template <typename F1, typename F2>
+inline void IndexVariantSorter::merge(
+    F1 on_ld_pair,
+    F2 on_index_variant_summary,
+    bool deduplicate) {
+	if (merged) {
+		throw sort_error("merge() Called Twice");
+	}
+	merged = true;
+	flush_buffer();
+	wait_for_runs(0);
+
+	// Merge in several passes if there are too many runs to open at once.
+	// Adjacent runs are merged so fragments stay in input order.
+	while (runs.size() > MAX_MERGE_WIDTH) {
+		std::vector<std::string> next_runs;
+		for (size_t begin = 0; begin < runs.size(); begin += MAX_MERGE_WIDTH) {
+			size_t end = std::min(begin + MAX_MERGE_WIDTH, runs.size());
+			next_runs.push_back(merge_runs(begin, end));
+			remove_runs(begin, end);
+		}
+		runs = next_runs;
+	}
+
+	std::vector<std::shared_ptr<RunReader>> readers;
+	for (const std::string &run : runs) {
+		readers.emplace_back(new RunReader(run, BUFFER_SIZE));
+	}
+
+	// Order readers by the ID of their current fragment, then by run, so
+	// fragments of the same index variant are visited in input order.
+	using Entry = std::pair<std::string, size_t>;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+	for (size_t i = 0; i < readers.size(); i++) {
+		if (readers[i]->next_fragment()) {
+			queue.emplace(readers[i]->get_summary().variant_id, i);
+		}
+	}
+
+	IndexVariantSummary combined{ "", 0.0, 0 };
+	bool found_variant = false;
+	std::unordered_set<std::string> seen_ld_variant_ids;
+	std::string ld_variant_id;
+	LDPairView pair;
+	while (!queue.empty()) {
+		size_t i = queue.top().second;
+		queue.pop();
+		const IndexVariantSummary &summary = readers[i]->get_summary();
+
+		// Report the previous index variant once all its fragments are read.
+		if (!found_variant || summary.variant_id != combined.variant_id) {
+			if (found_variant) {
+				on_index_variant_summary(combined);
+			}
+			found_variant = true;
+			combined.variant_id = summary.variant_id;
+			combined.maf = summary.maf;
+			combined.n_surrogates = 0;
+			seen_ld_variant_ids.clear();
+		}
+
+		pair.index_variant_id = combined.variant_id;
+		pair.index_variant_maf = combined.maf;
+		while (readers[i]->next_pair(ld_variant_id, pair.r2)) {
+			if (deduplicate && !seen_ld_variant_ids.insert(ld_variant_id).second) {
+				continue;
+			}
+			pair.ld_variant_id = ld_variant_id;
+			on_ld_pair(pair);
+			combined.n_surrogates++;
+		}
+
+		if (readers[i]->next_fragment()) {
+			queue.emplace(readers[i]->get_summary().variant_id, i);
+		}
+	}
+
+	if (found_variant) {
+		on_index_variant_summary(combined);
+	}
+
+	readers.clear();
+	remove_runs(0, runs.size());
+	runs.clear();
+}
+
+#endif
@@ -0,0 +1,442 @@
+#include "input_stream.hpp"
+
+#include <fcntl.h>   // open
+#include <stdint.h>  // uint32_t
+#include <unistd.h>  // read, close
+#include <zlib.h>    // z_stream, inflate, crc32
+
+#include <algorithm>  // std::min
+#include <cerrno>     // errno
+#include <cstring>    // std::memcpy, std::strerror
+
+#ifdef LDLOOKUP_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+using std::string;
+using std::string_view;
+
+/*************************************************/
+/*************************************************/
+/***                  Helpers                  ***/
+/*************************************************/
+/*************************************************/
+
+/* Size of the fixed part of a gzip header, up to and including XLEN. */
+const size_t GZIP_HEADER_SIZE = 12;
+
+/* Size of a gzip trailer (CRC32 and ISIZE). */
+const size_t GZIP_TRAILER_SIZE = 8;
+
+inline uint32_t read_le16(const char *p) {
+	const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+	return u[0] | (u[1] << 8);
+}
+
+inline uint32_t read_le32(const char *p) {
+	const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+	return u[0] | (u[1] << 8) | (u[2] << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+/* Reads exactly 'size' bytes, or returns false at the end of 'source'. */
+bool read_exactly(
+    FileInputStream &source,
+    char *buffer,
+    size_t size,
+    bool allow_eof) {
+	size_t total = 0;
+	while (total < size) {
+		size_t n = source.read(buffer + total, size - total);
+		if (n == 0) {
+			if (allow_eof && total == 0) {
+				return false;
+			}
+			throw input_stream_error(source.get_path(), "Truncated Compressed Data");
+		}
+		total += n;
+	}
+	return true;
+}
+
+/* Inflates a batch of complete BGZF blocks into one string. */
+string inflate_bgzf_batch(const std::vector<string> &blocks, const string &path) {
+	// The uncompressed size of each block is stored in its trailer.
+	size_t total = 0;
+	for (const string &block : blocks) {
+		total += read_le32(block.data() + block.size() - 4);
+	}
+	string inflated(total, '\0');
+
+	z_stream strm{};
+	if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+		throw input_stream_error(path, "Failed to Initialize zlib");
+	}
+
+	size_t out_pos = 0;
+	for (const string &block : blocks) {
+		size_t xlen = read_le16(block.data() + 10);
+		size_t cdata_size = block.size() - GZIP_HEADER_SIZE - xlen - GZIP_TRAILER_SIZE;
+		uint32_t crc = read_le32(block.data() + block.size() - 8);
+		uint32_t isize = read_le32(block.data() + block.size() - 4);
+
+		inflateReset(&strm);
+		strm.next_in = reinterpret_cast<Bytef *>(
+		    const_cast<char *>(block.data() + GZIP_HEADER_SIZE + xlen));
+		strm.avail_in = cdata_size;
+		strm.next_out = reinterpret_cast<Bytef *>(&inflated[out_pos]);
+		strm.avail_out = isize;
+		int ret = inflate(&strm, Z_FINISH);
+		bool ok = (ret == Z_STREAM_END && strm.avail_out == 0);
+		ok = ok && crc32(0L, strm.next_out - isize, isize) == crc;
+		if (!ok) {
+			inflateEnd(&strm);
+			throw input_stream_error(path, "Corrupt BGZF Block");
+		}
+		out_pos += isize;
+	}
+
+	inflateEnd(&strm);
+	return inflated;
+}
+
+/*************************************************/
+/*************************************************/
+/***              FileInputStream              ***/
+/*************************************************/
+/*************************************************/
+
+FileInputStream::FileInputStream(const string &path_in)
+    : path(path_in), peeked_read(0) {
+	fd = (path == "-") ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw input_stream_error(path, std::strerror(errno));
+	}
+}
+
+FileInputStream::~FileInputStream() {
+	if (fd != STDIN_FILENO) {
+		close(fd);
+	}
+}
+
+string_view FileInputStream::peek(size_t size) {
+	while (peeked.size() < size) {
+		char buffer[64];
+		size_t n = read_fd(buffer, std::min(sizeof(buffer), size - peeked.size()));
+		if (n == 0) {
+			break;
+		}
+		peeked.append(buffer, n);
+	}
+	return string_view(peeked).substr(0, size);
+}
+
+size_t FileInputStream::read(char *buffer, size_t size) {
+	// Replay peeked bytes first.
+	if (peeked_read < peeked.size()) {
+		size_t n = std::min(size, peeked.size() - peeked_read);
+		std::memcpy(buffer, peeked.data() + peeked_read, n);
+		peeked_read += n;
+		return n;
+	}
+	return read_fd(buffer, size);
+}
+
+const string &FileInputStream::get_path() const {
+	return path;
+}
+
+size_t FileInputStream::read_fd(char *buffer, size_t size) {
+	ssize_t n;
+	do {
+		n = ::read(fd, buffer, size);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0) {
+		throw input_stream_error(path, std::strerror(errno));
+	}
+	return static_cast<size_t>(n);
+}
+
+/*************************************************/
+/*************************************************/
+/***              GzipInputStream              ***/
+/*************************************************/
+/*************************************************/
+
+struct GzipInputStream::Inflater {
+	z_stream strm;
+	bool in_member;
+	bool in_padding;
+};
+
+GzipInputStream::GzipInputStream(std::unique_ptr<FileInputStream> source_in)
+    : source(std::move(source_in)),
+      compressed(BUFFER_SIZE),
+      inflater(new Inflater{}),
+      at_eof(false) {
+	// MAX_WBITS + 16 selects gzip (rather than zlib) headers.
+	if (inflateInit2(&inflater->strm, MAX_WBITS + 16) != Z_OK) {
+		throw input_stream_error(source->get_path(), "Failed to Initialize zlib");
+	}
+}
+
+GzipInputStream::~GzipInputStream() {
+	inflateEnd(&inflater->strm);
+}
+
+size_t GzipInputStream::read(char *buffer, size_t size) {
+	z_stream &strm = inflater->strm;
+	size = std::min<size_t>(size, 1 << 30);
+	strm.next_out = reinterpret_cast<Bytef *>(buffer);
+	strm.avail_out = size;
+
+	while (strm.avail_out == size && !at_eof) {
+		if (strm.avail_in == 0) {
+			size_t n = source->read(compressed.data(), compressed.size());
+			if (n == 0) {
+				if (inflater->in_member) {
+					throw input_stream_error(source->get_path(), "Truncated gzip Data");
+				}
+				at_eof = true;
+				break;
+			}
+			strm.next_in = reinterpret_cast<Bytef *>(compressed.data());
+			strm.avail_in = n;
+		}
+
+		// Some writers pad the last member with zeros up to a block size.
+		// Zeros where a member would begin end the data, if only zeros
+		// follow them.
+		if (!inflater->in_member && (inflater->in_padding || *strm.next_in == 0)) {
+			inflater->in_padding = true;
+			while (strm.avail_in && *strm.next_in == 0) {
+				strm.next_in++;
+				strm.avail_in--;
+			}
+			if (strm.avail_in) {
+				throw input_stream_error(source->get_path(), "Data After gzip Padding");
+			}
+			continue;
+		}
+
+		// Files may hold several gzip members back to back.
+		if (!inflater->in_member) {
+			inflateReset(&strm);
+			inflater->in_member = true;
+		}
+
+		int ret = inflate(&strm, Z_NO_FLUSH);
+		if (ret == Z_STREAM_END) {
+			inflater->in_member = false;
+		} else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			throw input_stream_error(source->get_path(), "Corrupt gzip Data");
+		}
+	}
+
+	return size - strm.avail_out;
+}
+
+/*************************************************/
+/*************************************************/
+/***              BgzfInputStream              ***/
+/*************************************************/
+/*************************************************/
+
+BgzfInputStream::BgzfInputStream(
+    std::unique_ptr<FileInputStream> source_in,
+    size_t n_threads_in)
+    : source(std::move(source_in)),
+      n_threads(std::max<size_t>(n_threads_in, 1)),
+      source_at_eof(false),
+      batch_read(0) {}
+
+BgzfInputStream::~BgzfInputStream() {
+	// Let in-flight tasks finish before their inputs are destroyed.
+	for (auto &future : in_flight) {
+		future.wait();
+	}
+}
+
+size_t BgzfInputStream::read(char *buffer, size_t size) {
+	while (batch_read == batch.size()) {
+		launch_batches();
+		if (in_flight.empty()) {
+			return 0;
+		}
+		batch = in_flight.front().get();
+		batch_read = 0;
+		in_flight.pop_front();
+	}
+
+	size_t n = std::min(size, batch.size() - batch_read);
+	std::memcpy(buffer, batch.data() + batch_read, n);
+	batch_read += n;
+	return n;
+}
+
+bool BgzfInputStream::read_block(string &block) {
+	char header[GZIP_HEADER_SIZE];
+	if (!read_exactly(*source, header, GZIP_HEADER_SIZE, true)) {
+		return false;
+	}
+	size_t xlen = read_le16(header + 10);
+	if (static_cast<unsigned char>(header[0]) != 0x1f
+	    || static_cast<unsigned char>(header[1]) != 0x8b
+	    || !(header[3] & 0x04)) {
+		throw input_stream_error(source->get_path(), "Corrupt BGZF Header");
+	}
+
+	// Find BSIZE (the block size minus 1) in the BC extra subfield.
+	string extra(xlen, '\0');
+	read_exactly(*source, extra.data(), xlen, false);
+	size_t block_size = 0;
+	for (size_t i = 0; i + 4 <= xlen;) {
+		size_t slen = read_le16(&extra[i + 2]);
+		if (extra[i] == 'B' && extra[i + 1] == 'C' && slen == 2 && i + 6 <= xlen) {
+			block_size = read_le16(&extra[i + 4]) + 1;
+		}
+		i += 4 + slen;
+	}
+	if (block_size < GZIP_HEADER_SIZE + xlen + GZIP_TRAILER_SIZE) {
+		throw input_stream_error(source->get_path(), "Corrupt BGZF Header");
+	}
+
+	block.resize(block_size);
+	std::memcpy(block.data(), header, GZIP_HEADER_SIZE);
+	std::memcpy(block.data() + GZIP_HEADER_SIZE, extra.data(), xlen);
+	size_t rest = block_size - GZIP_HEADER_SIZE - xlen;
+	read_exactly(*source, block.data() + GZIP_HEADER_SIZE + xlen, rest, false);
+	return true;
+}
+
+void BgzfInputStream::launch_batches() {
+	while (!source_at_eof && in_flight.size() < n_threads) {
+		std::vector<string> blocks;
+		string block;
+		while (blocks.size() < BLOCKS_PER_BATCH) {
+			if (!read_block(block)) {
+				source_at_eof = true;
+				break;
+			}
+			blocks.push_back(std::move(block));
+		}
+
+		if (blocks.empty()) {
+			break;
+		}
+		in_flight.push_back(std::async(
+		    std::launch::async,
+		    inflate_bgzf_batch,
+		    std::move(blocks),
+		    source->get_path()));
+	}
+}
+
+/*************************************************/
+/*************************************************/
+/***              ZstdInputStream              ***/
+/*************************************************/
+/*************************************************/
+
+#ifdef LDLOOKUP_WITH_ZSTD
+ZstdInputStream::ZstdInputStream(std::unique_ptr<FileInputStream> source_in)
+    : source(std::move(source_in)),
+      compressed(ZSTD_DStreamInSize()),
+      compressed_pos(0),
+      compressed_size(0),
+      dstream(ZSTD_createDStream()),
+      in_frame(false),
+      at_eof(false) {
+	if (!dstream) {
+		throw input_stream_error(source->get_path(), "Failed to Initialize zstd");
+	}
+}
+
+ZstdInputStream::~ZstdInputStream() {
+	ZSTD_freeDStream(static_cast<ZSTD_DStream *>(dstream));
+}
+
+size_t ZstdInputStream::read(char *buffer, size_t size) {
+	ZSTD_outBuffer out = { buffer, size, 0 };
+	while (out.pos == 0 && !at_eof) {
+		if (compressed_pos == compressed_size) {
+			compressed_size = source->read(compressed.data(), compressed.size());
+			compressed_pos = 0;
+			if (compressed_size == 0) {
+				if (in_frame) {
+					throw input_stream_error(source->get_path(), "Truncated zstd Data");
+				}
+				at_eof = true;
+				break;
+			}
+		}
+
+		ZSTD_inBuffer in = { compressed.data(), compressed_size, compressed_pos };
+		size_t ret = ZSTD_decompressStream(
+		    static_cast<ZSTD_DStream *>(dstream), &out, &in);
+		compressed_pos = in.pos;
+		if (ZSTD_isError(ret)) {
+			throw input_stream_error(
+			    source->get_path(),
+			    string("Corrupt zstd Data: ") + ZSTD_getErrorName(ret));
+		}
+
+		// A return of 0 marks the end of a frame.
+		in_frame = (ret != 0);
+	}
+	return out.pos;
+}
+#endif
+
+/*************************************************/
+/*************************************************/
+/***                 Factories                 ***/
+/*************************************************/
+/*************************************************/
+
+Compression detect_compression(string_view magic) {
+	auto byte = [&](size_t i) {
+		return static_cast<unsigned char>(magic[i]);
+	};
+
+	if (magic.size() >= 4 && byte(0) == 0x28 && byte(1) == 0xb5
+	    && byte(2) == 0x2f && byte(3) == 0xfd) {
+		return Compression::Zstd;
+	}
+
+	if (magic.size() < 2 || byte(0) != 0x1f || byte(1) != 0x8b) {
+		return Compression::None;
+	}
+
+	// BGZF blocks are gzip members whose first extra subfield is 'BC'.
+	if (magic.size() >= 18 && (byte(3) & 0x04) && read_le16(&magic[10]) >= 6
+	    && magic[12] == 'B' && magic[13] == 'C') {
+		return Compression::Bgzf;
+	}
+	return Compression::Gzip;
+}
+
+std::unique_ptr<InputStream> open_input_stream(
+    const string &path,
+    size_t n_threads) {
+	std::unique_ptr<FileInputStream> file(new FileInputStream(path));
+	switch (detect_compression(file->peek(18))) {
+		case Compression::Gzip:
+			return std::unique_ptr<InputStream>(
+			    new GzipInputStream(std::move(file)));
+		case Compression::Bgzf:
+			return std::unique_ptr<InputStream>(
+			    new BgzfInputStream(std::move(file), n_threads));
+		case Compression::Zstd:
+#ifdef LDLOOKUP_WITH_ZSTD
+			return std::unique_ptr<InputStream>(
+			    new ZstdInputStream(std::move(file)));
+#else
+			throw input_stream_error(
+			    path, "zstd Input Requires Building With 'make ZSTD=1'");
+#endif
+		default:
+			return file;
+	}
+}
@@ -0,0 +1,160 @@
+#ifndef _LDLOOKUP_INPUT_STREAM_HPP_
+#define _LDLOOKUP_INPUT_STREAM_HPP_
+
+#include <stddef.h>  // size_t
+
+#include <deque>      // std::deque
+#include <future>     // std::future
+#include <memory>     // std::unique_ptr
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Custom Exception for InputStreams */
+struct input_stream_error : std::runtime_error {
+	input_stream_error(const std::string &path, const std::string &msg)
+	    : std::runtime_error(
+	          "Input Error\nFile Path: " + path + "\nInfo: " + msg) {}
+};
+
+/* Compression formats recognized by open_input_stream(). */
+enum class Compression { None, Gzip, Bgzf, Zstd };
+
+/* Sequential source of bytes. */
+class InputStream {
+   public:
+	virtual ~InputStream() = default;
+
+	/**
+	 * EFFECTS: Reads up to 'size' bytes into 'buffer' and returns the number
+	 *          of bytes read. Returns 0 only at the end of the stream.
+	 * THROWS: input_stream_error on read or decompression failure.
+	 */
+	virtual size_t read(char *buffer, size_t size) = 0;
+};
+
+/**
+ * Reads a file descriptor. Bytes consumed while detecting the compression
+ * format are replayed before the rest of the file.
+ */
+class FileInputStream : public InputStream {
+   public:
+	/**
+	 * EFFECTS: Opens 'path' for reading. "-" denotes standard input.
+	 * THROWS: input_stream_error if 'path' cannot be opened.
+	 */
+	FileInputStream(const std::string &path);
+
+	~FileInputStream();
+
+	/**
+	 * EFFECTS: Returns up to 'size' bytes from the start of the stream
+	 *          without consuming them.
+	 */
+	std::string_view peek(size_t size);
+
+	size_t read(char *buffer, size_t size) override;
+
+	const std::string &get_path() const;
+
+	FileInputStream(const FileInputStream&) = delete;
+	FileInputStream& operator=(const FileInputStream&) = delete;
+
+   private:
+	std::string path;
+	int fd;
+	std::string peeked;
+	size_t peeked_read;
+
+	size_t read_fd(char *buffer, size_t size);
+};
+
+/*
+ * Decompresses gzip data, including files of several gzip members and files
+ * padded with zeros after their last member.
+ */
+class GzipInputStream : public InputStream {
+   public:
+	GzipInputStream(std::unique_ptr<FileInputStream> source);
+	~GzipInputStream();
+
+	size_t read(char *buffer, size_t size) override;
+
+   private:
+	const size_t BUFFER_SIZE = 1 << 20;
+
+	std::unique_ptr<FileInputStream> source;
+	std::vector<char> compressed;
+	struct Inflater;
+	std::unique_ptr<Inflater> inflater;
+	bool at_eof;
+};
+
+/**
+ * Decompresses BGZF data (as written by bgzip) on several threads.
+ *
+ * BGZF files are series of independent gzip blocks of at most 64 KiB. Blocks
+ * are read in batches, each batch is inflated by its own task, and up to
+ * 'n_threads' batches are inflated ahead of the reader.
+ */
+class BgzfInputStream : public InputStream {
+   public:
+	BgzfInputStream(std::unique_ptr<FileInputStream> source, size_t n_threads);
+	~BgzfInputStream();
+
+	size_t read(char *buffer, size_t size) override;
+
+   private:
+	const size_t BLOCKS_PER_BATCH = 256;
+
+	std::unique_ptr<FileInputStream> source;
+	size_t n_threads;
+	bool source_at_eof;
+	std::deque<std::future<std::string>> in_flight;
+	std::string batch;
+	size_t batch_read;
+
+	bool read_block(std::string &block);
+	void launch_batches();
+};
+
+#ifdef LDLOOKUP_WITH_ZSTD
+/* Decompresses zstd data, including files of several zstd frames. */
+class ZstdInputStream : public InputStream {
+   public:
+	ZstdInputStream(std::unique_ptr<FileInputStream> source);
+	~ZstdInputStream();
+
+	size_t read(char *buffer, size_t size) override;
+
+   private:
+	std::unique_ptr<FileInputStream> source;
+	std::vector<char> compressed;
+	size_t compressed_pos;
+	size_t compressed_size;
+	void *dstream;
+	bool in_frame;
+	bool at_eof;
+};
+#endif
+
+/**
+ * EFFECTS: Returns the compression format of the file that starts with
+ *          'magic', judging by its first 18 bytes.
+ */
+Compression detect_compression(std::string_view magic);
+
+/**
+ * EFFECTS: Opens 'path' ("-" for standard input) and returns a stream of
+ *          its decompressed contents. The compression format is detected
+ *          from the data, not from the file extension. BGZF data is
+ *          decompressed on 'n_threads' threads.
+ * THROWS: input_stream_error if 'path' cannot be opened, or is zstd data
+ *         and ldLookup was built without zstd support.
+ */
+std::unique_ptr<InputStream> open_input_stream(
+    const std::string &path,
+    size_t n_threads = 1);
+
+#endif
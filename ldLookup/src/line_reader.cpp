@@ -0,0 +1,137 @@
+#include "line_reader.hpp"
+
+#include <cstring>  // std::memchr, std::memmove
+
+using std::string;
+using std::string_view;
+
+LineReader::LineReader(const string &path_in, size_t n_threads)
+    : path(path_in),
+      buffer_begin(0),
+      buffer_end(0),
+      at_eof(false),
+      peeked(false) {
+	if (path != "-" && MappedFile::is_mappable(path)) {
+		mapped.reset(new MappedFile(path));
+		if (detect_compression(mapped->view().substr(0, 18)) == Compression::None) {
+			mapped->advise_sequential();
+			unread = mapped->view();
+			return;
+		}
+		mapped.reset();
+	}
+
+	stream = open_input_stream(path, n_threads);
+	buffer.resize(BUFFER_SIZE);
+}
+
+bool LineReader::next(string_view &line) {
+	if (peeked) {
+		peeked = false;
+		line = peeked_line;
+		return true;
+	}
+	return mapped ? next_mapped(line) : next_buffered(line);
+}
+
+bool LineReader::peek(string_view &line) {
+	if (!peeked) {
+		if (!(mapped ? next_mapped(peeked_line) : next_buffered(peeked_line))) {
+			return false;
+		}
+		peeked = true;
+	}
+	line = peeked_line;
+	return true;
+}
+
+void LineReader::skip_remaining() {
+	string_view line;
+	peeked = false;
+	if (mapped) {
+		unread = string_view();
+	} else {
+		while (next_buffered(line)) {}
+	}
+}
+
+bool LineReader::is_mapped() const {
+	return mapped != nullptr;
+}
+
+string_view LineReader::remaining() const {
+	if (peeked) {
+		// peeked_line points into the mapping, directly before 'unread'.
+		size_t size = unread.data() + unread.size() - peeked_line.data();
+		return string_view(peeked_line.data(), size);
+	}
+	return unread;
+}
+
+bool LineReader::next_mapped(string_view &line) {
+	if (unread.empty()) {
+		return false;
+	}
+
+	size_t end = unread.find('\n');
+	if (end == string_view::npos) {
+		line = unread;
+		unread = string_view();
+	} else {
+		line = unread.substr(0, end);
+		unread.remove_prefix(end + 1);
+	}
+	return true;
+}
+
+bool LineReader::next_buffered(string_view &line) {
+	size_t scanned = buffer_begin;
+	while (true) {
+		// Look for the end of the line in the buffered bytes.
+		const char *start = buffer.data() + scanned;
+		const void *newline = std::memchr(start, '\n', buffer_end - scanned);
+		if (newline) {
+			size_t end = static_cast<const char *>(newline) - buffer.data();
+			line = string_view(buffer.data() + buffer_begin, end - buffer_begin);
+			buffer_begin = end + 1;
+			return true;
+		}
+
+		if (at_eof) {
+			// Return a final line that lacks a trailing newline.
+			if (buffer_begin == buffer_end) {
+				return false;
+			}
+			line = string_view(
+			    buffer.data() + buffer_begin,
+			    buffer_end - buffer_begin);
+			buffer_begin = buffer_end;
+			return true;
+		}
+
+		size_t scanned_from_begin = buffer_end - buffer_begin;
+		fill_buffer();
+		scanned = buffer_begin + scanned_from_begin;
+	}
+}
+
+bool LineReader::fill_buffer() {
+	// Move the partial line to the front of the buffer, growing the buffer
+	// if the partial line already fills it.
+	size_t partial = buffer_end - buffer_begin;
+	std::memmove(buffer.data(), buffer.data() + buffer_begin, partial);
+	buffer_begin = 0;
+	buffer_end = partial;
+	if (buffer_end == buffer.size()) {
+		buffer.resize(buffer.size() * 2);
+	}
+
+	size_t n_read = stream->read(
+	    buffer.data() + buffer_end,
+	    buffer.size() - buffer_end);
+	if (n_read == 0) {
+		at_eof = true;
+	}
+	buffer_end += n_read;
+	return n_read > 0;
+}
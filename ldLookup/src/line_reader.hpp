@@ -0,0 +1,92 @@
+#ifndef _LDLOOKUP_LINE_READER_HPP_
+#define _LDLOOKUP_LINE_READER_HPP_
+
+#include <stddef.h>  // size_t
+
+#include <memory>  // std::unique_ptr
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "input_stream.hpp"
+#include "mapped_file.hpp"
+
+/**
+ * Reads newline-separated lines from a file without copying them.
+ *
+ * Uncompressed regular files are memory-mapped, and lines are views into
+ * the mapping that stay valid for the lifetime of the LineReader. Pipes,
+ * FIFOs, standard input (path "-"), and gzip, BGZF, or zstd compressed data
+ * are read through a buffer instead, and lines are only valid until the
+ * next call to next().
+ *
+ * As with std::getline, lines exclude their trailing '\n', and a final
+ * line without a trailing '\n' is still returned.
+ */
+class LineReader {
+   public:
+	/**
+	 * EFFECTS: Opens 'path' for reading. "-" denotes standard input.
+	 *          Compressed data is detected and decompressed, using
+	 *          'n_threads' threads for BGZF data.
+	 * THROWS: input_stream_error if 'path' cannot be opened.
+	 */
+	LineReader(const std::string &path, size_t n_threads = 1);
+
+	/**
+	 * EFFECTS: Sets 'line' to the next line and returns true, or returns
+	 *          false if there are no more lines.
+	 * THROWS: input_stream_error on read or decompression failure.
+	 */
+	bool next(std::string_view &line);
+
+	/**
+	 * EFFECTS: Like next(), but the line is returned again by the
+	 *          following call to next().
+	 */
+	bool peek(std::string_view &line);
+
+	/**
+	 * EFFECTS: Discards all unread lines.
+	 */
+	void skip_remaining();
+
+	/**
+	 * EFFECTS: Returns whether lines are read from a memory map.
+	 */
+	bool is_mapped() const;
+
+	/**
+	 * EFFECTS: Returns the unread bytes of a mapped file.
+	 * REQUIRES: is_mapped()
+	 */
+	std::string_view remaining() const;
+
+	LineReader(const LineReader&) = delete;
+	LineReader& operator=(const LineReader&) = delete;
+
+   private:
+	const size_t BUFFER_SIZE = 1 << 20;
+
+	std::string path;
+
+	/* Set for mapped files. */
+	std::unique_ptr<MappedFile> mapped;
+	std::string_view unread;
+
+	/* Set for everything else. */
+	std::unique_ptr<InputStream> stream;
+	std::vector<char> buffer;
+	size_t buffer_begin;
+	size_t buffer_end;
+	bool at_eof;
+
+	bool peeked;
+	std::string_view peeked_line;
+
+	bool next_mapped(std::string_view &line);
+	bool next_buffered(std::string_view &line);
+	bool fill_buffer();
+};
+
+#endif
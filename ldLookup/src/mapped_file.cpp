@@ -0,0 +1,89 @@
+#include "mapped_file.hpp"
+
+#include <fcntl.h>     // open
+#include <sys/mman.h>  // mmap, munmap, madvise, mlock
+#include <sys/stat.h>  // fstat, stat
+#include <unistd.h>    // close, sysconf
+
+#include <cerrno>   // errno
+#include <cstring>  // std::strerror
+
+using std::string;
+
+MappedFile::MappedFile(const string &path) : data(nullptr), size(0) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw mapped_file_error(path, std::strerror(errno));
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		throw mapped_file_error(path, "Not a Regular File");
+	}
+
+	// mmap() rejects empty mappings, so empty files are left unmapped.
+	size = static_cast<size_t>(st.st_size);
+	if (size) {
+		void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED) {
+			int mmap_errno = errno;
+			close(fd);
+			throw mapped_file_error(path, std::strerror(mmap_errno));
+		}
+		data = static_cast<const char *>(mapped);
+	}
+
+	// The mapping stays valid after the descriptor is closed.
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (data) {
+		munmap(const_cast<char *>(data), size);
+	}
+}
+
+std::string_view MappedFile::view() const {
+	return std::string_view(data, size);
+}
+
+void MappedFile::advise_sequential() const {
+	if (data) {
+		madvise(const_cast<char *>(data), size, MADV_SEQUENTIAL);
+	}
+}
+
+void MappedFile::advise_random() const {
+	if (data) {
+		madvise(const_cast<char *>(data), size, MADV_RANDOM);
+	}
+}
+
+void MappedFile::populate() const {
+	if (!data) {
+		return;
+	}
+#ifdef MADV_POPULATE_READ
+	if (madvise(const_cast<char *>(data), size, MADV_POPULATE_READ) == 0) {
+		return;
+	}
+#endif
+	// Older kernels read ahead on the hint, and each page is then faulted in
+	// by reading it.
+	madvise(const_cast<char *>(data), size, MADV_WILLNEED);
+	size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const volatile char *pages = data;
+	for (size_t i = 0; i < size; i += page_size) {
+		(void)pages[i];
+	}
+}
+
+bool MappedFile::lock() const {
+	return !data || mlock(data, size) == 0;
+}
+
+bool MappedFile::is_mappable(const string &path) {
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
@@ -0,0 +1,72 @@
+#ifndef _LDLOOKUP_MAPPED_FILE_HPP_
+#define _LDLOOKUP_MAPPED_FILE_HPP_
+
+#include <stddef.h>  // size_t
+
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <string_view>
+
+/* Custom Exception for MappedFile */
+struct mapped_file_error : std::runtime_error {
+	mapped_file_error(const std::string &path, const std::string &msg)
+	    : std::runtime_error(
+	          "MappedFile Error\nFile Path: " + path + "\nInfo: " + msg) {}
+};
+
+/* Read-only memory map of an entire file. */
+class MappedFile {
+   public:
+	/**
+	 * EFFECTS: Maps the file at 'path' into memory.
+	 * THROWS: mapped_file_error if the file cannot be opened or mapped.
+	 */
+	MappedFile(const std::string &path);
+
+	~MappedFile();
+
+	/**
+	 * EFFECTS: Returns the mapped bytes. Empty files map to an empty view.
+	 */
+	std::string_view view() const;
+
+	/**
+	 * EFFECTS: Hints that the mapping will be read once, front to back, so
+	 *          the kernel can read ahead aggressively.
+	 */
+	void advise_sequential() const;
+
+	/**
+	 * EFFECTS: Hints that the mapping will be read at random, so the kernel
+	 *          reads only the pages that are touched, without reading ahead.
+	 */
+	void advise_random() const;
+
+	/**
+	 * EFFECTS: Reads the whole file into memory now, so later reads of the
+	 *          mapping do not wait on the disk while it stays cached.
+	 */
+	void populate() const;
+
+	/**
+	 * EFFECTS: Reads the whole file into memory and locks it there, so it
+	 *          is never evicted. Returns whether it could be locked, which
+	 *          fails beyond the limit of locked memory (see ulimit -l).
+	 */
+	bool lock() const;
+
+	/**
+	 * EFFECTS: Returns whether 'path' is a regular file, which can be
+	 *          mapped. Pipes, sockets, and terminals cannot.
+	 */
+	static bool is_mappable(const std::string &path);
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+   private:
+	const char *data;
+	size_t size;
+};
+
+#endif
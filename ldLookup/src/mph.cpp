@@ -0,0 +1,174 @@
+#include "mph.hpp"
+
+#include <algorithm>  // std::max
+#include <cmath>      // std::ceil
+
+#include "string_ops.hpp"
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+/* The 64-bit finalizer of MurmurHash3. */
+inline uint64_t mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+inline bool test_bit(const vector<uint64_t> &bits, uint64_t bit) {
+	return (bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+inline void set_bit(vector<uint64_t> &bits, uint64_t bit) {
+	bits[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+uint64_t hash_key(string_view key, uint64_t seed) {
+	uint64_t hash = mix(seed ^ (key.size() * 0x9e3779b97f4a7c15ULL));
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= key.size(); i += sizeof(uint64_t)) {
+		hash = mix(hash ^ read_uint64(&key[i]));
+	}
+
+	// Read the last, partial word little-endian, like the others.
+	uint64_t tail = 0;
+	for (size_t shift = 0; i < key.size(); i++, shift += 8) {
+		tail |= static_cast<uint64_t>(static_cast<unsigned char>(key[i])) << shift;
+	}
+	return mix(hash ^ tail);
+}
+
+MinimalPerfectHash::MinimalPerfectHash(const vector<string_view> &keys) {
+	vector<string_view> remaining(keys);
+	vector<string_view> next;
+	vector<uint64_t> level_sizes;
+	vector<uint64_t> all_words;
+	while (!remaining.empty()) {
+		// Keys that collide at every level are almost certainly repeated.
+		if (level_sizes.size() == MAX_LEVELS) {
+			throw mph_error("Keys Are Not Distinct");
+		}
+		uint64_t seed = level_sizes.size();
+		uint64_t n_bits = std::max<uint64_t>(
+		    WORD_BITS,
+		    std::ceil(GAMMA * remaining.size()));
+		n_bits = (n_bits + WORD_BITS - 1) / WORD_BITS * WORD_BITS;
+
+		vector<uint64_t> hit(n_bits / WORD_BITS);
+		vector<uint64_t> collided(n_bits / WORD_BITS);
+		for (string_view key : remaining) {
+			uint64_t bit = hash_key(key, seed) % n_bits;
+			if (test_bit(hit, bit)) {
+				set_bit(collided, bit);
+			}
+			set_bit(hit, bit);
+		}
+		for (size_t i = 0; i < hit.size(); i++) {
+			hit[i] &= ~collided[i];
+		}
+
+		next.clear();
+		for (string_view key : remaining) {
+			if (!test_bit(hit, hash_key(key, seed) % n_bits)) {
+				next.push_back(key);
+			}
+		}
+		remaining.swap(next);
+		level_sizes.push_back(n_bits);
+		all_words.insert(all_words.end(), hit.begin(), hit.end());
+	}
+
+	append_uint64(built, keys.size());
+	append_uint64(built, level_sizes.size());
+	for (uint64_t n_bits : level_sizes) {
+		append_uint64(built, n_bits);
+	}
+	for (uint64_t word : all_words) {
+		append_uint64(built, word);
+	}
+
+	// Each rank counts the set bits before its block.
+	size_t words_per_block = RANK_BLOCK_BITS / WORD_BITS;
+	uint32_t n_set = 0;
+	for (size_t i = 0; i < all_words.size(); i++) {
+		if (i % words_per_block == 0) {
+			append_uint32(built, n_set);
+		}
+		n_set += __builtin_popcountll(all_words[i]);
+	}
+	parse(built);
+}
+
+MinimalPerfectHash::MinimalPerfectHash(string_view serialized) {
+	parse(serialized);
+}
+
+size_t MinimalPerfectHash::lookup(string_view key) const {
+	for (size_t level = 0; level + 1 < level_starts.size(); level++) {
+		uint64_t n_bits = level_starts[level + 1] - level_starts[level];
+		uint64_t bit = level_starts[level] + hash_key(key, level) % n_bits;
+		uint64_t word = read_uint64(&words[bit / WORD_BITS * sizeof(uint64_t)]);
+		if ((word >> (bit % WORD_BITS)) & 1) {
+			return rank(bit, word);
+		}
+	}
+	return NOT_FOUND;
+}
+
+size_t MinimalPerfectHash::size() const {
+	return n_keys;
+}
+
+string_view MinimalPerfectHash::serialized() const {
+	return data;
+}
+
+void MinimalPerfectHash::parse(string_view serialized) {
+	size_t pos = 2 * sizeof(uint64_t);
+	if (serialized.size() < pos) {
+		throw mph_error("Truncated Header");
+	}
+	n_keys = read_uint64(&serialized[0]);
+	uint64_t n_levels = read_uint64(&serialized[sizeof(uint64_t)]);
+	if (n_levels > MAX_LEVELS
+	    || serialized.size() - pos < n_levels * sizeof(uint64_t)) {
+		throw mph_error("Truncated Header");
+	}
+
+	level_starts.assign(1, 0);
+	for (uint64_t level = 0; level < n_levels; level++) {
+		uint64_t n_bits = read_uint64(&serialized[pos]);
+		pos += sizeof(uint64_t);
+		if (n_bits == 0 || n_bits % WORD_BITS
+		    || n_bits > SIZE_MAX / 2 - level_starts.back()) {
+			throw mph_error("Corrupted Level");
+		}
+		level_starts.push_back(level_starts.back() + n_bits);
+	}
+
+	size_t n_words = level_starts.back() / WORD_BITS;
+	size_t words_per_block = RANK_BLOCK_BITS / WORD_BITS;
+	size_t n_blocks = (n_words + words_per_block - 1) / words_per_block;
+	size_t n_bytes = n_words * sizeof(uint64_t) + n_blocks * sizeof(uint32_t);
+	if (serialized.size() - pos < n_bytes) {
+		throw mph_error("Truncated Levels");
+	}
+	words = serialized.substr(pos, n_words * sizeof(uint64_t));
+	ranks = serialized.substr(pos + words.size(), n_blocks * sizeof(uint32_t));
+	data = serialized.substr(0, pos + n_bytes);
+}
+
+size_t MinimalPerfectHash::rank(uint64_t bit, uint64_t word) const {
+	size_t word_index = bit / WORD_BITS;
+	size_t block = bit / RANK_BLOCK_BITS;
+	size_t n_set = read_uint32(&ranks[block * sizeof(uint32_t)]);
+	for (size_t i = block * (RANK_BLOCK_BITS / WORD_BITS); i < word_index; i++) {
+		n_set += __builtin_popcountll(read_uint64(&words[i * sizeof(uint64_t)]));
+	}
+	uint64_t below = (uint64_t(1) << (bit % WORD_BITS)) - 1;
+	return n_set + __builtin_popcountll(word & below);
+}
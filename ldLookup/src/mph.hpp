@@ -0,0 +1,101 @@
+#ifndef _LDLOOKUP_MPH_HPP_
+#define _LDLOOKUP_MPH_HPP_
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Custom Exception for MinimalPerfectHash */
+struct mph_error : std::runtime_error {
+	mph_error(const std::string &msg="")
+	    : std::runtime_error("Minimal Perfect Hash Error: " + msg) {}
+};
+
+/**
+ * EFFECTS: Returns a 64-bit hash of 'key' that depends on 'seed'. Hashes are
+ *          stored on disk, so they do not vary between builds or machines.
+ */
+uint64_t hash_key(std::string_view key, uint64_t seed);
+
+/**
+ * Maps each of a fixed set of n keys to its own slot in [0, n), in the style
+ * of BBHash.
+ *
+ * Keys are hashed into the bits of a level about GAMMA times as long as their
+ * number. Bits hit by exactly one key are set, and that key stays at the
+ * level. The other keys move on to a shorter level, until none are left. The
+ * slot of a key is the number of set bits before its own, which is counted
+ * from a 4-byte rank stored every RANK_BLOCK_BITS bits. The map takes about
+ * 3.5 bits per key.
+ *
+ * Keys outside the set map to an arbitrary slot or to none, so callers must
+ * check the key stored at a slot.
+ *
+ * A serialized map is its number of keys and number of levels, the length in
+ * bits of each level, the bits of every level, then the ranks. All integers
+ * are little-endian.
+ */
+class MinimalPerfectHash {
+   public:
+	/**
+	 * EFFECTS: Builds a MinimalPerfectHash of 'keys'.
+	 * THROWS: mph_error if 'keys' are not distinct.
+	 */
+	MinimalPerfectHash(const std::vector<std::string_view> &keys);
+
+	/**
+	 * EFFECTS: Views the MinimalPerfectHash serialized at the start of
+	 *          'serialized', which must outlive it.
+	 * THROWS: mph_error if 'serialized' is corrupted.
+	 */
+	MinimalPerfectHash(std::string_view serialized);
+
+	/**
+	 * EFFECTS: Returns the slot of 'key', or NOT_FOUND if 'key' is certainly
+	 *          not one of the keys.
+	 */
+	size_t lookup(std::string_view key) const;
+
+	/**
+	 * EFFECTS: Returns the number of keys, and so of slots.
+	 */
+	size_t size() const;
+
+	/**
+	 * EFFECTS: Returns the serialized MinimalPerfectHash.
+	 */
+	std::string_view serialized() const;
+
+	static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+	MinimalPerfectHash(const MinimalPerfectHash&) = delete;
+	MinimalPerfectHash& operator=(const MinimalPerfectHash&) = delete;
+
+   private:
+	static constexpr double GAMMA = 2.0;
+	static constexpr size_t MAX_LEVELS = 64;
+	static constexpr size_t WORD_BITS = 64;
+	static constexpr size_t RANK_BLOCK_BITS = 512;
+
+	/* Holds the serialized map if it was built rather than viewed. */
+	std::string built;
+
+	std::string_view data;
+	size_t n_keys;
+
+	/* Is the offset of each level's first bit, then the total length. */
+	std::vector<uint64_t> level_starts;
+
+	/* View the bits of every level, and the rank of each block of bits. */
+	std::string_view words;
+	std::string_view ranks;
+
+	void parse(std::string_view serialized);
+	size_t rank(uint64_t bit, uint64_t word) const;
+};
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef _LDLOOKUP_PARALLEL_INGEST_HPP_
+#define _LDLOOKUP_PARALLEL_INGEST_HPP_
+
+#include <stddef.h>  // size_t
+
+#include <functional>  // std::cref
+#include <string>
+#include <vector>
+
+#include "line_reader.hpp"
+#include "parse_variants.hpp"
+
+/* Default number of bytes of LD data parsed by each task. */
+const size_t DEFAULT_INGEST_CHUNK_SIZE = 64 << 20;
+
+/**
+ * EFFECTS: Equivalent to iterate_ld_data(ld_data...), but parses the lines
+ *          that remain in 'ld_data' on 'n_threads' threads.
+ *
+ *          The lines are split into byte ranges of roughly 'chunk_size'
+ *          bytes. Each boundary is moved forward to the start of the next
+ *          index variant group, so no group spans two ranges and every
+ *          IndexVariantSummary matches the one iterate_ld_data() reports.
+ *          Ranges are parsed concurrently, and their results are passed to
+ *          the callbacks in input order on the calling thread. Within a
+ *          range, invalid lines are reported before its pairs.
+ *
+ *          Ranges are taken directly from the memory map, so if 'n_threads'
+ *          <= 1 or !ld_data.is_mapped(), iterate_ld_data() is called
+ *          instead.
+ * THROWS: Any exception thrown by a callback.
+ */
+template <typename F1, typename F2, typename F3>
+void iterate_ld_data_parallel(
+    LineReader& ld_data,
+    const LDPairParser& parser,
+    size_t n_threads,
+    F1 on_ld_pair,
+    F2 on_index_variant_summary,
+    F3 on_invalid_line,
+    size_t chunk_size = DEFAULT_INGEST_CHUNK_SIZE);
+
+/*************************************************/
+/*************************************************/
+/****             Implementations             ****/
+/*************************************************/
+/*************************************************/
+
+#include <deque>        // std::deque
+#include <future>       // std::async, std::future
+#include <string_view>
+
+/* Results of parsing one byte range of LD data. */
+struct ParsedLDChunk {
+	std::vector<LDPairView> pairs;
+	std::vector<IndexVariantSummary> summaries;
+	std::vector<std::string_view> invalid_lines;
+};
+
+/**
+ * EFFECTS: Returns the offset of the first line at or after 'nominal' that
+ *          starts a new index variant group, or data.size() if there is
+ *          none.
+ */
+inline size_t snap_to_index_variant_group(
+    std::string_view data,
+    const LDPairParser& parser,
+    size_t nominal) {
+	// Skip to the start of the first line at or after 'nominal'.
+	size_t pos = data.find('\n', nominal - 1);
+	if (pos == std::string_view::npos) {
+		return data.size();
+	}
+	pos++;
+
+	// Find the first line whose index variant differs from the index
+	// variant of the group in progress at 'nominal'.
+	std::string_view group_id;
+	bool found_variant = false;
+	LDPairView parsed_line;
+	while (pos < data.size()) {
+		size_t end = data.find('\n', pos);
+		if (end == std::string_view::npos) {
+			end = data.size();
+		}
+
+		if (parser.parse_pair(data.substr(pos, end - pos), parsed_line)) {
+			if (!found_variant) {
+				group_id = parsed_line.index_variant_id;
+				found_variant = true;
+			} else if (parsed_line.index_variant_id != group_id) {
+				return pos;
+			}
+		}
+		pos = end + 1;
+	}
+
+	return data.size();
+}
+
+/**
+ * EFFECTS: Returns the offsets at which ranges of 'data' begin. The final
+ *          offset is data.size().
+ */
+inline std::vector<size_t> find_ld_chunk_boundaries(
+    std::string_view data,
+    const LDPairParser& parser,
+    size_t chunk_size) {
+	std::vector<size_t> boundaries = { 0 };
+	while (boundaries.back() + chunk_size < data.size()) {
+		size_t snapped = snap_to_index_variant_group(
+		    data, parser, boundaries.back() + chunk_size);
+		if (snapped >= data.size()) {
+			break;
+		}
+		boundaries.push_back(snapped);
+	}
+	boundaries.push_back(data.size());
+
+	return boundaries;
+}
+
+/**
+ * EFFECTS: Parses the lines of 'chunk_data'. Views in the result refer to
+ *          'chunk_data'.
+ */
+inline ParsedLDChunk parse_ld_chunk(
+    std::string_view chunk_data,
+    const LDPairParser& parser) {
+	ParsedLDChunk chunk;
+	auto on_ld_pair = [&](const LDPairView& pair) {
+		chunk.pairs.push_back(pair);
+	};
+	auto on_index_variant_summary = [&](const IndexVariantSummary& summary) {
+		chunk.summaries.push_back(summary);
+	};
+
+	IndexVariantGrouper grouper;
+	LDPairView parsed_line;
+	size_t pos = 0;
+	while (pos < chunk_data.size()) {
+		size_t end = chunk_data.find('\n', pos);
+		if (end == std::string_view::npos) {
+			end = chunk_data.size();
+		}
+		std::string_view line = chunk_data.substr(pos, end - pos);
+		pos = end + 1;
+
+		if (!parser.parse_pair(line, parsed_line)) {
+			chunk.invalid_lines.push_back(line);
+			continue;
+		}
+
+		grouper.add(
+		    parsed_line,
+		    parser.r2_threshold_for_ld,
+		    on_ld_pair,
+		    on_index_variant_summary);
+	}
+	grouper.finish(on_index_variant_summary);
+
+	return chunk;
+}
+
+template <typename F1, typename F2, typename F3>
+inline void iterate_ld_data_parallel(
+    LineReader& ld_data,
+    const LDPairParser& parser,
+    size_t n_threads,
+    F1 on_ld_pair,
+    F2 on_index_variant_summary,
+    F3 on_invalid_line,
+    size_t chunk_size) {
+	if (n_threads <= 1 || !ld_data.is_mapped()) {
+		iterate_ld_data(
+		    ld_data,
+		    parser,
+		    on_ld_pair,
+		    on_index_variant_summary,
+		    on_invalid_line);
+		return;
+	}
+
+	std::string_view data = ld_data.remaining();
+	std::vector<size_t> boundaries = find_ld_chunk_boundaries(
+	    data, parser, chunk_size);
+	size_t n_chunks = boundaries.size() - 1;
+
+	// Keep at most n_threads chunks in flight. Chunks are consumed in the
+	// order they were launched, so results are reported in input order.
+	std::deque<std::future<ParsedLDChunk>> in_flight;
+	size_t next_chunk = 0;
+	while (next_chunk < n_chunks || !in_flight.empty()) {
+		while (next_chunk < n_chunks && in_flight.size() < n_threads) {
+			size_t begin = boundaries.at(next_chunk);
+			size_t end = boundaries.at(next_chunk + 1);
+			in_flight.push_back(std::async(
+			    std::launch::async,
+			    parse_ld_chunk,
+			    data.substr(begin, end - begin),
+			    std::cref(parser)));
+			next_chunk++;
+		}
+
+		ParsedLDChunk chunk = in_flight.front().get();
+		in_flight.pop_front();
+
+		for (std::string_view line : chunk.invalid_lines) {
+			on_invalid_line(line);
+		}
+
+		// Summaries follow the pairs of their group, and a group's pairs
+		// are contiguous, so replay them in the sequential order.
+		auto pair_it = chunk.pairs.begin();
+		for (const IndexVariantSummary& summary : chunk.summaries) {
+			for (size_t i = 0; i < summary.n_surrogates; i++) {
+				on_ld_pair(*pair_it++);
+			}
+			on_index_variant_summary(summary);
+		}
+	}
+
+	// All lines were consumed through the map.
+	ld_data.skip_remaining();
+}
+
+#endif
@@ -2,8 +2,11 @@
 #define _LDLOOKUP_PARSE_VARIANTS_HPP_
 
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "line_reader.hpp"
+
 /**
  *  TODO: Document!
  */
@@ -11,6 +14,9 @@ struct IndexVariantSummary {
 	std::string variant_id;
 	double maf;
 	size_t n_surrogates;
+
+	/* Number of LD surrogates at each R2Cutoffs cutoff, if set. */
+	std::vector<size_t> n_surrogates_at_r2_cutoffs = std::vector<size_t>();
 };
 
 /**
@@ -25,6 +31,22 @@ struct LDPair {
 	bool is_in_ld(double r2_threshold) const;
 };
 
+/**
+ * LDPair whose variant IDs are views into the parsed line, so parsing
+ * allocates nothing. The views are only as valid as the line.
+ */
+struct LDPairView {
+    std::string_view index_variant_id;
+    std::string_view ld_variant_id;
+    double index_variant_maf;
+	double r2;
+
+	/* Only set if LDPairParser::ld_variant_maf_column is set. */
+	double ld_variant_maf;
+
+	bool is_in_ld(double r2_threshold) const;
+};
+
 /**
  *  TODO: Document!
  */
@@ -39,6 +61,9 @@ struct LDPairParser {
 	size_t r2_column;
 	double r2_threshold_for_ld;
 
+	/* Column of LD variant MAFs, or 0 if they are not needed. */
+	size_t ld_variant_maf_column;
+
 	/**
 	 *  TODO: Document!
 	 */
@@ -48,6 +73,45 @@ struct LDPairParser {
 	 *  TODO: Document!
 	 */
 	bool parse_pair(const std::string& s, LDPair& pair) const;
+
+	/**
+	 * EFFECTS: Equivalent to parse_pair(s, pair), but 'pair' refers to the
+	 *          variant IDs inside 's' instead of copying them.
+	 */
+	bool parse_pair(std::string_view s, LDPairView& pair) const;
+};
+
+/**
+ * Groups LDPairs visited in input order by index variant. Every change of
+ * index variant ID starts a new group; the summary of a group is reported
+ * once the group ends.
+ */
+class IndexVariantGrouper {
+   public:
+	IndexVariantGrouper();
+
+	/**
+	 * EFFECTS: Adds 'pair' to the current group, first reporting the
+	 *          summary of the previous group via on_index_variant_summary
+	 *          if 'pair' starts a new one. Reports 'pair' via on_ld_pair if
+	 *          it is in LD at 'r2_threshold'.
+	 */
+	template <typename F1, typename F2>
+	void add(
+	    const LDPairView& pair,
+	    double r2_threshold,
+	    F1 on_ld_pair,
+	    F2 on_index_variant_summary);
+
+	/**
+	 * EFFECTS: Reports the summary of the final group, if any.
+	 */
+	template <typename F2>
+	void finish(F2 on_index_variant_summary);
+
+   private:
+	IndexVariantSummary curr_summary;
+	bool found_variant;
 };
 
 /**
@@ -61,6 +125,18 @@ void iterate_ld_data(
     F2 on_new_index_variant,
     F3 on_invalid_line);
 
+/**
+ * EFFECTS: Equivalent to iterate_ld_data(path...), but reads the lines that
+ *          remain in 'ld_data'.
+ */
+template <typename F1, typename F2, typename F3>
+void iterate_ld_data(
+    LineReader& ld_data,
+    const LDPairParser& parser,
+    F1 on_ld_pair,
+    F2 on_new_index_variant,
+    F3 on_invalid_line);
+
 /**
  *  TODO: Document!
  */
@@ -70,6 +146,17 @@ void iterate_variants(
     const std::vector<std::string>& additional_variants,
     F1 on_variant);
 
+/**
+ * EFFECTS: Calls on_batch(variants) with the variants iterate_variants()
+ *          visits, in the same order, up to 'batch_size' at a time.
+ */
+template <typename F1>
+void iterate_variant_batches(
+    const std::string& variants_file,
+    const std::vector<std::string>& additional_variants,
+    size_t batch_size,
+    F1 on_batch);
+
 /*************************************************/
 /*************************************************/
 /****             Implementations             ****/
@@ -80,65 +167,147 @@ void iterate_variants(
 #include <fstream>    // std::ifstream
 
 #include "string_ops.hpp"
+#include "tokenize.hpp"
 
 inline bool LDPair::is_in_ld(double r2_threshold) const {
 	return r2 >= r2_threshold;
 }
 
+inline bool LDPairView::is_in_ld(double r2_threshold) const {
+	return r2 >= r2_threshold;
+}
+
 inline size_t LDPairParser::get_max_column() const {
 	return std::max({
 		index_variant_id_column,
 		ld_variant_id_column,
 		index_variant_maf_column,
-		r2_column
+		r2_column,
+		ld_variant_maf_column
     });
 }
 
 inline bool LDPairParser::parse_pair(
 	const std::string& s,
 	LDPair& pair) const {
-	std::string_view sv(s);
-    std::vector<std::string_view> vec(split(sv, delimiter));
+	LDPairView view;
+	if (!parse_pair(std::string_view(s), view)) {
+		return false;
+	}
+
+	pair.index_variant_id = std::string(view.index_variant_id);
+	pair.ld_variant_id = std::string(view.ld_variant_id);
+	pair.index_variant_maf = view.index_variant_maf;
+	pair.r2 = view.r2;
+	return true;
+}
 
+inline bool LDPairParser::parse_pair(
+	std::string_view sv,
+	LDPairView& pair) const {
+	// Find only the columns we need.
+	std::string_view maf_str, r2_str, ld_maf_str;
 	size_t max_col = get_max_column();
-    if (vec.size() < max_col) {
-        return false;
-    }
+	auto on_column = [&](size_t column, std::string_view text) {
+		if (column == index_variant_id_column) {
+			pair.index_variant_id = text;
+		}
+		if (column == ld_variant_id_column) {
+			pair.ld_variant_id = text;
+		}
+		if (column == index_variant_maf_column) {
+			maf_str = text;
+		}
+		if (column == r2_column) {
+			r2_str = text;
+		}
+		if (column == ld_variant_maf_column) {
+			ld_maf_str = text;
+		}
+	};
+	if (for_each_column(sv, delimiter, max_col, on_column) < max_col) {
+		return false;
+	}
 
 	// Set MAF field.
-    // MAF must be a double.
-	try {
-		std::string col_str(vec.at(index_variant_maf_column-1));
-		pair.index_variant_maf = std::stod(col_str);
-	} catch (std::invalid_argument& ignore) {
+	// MAF must be a double in [0, 0.5].
+	if (!parse_double(maf_str, pair.index_variant_maf)) {
 		return false;
 	}
-
-	// MAF must be in [0, 0.5].
 	if (pair.index_variant_maf > 0.5 || pair.index_variant_maf < 0) {
 		return false;
 	}
 
 	// Set r-squared field.
-	// R2 must be a double.
-	try {
-		std::string col_str(vec.at(r2_column-1));
-		pair.r2 = std::stod(col_str);
-	} catch (std::invalid_argument& ignore) {
+	// R2 must be a double in [0, 1].
+	if (!parse_double(r2_str, pair.r2)) {
 		return false;
 	}
-
-	// R2 must be in [0, 1].
 	if (pair.r2 > 1 || pair.r2 < 0) {
 		return false;
 	}
 
-	// Set index_variant_id and ld_variant_id. No validation is performed here.
-    pair.index_variant_id = std::string(vec.at(index_variant_id_column-1));
-	pair.ld_variant_id = std::string(vec.at(ld_variant_id_column-1));
+	// Set LD variant MAF field, if requested.
+	// MAF must be a double in [0, 0.5].
+	if (ld_variant_maf_column != 0) {
+		if (!parse_double(ld_maf_str, pair.ld_variant_maf)) {
+			return false;
+		}
+		if (pair.ld_variant_maf > 0.5 || pair.ld_variant_maf < 0) {
+			return false;
+		}
+	}
+
+	// index_variant_id and ld_variant_id were set above.
+	// No validation is performed on them.
     return true;
 }
 
+inline IndexVariantGrouper::IndexVariantGrouper()
+    // Initialize curr_summary with placeholder/junk values.
+    : curr_summary{ "", 0.0, 0 }, found_variant(false) {}
+
+template <typename F1, typename F2>
+inline void IndexVariantGrouper::add(
+    const LDPairView& pair,
+    double r2_threshold,
+    F1 on_ld_pair,
+    F2 on_index_variant_summary) {
+	// Check if we found a new index variant.
+	if (pair.index_variant_id != curr_summary.variant_id) {
+		// Report summary statistics on the previous index variant.
+		// found_variant ensures such a variant exists: we don't
+		// want to report our placeholder values when we encounter
+		// our first valid variant.
+		if (found_variant) {
+			on_index_variant_summary(curr_summary);
+		} else {
+			found_variant = true;
+		}
+
+		// Set the current index variant to the new index variant.
+		// assign() reuses the capacity of the previous ID.
+		curr_summary.variant_id.assign(pair.index_variant_id);
+		curr_summary.maf = pair.index_variant_maf;
+		curr_summary.n_surrogates = 0;
+	}
+
+	// Report pairs in LD.
+	if (pair.is_in_ld(r2_threshold)) {
+		curr_summary.n_surrogates++;
+		on_ld_pair(pair);
+	}
+}
+
+template <typename F2>
+inline void IndexVariantGrouper::finish(F2 on_index_variant_summary) {
+	// Report summary statistics for the final index variant.
+	if (found_variant) {
+		on_index_variant_summary(curr_summary);
+		found_variant = false;
+	}
+}
+
 template <typename F1, typename F2, typename F3>
 inline void iterate_ld_data(
     const std::string& ld_data_file,
@@ -147,54 +316,42 @@ inline void iterate_ld_data(
     F2 on_index_variant_summary,
     F3 on_invalid_line) {
 	// Open the LD data.
-	std::ifstream ld_data(ld_data_file);
-	if (!ld_data) {
-		throw std::runtime_error("Failed to open '" + ld_data_file + "'");
-	}
-	
-	// Initialize curr_summary with placeholder/junk values.
-	IndexVariantSummary curr_summary{ "", 0.0, 0 };
-	bool found_variant = false;
-	std::string line;
-	LDPair parsed_line;
+	LineReader ld_data(ld_data_file);
+	iterate_ld_data(
+	    ld_data,
+	    parser,
+	    on_ld_pair,
+	    on_index_variant_summary,
+	    on_invalid_line);
+}
+
+template <typename F1, typename F2, typename F3>
+inline void iterate_ld_data(
+    LineReader& ld_data,
+    const LDPairParser& parser,
+    F1 on_ld_pair,
+    F2 on_index_variant_summary,
+    F3 on_invalid_line) {
+	IndexVariantGrouper grouper;
+	std::string_view line;
+	LDPairView parsed_line;
 
 	// Loop over lines of ld_data.
-	while (std::getline(ld_data, line)) {
-		// Parse each line into an LDPair.
+	while (ld_data.next(line)) {
+		// Parse each line into an LDPairView.
 		if (!parser.parse_pair(line, parsed_line)) {
 			on_invalid_line(line);
 			continue;
 		}
 
-		// Check if we found a new index variant.
-		if (parsed_line.index_variant_id != curr_summary.variant_id) {
-			// Report summary statistics on the previous index variant.
-			// found_variant ensures such a variant exists: we don't
-			// want to report our placeholder values when we encounter
-			// our first valid variant.
-			if (found_variant) {
-				on_index_variant_summary(curr_summary);
-			} else {
-				found_variant = true;
-			}
-
-			// Set the current index variant to the new index variant.
-			curr_summary.variant_id = parsed_line.index_variant_id;
-			curr_summary.maf = parsed_line.index_variant_maf;
-			curr_summary.n_surrogates = 0;
-		}
-
-		// Report pairs in LD.
-		if (parsed_line.is_in_ld(parser.r2_threshold_for_ld)) {
-			curr_summary.n_surrogates++;
-			on_ld_pair(parsed_line);
-		}
+		grouper.add(
+		    parsed_line,
+		    parser.r2_threshold_for_ld,
+		    on_ld_pair,
+		    on_index_variant_summary);
 	}
 
-	// Report summary statistics for the final index variant.
-	if (found_variant) {
-		on_index_variant_summary(curr_summary);
-	}
+	grouper.finish(on_index_variant_summary);
 }
 
 template <typename F1>
@@ -222,4 +379,24 @@ inline void iterate_variants(
     }
 }
 
+template <typename F1>
+inline void iterate_variant_batches(
+    const std::string& variants_file,
+    const std::vector<std::string>& additional_variants,
+    size_t batch_size,
+    F1 on_batch) {
+	std::vector<std::string> batch;
+	batch.reserve(batch_size);
+	iterate_variants(variants_file, additional_variants, [&](const std::string& variant) {
+		batch.push_back(variant);
+		if (batch.size() == batch_size) {
+			on_batch(batch);
+			batch.clear();
+		}
+	});
+	if (!batch.empty()) {
+		on_batch(batch);
+	}
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,120 @@
+#include "posting_codec.hpp"
+
+#include <cmath>    // std::lround
+#include <cstring>  // std::memcpy
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+void encode_postings(const vector<uint32_t> &ordinals, string &encoded) {
+	// Write the length as a varint.
+	uint64_t n = ordinals.size();
+	do {
+		uint8_t byte = n & 0x7f;
+		n >>= 7;
+		encoded.push_back(static_cast<char>(n ? byte | 0x80 : byte));
+	} while (n);
+
+	uint32_t block[POSTING_BLOCK_SIZE];
+	uint32_t previous = 0;
+	for (size_t start = 0; start < ordinals.size(); start += POSTING_BLOCK_SIZE) {
+		size_t n_block = std::min(POSTING_BLOCK_SIZE, ordinals.size() - start);
+
+		// Zigzag-encode the differences, so small negative ones stay small.
+		uint32_t all_bits = 0;
+		for (size_t i = 0; i < n_block; i++) {
+			uint32_t delta = ordinals[start + i] - previous;
+			block[i] = (delta << 1) ^ (0 - (delta >> 31));
+			all_bits |= block[i];
+			previous = ordinals[start + i];
+		}
+
+		uint8_t width = 0;
+		while (width < 32 && (all_bits >> width)) {
+			width++;
+		}
+		encoded.push_back(static_cast<char>(width));
+
+		// Pack the differences, least significant bit first.
+		uint64_t bits = 0;
+		size_t n_bits = 0;
+		for (size_t i = 0; i < n_block; i++) {
+			bits |= static_cast<uint64_t>(block[i]) << n_bits;
+			n_bits += width;
+			while (n_bits >= 8) {
+				encoded.push_back(static_cast<char>(bits & 0xff));
+				bits >>= 8;
+				n_bits -= 8;
+			}
+		}
+		if (n_bits) {
+			encoded.push_back(static_cast<char>(bits & 0xff));
+		}
+	}
+}
+
+size_t count_postings(string_view encoded) {
+	size_t pos = 0;
+	return read_varint(encoded, pos);
+}
+
+uint64_t read_varint(string_view encoded, size_t &pos) {
+	uint64_t x = 0;
+	for (size_t shift = 0; shift < 64; shift += 7) {
+		if (pos >= encoded.size()) {
+			break;
+		}
+		uint8_t byte = static_cast<uint8_t>(encoded[pos++]);
+		x |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return x;
+		}
+	}
+	throw posting_codec_error("Truncated Length");
+}
+
+void unpack_block(
+    string_view encoded,
+    size_t &pos,
+    size_t n,
+    uint32_t *values) {
+	if (pos >= encoded.size()) {
+		throw posting_codec_error("Truncated Block");
+	}
+	size_t width = static_cast<uint8_t>(encoded[pos++]);
+	size_t n_bytes = (n * width + 7) / 8;
+	if (width > 32 || n_bytes > encoded.size() - pos) {
+		throw posting_codec_error("Truncated Block");
+	}
+
+	// Copy the block into a padded buffer, so each value can be read with
+	// one 8-byte load that never runs past the end of the block.
+	unsigned char packed[POSTING_BLOCK_SIZE * sizeof(uint32_t) + sizeof(uint64_t)] = {};
+	std::memcpy(packed, encoded.data() + pos, n_bytes);
+	pos += n_bytes;
+
+	uint64_t mask = (uint64_t(1) << width) - 1;
+	for (size_t i = 0; i < n; i++) {
+		size_t bit = i * width;
+		uint64_t word;
+		std::memcpy(&word, packed + bit / 8, sizeof(word));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		word = __builtin_bswap64(word);
+#endif
+		values[i] = static_cast<uint32_t>((word >> (bit % 8)) & mask);
+	}
+}
+
+uint16_t quantize_r2(double r2) {
+	if (!(r2 > 0.0)) {
+		return 0;
+	} else if (r2 >= 1.0) {
+		return R2_SCALE;
+	}
+	return static_cast<uint16_t>(std::lround(r2 * R2_SCALE));
+}
+
+double dequantize_r2(uint16_t quantized) {
+	return static_cast<double>(quantized) / R2_SCALE;
+}
@@ -0,0 +1,133 @@
+#ifndef _LDLOOKUP_POSTING_CODEC_HPP_
+#define _LDLOOKUP_POSTING_CODEC_HPP_
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint16_t, uint32_t, uint64_t
+
+#include <algorithm>  // std::min
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Custom Exception for corrupted posting lists */
+struct posting_codec_error : std::runtime_error {
+	posting_codec_error(const std::string &msg="")
+	    : std::runtime_error("Posting Codec Error: " + msg) {}
+};
+
+/**
+ * Compresses posting lists of variant ordinals.
+ *
+ * Ordinals are numbered in the order variants first appear in the LD data,
+ * which roughly follows genomic position, so neighbouring postings are
+ * numerically close. Each ordinal is stored as the zigzag-encoded difference
+ * from the one before it, which keeps the postings' order.
+ *
+ * An encoded list is its length as a varint, then blocks of up to
+ * POSTING_BLOCK_SIZE differences. Each block is one byte holding the bit
+ * width of its largest difference, then every difference packed with that
+ * width, least significant bit first. Blocks have a fixed number of values
+ * of a fixed width, so they unpack without branching on each value.
+ */
+const size_t POSTING_BLOCK_SIZE = 128;
+
+/**
+ * EFFECTS: Appends the encoding of 'ordinals' to 'encoded'.
+ */
+void encode_postings(const std::vector<uint32_t> &ordinals, std::string &encoded);
+
+/**
+ * EFFECTS: Returns the number of ordinals in 'encoded'.
+ * THROWS: posting_codec_error if 'encoded' is corrupted.
+ */
+size_t count_postings(std::string_view encoded);
+
+/**
+ * EFFECTS: Calls on_ordinal(ordinal) with each ordinal in 'encoded', in
+ *          the order they were encoded.
+ * THROWS: posting_codec_error if 'encoded' is corrupted.
+ */
+template <typename F>
+void decode_postings(std::string_view encoded, F on_ordinal);
+
+/**
+ * EFFECTS: Calls on_ordinal(ordinal) with the first 'max_ordinals' ordinals
+ *          in 'encoded', in the order they were encoded. Blocks after them
+ *          are not read.
+ * THROWS: posting_codec_error if 'encoded' is corrupted.
+ */
+template <typename F>
+void decode_postings(std::string_view encoded, size_t max_ordinals, F on_ordinal);
+
+/**
+ * Postings may carry the r2 of their pair, rounded to a multiple of
+ * 1 / R2_SCALE so it fits in 2 bytes.
+ */
+const uint32_t R2_SCALE = 65535;
+
+/**
+ * EFFECTS: Returns 'r2', clamped to [0, 1], rounded to a multiple of
+ *          1 / R2_SCALE and scaled by R2_SCALE.
+ */
+uint16_t quantize_r2(double r2);
+
+/**
+ * EFFECTS: Returns the r2 that 'quantized' was rounded from, to within
+ *          1 / (2 * R2_SCALE).
+ */
+double dequantize_r2(uint16_t quantized);
+
+/**
+ * EFFECTS: Reads the varint at 'pos' in 'encoded' and moves 'pos' past it.
+ * THROWS: posting_codec_error if the varint is truncated.
+ */
+uint64_t read_varint(std::string_view encoded, size_t &pos);
+
+/**
+ * EFFECTS: Unpacks the block of 'n' values at 'pos' in 'encoded' into
+ *          'values' and moves 'pos' past it.
+ * THROWS: posting_codec_error if the block is truncated.
+ */
+void unpack_block(
+    std::string_view encoded,
+    size_t &pos,
+    size_t n,
+    uint32_t *values);
+
+/*************************************************/
+/*************************************************/
+/****         Template Implementation         ****/
+/*************************************************/
+/*************************************************/
+
+template <typename F>
+inline void decode_postings(std::string_view encoded, F on_ordinal) {
+	decode_postings(encoded, SIZE_MAX, on_ordinal);
+}
+
+template <typename F>
+inline void decode_postings(
+    std::string_view encoded,
+    size_t max_ordinals,
+    F on_ordinal) {
+	size_t pos = 0;
+	uint64_t n_left = std::min<uint64_t>(read_varint(encoded, pos), max_ordinals);
+
+	uint32_t block[POSTING_BLOCK_SIZE];
+	uint32_t ordinal = 0;
+	while (n_left) {
+		size_t n = std::min<uint64_t>(n_left, POSTING_BLOCK_SIZE);
+		unpack_block(encoded, pos, n, block);
+
+		// Undo the zigzag encoding, then the differences. Ordinals wrap
+		// around like the differences did when they were encoded.
+		for (size_t i = 0; i < n; i++) {
+			ordinal += (block[i] >> 1) ^ (0 - (block[i] & 1));
+			on_ordinal(ordinal);
+		}
+		n_left -= n;
+	}
+}
+
+#endif
@@ -0,0 +1,185 @@
+#include "segments.hpp"
+
+#include <fcntl.h>     // open
+#include <sys/file.h>  // flock
+#include <unistd.h>    // close
+
+#include <algorithm>   // std::max
+#include <cstdio>      // std::rename
+#include <filesystem>  // std::filesystem
+#include <fstream>     // std::ifstream, std::ofstream
+
+using std::string;
+using std::vector;
+
+/*************************************************/
+/*************************************************/
+/***                 Manifest                  ***/
+/*************************************************/
+/*************************************************/
+
+Manifest::Manifest(const string &dir_in) : dir(dir_in) {
+	std::filesystem::path path = std::filesystem::path(dir) / MANIFEST_FILE_PATH;
+	if (!std::filesystem::exists(path)) {
+		segments = { "." };
+		return;
+	}
+
+	std::ifstream file(path);
+	string line;
+	while (std::getline(file, line)) {
+		if (line.size() && line[0] != '#') {
+			segments.push_back(line);
+		}
+	}
+	if (file.bad() || segments.empty()) {
+		throw segment_error("Unreadable Segment List: " + path.string());
+	}
+}
+
+const vector<string> &Manifest::get_segments() const {
+	return segments;
+}
+
+string Manifest::create_segment() const {
+	// Number segments after the newest one, skipping directories left
+	// behind by failed appends.
+	size_t n = 0;
+	for (const string &segment : segments) {
+		if (segment.rfind("segment_", 0) == 0) {
+			n = std::max<size_t>(n, std::stoull(segment.substr(8)));
+		}
+	}
+
+	string segment;
+	do {
+		segment = "segment_" + std::to_string(++n);
+	} while (std::filesystem::exists(std::filesystem::path(dir) / segment));
+
+	std::filesystem::create_directory(std::filesystem::path(dir) / segment);
+	return segment;
+}
+
+void Manifest::add_segment(const string &segment) {
+	segments.push_back(segment);
+}
+
+void Manifest::set_segments(const vector<string> &segments_in) {
+	segments = segments_in;
+}
+
+void Manifest::save() const {
+	// Write a temporary file, then rename it over the old list.
+	std::filesystem::path path = std::filesystem::path(dir) / MANIFEST_FILE_PATH;
+	string tmp_path = path.string() + ".tmp";
+	std::ofstream file(tmp_path, std::ios_base::out | std::ios_base::trunc);
+	file << "# ldLookup segments, oldest first\n";
+	for (const string &segment : segments) {
+		file << segment << '\n';
+	}
+	file.close();
+
+	if (!file || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+		throw segment_error("Failed to Write Segment List: " + path.string());
+	}
+}
+
+/*************************************************/
+/*************************************************/
+/***               DirectoryLock               ***/
+/*************************************************/
+/*************************************************/
+
+DirectoryLock::DirectoryLock(const string &dir) {
+	string path = std::filesystem::path(dir) / LOCK_FILE_PATH;
+	fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		throw segment_error("Failed to Create Lock File: " + path);
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+		close(fd);
+		throw segment_error("Lookup Table Is Being Modified: " + dir);
+	}
+}
+
+DirectoryLock::~DirectoryLock() {
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+/*************************************************/
+/*************************************************/
+/***             SegmentedLDTable              ***/
+/*************************************************/
+/*************************************************/
+
+SegmentedLDTable::SegmentedLDTable(vector<std::shared_ptr<LDTable>> segments_in)
+    : segments(segments_in) {}
+
+bool SegmentedLDTable::is_member(const string &key) const {
+	for (const auto &segment : segments) {
+		if (segment->is_member(key)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void SegmentedLDTable::prefetch(const vector<string> &keys) {
+	for (const auto &segment : segments) {
+		segment->prefetch(keys);
+	}
+}
+
+bool SegmentedLDTable::has_r2() const {
+	for (const auto &segment : segments) {
+		if (!segment->has_r2()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+vector<string> SegmentedLDTable::lookup(const string &key) {
+	vector<string> postings;
+	for_each_posting(key, [&](std::string_view posting) {
+		postings.emplace_back(posting);
+	});
+	return postings;
+}
+
+/*************************************************/
+/*************************************************/
+/***           SegmentedSummaryTable           ***/
+/*************************************************/
+/*************************************************/
+
+SegmentedSummaryTable::SegmentedSummaryTable(
+    vector<std::shared_ptr<SummaryTable>> segments_in)
+    : segments(segments_in) {}
+
+bool SegmentedSummaryTable::is_member(const string &index_variant_id) const {
+	for (const auto &segment : segments) {
+		if (segment->is_member(index_variant_id)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void SegmentedSummaryTable::prefetch(const vector<string> &index_variant_ids) {
+	for (const auto &segment : segments) {
+		segment->prefetch(index_variant_ids);
+	}
+}
+
+IndexVariantSummary SegmentedSummaryTable::lookup(const string &index_variant_id) {
+	for (auto it = segments.rbegin(); it != segments.rend(); it++) {
+		if ((*it)->is_member(index_variant_id)) {
+			return (*it)->lookup(index_variant_id);
+		}
+	}
+
+	// Let the oldest segment report the missing key.
+	return segments.front()->lookup(index_variant_id);
+}
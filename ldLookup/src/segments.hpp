@@ -0,0 +1,264 @@
+#ifndef _LDLOOKUP_SEGMENTS_HPP_
+#define _LDLOOKUP_SEGMENTS_HPP_
+
+#include <stddef.h>  // size_t
+
+#include <memory>     // std::shared_ptr
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parse_variants.hpp"
+#include "tables.hpp"
+
+/* Custom Exception for segmented lookup tables */
+struct segment_error : std::runtime_error {
+	segment_error(const std::string &msg="")
+	    : std::runtime_error("Segment Error: " + msg) {}
+};
+
+/**
+ * Lists the segments of a lookup table directory, oldest first.
+ *
+ * Each segment is a directory holding an LDTable, a SummaryTable, and a
+ * StrataTable. The StrataTable of the newest segment covers all segments;
+ * older ones are unused. The segment "." is the lookup table directory
+ * itself, which is where setup writes a new table. setup --append adds a
+ * segment for each batch of LD data, and compact merges all segments into
+ * one.
+ *
+ * The list is stored as a text file with one segment per line. Directories
+ * without that file, such as those made before segments existed, have the
+ * single segment ".".
+ */
+class Manifest {
+   public:
+	/**
+	 * EFFECTS: Reads the segment list of the lookup table in 'dir'.
+	 * THROWS: segment_error if the segment list is unreadable.
+	 */
+	Manifest(const std::string &dir);
+
+	/**
+	 * EFFECTS: Returns the segment names, oldest first.
+	 */
+	const std::vector<std::string> &get_segments() const;
+
+	/**
+	 * EFFECTS: Creates an empty directory for a new segment and returns
+	 *          its name. The segment is not listed until add_segment()
+	 *          and save() are called.
+	 */
+	std::string create_segment() const;
+
+	/**
+	 * EFFECTS: Lists 'segment' as the newest segment.
+	 */
+	void add_segment(const std::string &segment);
+
+	/**
+	 * EFFECTS: Replaces the list of segments.
+	 */
+	void set_segments(const std::vector<std::string> &segments);
+
+	/**
+	 * EFFECTS: Writes the segment list. Readers see either the old or the
+	 *          new list, never a partial one.
+	 * THROWS: segment_error if the list cannot be written.
+	 */
+	void save() const;
+
+   private:
+	const std::string MANIFEST_FILE_PATH = "segments.txt";
+
+	std::string dir;
+	std::vector<std::string> segments;
+};
+
+/**
+ * Holds an exclusive lock on a lookup table directory, so only one
+ * setup --append or compact modifies it at a time. Readers do not lock.
+ */
+class DirectoryLock {
+   public:
+	/**
+	 * EFFECTS: Locks 'dir'.
+	 * THROWS: segment_error if 'dir' is already locked.
+	 */
+	DirectoryLock(const std::string &dir);
+
+	~DirectoryLock();
+
+	DirectoryLock(const DirectoryLock&) = delete;
+	DirectoryLock& operator=(const DirectoryLock&) = delete;
+
+   private:
+	const std::string LOCK_FILE_PATH = ".lock";
+
+	int fd;
+};
+
+/* The LDTables of several segments, read as one table. */
+class SegmentedLDTable {
+   public:
+	/**
+	 * EFFECTS: Combines 'segments', which are ordered oldest first.
+	 */
+	SegmentedLDTable(std::vector<std::shared_ptr<LDTable>> segments);
+
+	/**
+	 * EFFECTS: Returns whether any segment has postings for 'key'.
+	 */
+	bool is_member(const std::string &key) const;
+
+	/**
+	 * EFFECTS: Prefetches the postings of 'keys' from every segment.
+	 */
+	void prefetch(const std::vector<std::string> &keys);
+
+	/**
+	 * EFFECTS: Returns whether the postings of every segment carry r2
+	 *          values.
+	 */
+	bool has_r2() const;
+
+	/**
+	 * EFFECTS: Returns the postings of 'key' from every segment, oldest
+	 *          segment first.
+	 * THROWS: vdh_key_error if !is_member(key).
+	 */
+	std::vector<std::string> lookup(const std::string &key);
+
+	/**
+	 * EFFECTS: Calls on_posting(posting) with each posting of 'key', as a
+	 *          std::string_view into the segment, in the order of lookup().
+	 * THROWS: vdh_key_error if !is_member(key).
+	 */
+	template <typename F1>
+	void for_each_posting(const std::string &key, F1 on_posting);
+
+	/**
+	 * EFFECTS: Calls on_posting(posting, r2) with each posting of 'key'
+	 *          whose r2 is at least 'min_r2', oldest segment first. See
+	 *          LDTable::for_each_posting().
+	 * THROWS: vdh_key_error if !is_member(key).
+	 *         std::runtime_error if !has_r2().
+	 */
+	template <typename F1>
+	void for_each_posting(const std::string &key, double min_r2, F1 on_posting);
+
+   private:
+	std::vector<std::shared_ptr<LDTable>> segments;
+};
+
+/**
+ * The SummaryTables of several segments, read as one table. A segment's
+ * summary of an index variant already includes the surrogates of older
+ * segments, so the newest summary of each index variant is used.
+ */
+class SegmentedSummaryTable {
+   public:
+	/**
+	 * EFFECTS: Combines 'segments', which are ordered oldest first.
+	 */
+	SegmentedSummaryTable(std::vector<std::shared_ptr<SummaryTable>> segments);
+
+	/**
+	 * EFFECTS: Returns whether any segment summarizes 'index_variant_id'.
+	 */
+	bool is_member(const std::string &index_variant_id) const;
+
+	/**
+	 * EFFECTS: Prefetches the summaries of 'index_variant_ids' from every
+	 *          segment.
+	 */
+	void prefetch(const std::vector<std::string> &index_variant_ids);
+
+	/**
+	 * EFFECTS: Returns the newest summary of 'index_variant_id'.
+	 * THROWS: vdh_key_error if !is_member(index_variant_id).
+	 */
+	IndexVariantSummary lookup(const std::string &index_variant_id);
+
+	/**
+	 * EFFECTS: Calls on_index_variant_summary(summary) with the newest
+	 *          summary of each index variant, once per index variant.
+	 *          Index variants are visited in the order they were first
+	 *          added to the lookup table.
+	 */
+	template <typename F1>
+	void for_each_summary(F1 on_index_variant_summary);
+
+   private:
+	std::vector<std::shared_ptr<SummaryTable>> segments;
+};
+
+/*************************************************/
+/*************************************************/
+/****         Template Implementation         ****/
+/*************************************************/
+/*************************************************/
+
+template <typename F1>
+inline void SegmentedLDTable::for_each_posting(
+    const std::string &key,
+    F1 on_posting) {
+	bool found = false;
+	for (const auto &segment : segments) {
+		if (!segment->is_member(key)) {
+			continue;
+		}
+		segment->for_each_posting(key, on_posting);
+		found = true;
+	}
+
+	if (!found) {
+		// Let the oldest segment report the missing key.
+		segments.front()->lookup(key);
+	}
+}
+
+template <typename F1>
+inline void SegmentedLDTable::for_each_posting(
+    const std::string &key,
+    double min_r2,
+    F1 on_posting) {
+	bool found = false;
+	for (const auto &segment : segments) {
+		if (!segment->is_member(key)) {
+			continue;
+		}
+		segment->for_each_posting(key, min_r2, on_posting);
+		found = true;
+	}
+
+	if (!found) {
+		segments.front()->lookup(key);
+	}
+}
+
+template <typename F1>
+inline void SegmentedSummaryTable::for_each_summary(F1 on_index_variant_summary) {
+	for (size_t i = 0; i < segments.size(); i++) {
+		segments[i]->for_each_summary([&](const IndexVariantSummary &summary) {
+			// Skip variants already reported from an older segment.
+			for (size_t j = 0; j < i; j++) {
+				if (segments[j]->is_member(summary.variant_id)) {
+					return;
+				}
+			}
+
+			// Report the summary from the newest segment with the variant.
+			for (size_t j = segments.size() - 1; j > i; j--) {
+				if (segments[j]->is_member(summary.variant_id)) {
+					on_index_variant_summary(segments[j]->lookup(summary.variant_id));
+					return;
+				}
+			}
+			on_index_variant_summary(summary);
+		});
+	}
+}
+
+#endif
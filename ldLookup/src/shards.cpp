@@ -0,0 +1,172 @@
+#include "shards.hpp"
+
+#include <unistd.h>    // getpid
+
+#include <cstdint>     // uint64_t
+#include <cstdio>      // std::rename, std::remove
+#include <filesystem>  // std::filesystem
+#include <fstream>     // std::ifstream, std::ofstream
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+/*************************************************/
+/*************************************************/
+/***                ShardLayout                ***/
+/*************************************************/
+/*************************************************/
+
+ShardLayout::ShardLayout(const string &dir_in) : dir(dir_in) {
+	std::filesystem::path path = std::filesystem::path(dir) / LAYOUT_FILE_PATH;
+	sharded = std::filesystem::exists(path);
+	n_shards = sharded ? read_n_shards(path) : 1;
+}
+
+ShardLayout::ShardLayout(const string &dir_in, size_t n_shards_in)
+    : dir(dir_in), n_shards(n_shards_in), sharded(true) {
+	if (n_shards == 0) {
+		throw shard_error("Lookup Table Must Have at Least One Shard");
+	}
+}
+
+bool ShardLayout::is_sharded() const {
+	return sharded;
+}
+
+size_t ShardLayout::get_n_shards() const {
+	return n_shards;
+}
+
+size_t ShardLayout::get_shard(string_view index_variant_id) const {
+	if (!sharded) {
+		return 0;
+	}
+
+	// 64-bit FNV-1a. Shards are stored on disk, so the hash must not vary
+	// between builds or machines, as std::hash may.
+	uint64_t hash = 14695981039346656037ULL;
+	for (char c : index_variant_id) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ULL;
+	}
+	return hash % n_shards;
+}
+
+vector<vector<string>> ShardLayout::split_by_shard(
+    const vector<string> &index_variant_ids) const {
+	vector<vector<string>> split(n_shards);
+	for (const string &index_variant_id : index_variant_ids) {
+		split[get_shard(index_variant_id)].push_back(index_variant_id);
+	}
+	return split;
+}
+
+string ShardLayout::get_shard_dir(size_t shard) const {
+	if (!sharded) {
+		return dir;
+	}
+	return std::filesystem::path(dir) / ("shard_" + std::to_string(shard));
+}
+
+void ShardLayout::save() const {
+	std::filesystem::path path = std::filesystem::path(dir) / LAYOUT_FILE_PATH;
+	if (std::filesystem::exists(path)) {
+		if (read_n_shards(path) != n_shards) {
+			throw shard_error(
+			    "Lookup Table Already Has " + std::to_string(read_n_shards(path))
+			    + " Shards: " + dir);
+		}
+		return;
+	}
+
+	// Write a temporary file, then rename it into place. Each process uses
+	// its own temporary file, so concurrent saves do not interfere.
+	string tmp_path = path.string() + "." + std::to_string(getpid()) + ".tmp";
+	std::ofstream file(tmp_path, std::ios_base::out | std::ios_base::trunc);
+	file << "# ldLookup shards\n" << n_shards << '\n';
+	file.close();
+
+	if (!file || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+		std::remove(tmp_path.c_str());
+		throw shard_error("Failed to Write Shard Layout: " + path.string());
+	}
+}
+
+size_t ShardLayout::read_n_shards(const string &path) {
+	std::ifstream file(path);
+	string line;
+	while (std::getline(file, line)) {
+		if (line.size() && line[0] != '#') {
+			try {
+				size_t n = std::stoull(line);
+				if (n != 0) {
+					return n;
+				}
+			} catch (std::logic_error &ignore) {}
+			break;
+		}
+	}
+	throw shard_error("Unreadable Shard Layout: " + path);
+}
+
+/*************************************************/
+/*************************************************/
+/***              ShardedLDTable               ***/
+/*************************************************/
+/*************************************************/
+
+ShardedLDTable::ShardedLDTable(
+    const ShardLayout &layout_in,
+    vector<std::shared_ptr<SegmentedLDTable>> shards_in)
+    : layout(layout_in), shards(shards_in) {}
+
+bool ShardedLDTable::is_member(const string &key) const {
+	return shards[layout.get_shard(key)]->is_member(key);
+}
+
+void ShardedLDTable::prefetch(const vector<string> &keys) {
+	vector<vector<string>> split = layout.split_by_shard(keys);
+	for (size_t i = 0; i < shards.size(); i++) {
+		shards[i]->prefetch(split[i]);
+	}
+}
+
+bool ShardedLDTable::has_r2() const {
+	for (const auto &shard : shards) {
+		if (!shard->has_r2()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+vector<string> ShardedLDTable::lookup(const string &key) {
+	return shards[layout.get_shard(key)]->lookup(key);
+}
+
+/*************************************************/
+/*************************************************/
+/***            ShardedSummaryTable            ***/
+/*************************************************/
+/*************************************************/
+
+ShardedSummaryTable::ShardedSummaryTable(
+    const ShardLayout &layout_in,
+    vector<std::shared_ptr<SegmentedSummaryTable>> shards_in)
+    : layout(layout_in), shards(shards_in) {}
+
+bool ShardedSummaryTable::is_member(const string &index_variant_id) const {
+	return shards[layout.get_shard(index_variant_id)]->is_member(index_variant_id);
+}
+
+void ShardedSummaryTable::prefetch(const vector<string> &index_variant_ids) {
+	vector<vector<string>> split = layout.split_by_shard(index_variant_ids);
+	for (size_t i = 0; i < shards.size(); i++) {
+		shards[i]->prefetch(split[i]);
+	}
+}
+
+IndexVariantSummary ShardedSummaryTable::lookup(const string &index_variant_id) {
+	return shards[layout.get_shard(index_variant_id)]->lookup(index_variant_id);
+}
@@ -0,0 +1,212 @@
+#ifndef _LDLOOKUP_SHARDS_HPP_
+#define _LDLOOKUP_SHARDS_HPP_
+
+#include <stddef.h>  // size_t
+
+#include <memory>     // std::shared_ptr
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parse_variants.hpp"
+#include "segments.hpp"
+
+/* Custom Exception for sharded lookup tables */
+struct shard_error : std::runtime_error {
+	shard_error(const std::string &msg="")
+	    : std::runtime_error("Shard Error: " + msg) {}
+};
+
+/**
+ * Splits the index variants of a lookup table into shards by a hash of
+ * their IDs, so shards can be built independently and in parallel.
+ *
+ * Each shard is a directory "shard_<i>" holding the LDTable and SummaryTable
+ * of its index variants, in segments like an unsharded table. The StrataTable
+ * covers every shard and is stored in the lookup table directory itself.
+ *
+ * The number of shards is stored in a text file. Directories without that
+ * file are unsharded: they have one shard, the directory itself.
+ */
+class ShardLayout {
+   public:
+	/**
+	 * EFFECTS: Reads the layout of the lookup table in 'dir'.
+	 * THROWS: shard_error if the layout is unreadable.
+	 */
+	ShardLayout(const std::string &dir);
+
+	/**
+	 * EFFECTS: Creates a layout of 'n_shards' shards for the lookup table in
+	 *          'dir'. The layout is not stored until save() is called.
+	 */
+	ShardLayout(const std::string &dir, size_t n_shards);
+
+	/**
+	 * EFFECTS: Returns whether the lookup table is split into shards.
+	 */
+	bool is_sharded() const;
+
+	/**
+	 * EFFECTS: Returns the number of shards.
+	 */
+	size_t get_n_shards() const;
+
+	/**
+	 * EFFECTS: Returns the shard holding 'index_variant_id'.
+	 */
+	size_t get_shard(std::string_view index_variant_id) const;
+
+	/**
+	 * EFFECTS: Returns the index variants of 'index_variant_ids' held by
+	 *          each shard, in the order they are given.
+	 */
+	std::vector<std::vector<std::string>> split_by_shard(
+	    const std::vector<std::string> &index_variant_ids) const;
+
+	/**
+	 * EFFECTS: Returns the directory of 'shard'.
+	 */
+	std::string get_shard_dir(size_t shard) const;
+
+	/**
+	 * EFFECTS: Stores the layout. Several processes may save the same layout
+	 *          at once, for example workers building different shards.
+	 * THROWS: shard_error if a different layout is already stored, or the
+	 *         layout cannot be written.
+	 */
+	void save() const;
+
+   private:
+	const std::string LAYOUT_FILE_PATH = "shards.txt";
+
+	std::string dir;
+	size_t n_shards;
+	bool sharded;
+
+	static size_t read_n_shards(const std::string &path);
+};
+
+/* The LDTables of every shard, read as one table. */
+class ShardedLDTable {
+   public:
+	/**
+	 * EFFECTS: Combines 'shards', which are ordered as in 'layout'.
+	 */
+	ShardedLDTable(
+	    const ShardLayout &layout,
+	    std::vector<std::shared_ptr<SegmentedLDTable>> shards);
+
+	/**
+	 * EFFECTS: Returns whether the shard of 'key' has postings for it.
+	 */
+	bool is_member(const std::string &key) const;
+
+	/**
+	 * EFFECTS: Prefetches the postings of 'keys' from their shards.
+	 */
+	void prefetch(const std::vector<std::string> &keys);
+
+	/**
+	 * EFFECTS: Returns whether the postings of every shard carry r2 values.
+	 */
+	bool has_r2() const;
+
+	/**
+	 * EFFECTS: Returns the postings of 'key' from its shard.
+	 * THROWS: vdh_key_error if !is_member(key).
+	 */
+	std::vector<std::string> lookup(const std::string &key);
+
+	/**
+	 * EFFECTS: Calls on_posting(posting) with each posting of 'key' from its
+	 *          shard. See SegmentedLDTable::for_each_posting().
+	 * THROWS: vdh_key_error if !is_member(key).
+	 */
+	template <typename F1>
+	void for_each_posting(const std::string &key, F1 on_posting);
+
+	/**
+	 * EFFECTS: Calls on_posting(posting, r2) with each posting of 'key' from
+	 *          its shard whose r2 is at least 'min_r2'. See
+	 *          SegmentedLDTable::for_each_posting().
+	 * THROWS: vdh_key_error if !is_member(key).
+	 *         std::runtime_error if the shard of 'key' has no r2 values.
+	 */
+	template <typename F1>
+	void for_each_posting(const std::string &key, double min_r2, F1 on_posting);
+
+   private:
+	ShardLayout layout;
+	std::vector<std::shared_ptr<SegmentedLDTable>> shards;
+};
+
+/* The SummaryTables of every shard, read as one table. */
+class ShardedSummaryTable {
+   public:
+	/**
+	 * EFFECTS: Combines 'shards', which are ordered as in 'layout'.
+	 */
+	ShardedSummaryTable(
+	    const ShardLayout &layout,
+	    std::vector<std::shared_ptr<SegmentedSummaryTable>> shards);
+
+	/**
+	 * EFFECTS: Returns whether the shard of 'index_variant_id' summarizes it.
+	 */
+	bool is_member(const std::string &index_variant_id) const;
+
+	/**
+	 * EFFECTS: Prefetches the summaries of 'index_variant_ids' from their
+	 *          shards.
+	 */
+	void prefetch(const std::vector<std::string> &index_variant_ids);
+
+	/**
+	 * EFFECTS: Returns the summary of 'index_variant_id' from its shard.
+	 * THROWS: vdh_key_error if !is_member(index_variant_id).
+	 */
+	IndexVariantSummary lookup(const std::string &index_variant_id);
+
+	/**
+	 * EFFECTS: Calls on_index_variant_summary(summary) with the summary of
+	 *          each index variant, one shard after another.
+	 */
+	template <typename F1>
+	void for_each_summary(F1 on_index_variant_summary);
+
+   private:
+	ShardLayout layout;
+	std::vector<std::shared_ptr<SegmentedSummaryTable>> shards;
+};
+
+/*************************************************/
+/*************************************************/
+/****         Template Implementation         ****/
+/*************************************************/
+/*************************************************/
+
+template <typename F1>
+inline void ShardedLDTable::for_each_posting(
+    const std::string &key,
+    F1 on_posting) {
+	shards[layout.get_shard(key)]->for_each_posting(key, on_posting);
+}
+
+template <typename F1>
+inline void ShardedLDTable::for_each_posting(
+    const std::string &key,
+    double min_r2,
+    F1 on_posting) {
+	shards[layout.get_shard(key)]->for_each_posting(key, min_r2, on_posting);
+}
+
+template <typename F1>
+inline void ShardedSummaryTable::for_each_summary(F1 on_index_variant_summary) {
+	for (auto &shard : shards) {
+		shard->for_each_summary(on_index_variant_summary);
+	}
+}
+
+#endif
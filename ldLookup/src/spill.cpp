@@ -0,0 +1,121 @@
+#include "spill.hpp"
+
+#include <cstdio>      // std::remove
+#include <filesystem>  // std::filesystem::path
+
+using std::string;
+
+SetupSpill::SetupSpill(const string &dir, const string &name)
+    : summaries_buffer(BUFFER_SIZE),
+      surrogates_buffer(BUFFER_SIZE),
+      n_summaries(0),
+      finished(false) {
+	std::filesystem::path dir_path(dir);
+	summaries_path = dir_path / (name + "_summaries.spill");
+	surrogates_path = dir_path / (name + "_surrogates.spill");
+
+	auto mask = std::ios_base::binary | std::ios_base::out | std::ios_base::trunc;
+	summaries_out.rdbuf()->pubsetbuf(summaries_buffer.data(), BUFFER_SIZE);
+	summaries_out.open(summaries_path, mask);
+	surrogates_out.rdbuf()->pubsetbuf(surrogates_buffer.data(), BUFFER_SIZE);
+	surrogates_out.open(surrogates_path, mask);
+	if (!summaries_out || !surrogates_out) {
+		throw spill_error("Failed to Create Spill Files in '" + dir + "'");
+	}
+
+	// Streams should throw on failure to simplify error checking.
+	summaries_out.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+	surrogates_out.exceptions(std::ofstream::badbit | std::ofstream::failbit);
+}
+
+SetupSpill::~SetupSpill() {
+	// Destructors must not throw, so discard any pending write errors.
+	summaries_out.exceptions(std::ofstream::goodbit);
+	surrogates_out.exceptions(std::ofstream::goodbit);
+	summaries_out.close();
+	surrogates_out.close();
+	std::remove(summaries_path.c_str());
+	std::remove(surrogates_path.c_str());
+}
+
+void SetupSpill::append(const LDPairView &pair) {
+	if (finished) {
+		throw spill_error("append() Called After finish()");
+	}
+	write_string(surrogates_out, pair.ld_variant_id);
+	surrogates_out.write(reinterpret_cast<const char *>(&pair.r2), sizeof(pair.r2));
+}
+
+void SetupSpill::append(const IndexVariantSummary &summary) {
+	if (finished) {
+		throw spill_error("append() Called After finish()");
+	}
+	write_string(summaries_out, summary.variant_id);
+	summaries_out.write(
+	    reinterpret_cast<const char *>(&summary.maf),
+	    sizeof(summary.maf));
+	summaries_out.write(
+	    reinterpret_cast<const char *>(&summary.n_surrogates),
+	    sizeof(summary.n_surrogates));
+	n_summaries++;
+}
+
+size_t SetupSpill::size() const {
+	return n_summaries;
+}
+
+void SetupSpill::finish() {
+	if (!finished) {
+		summaries_out.close();
+		surrogates_out.close();
+		finished = true;
+	}
+}
+
+void SetupSpill::open_for_reading(
+    std::ifstream &file,
+    const string &path,
+    std::vector<char> &buffer) const {
+	if (!finished) {
+		throw spill_error("Spill Read Before finish()");
+	}
+
+	buffer.resize(BUFFER_SIZE);
+	file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+	file.open(path, std::ios_base::binary | std::ios_base::in);
+	if (!file) {
+		throw spill_error("Failed to Open '" + path + "'");
+	}
+}
+
+void SetupSpill::write_string(std::ofstream &file, std::string_view s) {
+	size_t size = s.size();
+	file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+	file.write(s.data(), size);
+}
+
+bool SetupSpill::read_string(std::ifstream &file, string &s) {
+	size_t size;
+	if (!file.read(reinterpret_cast<char *>(&size), sizeof(size))) {
+		return false;
+	}
+	s.resize(size);
+	if (!file.read(s.data(), size)) {
+		throw spill_error("Truncated Record");
+	}
+	return true;
+}
+
+bool SetupSpill::read_summary(std::ifstream &file, IndexVariantSummary &summary) {
+	if (!read_string(file, summary.variant_id)) {
+		return false;
+	}
+	file.read(reinterpret_cast<char *>(&summary.maf), sizeof(summary.maf));
+	file.read(
+	    reinterpret_cast<char *>(&summary.n_surrogates),
+	    sizeof(summary.n_surrogates));
+	if (!file) {
+		throw spill_error("Truncated Record for " + summary.variant_id);
+	}
+	return true;
+}
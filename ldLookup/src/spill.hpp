@@ -0,0 +1,150 @@
+#ifndef _LDLOOKUP_SPILL_HPP_
+#define _LDLOOKUP_SPILL_HPP_
+
+#include <stddef.h>  // size_t
+
+#include <fstream>    // std::ifstream, std::ofstream
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parse_variants.hpp"
+
+/* Custom Exception for SetupSpill */
+struct spill_error : std::runtime_error {
+	spill_error(const std::string &msg="")
+	    : std::runtime_error("Spill Error: " + msg) {}
+};
+
+/**
+ * Temporary binary copy of the parsed LD data, written during the single
+ * text pass of setup and replayed to size and populate the tables.
+ *
+ * Two files are created in 'dir':
+ * - A summaries file holding one IndexVariantSummary record per index
+ *   variant, in input order.
+ * - A surrogates file holding the LD variant ID and r2 of each pair in LD,
+ *   in input order. The pairs of an index variant are found by reading
+ *   n_surrogates pairs after its summary.
+ *
+ * Both files are removed when the SetupSpill is destroyed.
+ */
+class SetupSpill {
+   public:
+	/**
+	 * EFFECTS: Creates an empty spill in 'dir'. Its files are named after
+	 *          'name', so spills with different names may share 'dir'.
+	 * THROWS: spill_error if the spill files cannot be created.
+	 */
+	SetupSpill(const std::string &dir, const std::string &name = "setup");
+
+	~SetupSpill();
+
+	/**
+	 * EFFECTS: Records a pair in LD. Must be called before the summary of
+	 *          the pair's index variant is recorded.
+	 * THROWS: spill_error if finish() was called.
+	 */
+	void append(const LDPairView &pair);
+
+	/**
+	 * EFFECTS: Records the summary of an index variant.
+	 * THROWS: spill_error if finish() was called.
+	 */
+	void append(const IndexVariantSummary &summary);
+
+	/**
+	 * EFFECTS: Flushes the spill to disk. After finish(), the spill is
+	 *          read-only and may be replayed any number of times.
+	 */
+	void finish();
+
+	/**
+	 * EFFECTS: Returns the number of recorded summaries.
+	 */
+	size_t size() const;
+
+	/**
+	 * EFFECTS: Calls on_index_variant_summary for each recorded summary.
+	 * THROWS: spill_error if finish() was not called or a record is corrupt.
+	 */
+	template <typename F1>
+	void iterate_summaries(F1 on_index_variant_summary) const;
+
+	/**
+	 * EFFECTS: For each recorded summary, calls
+	 *          on_ld_pair(summary, ld_variant_id, r2) for each of its pairs
+	 *          in LD, then on_index_variant_summary(summary).
+	 * THROWS: spill_error if finish() was not called or a record is corrupt.
+	 */
+	template <typename F1, typename F2>
+	void iterate(F1 on_ld_pair, F2 on_index_variant_summary) const;
+
+	SetupSpill(const SetupSpill&) = delete;
+	SetupSpill& operator=(const SetupSpill&) = delete;
+
+   private:
+	const size_t BUFFER_SIZE = 1 << 20;
+
+	std::string summaries_path;
+	std::string surrogates_path;
+	std::ofstream summaries_out;
+	std::ofstream surrogates_out;
+	std::vector<char> summaries_buffer;
+	std::vector<char> surrogates_buffer;
+	size_t n_summaries;
+	bool finished;
+
+	void open_for_reading(
+	    std::ifstream &file,
+	    const std::string &path,
+	    std::vector<char> &buffer) const;
+	static void write_string(std::ofstream &file, std::string_view s);
+	static bool read_string(std::ifstream &file, std::string &s);
+	static bool read_summary(std::ifstream &file, IndexVariantSummary &summary);
+};
+
+/*************************************************/
+/*************************************************/
+/****         Template Implementation         ****/
+/*************************************************/
+/*************************************************/
+
+template <typename F1>
+inline void SetupSpill::iterate_summaries(F1 on_index_variant_summary) const {
+	std::vector<char> buffer;
+	std::ifstream summaries;
+	open_for_reading(summaries, summaries_path, buffer);
+
+	IndexVariantSummary summary;
+	while (read_summary(summaries, summary)) {
+		on_index_variant_summary(summary);
+	}
+}
+
+template <typename F1, typename F2>
+inline void SetupSpill::iterate(
+    F1 on_ld_pair,
+    F2 on_index_variant_summary) const {
+	std::vector<char> summaries_buf, surrogates_buf;
+	std::ifstream summaries, surrogates;
+	open_for_reading(summaries, summaries_path, summaries_buf);
+	open_for_reading(surrogates, surrogates_path, surrogates_buf);
+
+	IndexVariantSummary summary;
+	std::string ld_variant_id;
+	double r2;
+	while (read_summary(summaries, summary)) {
+		for (size_t i = 0; i < summary.n_surrogates; i++) {
+			if (!read_string(surrogates, ld_variant_id)
+			    || !surrogates.read(reinterpret_cast<char *>(&r2), sizeof(r2))) {
+				throw spill_error("Truncated Surrogates for " + summary.variant_id);
+			}
+			on_ld_pair(summary, ld_variant_id, r2);
+		}
+		on_index_variant_summary(summary);
+	}
+}
+
+#endif
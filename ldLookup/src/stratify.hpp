@@ -25,15 +25,23 @@ class Histogram {
         size_t get_count(K key) const;
 
         /**
-         * TODO: Document!
+         * EFFECTS: Returns the greatest stratum bound at or below 'key'. If
+         *          '!inclusive', returns the greatest bound strictly below
+         *          'key', as tables built before strata version 2 did.
+         * THROWS: histogram_error if no such bound exists.
          */
-        K get_stratum(K key) const;
+        K get_stratum(K key, bool inclusive=true) const;
 
         /**
          * TODO: Document!
          */
         void increase_count(K key, size_t increase_by=1);
 
+        /**
+         * EFFECTS: Adds the counts of 'other' to this histogram.
+         */
+        void merge(const Histogram<K>& other);
+
         /**
          * TODO: Document!
          */
@@ -69,8 +77,8 @@ inline size_t Histogram<K>::get_count(K key) const {
 }
 
 template <typename K>
-inline K Histogram<K>::get_stratum(K key) const {
-    auto it = histogram.lower_bound(key);
+inline K Histogram<K>::get_stratum(K key, bool inclusive) const {
+    auto it = inclusive ? histogram.upper_bound(key) : histogram.lower_bound(key);
     if (it == histogram.begin()) {
         throw histogram_error("get_stratum() Called on Out-of-Range Key");
     }
@@ -83,6 +91,13 @@ inline void Histogram<K>::increase_count(K key, size_t increase_by) {
     emplace_pair.first->second += increase_by;
 }
 
+template <typename K>
+inline void Histogram<K>::merge(const Histogram<K>& other) {
+    for (auto it = other.histogram.begin(); it != other.histogram.end(); it++) {
+        increase_count(it->first, it->second);
+    }
+}
+
 template <typename K>
 inline Histogram<K> Histogram<K>::stratify(size_t bins) const {
     if (bins == 0 || total_count() == 0) {
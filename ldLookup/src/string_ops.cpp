@@ -53,10 +53,9 @@ string join(
 	return ret;
 }
 
-vector<string> sample(const string &s, const char delimiter, size_t k) {
+vector<string> sample(std::string_view s, const char delimiter, size_t k) {
 	// Sample random entries from s without constructing lots of strings.
-	std::string_view line_view = s;
-	vector<std::string_view> split_lv = split(line_view, delimiter);
+	vector<std::string_view> split_lv = split(s, delimiter);
 	auto samples = sample_with_replacement(split_lv, k);
 
 	vector<string> ret;
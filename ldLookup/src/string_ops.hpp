@@ -2,6 +2,7 @@
 #define _LDLOOKUP_STRING_OPS_HPP_
 
 #include <stddef.h>  // size_t
+#include <stdint.h>  // uint16_t, uint32_t, uint64_t
 
 #include <string>
 #include <string_view>
@@ -19,7 +20,7 @@ std::string join(
  *  TODO: Document!
  */
 std::vector<std::string> sample(
-    const std::string &s,
+    std::string_view s,
 	const char delimiter,
     size_t k);
 
@@ -31,6 +32,37 @@ std::vector<StringLike> split(
     const StringLike &s,
     const char delimiter);
 
+/**
+ * EFFECTS: Appends 'x' to 's' as a 4-byte little-endian integer, so files
+ *          do not depend on the host's byte order.
+ */
+inline void append_uint32(std::string &s, uint32_t x);
+
+/**
+ * EFFECTS: Returns the 4-byte little-endian integer at 'p'.
+ */
+inline uint32_t read_uint32(const char *p);
+
+/**
+ * EFFECTS: Appends 'x' to 's' as a 2-byte little-endian integer.
+ */
+inline void append_uint16(std::string &s, uint16_t x);
+
+/**
+ * EFFECTS: Returns the 2-byte little-endian integer at 'p'.
+ */
+inline uint16_t read_uint16(const char *p);
+
+/**
+ * EFFECTS: Appends 'x' to 's' as an 8-byte little-endian integer.
+ */
+inline void append_uint64(std::string &s, uint64_t x);
+
+/**
+ * EFFECTS: Returns the 8-byte little-endian integer at 'p'.
+ */
+inline uint64_t read_uint64(const char *p);
+
 /*************************************************/
 /*************************************************/
 /****         Template Implementation         ****/
@@ -61,4 +93,43 @@ inline std::vector<StringLike> split(
 	return ret;
 }
 
+inline void append_uint32(std::string &s, uint32_t x) {
+	for (size_t i = 0; i < sizeof(uint32_t); i++) {
+		s.push_back(static_cast<char>((x >> (8 * i)) & 0xff));
+	}
+}
+
+inline uint32_t read_uint32(const char *p) {
+	uint32_t x = 0;
+	for (size_t i = 0; i < sizeof(uint32_t); i++) {
+		x |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+	}
+	return x;
+}
+
+inline void append_uint16(std::string &s, uint16_t x) {
+	s.push_back(static_cast<char>(x & 0xff));
+	s.push_back(static_cast<char>(x >> 8));
+}
+
+inline uint16_t read_uint16(const char *p) {
+	return static_cast<uint16_t>(
+	    static_cast<unsigned char>(p[0])
+	    | static_cast<unsigned char>(p[1]) << 8);
+}
+
+inline void append_uint64(std::string &s, uint64_t x) {
+	for (size_t i = 0; i < sizeof(uint64_t); i++) {
+		s.push_back(static_cast<char>((x >> (8 * i)) & 0xff));
+	}
+}
+
+inline uint64_t read_uint64(const char *p) {
+	uint64_t x = 0;
+	for (size_t i = 0; i < sizeof(uint64_t); i++) {
+		x |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+	}
+	return x;
+}
+
 #endif
\ No newline at end of file
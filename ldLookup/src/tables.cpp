@@ -1,10 +1,288 @@
 #include "tables.hpp"
 
+#include <unistd.h>    // getpid
+
+#include <algorithm>   // std::max, std::sort, std::stable_sort, std::unique
+#include <cstdio>      // std::rename, std::remove
+#include <filesystem>  // std::filesystem
+#include <fstream>     // std::ifstream, std::ofstream
+#include <iomanip>     // std::setprecision
+#include <numeric>     // std::iota
+
 using std::string;
+using std::string_view;
 using std::vector;
 
-LDTable::LDTable(const Options& opts)
-: VectorDiskHash(opts) {}
+VariantDictionary::VariantDictionary(
+    const string& file_path,
+    const string& table_path,
+    const string& posting_codec_in)
+    : posting_codec(posting_codec_in), variant_ids(string_view(), '\t') {
+	table.reset(new VectorDiskHash({
+        file_path,
+        table_path,
+        std::max(IDS_KEY.size(), POSTING_CODEC_KEY.size()),
+        true
+    }));
+    table->push(POSTING_CODEC_KEY, posting_codec);
+}
+
+VariantDictionary::VariantDictionary(
+    const string& file_path,
+    const string& table_path,
+    dht::Residency residency)
+    : posting_codec("u32"), variant_ids(string_view(), '\t') {
+	table.reset(new VectorDiskHash({
+        file_path, table_path, 0, false, 0, residency
+    }));
+
+    // Dictionaries made before postings were compressed store no codec.
+    if (table->is_member(POSTING_CODEC_KEY)) {
+        posting_codec = string(table->lookup_range(POSTING_CODEC_KEY).at(0));
+    }
+    if (table->is_member(IDS_KEY)) {
+        variant_ids = table->lookup_range(IDS_KEY);
+    }
+}
+
+uint32_t VariantDictionary::add(string_view variant_id) {
+    auto it = ordinals.find(variant_id);
+    if (it != ordinals.end()) {
+        return it->second;
+    }
+
+    table->push(IDS_KEY, variant_id);
+
+    // Copy the ID into the arena, starting a chunk if it does not fit.
+    if (id_arena.empty()
+        || id_arena.back().size() + variant_id.size() > id_arena.back().capacity()) {
+        id_arena.emplace_back();
+        id_arena.back().reserve(std::max(ID_ARENA_CHUNK_SIZE, variant_id.size()));
+    }
+    std::string& chunk = id_arena.back();
+    chunk.append(variant_id);
+    string_view stored_id(chunk.data() + chunk.size() - variant_id.size(), variant_id.size());
+
+    uint32_t ordinal = ordinals.size();
+    ordinals.emplace(stored_id, ordinal);
+    return ordinal;
+}
+
+string_view VariantDictionary::get_variant_id(uint32_t ordinal) const {
+    return variant_ids.at(ordinal);
+}
+
+size_t VariantDictionary::size() const {
+    return ordinals.empty() ? variant_ids.size() : ordinals.size();
+}
+
+const string& VariantDictionary::get_posting_codec() const {
+    return posting_codec;
+}
+
+void VariantDictionary::flush() {
+    table->flush();
+}
+
+LDTable::LDTable(
+    const Options& opts,
+    const string& dictionary_file_path,
+    const string& dictionary_table_path,
+    bool store_r2)
+    : compressed(false), with_r2(false) {
+	table.reset(new VectorDiskHash(opts));
+
+    if (opts.create) {
+        dictionary.reset(new VariantDictionary(
+            dictionary_file_path,
+            dictionary_table_path,
+            store_r2 ? POSTING_CODEC : R2_FREE_POSTING_CODEC));
+        compressed = true;
+        with_r2 = store_r2;
+    } else if (std::filesystem::exists(dictionary_table_path)) {
+        dictionary.reset(new VariantDictionary(
+            dictionary_file_path, dictionary_table_path, opts.residency));
+
+        const string& codec = dictionary->get_posting_codec();
+        if (codec != POSTING_CODEC
+            && codec != R2_FREE_POSTING_CODEC
+            && codec != UNCOMPRESSED_POSTING_CODEC) {
+            throw vdh_internal_error(opts, "Unknown Posting Codec " + codec);
+        }
+        compressed = codec != UNCOMPRESSED_POSTING_CODEC;
+        with_r2 = codec == POSTING_CODEC;
+    }
+
+    // Otherwise, the table was made before dictionaries existed, and its
+    // postings hold IDs.
+}
+
+void LDTable::push(
+    const string& index_variant_id,
+    string_view ld_variant_id,
+    double r2) {
+    if (pushed_ordinals.empty() || index_variant_id != pushed_key) {
+        if (!dictionary || !table->get_options().create) {
+            auto msg = "LDTable push(): LDTable is Read-Only";
+            throw vdh_mode_error(table->get_options(), msg);
+        } else if (table->is_member(index_variant_id)) {
+            auto msg = "LDTable push(): Postings Already Written for ";
+            throw vdh_value_error(table->get_options(), msg + index_variant_id);
+        }
+        commit_pushed();
+        pushed_key = index_variant_id;
+    }
+    pushed_ordinals.push_back(dictionary->add(ld_variant_id));
+    if (with_r2) {
+        pushed_r2s.push_back(quantize_r2(r2));
+    }
+}
+
+void LDTable::flush() {
+    commit_pushed();
+    table->flush();
+    if (dictionary) {
+        dictionary->flush();
+    }
+}
+
+bool LDTable::is_member(const string& index_variant_id) const {
+    return (!pushed_ordinals.empty() && index_variant_id == pushed_key)
+        || table->is_member(index_variant_id);
+}
+
+void LDTable::prefetch(const vector<string>& index_variant_ids) {
+    table->prefetch(index_variant_ids);
+}
+
+bool LDTable::has_r2() const {
+    return with_r2;
+}
+
+vector<string> LDTable::lookup(const string& index_variant_id) {
+    vector<string> postings;
+    for_each_posting(index_variant_id, [&](string_view posting) {
+        postings.emplace_back(posting);
+    });
+    return postings;
+}
+
+void LDTable::commit_pushed() {
+    if (pushed_ordinals.empty()) {
+        return;
+    }
+
+    // Ordinals are pushed as one value, so the table stores no offsets
+    // between them.
+    encoded_ordinals.clear();
+    if (!with_r2) {
+        encode_postings(pushed_ordinals, encoded_ordinals);
+        table->push(pushed_key, encoded_ordinals);
+        pushed_ordinals.clear();
+        return;
+    }
+
+    // Sort postings by descending r2, keeping the order of equal r2s.
+    posting_order.resize(pushed_ordinals.size());
+    std::iota(posting_order.begin(), posting_order.end(), 0);
+    std::stable_sort(
+        posting_order.begin(),
+        posting_order.end(),
+        [&](size_t a, size_t b) { return pushed_r2s[a] > pushed_r2s[b]; });
+
+    sorted_ordinals.clear();
+    encoded_r2s.clear();
+    for (size_t i : posting_order) {
+        sorted_ordinals.push_back(pushed_ordinals[i]);
+        append_uint16(encoded_r2s, pushed_r2s[i]);
+    }
+    encode_postings(sorted_ordinals, encoded_ordinals);
+    table->push(pushed_key, encoded_ordinals);
+    table->push(pushed_key, encoded_r2s);
+    pushed_ordinals.clear();
+    pushed_r2s.clear();
+}
+
+R2Cutoffs::R2Cutoffs(const string& dir_in) : dir(dir_in) {
+    std::filesystem::path path = std::filesystem::path(dir) / CUTOFFS_FILE_PATH;
+    if (std::filesystem::exists(path)) {
+        cutoffs = read_cutoffs(path);
+    }
+}
+
+R2Cutoffs::R2Cutoffs(const string& dir_in, vector<double> cutoffs_in)
+    : dir(dir_in), cutoffs(cutoffs_in) {
+    std::sort(cutoffs.begin(), cutoffs.end());
+    cutoffs.erase(std::unique(cutoffs.begin(), cutoffs.end()), cutoffs.end());
+    for (double cutoff : cutoffs) {
+        if (!(cutoff > 0 && cutoff <= 1)) {
+            throw r2_cutoff_error("Cutoffs Must Be in (0, 1]");
+        }
+    }
+}
+
+const vector<double>& R2Cutoffs::get_cutoffs() const {
+    return cutoffs;
+}
+
+size_t R2Cutoffs::find(double r2) const {
+    auto it = std::find(cutoffs.begin(), cutoffs.end(), r2);
+    if (it == cutoffs.end()) {
+        string msg = "Lookup Table Has No Cutoff " + std::to_string(r2)
+            + "\nCutoffs:";
+        for (double cutoff : cutoffs) {
+            msg += " " + std::to_string(cutoff);
+        }
+        throw r2_cutoff_error(cutoffs.empty() ? msg + " None" : msg);
+    }
+    return it - cutoffs.begin();
+}
+
+void R2Cutoffs::save() const {
+    std::filesystem::path path = std::filesystem::path(dir) / CUTOFFS_FILE_PATH;
+    if (std::filesystem::exists(path)) {
+        if (read_cutoffs(path) != cutoffs) {
+            throw r2_cutoff_error("Lookup Table Has Different Cutoffs: " + dir);
+        }
+        return;
+    } else if (cutoffs.empty()) {
+        return;
+    }
+
+    // Write a temporary file, then rename it into place. Cutoffs are
+    // written with enough digits to read back exactly.
+    string tmp_path = path.string() + "." + std::to_string(getpid()) + ".tmp";
+    std::ofstream file(tmp_path, std::ios_base::out | std::ios_base::trunc);
+    file << "# ldLookup r2 cutoffs\n" << std::setprecision(17);
+    for (double cutoff : cutoffs) {
+        file << cutoff << '\n';
+    }
+    file.close();
+
+    if (!file || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        throw r2_cutoff_error("Failed to Write Cutoffs: " + path.string());
+    }
+}
+
+vector<double> R2Cutoffs::read_cutoffs(const string& path) {
+    std::ifstream file(path);
+    vector<double> cutoffs;
+    string line;
+    try {
+        while (std::getline(file, line)) {
+            if (line.size() && line[0] != '#') {
+                cutoffs.push_back(std::stod(line));
+            }
+        }
+    } catch (std::logic_error& e) {
+        throw r2_cutoff_error("Unreadable Cutoffs: " + path);
+    }
+    if (file.bad()) {
+        throw r2_cutoff_error("Unreadable Cutoffs: " + path);
+    }
+    return cutoffs;
+}
 
 StrataTable::StrataTable(
     const string& file_path,
@@ -13,28 +291,42 @@ StrataTable::StrataTable(
     Histogram<double> maf_strata_in)
     : n_surrogates_strata(n_surrogates_strata_in),
       maf_strata(maf_strata_in) {
+    n_surrogates_strata.increase_count(0, 0);
+    maf_strata.increase_count(0.0, 0);
+
+    // Keys are the version, the two lists of strata and at most every pair
+    // of strata.
+    size_t n_keys = 3 + n_surrogates_strata.strata().size()
+        * maf_strata.strata().size();
 	table.reset(new VectorDiskHash({
-        file_path, table_path, MAX_KEY_SIZE, true
+        file_path, table_path, MAX_KEY_SIZE, true, n_keys
     }));
 
-    n_surrogates_strata.increase_count(0, 0);
+    table->push(VERSION_KEY, VERSION);
+
     for (size_t n_surrogates : n_surrogates_strata.strata()) {
-        table->append(N_SURROGATES_KEY, std::to_string(n_surrogates));
+        table->push(N_SURROGATES_KEY, std::to_string(n_surrogates));
     }
 
-    maf_strata.increase_count(0.0, 0);
     for (double maf : maf_strata.strata()) {
-        table->append(MAF_KEY, std::to_string(maf));
+        table->push(MAF_KEY, std::to_string(maf));
     }
 }
 
 StrataTable::StrataTable(
     const string& file_path,
-    const string& table_path) {
+    const string& table_path,
+    dht::Residency residency) {
 	table.reset(new VectorDiskHash({
-        file_path, table_path, MAX_KEY_SIZE, false
+        file_path, table_path, MAX_KEY_SIZE, false, 0, residency
     }));
 
+    if (!table->is_member(VERSION_KEY)) {
+        bounds_inclusive = false;
+    } else if (table->lookup(VERSION_KEY) != vector<string>{VERSION}) {
+        throw strata_version_error("Unsupported Strata Version: " + table_path);
+    }
+
     try {
         for (string n_surrogates_str : table->lookup(N_SURROGATES_KEY)) {
             auto n_surrogates = static_cast<size_t>(std::stoull(n_surrogates_str));
@@ -60,6 +352,10 @@ vector<string> StrataTable::lookup(const IndexVariantSummary& summary) {
     return table->lookup(get_stratum(summary));
 }
 
+ValueRange StrataTable::lookup_range(const IndexVariantSummary& summary) {
+    return table->lookup_range(get_stratum(summary));
+}
+
 vector<string> StrataTable::lookup_sample(
     const IndexVariantSummary& summary,
     const size_t k) {
@@ -67,17 +363,33 @@ vector<string> StrataTable::lookup_sample(
 }
 
 void StrataTable::reserve(
-    const Histogram<StrataTable::Stratum>& strata_sizes) {
-    for (auto &stratum : strata_sizes.strata()) {
-        size_t bytes_to_reserve = strata_sizes.get_count(stratum);
-        table->reserve(stratum, bytes_to_reserve);
+    const Histogram<StrataTable::Stratum>& strata_counts,
+    const Histogram<StrataTable::Stratum>& strata_bytes) {
+    for (auto &stratum : strata_counts.strata()) {
+        table->reserve(
+            stratum,
+            strata_counts.get_count(stratum),
+            strata_bytes.get_count(stratum));
     }
 }
 
+void StrataTable::flush() {
+    table->flush();
+}
+
+const Histogram<size_t>& StrataTable::get_n_surrogates_strata() const {
+    return n_surrogates_strata;
+}
+
+const Histogram<double>& StrataTable::get_maf_strata() const {
+    return maf_strata;
+}
+
 StrataTable::Stratum
 StrataTable::get_stratum(const IndexVariantSummary& summary) {
-    size_t surr_stratum = n_surrogates_strata.get_stratum(summary.n_surrogates);
-    double maf_stratum = maf_strata.get_stratum(summary.maf);
+    size_t surr_stratum = n_surrogates_strata.get_stratum(
+        summary.n_surrogates, bounds_inclusive);
+    double maf_stratum = maf_strata.get_stratum(summary.maf, bounds_inclusive);
     return std::to_string(surr_stratum) + " " + std::to_string(maf_stratum);
 }
 
@@ -90,9 +402,24 @@ void SummaryTable::append(const IndexVariantSummary& summary) {
         std::to_string(summary.maf),
         std::to_string(summary.n_surrogates)
     };
+    for (size_t n_surrogates : summary.n_surrogates_at_r2_cutoffs) {
+        values.push_back(std::to_string(n_surrogates));
+    }
     table->append(summary.variant_id, values);
 }
 
+void SummaryTable::flush() {
+    table->flush();
+}
+
+bool SummaryTable::is_member(const string &index_variant_id) const {
+    return table->is_member(index_variant_id);
+}
+
+void SummaryTable::prefetch(const vector<string>& index_variant_ids) {
+    table->prefetch(index_variant_ids);
+}
+
 IndexVariantSummary SummaryTable::lookup(const string &index_variant_id) {
     IndexVariantSummary ret{ index_variant_id, 0.0, 0 };
     vector<string> lookup_values = table->lookup(index_variant_id);
@@ -100,6 +427,10 @@ IndexVariantSummary SummaryTable::lookup(const string &index_variant_id) {
         ret.maf = std::stod(lookup_values.at(0));
         auto n_surrogates = std::stoull(lookup_values.at(1));
         ret.n_surrogates = static_cast<size_t>(n_surrogates);
+        for (size_t i = 2; i < lookup_values.size(); i++) {
+            n_surrogates = std::stoull(lookup_values[i]);
+            ret.n_surrogates_at_r2_cutoffs.push_back(static_cast<size_t>(n_surrogates));
+        }
         return ret;
     } catch (std::invalid_argument& e) {
         auto msg = "SummaryTable lookup(): Corrupted Value for Key ";
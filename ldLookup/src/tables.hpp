@@ -2,22 +2,289 @@
 #define _LDLOOKUP_TABLES_HPP_
 
 #include <stddef.h>  // size_t
+#include <stdint.h>  // uint16_t, uint32_t
 
-#include <memory>  // std::shared_ptr
+#include <deque>      // std::deque
+#include <memory>     // std::shared_ptr
+#include <stdexcept>  // std::runtime_error
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "parse_variants.hpp"
+#include "posting_codec.hpp"
 #include "stratify.hpp"
+#include "string_ops.hpp"
 #include "vdh.hpp"
 
 /**
- * TODO: Document!
+ * Numbers variant IDs densely from 0 in the order they are first added,
+ * so tables can refer to a variant by its 4-byte ordinal instead of its ID.
  */
-class LDTable : public VectorDiskHash {
+class VariantDictionary {
    public:
 	/**
-	 * TODO: Document!
+	 * EFFECTS: Creates a VariantDictionary stored at 'file_path' and
+	 *          'table_path', for postings encoded with 'posting_codec'.
+	 * THROWS: vdh_mode_error if either file already exists.
+	 */
+	VariantDictionary(
+	    const std::string& file_path,
+	    const std::string& table_path,
+	    const std::string& posting_codec);
+
+	/**
+	 * EFFECTS: Opens the VariantDictionary stored at 'file_path' and
+	 *          'table_path', brought into memory as 'residency' says.
+	 * THROWS: vdh_mode_error if either file does not exist.
+	 */
+	VariantDictionary(
+	    const std::string& file_path,
+	    const std::string& table_path,
+	    dht::Residency residency = dht::DHDefault);
+
+	/**
+	 * EFFECTS: Returns the ordinal of 'variant_id', adding it if it is new.
+	 * THROWS: vdh_mode_error if the dictionary is read-only.
 	 */
-	LDTable(const Options& opts);
+	uint32_t add(std::string_view variant_id);
+
+	/**
+	 * EFFECTS: Returns the ID of the variant numbered 'ordinal'.
+	 * THROWS: std::out_of_range if ordinal >= size().
+	 */
+	std::string_view get_variant_id(uint32_t ordinal) const;
+
+	/**
+	 * EFFECTS: Returns the number of variants.
+	 */
+	size_t size() const;
+
+	/**
+	 * EFFECTS: Returns the codec of the postings whose ordinals refer to
+	 *          this dictionary. Dictionaries made before postings were
+	 *          compressed have the codec "u32".
+	 */
+	const std::string& get_posting_codec() const;
+
+	/**
+	 * EFFECTS: Writes added variants to disk.
+	 * THROWS: vdh_internal_error if the variants cannot be written.
+	 */
+	void flush();
+
+   private:
+	const std::string IDS_KEY = "__VARIANT_IDS__";
+	const std::string POSTING_CODEC_KEY = "__CODEC__";
+	const size_t ID_ARENA_CHUNK_SIZE = 1 << 20;
+
+	std::string posting_codec;
+
+	/* Stores the IDs as the values of IDS_KEY, in ordinal order. */
+	std::shared_ptr<VectorDiskHash> table;
+
+	/*
+	 * Maps IDs to ordinals while the dictionary is written. The IDs are
+	 * copied into the chunks of 'id_arena', which are never reallocated.
+	 */
+	std::unordered_map<std::string_view, uint32_t> ordinals;
+	std::deque<std::string> id_arena;
+
+	/* Views the IDs of a read-only dictionary. */
+	ValueRange variant_ids;
+};
+
+/**
+ * Maps each index variant to the IDs of its LD surrogates (its postings).
+ *
+ * Surrogate IDs are stored once, in a VariantDictionary. Each posting list
+ * is two values: its ordinals, compressed as in posting_codec.hpp, then the
+ * r2 of each posting as a 2-byte little-endian quantize_r2() value. Postings
+ * are sorted by descending r2, so the postings at or above any minimum r2
+ * are a prefix of the list.
+ *
+ * Older LDTables can still be read, but carry no r2 values: those made
+ * before r2 values were stored hold only the compressed ordinals, those made
+ * before postings were compressed hold 4-byte little-endian ordinals, and
+ * those made before dictionaries existed hold the IDs themselves.
+ */
+class LDTable {
+   public:
+	/**
+	 * EFFECTS: Creates or opens an LDTable whose postings are stored as
+	 *          described by 'opts', and whose dictionary is stored at
+	 *          'dictionary_file_path' and 'dictionary_table_path'. A created
+	 *          LDTable stores r2 values unless 'store_r2' is false.
+	 * THROWS: vdh_mode_error (see Options class).
+	 */
+	LDTable(
+	    const Options& opts,
+	    const std::string& dictionary_file_path,
+	    const std::string& dictionary_table_path,
+	    bool store_r2 = true);
+
+	/**
+	 * EFFECTS: Adds 'ld_variant_id', in LD with 'index_variant_id' at 'r2',
+	 *          to the postings of 'index_variant_id'. 'r2' is ignored if
+	 *          !has_r2(). The postings of each index variant must be pushed
+	 *          in a row.
+	 * THROWS: vdh_mode_error if the LDTable is read-only.
+	 *         vdh_value_error if postings were already written for
+	 *         'index_variant_id'.
+	 */
+	void push(
+	    const std::string& index_variant_id,
+	    std::string_view ld_variant_id,
+	    double r2);
+
+	/**
+	 * EFFECTS: Writes pushed postings to disk.
+	 * THROWS: vdh_internal_error if the postings cannot be written.
+	 */
+	void flush();
+
+	/**
+	 * EFFECTS: Returns whether postings were pushed for 'index_variant_id'.
+	 */
+	bool is_member(const std::string& index_variant_id) const;
+
+	/**
+	 * EFFECTS: Prefetches the postings of 'index_variant_ids', so looking
+	 *          them up soon after is faster. See VectorDiskHash::prefetch().
+	 */
+	void prefetch(const std::vector<std::string>& index_variant_ids);
+
+	/**
+	 * EFFECTS: Returns whether postings carry r2 values.
+	 */
+	bool has_r2() const;
+
+	/**
+	 * EFFECTS: Returns the postings of 'index_variant_id'.
+	 * THROWS: vdh_key_error if !is_member(index_variant_id).
+	 */
+	std::vector<std::string> lookup(const std::string& index_variant_id);
+
+	/**
+	 * EFFECTS: Calls on_posting(posting) with each posting of
+	 *          'index_variant_id', as a std::string_view into the table. If
+	 *          has_r2(), postings are in descending order of r2, and
+	 *          otherwise in the order they were pushed. Postings with equal
+	 *          r2 keep the order they were pushed.
+	 * THROWS: vdh_key_error if !is_member(index_variant_id).
+	 */
+	template <typename F1>
+	void for_each_posting(const std::string& index_variant_id, F1 on_posting);
+
+	/**
+	 * EFFECTS: Calls on_posting(posting, r2) with each posting of
+	 *          'index_variant_id' whose r2 is at least 'min_r2', in
+	 *          descending order of r2. Both r2 values are compared as
+	 *          rounded by quantize_r2(). Postings below 'min_r2' are not
+	 *          decoded.
+	 * THROWS: vdh_key_error if !is_member(index_variant_id).
+	 *         std::runtime_error if !has_r2().
+	 */
+	template <typename F1>
+	void for_each_posting(
+	    const std::string& index_variant_id,
+	    double min_r2,
+	    F1 on_posting);
+
+   private:
+	const std::string POSTING_CODEC = "delta-bp128-r2";
+	const std::string R2_FREE_POSTING_CODEC = "delta-bp128";
+	const std::string UNCOMPRESSED_POSTING_CODEC = "u32";
+
+	std::shared_ptr<VectorDiskHash> table;
+
+	/* Is null if the postings hold IDs rather than ordinals. */
+	std::shared_ptr<VariantDictionary> dictionary;
+
+	/* Are true if ordinals are compressed, and if r2 values follow them. */
+	bool compressed;
+	bool with_r2;
+
+	/* Stores the key, ordinals, and r2 values gathered by push(). */
+	std::string pushed_key;
+	std::vector<uint32_t> pushed_ordinals;
+	std::vector<uint16_t> pushed_r2s;
+
+	/* Buffers for sorting and encoding pushed postings. */
+	std::vector<size_t> posting_order;
+	std::vector<uint32_t> sorted_ordinals;
+	std::string encoded_ordinals;
+	std::string encoded_r2s;
+
+	void commit_pushed();
+};
+
+/* Custom Exception for R2Cutoffs */
+struct r2_cutoff_error : std::runtime_error {
+	r2_cutoff_error(const std::string& msg="")
+	    : std::runtime_error("R2 Cutoff Error: " + msg) {}
+};
+
+/**
+ * The r2 cutoffs, besides the setup threshold, at which the LD surrogates of
+ * each index variant are counted. Each cutoff has its own StrataTable, so
+ * index variants can be matched by their number of LD surrogates at any
+ * cutoff without a rebuild.
+ *
+ * The cutoffs are stored as a text file in the lookup table directory, and
+ * apply to every segment and shard. Directories without that file have no
+ * cutoffs.
+ */
+class R2Cutoffs {
+   public:
+	/**
+	 * EFFECTS: Reads the cutoffs of the lookup table in 'dir'.
+	 * THROWS: r2_cutoff_error if the cutoffs are unreadable.
+	 */
+	R2Cutoffs(const std::string& dir);
+
+	/**
+	 * EFFECTS: Creates the cutoffs 'cutoffs', in ascending order, for the
+	 *          lookup table in 'dir'. They are not stored until save() is
+	 *          called.
+	 * THROWS: r2_cutoff_error if a cutoff is not in (0, 1].
+	 */
+	R2Cutoffs(const std::string& dir, std::vector<double> cutoffs);
+
+	/**
+	 * EFFECTS: Returns the cutoffs in ascending order.
+	 */
+	const std::vector<double>& get_cutoffs() const;
+
+	/**
+	 * EFFECTS: Returns the position of 'r2' in get_cutoffs().
+	 * THROWS: r2_cutoff_error if 'r2' is not a cutoff.
+	 */
+	size_t find(double r2) const;
+
+	/**
+	 * EFFECTS: Stores the cutoffs, unless there are none. Several processes
+	 *          may save the same cutoffs at once, for example workers
+	 *          building different shards.
+	 * THROWS: r2_cutoff_error if different cutoffs are already stored, or
+	 *         the cutoffs cannot be written.
+	 */
+	void save() const;
+
+   private:
+	const std::string CUTOFFS_FILE_PATH = "r2_cutoffs.txt";
+
+	std::string dir;
+	std::vector<double> cutoffs;
+
+	static std::vector<double> read_cutoffs(const std::string& path);
+};
+
+/* Custom Exception for StrataTable */
+struct strata_version_error : std::runtime_error {
+	strata_version_error(const std::string& msg="")
+	    : std::runtime_error("Strata Version Error: " + msg) {}
 };
 
 /**
@@ -37,11 +304,13 @@ class StrataTable {
 	    Histogram<double> maf_strata_in);
 
     /**
-	 * TODO: Document!
+	 * EFFECTS: Opens the StrataTable at 'table_path'.
+	 * THROWS: strata_version_error if its strata version is unsupported.
 	 */
 	StrataTable(
 	    const std::string& file_path,
-        const std::string& table_path);
+        const std::string& table_path,
+	    dht::Residency residency = dht::DHDefault);
 
 	/**
 	 * TODO: Document!
@@ -58,6 +327,13 @@ class StrataTable {
 	 */
 	std::vector<std::string> lookup(const IndexVariantSummary& summary);
 
+	/**
+	 * EFFECTS: Returns a view of the index variants in the stratum of
+	 *          'summary'. See VectorDiskHash::lookup_range().
+	 * THROWS: vdh_key_error if the stratum is empty.
+	 */
+	ValueRange lookup_range(const IndexVariantSummary& summary);
+
 	/**
 	 * TODO: Document!
 	 */
@@ -66,14 +342,44 @@ class StrataTable {
 		const size_t k);
 
 	/**
-	 * TODO: Document!
+	 * EFFECTS: Reserves space for each stratum in 'strata_counts' to hold
+	 *          its count of index variants, whose IDs total its count in
+	 *          'strata_bytes' bytes.
 	 */
-	void reserve(const Histogram<Stratum>& strata_sizes);
+	void reserve(
+	    const Histogram<Stratum>& strata_counts,
+	    const Histogram<Stratum>& strata_bytes);
+
+	/**
+	 * EFFECTS: Writes buffered strata to disk.
+	 * THROWS: vdh_internal_error if the strata cannot be written.
+	 */
+	void flush();
+
+	/**
+	 * EFFECTS: Returns the lower bounds of the strata for number of LD
+	 *          surrogates.
+	 */
+	const Histogram<size_t>& get_n_surrogates_strata() const;
+
+	/**
+	 * EFFECTS: Returns the lower bounds of the strata for MAF.
+	 */
+	const Histogram<double>& get_maf_strata() const;
 
    private:
 	const size_t MAX_KEY_SIZE = 64;
 	const std::string N_SURROGATES_KEY = "__N_SURROGATES_KEY__";
 	const std::string MAF_KEY = "__MAF_KEY__";
+	const std::string VERSION_KEY = "__STRATA_VERSION_KEY__";
+
+	/*
+	 * Version 2 puts variants equal to a stratum bound in that stratum.
+	 * Tables without VERSION_KEY put them in the stratum below, and are
+	 * still looked up that way.
+	 */
+	const std::string VERSION = "2";
+	bool bounds_inclusive = true;
 
 	Histogram<size_t> n_surrogates_strata;
 	Histogram<double> maf_strata;
@@ -81,7 +387,8 @@ class StrataTable {
 };
 
 /**
- * TODO: Document!
+ * Maps each index variant to its MAF, number of LD surrogates, and number
+ * of LD surrogates at each R2Cutoffs cutoff, as text values in that order.
  */
 class SummaryTable {
    public:
@@ -100,8 +407,112 @@ class SummaryTable {
 	 */
 	IndexVariantSummary lookup(const std::string& index_variant_id);
 
+	/**
+	 * EFFECTS: Writes buffered summaries to disk.
+	 * THROWS: vdh_internal_error if the summaries cannot be written.
+	 */
+	void flush();
+
+	/**
+	 * EFFECTS: Returns whether a summary was appended for 'index_variant_id'.
+	 */
+	bool is_member(const std::string& index_variant_id) const;
+
+	/**
+	 * EFFECTS: Prefetches the summaries of 'index_variant_ids', so looking
+	 *          them up soon after is faster. See VectorDiskHash::prefetch().
+	 */
+	void prefetch(const std::vector<std::string>& index_variant_ids);
+
+	/**
+	 * EFFECTS: Calls on_index_variant_summary(summary) for each summary, in
+	 *          the order they were appended.
+	 */
+	template <typename F1>
+	void for_each_summary(F1 on_index_variant_summary);
+
    private:
 	std::shared_ptr<VectorDiskHash> table;
 };
 
-#endif
\ No newline at end of file
+/*************************************************/
+/*************************************************/
+/****         Template Implementation         ****/
+/*************************************************/
+/*************************************************/
+
+template <typename F1>
+inline void LDTable::for_each_posting(
+    const std::string& index_variant_id,
+    F1 on_posting) {
+	ValueRange values = table->lookup_range(index_variant_id);
+	if (!dictionary) {
+		for (std::string_view ld_variant_id : values) {
+			on_posting(ld_variant_id);
+		}
+		return;
+	}
+
+	if (with_r2) {
+		decode_postings(values.at(0), [&](uint32_t ordinal) {
+			on_posting(dictionary->get_variant_id(ordinal));
+		});
+		return;
+	}
+
+	for (std::string_view ordinals : values) {
+		if (compressed) {
+			decode_postings(ordinals, [&](uint32_t ordinal) {
+				on_posting(dictionary->get_variant_id(ordinal));
+			});
+			continue;
+		}
+
+		size_t n_ordinals = ordinals.size() / sizeof(uint32_t);
+		for (size_t i = 0; i < n_ordinals; i++) {
+			uint32_t ordinal = read_uint32(&ordinals[i * sizeof(uint32_t)]);
+			on_posting(dictionary->get_variant_id(ordinal));
+		}
+	}
+}
+
+template <typename F1>
+inline void LDTable::for_each_posting(
+    const std::string& index_variant_id,
+    double min_r2,
+    F1 on_posting) {
+	if (!with_r2) {
+		throw std::runtime_error("LDTable for_each_posting(): No r2 Values");
+	}
+
+	ValueRange values = table->lookup_range(index_variant_id);
+	std::string_view r2s = values.at(1);
+
+	// r2 values descend, so binary search for the first below 'min_r2'.
+	uint16_t min_quantized = quantize_r2(min_r2);
+	size_t begin = 0;
+	size_t end = r2s.size() / sizeof(uint16_t);
+	while (begin < end) {
+		size_t mid = begin + (end - begin) / 2;
+		if (read_uint16(&r2s[mid * sizeof(uint16_t)]) >= min_quantized) {
+			begin = mid + 1;
+		} else {
+			end = mid;
+		}
+	}
+
+	size_t i = 0;
+	decode_postings(values.at(0), begin, [&](uint32_t ordinal) {
+		uint16_t r2 = read_uint16(&r2s[i++ * sizeof(uint16_t)]);
+		on_posting(dictionary->get_variant_id(ordinal), dequantize_r2(r2));
+	});
+}
+
+template <typename F1>
+inline void SummaryTable::for_each_summary(F1 on_index_variant_summary) {
+	table->for_each_key([&](const std::string& index_variant_id) {
+		on_index_variant_summary(lookup(index_variant_id));
+	});
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef _LDLOOKUP_TOKENIZE_HPP_
+#define _LDLOOKUP_TOKENIZE_HPP_
+
+#include <stddef.h>  // size_t
+
+#include <string_view>
+
+/**
+ * EFFECTS: Calls on_column(column, text) for the first 'max_column' columns
+ *          of 'line', where 'column' counts from 1. Returns the number of
+ *          columns visited. Scanning stops once column 'max_column' ends,
+ *          so trailing columns are never examined.
+ *
+ *          As with split(), consecutive delimiters count as one, and leading
+ *          and trailing delimiters are ignored. Delimiters are located 16
+ *          bytes at a time with SSE2 where available.
+ */
+template <typename F>
+size_t for_each_column(
+    std::string_view line,
+    char delimiter,
+    size_t max_column,
+    F on_column);
+
+/**
+ * EFFECTS: Parses all of 'text' as a double without allocating or throwing.
+ *          Returns false if 'text' is empty, is not entirely a number, or
+ *          is out of range for a double.
+ */
+bool parse_double(std::string_view text, double& value);
+
+/*************************************************/
+/*************************************************/
+/****             Implementations             ****/
+/*************************************************/
+/*************************************************/
+
+#include <stdint.h>  // uint32_t
+
+#include <charconv>      // std::from_chars
+#include <cstring>       // std::memcpy
+#include <system_error>  // std::errc
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * EFFECTS: Returns a mask whose i-th bit is set if block[i] == delimiter,
+ *          for the 16 bytes at 'block'.
+ */
+inline uint32_t delimiter_mask(const char* block, char delimiter) {
+#if defined(__SSE2__)
+	__m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+	__m128i matches = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(delimiter));
+	return static_cast<uint32_t>(_mm_movemask_epi8(matches));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < 16; i++) {
+		mask |= static_cast<uint32_t>(block[i] == delimiter) << i;
+	}
+	return mask;
+#endif
+}
+
+template <typename F>
+inline size_t for_each_column(
+    std::string_view line,
+    char delimiter,
+    size_t max_column,
+    F on_column) {
+	const char* data = line.data();
+	size_t size = line.size();
+	size_t n_columns = 0;
+	bool in_column = false;
+	size_t column_start = 0;
+
+	if (max_column == 0) {
+		return 0;
+	}
+
+	for (size_t base = 0; base < size; base += 16) {
+		// Compute the delimiter mask of this block. The final block is
+		// copied and padded with delimiters so we never read past 'line'.
+		uint32_t delimiters;
+		if (size - base >= 16) {
+			delimiters = delimiter_mask(data + base, delimiter);
+		} else {
+			char tail[16];
+			std::memset(tail, delimiter, sizeof(tail));
+			std::memcpy(tail, data + base, size - base);
+			delimiters = delimiter_mask(tail, delimiter);
+		}
+
+		// Alternate between looking for the start of a column (a
+		// non-delimiter) and the end of a column (a delimiter).
+		uint32_t searched = 0;
+		while (true) {
+			uint32_t candidates = in_column ? delimiters : ~delimiters & 0xFFFF;
+			candidates &= ~searched;
+			if (!candidates) {
+				break;
+			}
+
+			unsigned i = __builtin_ctz(candidates);
+			searched = (2u << i) - 1;
+			if (in_column) {
+				n_columns++;
+				on_column(
+				    n_columns,
+				    std::string_view(data + column_start, base + i - column_start));
+				if (n_columns == max_column) {
+					return n_columns;
+				}
+			} else {
+				column_start = base + i;
+			}
+			in_column = !in_column;
+		}
+	}
+
+	// Report a column that ends at the end of 'line'.
+	if (in_column) {
+		n_columns++;
+		on_column(
+		    n_columns,
+		    std::string_view(data + column_start, size - column_start));
+	}
+
+	return n_columns;
+}
+
+inline bool parse_double(std::string_view text, double& value) {
+	const char* end = text.data() + text.size();
+	auto result = std::from_chars(text.data(), end, value);
+	return result.ec == std::errc() && result.ptr == end && !text.empty();
+}
+
+#endif
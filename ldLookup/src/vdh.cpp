@@ -1,70 +1,181 @@
-#include <iterator>  // std::ostream_iterator
+#include <algorithm>   // std::copy, std::min
+#include <cstdio>      // std::rename, std::remove
+#include <filesystem>  // std::filesystem::exists
+#include <iterator>    // std::distance
+#include <random>      // std::mt19937, random_device, uniform_int_distribution
+#include <sstream>     // std::istringstream
 #include <string_view>
 
 #include "string_ops.hpp"
 #include "vdh.hpp"
 
 using std::string;
+using std::string_view;
 using std::vector;
 
-VectorDiskHash::VectorDiskHash(const Options &opts)
-    : options(opts), eof_key("") {
-	if (options.max_key_size) {
-		options.max_key_size++;
+ValueRange::iterator::iterator(const ValueRange *range_in, size_t index_in)
+    : range(range_in), index(index_in) {
+	if (index != string_view::npos) {
+		rest = range->values;
+		read_value();
 	}
-	
-	// Set up 'file'.
-	auto file_mask = std::ios_base::binary | std::ios_base::in;
-	if (options.create) {
-		// Ensure 'file_path' doesn't already exist.
-		if (open_file(options.file_path, file_mask)) {
-			throw vdh_mode_error(options, "File Already Exists");
+}
+
+ValueRange::iterator &ValueRange::iterator::operator++() {
+	index++;
+	read_value();
+	return *this;
+}
+
+ValueRange::iterator ValueRange::iterator::operator++(int) {
+	iterator ret = *this;
+	++*this;
+	return ret;
+}
+
+bool ValueRange::iterator::operator==(const iterator &other) const {
+	return index == other.index;
+}
+
+bool ValueRange::iterator::operator!=(const iterator &other) const {
+	return !(*this == other);
+}
+
+void ValueRange::iterator::read_value() {
+	if (range->offsets) {
+		if (index < range->size()) {
+			value = range->at(index);
+		} else {
+			index = string_view::npos;
+			value = string_view();
 		}
+		return;
+	}
 
-		// Update file_mask to create 'file'.
-		file_mask |= std::ios_base::out | std::ios_base::trunc;
+	// Find the next non-empty value in 'rest'.
+	size_t start = rest.find_first_not_of(range->delimiter);
+	if (start == string_view::npos) {
+		index = string_view::npos;
+		rest = value = string_view();
+		return;
 	}
+	size_t end = rest.find(range->delimiter, start);
+	value = rest.substr(start, end - start);
+	rest.remove_prefix(end == string_view::npos ? rest.size() : end);
+}
+
+ValueRange::ValueRange(string_view serialized, char delimiter_in)
+    : values(serialized), delimiter(delimiter_in), offsets(false) {}
 
-	// Create/open 'file'.
-	if (!open_file(options.file_path, file_mask)) {
-		throw vdh_internal_error(options, "Failed to Open File");
+ValueRange::ValueRange(string_view ends_in, string_view payload)
+    : ends(ends_in), values(payload), delimiter('\0'), offsets(true) {}
+
+ValueRange::iterator ValueRange::begin() const {
+	return iterator(this, 0);
+}
+
+ValueRange::iterator ValueRange::end() const {
+	return iterator(this, string_view::npos);
+}
+
+size_t ValueRange::size() const {
+	if (offsets) {
+		return ends.size() / sizeof(uint32_t);
 	}
+	return std::distance(begin(), end());
+}
 
-	// 'file' should throw on failure to simplify error checking.
-	file.exceptions(std::fstream::badbit | std::fstream::failbit);
+bool ValueRange::empty() const {
+	return begin() == end();
+}
 
-	if (options.create) {
-		// Persist max_key_size.
-		string mks = std::to_string(options.max_key_size);
-		file.write(mks.c_str(), mks.size());
-		file.put(KEY_DELIMITER);
-	} else if (!options.max_key_size) {
-		// Load the persisted max_key_size. We need it to open 'table'.
-		string mks;
-        std::getline(file, mks, KEY_DELIMITER);
-		try {
-			options.max_key_size = static_cast<size_t>(std::stoull(mks));
-		} catch (std::invalid_argument &e) {
-			throw vdh_internal_error(options, "Failed to Read Max Key Size");
+string_view ValueRange::at(size_t index) const {
+	if (!offsets) {
+		for (string_view value : *this) {
+			if (!index--) {
+				return value;
+			}
 		}
+		throw std::out_of_range("ValueRange at(): Index Out of Range");
+	}
+
+	if (index >= size()) {
+		throw std::out_of_range("ValueRange at(): Index Out of Range");
+	}
+	size_t start = index ? read_uint32(&ends[(index - 1) * sizeof(uint32_t)]) : 0;
+	size_t end = read_uint32(&ends[index * sizeof(uint32_t)]);
+	if (start > end || end > values.size()) {
+		throw std::out_of_range("ValueRange at(): Corrupted Value Offsets");
+	}
+	return values.substr(start, end - start);
+}
+
+bool ValueRange::has_offsets() const {
+	return offsets;
+}
+
+VectorDiskHash::VectorDiskHash(const Options &opts)
+    : options(opts),
+      format_version(FORMAT_VERSION) {
+	if (options.max_key_size) {
+		options.max_key_size++;
 	}
 
-	// Set up 'table'.
-	auto dht_mask = dht::DHOpenRO;
 	if (options.create) {
-		// Ensure 'table_path' doesn't exist.
-		if (open_table(options.table_path, options.max_key_size, dht_mask)) {
+		// Ensure neither 'file_path' nor 'table_path' exist.
+		if (std::filesystem::exists(options.file_path)) {
+			throw vdh_mode_error(options, "File Already Exists");
+		}
+		options.file_path.clear();
+		if (open_table(options.table_path, options.max_key_size, dht::DHOpenRO)) {
 			throw vdh_mode_error(options, "Table Already Exists");
 		}
 
-		// Update dht_mask to create 'table'.
-		dht_mask = dht::DHOpenRW;
+		// Create 'table' sized for the expected keys.
+		if (!create_table(
+		        options.table_path,
+		        options.max_key_size,
+		        options.expected_n_keys)) {
+			throw vdh_internal_error(options, "Failed to Create Table");
+		}
+
+		// Persist the format version and max_key_size at the start of the
+		// heap, before any key is written there.
+		string header = FORMAT_MAGIC + " " + std::to_string(FORMAT_VERSION)
+		    + " " + std::to_string(options.max_key_size) + KEY_DELIMITER;
+		write_at_end(header);
+		std::remove(get_static_index_path(options.table_path).c_str());
+		return;
 	}
 
-	// Create/open 'table'.
-	if (!open_table(options.table_path, options.max_key_size, dht_mask)) {
+	// A max_key_size of 0 opens tables of any max_key_size.
+	if (!open_table(options.table_path, options.max_key_size, dht::DHOpenRO)) {
 		throw vdh_internal_error(options, "Failed to Open Table");
 	}
+
+	// Tables whose heap has no header store their values in 'file_path'.
+	// Read-only files do not change, so lookups can view them in place.
+	string_view heap = values_view();
+	if (heap.substr(0, FORMAT_MAGIC.size() + 1) != FORMAT_MAGIC + " ") {
+		try {
+			mapped_file.reset(new MappedFile(options.file_path));
+		} catch (mapped_file_error &e) {
+			throw vdh_internal_error(options, "Failed to Map File");
+		}
+	} else {
+		options.file_path.clear();
+	}
+	read_header(values_view());
+	open_static_index();
+	make_resident();
+}
+
+VectorDiskHash::~VectorDiskHash() {
+	// Destructors must not throw, so write errors are only reported by
+	// calling flush() directly.
+	try {
+		flush();
+	} catch (...) {}
 }
 
 void VectorDiskHash::append(
@@ -79,44 +190,87 @@ void VectorDiskHash::append(
 		throw vdh_key_error(options, msg);
 	}
 
-	// Serialize the values vector.
-	string serialized = join(values, VALUE_DELIMITER, true);
-	size_t serialized_size = serialized.size();
+	auto reserved_it = reserved.find(key);
+	if (reserved_it == reserved.end()) {
+		bool pushing = !pushed_ends.empty() && key == pushed_key;
+		if (!pushing && table->is_member(key.data(), key.size())) {
+			string msg = "append(): Key Out of Reserved Space - " + key;
+			throw vdh_value_error(options, msg);
+		}
+		for (const string &value : values) {
+			push(key, value);
+		}
+		if (values.empty() && !pushing) {
+			commit_pushed();
+			write_values(key, {}, "");
+		}
+		return;
+	}
 
-	if (key == eof_key) {
-		file.seekp(0, std::ios_base::end);
-		file.put(VALUE_DELIMITER);
-		file.write(serialized.data(), serialized_size);
-	} else {
-		Location *loc = table->lookup(key.c_str());
-		if (loc == nullptr) {
-			file.seekp(0, std::ios_base::end);
-			file.put(KEY_DELIMITER);
+	ReservedValues &n_written = reserved_it->second;
+	Location *loc = table->lookup(key.data(), key.size());
+	size_t start = std::streamoff(loc->start);
+	size_t payload_start = start + ENTRY_HEADER_SIZE
+	    + n_written.capacity * sizeof(uint32_t);
+	for (const string &value : values) {
+		if (n_written.n_values == n_written.capacity
+		    || value.size() > loc->bytes_reserved) {
+			string msg = "append(): Key Out of Reserved Space - " + key;
+			throw vdh_value_error(options, msg);
+		}
 
-			Location new_loc;
-			new_loc.start = file.tellp();
-			new_loc.bytes_reserved = 0;
+		// Write the value, then its end offset, then the new count.
+		size_t offset = std::streamoff(loc->write_location);
+		write_at(offset, value);
+		loc->bytes_reserved -= value.size();
+		loc->write_location = std::streamoff(offset + value.size());
 
-			file.write(serialized.data(), serialized_size);
-			new_loc.write_location = file.tellp();
+		string end;
+		append_uint32(end, offset + value.size() - payload_start);
+		write_at(
+		    start + ENTRY_HEADER_SIZE + n_written.n_values * sizeof(uint32_t),
+		    end);
 
-			table->insert(key.c_str(), new_loc);
+		string n_values;
+		append_uint32(n_values, ++n_written.n_values);
+		write_at(start, n_values);
+	}
+}
 
-			eof_key = key;
-		} else if (serialized_size > loc->bytes_reserved) {
-			string msg = "append(): Key Out of Reserved Space - " + key;
+void VectorDiskHash::append(const string &key, const string &values) {
+	append(key, vector<string>({values}));
+}
+
+void VectorDiskHash::push(const string &key, string_view value) {
+	if (pushed_ends.empty() || key != pushed_key) {
+		if (!options.create) {
+			string msg = "push(): VectorDiskHash is Read-Only";
+			throw vdh_mode_error(options, msg);
+		} else if (key.size() > options.max_key_size) {
+			string msg = "push(): Key Too Long - " + key;
+			throw vdh_key_error(options, msg);
+		} else if (table->is_member(key.data(), key.size())) {
+			string msg = "push(): Key Already Written - " + key;
 			throw vdh_value_error(options, msg);
-		} else {
-			file.seekp(loc->write_location);
-			file.write(serialized.data(), serialized_size);
-			loc->bytes_reserved -= serialized_size;
-			loc->write_location = file.tellp();
 		}
+
+		commit_pushed();
+		pushed_key = key;
+	}
+
+	// Value end offsets must fit in 4 bytes.
+	if (pushed_payload.size() + value.size() > UINT32_MAX) {
+		string msg = "push(): Values Too Large - " + key;
+		throw vdh_value_error(options, msg);
 	}
+	pushed_payload.append(value);
+	pushed_ends.push_back(pushed_payload.size());
 }
 
-void VectorDiskHash::append(const string &key, const string &values) {
-	append(key, vector<string>({values}));
+void VectorDiskHash::flush() {
+	if (options.create) {
+		commit_pushed();
+	}
 }
 
 Options VectorDiskHash::get_options() const {
@@ -124,20 +278,61 @@ Options VectorDiskHash::get_options() const {
 }
 
 bool VectorDiskHash::is_member(const string &key) const {
-	return table->is_member(key.c_str());
+	return (!pushed_ends.empty() && key == pushed_key)
+	    || find_location(key) != nullptr;
 }
 
 vector<string> VectorDiskHash::lookup(const string &key) {
-	string serialized(read_serialized_vector(key));
-	return split(serialized, VALUE_DELIMITER);
+	ValueRange values = read_values(key);
+	return vector<string>(values.begin(), values.end());
 }
 
 vector<string> VectorDiskHash::lookup_sample(const string &key, size_t k) {
-	string serialized(read_serialized_vector(key));
-	return sample(serialized, VALUE_DELIMITER, k);
+	ValueRange values = read_values(key);
+
+	// Values without offsets are split once, so each draw takes O(1).
+	vector<string_view> split_values;
+	if (!values.has_offsets()) {
+		split_values.assign(values.begin(), values.end());
+	}
+	size_t n_values = values.has_offsets() ? values.size() : split_values.size();
+
+	vector<string> sampled;
+	if (!n_values) {
+		return sampled;
+	}
+	sampled.reserve(k);
+
+	// Draw random indices, touching only the sampled values.
+	std::random_device rd;
+	std::mt19937 gen(rd());
+	std::uniform_int_distribution<size_t> dist(0, n_values - 1);
+	for (size_t i = 0; i < k; i++) {
+		size_t index = dist(gen);
+		sampled.emplace_back(
+		    values.has_offsets() ? values.at(index) : split_values[index]);
+	}
+	return sampled;
+}
+
+ValueRange VectorDiskHash::lookup_range(const string &key) {
+	return read_values(key);
+}
+
+void VectorDiskHash::prefetch(const vector<string> &keys) {
+	flush();
+
+	vector<Location *> locations;
+	for (size_t start = 0; start < keys.size(); start += LOOKUP_BATCH_SIZE) {
+		size_t n = std::min(LOOKUP_BATCH_SIZE, keys.size() - start);
+		find_locations(keys, start, n, locations);
+	}
 }
 
-void VectorDiskHash::reserve(const string &key, size_t bytes_to_reserve) {
+void VectorDiskHash::reserve(
+    const string &key,
+    size_t n_values,
+    size_t bytes_to_reserve) {
 	if (!options.create) {
 		string msg = "reserve(): VectorDiskHash is Read-Only";
 		throw vdh_mode_error(options, msg);
@@ -147,31 +342,112 @@ void VectorDiskHash::reserve(const string &key, size_t bytes_to_reserve) {
 	} else if (is_member(key)) {
 		string msg = "reserve(): Key is_member - " + key;
 		throw vdh_key_error(options, msg);
+	} else if (n_values > UINT32_MAX || bytes_to_reserve > UINT32_MAX) {
+		string msg = "reserve(): Values Too Large - " + key;
+		throw vdh_value_error(options, msg);
 	}
 
-	file.seekp(0, std::ios_base::end);
-	file.put(KEY_DELIMITER);
+	commit_pushed();
 
+	// Write an empty entry with room for 'n_values' end offsets and the
+	// values. Inserting the key writes it to the heap too, so the entry
+	// must be complete first.
 	Location loc;
-	loc.start = file.tellp();
-	loc.write_location = file.tellp();
+	loc.start = std::streamoff(file_size());
+	write_filler_at_end(ENTRY_HEADER_SIZE + n_values * sizeof(uint32_t));
+	string capacity;
+	append_uint32(capacity, n_values);
+	write_at(std::streamoff(loc.start) + sizeof(uint32_t), capacity);
+	loc.write_location = std::streamoff(file_size());
 	loc.bytes_reserved = bytes_to_reserve;
+	write_filler_at_end(loc.bytes_reserved);
 
 	table->insert(key.c_str(), loc);
-	std::fill_n(
-	    std::ostream_iterator<char>(file),
-	    loc.bytes_reserved,
-	    KEY_DELIMITER);
+	reserved[key] = { 0, static_cast<uint32_t>(n_values) };
 }
 
-bool VectorDiskHash::open_file(
-    const string &file_path,
-    std::_Ios_Openmode mask) {
-	// Open file with the specified mask.
-	file.open(file_path, mask);
+void VectorDiskHash::build_static_index() {
+	if (options.create) {
+		string msg = "build_static_index(): VectorDiskHash is Writable";
+		throw vdh_mode_error(options, msg);
+	}
+	size_t n_keys = table->size();
+	if (n_keys > UINT32_MAX) {
+		throw vdh_internal_error(options, "Too Many Keys for Static Index");
+	}
+
+	// Keys view the table, which stays open while the index is built.
+	vector<string_view> keys;
+	keys.reserve(n_keys);
+	for (size_t i = 0; i < n_keys; i++) {
+		keys.emplace_back(table->key_at(i));
+	}
+	MinimalPerfectHash index(keys);
+	vector<uint32_t> order(n_keys);
+	for (size_t i = 0; i < n_keys; i++) {
+		order[index.lookup(keys[i])] = i;
+	}
 
-	// Return whether there were any errors.
-	return file.good();
+	// Rewrite the table with each key at the position of its slot, so a
+	// lookup through the index goes straight to the key and its location.
+	// The heap is copied as it is, so the locations stay valid.
+	string table_path = options.table_path;
+	string tmp_table_path = table_path + ".tmp";
+	std::remove(tmp_table_path.c_str());
+	try {
+		bool has_heap = table->has_heap();
+		auto create = has_heap
+		    ? dht::DiskHash<Location>::create_with_heap
+		    : dht::DiskHash<Location>::create;
+		dht::DiskHash<Location> ordered = create(
+		    tmp_table_path.c_str(), options.max_key_size, n_keys, 0);
+		if (has_heap && ordered.heap_append(table->heap_at(0), table->heap_size()) != 0) {
+			throw std::runtime_error("Heap Not Copied to its Start");
+		}
+		for (uint32_t position : order) {
+			Location *loc_ptr;
+			const char *key = table->key_at(position, &loc_ptr);
+			Location loc;
+			memcpy(&loc, loc_ptr, sizeof(loc));
+			ordered.insert(key, loc);
+		}
+	} catch (std::exception &e) {
+		std::remove(tmp_table_path.c_str());
+		throw vdh_internal_error(options, "Failed to Write Static Index");
+	}
+
+	// Write temporary files, then rename them into place, table first, so
+	// readers never see an index without its table.
+	string path = get_static_index_path(table_path);
+	string tmp_path = path + ".tmp";
+	std::ofstream out(tmp_path, std::ios_base::binary | std::ios_base::trunc);
+	out << STATIC_INDEX_MAGIC << ' ' << STATIC_INDEX_VERSION << KEY_DELIMITER;
+	out << index.serialized();
+	out.close();
+
+	if (!out || std::rename(tmp_table_path.c_str(), table_path.c_str()) != 0) {
+		std::remove(tmp_table_path.c_str());
+		std::remove(tmp_path.c_str());
+		throw vdh_internal_error(options, "Failed to Write Static Index");
+	}
+	if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+		std::remove(tmp_path.c_str());
+		throw vdh_internal_error(options, "Failed to Write Static Index");
+	}
+
+	// Reopen the rewritten table.
+	if (!open_table(table_path, options.max_key_size, dht::DHOpenRO)) {
+		throw vdh_internal_error(options, "Failed to Open Table");
+	}
+	make_resident();
+}
+
+bool VectorDiskHash::has_static_index() const {
+	return std::filesystem::exists(get_static_index_path(options.table_path));
+}
+
+string VectorDiskHash::get_static_index_path(const string &table_path) {
+	return table_path + STATIC_INDEX_SUFFIX;
 }
 
 bool VectorDiskHash::open_table(
@@ -189,16 +465,270 @@ bool VectorDiskHash::open_table(
 	}
 }
 
-string VectorDiskHash::read_serialized_vector(const string &key) {
-	Location *loc = table->lookup(key.c_str());
+bool VectorDiskHash::create_table(
+    const string &table_path,
+    const size_t max_key_size,
+    const size_t capacity) {
+	// Create table in one step at its final size and return
+	// whether there were any errors.
+	try {
+		table.reset(new dht::DiskHash<Location>(dht::DiskHash<Location>::create_with_heap(
+		    table_path.c_str(), max_key_size, capacity)));
+		return true;
+	} catch (std::exception &e) {
+		return false;
+	}
+}
+
+void VectorDiskHash::read_header(string_view data) {
+	string header(data.substr(0, data.find(KEY_DELIMITER)));
+	string mks = header;
+	if (header.rfind(FORMAT_MAGIC + " ", 0) == 0) {
+		// Values in the heap are in the current format, and values in a
+		// separate file in an older one.
+		unsigned max_version = mapped_file ? FORMAT_VERSION - 1 : FORMAT_VERSION;
+		unsigned min_version = mapped_file ? MIN_SEPARATE_FORMAT_VERSION : FORMAT_VERSION;
+		std::istringstream fields(header.substr(FORMAT_MAGIC.size()));
+		if (!(fields >> format_version >> mks)) {
+			throw vdh_internal_error(options, "Failed to Read Header");
+		} else if (format_version < min_version || format_version > max_version) {
+			string msg = "Unsupported Format Version "
+			    + std::to_string(format_version);
+			throw vdh_internal_error(options, msg);
+		}
+	} else {
+		// Files without a format version only hold max_key_size.
+		format_version = 1;
+	}
+
+	if (options.max_key_size) {
+		return;
+	}
+	try {
+		options.max_key_size = static_cast<size_t>(std::stoull(mks));
+	} catch (std::logic_error &e) {
+		throw vdh_internal_error(options, "Failed to Read Max Key Size");
+	}
+}
+
+void VectorDiskHash::open_static_index() {
+	string path = get_static_index_path(options.table_path);
+	if (!std::filesystem::exists(path)) {
+		return;
+	}
+	try {
+		static_index_file.reset(new MappedFile(path));
+	} catch (mapped_file_error &e) {
+		throw vdh_internal_error(options, "Failed to Map Static Index");
+	}
+
+	string_view data = static_index_file->view();
+	string header = STATIC_INDEX_MAGIC + " "
+	    + std::to_string(STATIC_INDEX_VERSION) + KEY_DELIMITER;
+	if (data.substr(0, header.size()) != header) {
+		throw vdh_internal_error(options, "Unsupported Static Index");
+	}
+	data.remove_prefix(header.size());
+
+	try {
+		static_index.reset(new MinimalPerfectHash(data));
+	} catch (mph_error &e) {
+		throw vdh_internal_error(options, "Corrupted Static Index");
+	}
+	size_t n_keys = static_index->size();
+	if (n_keys != table->size() || data.size() != static_index->serialized().size()) {
+		throw vdh_internal_error(options, "Corrupted Static Index");
+	}
+}
+
+void VectorDiskHash::make_resident() {
+	try {
+		table->set_residency(options.residency);
+	} catch (std::runtime_error &e) {
+		throw vdh_internal_error(options, "Failed to Load Table Into Memory");
+	}
+
+	// Only the table can be copied onto huge pages.
+	for (const MappedFile *file : { mapped_file.get(), static_index_file.get() }) {
+		if (!file || options.residency == dht::DHDefault) {
+			continue;
+		} else if (options.residency == dht::DHLazy) {
+			file->advise_random();
+		} else if (options.residency != dht::DHLocked) {
+			file->populate();
+		} else if (!file->lock()) {
+			throw vdh_internal_error(options, "Failed to Lock File Into Memory");
+		}
+	}
+}
+
+VectorDiskHash::Location *VectorDiskHash::find_location(const string &key) const {
+	if (!static_index) {
+		return table->lookup(key.data(), key.size());
+	}
+
+	// Only the key at the position of the slot can match.
+	size_t slot = static_index->lookup(key);
+	if (slot >= static_index->size()) {
+		return nullptr;
+	}
+	Location *loc;
+	const char *stored_key = table->key_at(slot, &loc);
+	return key == stored_key ? loc : nullptr;
+}
+
+void VectorDiskHash::find_locations(
+    const vector<string> &keys,
+    size_t start,
+    size_t n,
+    vector<Location *> &locations) {
+	locations.resize(n);
+	if (static_index) {
+		// As in dht_lookup_many(), the keys and locations in 'table' are
+		// prefetched for the whole batch before they are compared.
+		const char *stored_keys[LOOKUP_BATCH_SIZE];
+		for (size_t i = 0; i < n; i++) {
+			locations[i] = nullptr;
+			stored_keys[i] = nullptr;
+			size_t slot = static_index->lookup(keys[start + i]);
+			if (slot >= static_index->size()) {
+				continue;
+			}
+			stored_keys[i] = table->key_at(slot, &locations[i]);
+			__builtin_prefetch(stored_keys[i]);
+			__builtin_prefetch(locations[i]);
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (stored_keys[i] && keys[start + i] != stored_keys[i]) {
+				locations[i] = nullptr;
+			}
+		}
+	} else {
+		const char *key_data[LOOKUP_BATCH_SIZE];
+		size_t key_sizes[LOOKUP_BATCH_SIZE];
+		for (size_t i = 0; i < n; i++) {
+			key_data[i] = keys[start + i].data();
+			key_sizes[i] = keys[start + i].size();
+		}
+		table->lookup_many(key_data, key_sizes, n, locations.data());
+	}
+
+	// Start reading the entries while the caller works through the batch.
+	string_view data = values_view();
+	for (Location *loc : locations) {
+		size_t entry_start = loc ? location_start(loc) : data.size();
+		if (entry_start < data.size()) {
+			__builtin_prefetch(data.data() + entry_start);
+		}
+	}
+}
+
+ValueRange VectorDiskHash::read_values(const string &key) {
+	// Values gathered by push() must be written before they can be read.
+	flush();
+
+	Location *loc = find_location(key);
 	// Check that key is in the VectorDiskHash.
 	if (loc == nullptr) {
 		string msg = "lookup(): Nonexistent Key - " + key;
 		throw vdh_key_error(options, msg);
 	}
 
-	file.seekg(loc->start);
-	string serialized;
-	std::getline(file, serialized, KEY_DELIMITER);
-	return serialized;
-}
\ No newline at end of file
+	string_view data = values_view();
+	size_t start = location_start(loc);
+	if (start > data.size()) {
+		throw vdh_internal_error(options, "Value Past End of File");
+	}
+	return parse_values(data.substr(start));
+}
+
+ValueRange VectorDiskHash::parse_values(string_view entry) const {
+	// Serialized text values run up to the next KEY_DELIMITER.
+	if (format_version == 1) {
+		return ValueRange(
+		    entry.substr(0, entry.find(KEY_DELIMITER)),
+		    VALUE_DELIMITER);
+	}
+
+	if (entry.size() < ENTRY_HEADER_SIZE) {
+		throw vdh_internal_error(options, "Value Past End of File");
+	}
+	size_t n_values = read_uint32(entry.data());
+	size_t capacity = read_uint32(entry.data() + sizeof(uint32_t));
+	size_t payload_start = ENTRY_HEADER_SIZE + capacity * sizeof(uint32_t);
+	if (n_values > capacity || payload_start > entry.size()) {
+		throw vdh_internal_error(options, "Corrupted Value Offsets");
+	}
+
+	string_view ends = entry.substr(ENTRY_HEADER_SIZE, n_values * sizeof(uint32_t));
+	size_t payload_size = 0;
+	if (n_values) {
+		payload_size = read_uint32(ends.data() + ends.size() - sizeof(uint32_t));
+	}
+	if (payload_size > entry.size() - payload_start) {
+		throw vdh_internal_error(options, "Value Past End of File");
+	}
+	return ValueRange(ends, entry.substr(payload_start, payload_size));
+}
+
+void VectorDiskHash::write_values(
+    const string &key,
+    const vector<uint32_t> &ends,
+    string_view payload) {
+	Location new_loc;
+	new_loc.start = std::streamoff(file_size());
+	new_loc.bytes_reserved = 0;
+
+	// The entry is full, so its capacity is its number of values.
+	string entry_header;
+	entry_header.reserve(ENTRY_HEADER_SIZE + ends.size() * sizeof(uint32_t));
+	append_uint32(entry_header, ends.size());
+	append_uint32(entry_header, ends.size());
+	for (uint32_t end : ends) {
+		append_uint32(entry_header, end);
+	}
+	write_at_end(entry_header);
+	write_at_end(payload);
+	new_loc.write_location = std::streamoff(file_size());
+
+	table->insert(key.c_str(), new_loc);
+}
+
+void VectorDiskHash::commit_pushed() {
+	if (pushed_ends.empty()) {
+		return;
+	}
+
+	// Clearing keeps the capacity of the buffers for the next key.
+	write_values(pushed_key, pushed_ends, pushed_payload);
+	pushed_ends.clear();
+	pushed_payload.clear();
+}
+
+string_view VectorDiskHash::values_view() const {
+	if (mapped_file) {
+		return mapped_file->view();
+	}
+	size_t size = table->heap_size();
+	return size ? string_view(table->heap_at(0), size) : string_view();
+}
+
+size_t VectorDiskHash::file_size() const {
+	return table->heap_size();
+}
+
+void VectorDiskHash::write_at_end(string_view data) {
+	table->heap_append(data.data(), data.size());
+}
+
+void VectorDiskHash::write_filler_at_end(size_t size) {
+	table->heap_append(nullptr, size);
+}
+
+void VectorDiskHash::write_at(size_t offset, string_view data) {
+	// The range must lie within the heap.
+	if (offset + data.size() > file_size()) {
+		throw vdh_internal_error(options, "Write Past End of File");
+	}
+	std::copy(data.begin(), data.end(), table->heap_at(offset));
+}
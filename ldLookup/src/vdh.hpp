@@ -2,40 +2,70 @@
 #define _LDLOOKUP_VDH_HPP_
 
 #include <stddef.h>  // size_t
+#include <stdint.h>  // uint32_t
+#include <string.h>  // memcpy
 
-#include <fstream>    // std::fstream, streampos, _Ios_openmode
-#include <memory>     // std::shared_ptr
+#include <fstream>    // std::streampos
+#include <algorithm>  // std::min
+#include <iterator>   // std::forward_iterator_tag
+#include <memory>     // std::shared_ptr, std::unique_ptr
 #include <stdexcept>  // std::runtime_error
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "diskhash/src/diskhash.hpp"
+#include "mapped_file.hpp"
+#include "mph.hpp"
 
 /**
- * VectorDiskHashes are made of two files, the paths to which must be
- * specified to create or open the VectorDiskHash. file_path and
- * table_path are NOT interchangeable.
+ * VectorDiskHashes are stored in the file at table_path, which holds both
+ * the keys and their values. Tables made before format version 3 keep their
+ * values in a second file, at file_path. Both paths must be specified to
+ * create or open the VectorDiskHash, and are NOT interchangeable.
  * 
  * If 'create' is true:
- * - Both files will be created.
+ * - The file at table_path will be created. No file is created at file_path.
  * - If either file already exists, vdh_mode_error will be thrown.
  * If 'create' is false:
- * - If either file does not exist, vdh_mode_error will be thrown.
+ * - If the file at table_path (or, for tables made before format version 3,
+ *   either file) does not exist, vdh_mode_error will be thrown.
+ *
+ * If 'create' is true, 'expected_n_keys' may give the number of keys that
+ * will be added. The table is then created at its final size, rather than
+ * being grown (and rewritten) each time it fills up. More keys may still be
+ * added.
+ *
+ * If 'create' is false, 'residency' says how much of the table is brought
+ * into memory when it is opened: nothing (lookups page it in as they go,
+ * with or without the kernel reading ahead), all of it, all of it locked
+ * there, or a copy of the table on transparent huge pages (see
+ * dht::Residency). The values of tables made before format version 3 and
+ * static indexes cannot be copied, and are read into memory instead of onto
+ * huge pages.
  */
 struct Options {
 	std::string file_path;
 	std::string table_path;
     unsigned long max_key_size;
 	bool create;
+	size_t expected_n_keys = 0;
+	dht::Residency residency = dht::DHDefault;
 };
 
-/* Custom Exceptions for VectorDiskHash */
+/*
+ * Custom Exceptions for VectorDiskHash
+ *
+ * Tables of format version 3 have no file at file_path, so their errors
+ * leave it out (see VectorDiskHash::get_options()).
+ */
 struct vdh_error : std::runtime_error {
 	vdh_error(const Options &opts, const std::string &msg)
 	    : std::runtime_error(
-	          "VectorDiskHash Error\nFile Path: " +
-			  opts.file_path + 
-			  "\nTable Path: " + 
+	          "VectorDiskHash Error\n" +
+			  (opts.file_path.empty() ? "" : "File Path: " + opts.file_path + "\n") +
+			  "Table Path: " + 
 			  opts.table_path + 
 			  "\nInfo: " +
 			  msg) {}
@@ -69,6 +99,86 @@ struct vdh_value_error : vdh_error {
 	    : vdh_error(opts, msg) {}
 };
 
+/**
+ * The values of one key, viewed in place as a range of std::string_views,
+ * so they can be iterated without allocating a string per value.
+ *
+ * Values are stored either as text separated by a delimiter, the format of
+ * tables made before format version 2, or with an array of their end
+ * offsets, which makes size() and at() take constant time.
+ */
+class ValueRange {
+   public:
+	class iterator {
+	   public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = std::string_view;
+		using difference_type = std::ptrdiff_t;
+		using pointer = const std::string_view *;
+		using reference = const std::string_view &;
+
+		iterator(const ValueRange *range, size_t index);
+
+		reference operator*() const { return value; }
+		pointer operator->() const { return &value; }
+		iterator &operator++();
+		iterator operator++(int);
+		bool operator==(const iterator &other) const;
+		bool operator!=(const iterator &other) const;
+
+	   private:
+		const ValueRange *range;
+		size_t index;
+		std::string_view rest;
+		std::string_view value;
+
+		void read_value();
+	};
+
+	/**
+	 * EFFECTS: Views the values in 'serialized', which are separated by
+	 *          'delimiter'. Empty values are skipped.
+	 */
+	ValueRange(std::string_view serialized, char delimiter);
+
+	/**
+	 * EFFECTS: Views the values in 'payload'. 'ends' holds the end offset
+	 *          of each value in 'payload' as a 4-byte little-endian integer.
+	 */
+	ValueRange(std::string_view ends, std::string_view payload);
+
+	iterator begin() const;
+	iterator end() const;
+
+	/**
+	 * EFFECTS: Returns the number of values.
+	 */
+	size_t size() const;
+
+	/**
+	 * EFFECTS: Returns whether there are no values.
+	 */
+	bool empty() const;
+
+	/**
+	 * EFFECTS: Returns the value at 'index'.
+	 * THROWS: std::out_of_range if index >= size().
+	 */
+	std::string_view at(size_t index) const;
+
+	/**
+	 * EFFECTS: Returns whether the values have end offsets, which make
+	 *          size() and at() take constant time instead of a scan.
+	 */
+	bool has_offsets() const;
+
+   private:
+	std::string_view ends;
+	std::string_view values;
+	char delimiter;
+	bool offsets;
+};
+
 /* Persistent, write-once map from strings to string vectors. */
 class VectorDiskHash {
    public:
@@ -80,11 +190,15 @@ class VectorDiskHash {
      */
 	VectorDiskHash(const Options &opts);
 
+	~VectorDiskHash();
+
     /**
-     * EFFECTS: Associates 'key' with 'values'.
+     * EFFECTS: Associates 'key' with 'values'. Values of a reserve()d key
+     *          are written into its reserved space. Otherwise, they are
+     *          gathered as by push().
      * THROWS: vdh_mode_error if VectorDiskHash is read-only.
      *         vdh_value_error if 'values' overruns available space for 'key'
-     *                      OR if a string in 'values' contains RESERVED_CHAR.
+     *                      OR if values were already written for 'key'.
      *         exception on operation failure.
      */
 	void append(
@@ -96,16 +210,48 @@ class VectorDiskHash {
      */
 	void append(const std::string &key, const std::string &values);
 
+    /**
+     * EFFECTS: Adds 'value' to the values of 'key'. Values pushed for the
+     *          same key in a row are gathered in memory and written at once,
+     *          as by append(key, values), when another key is pushed or
+     *          flush() is called.
+     * THROWS: vdh_mode_error if VectorDiskHash is read-only.
+     *         vdh_key_error if key.size() > get_options().max_key_size.
+     *         vdh_value_error if values were already written for 'key'.
+     *         exception on operation failure.
+     */
+	void push(const std::string &key, std::string_view value);
+
+    /**
+     * EFFECTS: Writes values gathered by push() and any buffered writes to
+     *          disk. The destructor also flushes, but cannot report errors.
+     * THROWS: exception on operation failure.
+     */
+	void flush();
+
 	/**
-     * EFFECTS: Returns options used to create the VectorDiskHash.
+     * EFFECTS: Returns options used to create the VectorDiskHash. Tables of
+     *          format version 3 keep their values in the file at table_path,
+     *          so their file_path is empty.
      */
 	Options get_options() const;
 
     /**
-     * EFFECTS: Returns whether reserve(key...) or append(key...) were called.
+     * EFFECTS: Returns whether reserve(key...), append(key...), or
+     *          push(key...) were called.
      */
     bool is_member(const std::string& key) const;
 
+    /**
+     * EFFECTS: Calls on_key(key) for each key, in the order keys were first
+     *          passed to reserve(), append(), or push(). Keys whose values
+     *          are still gathered in memory are visited only after flush().
+     *          Tables with a static index visit keys in the order of its
+     *          slots instead.
+     */
+    template <typename F>
+    void for_each_key(F on_key) const;
+
     /**
      * EFFECTS: Retrieves values associated with 'key'.
      * THROWS: vdh_key_error if !is_member(key).
@@ -113,6 +259,36 @@ class VectorDiskHash {
      */
 	std::vector<std::string> lookup(const std::string &key);
 
+    /**
+     * EFFECTS: Returns a view of the values associated with 'key'. Read-only
+     *          VectorDiskHashes view their memory-mapped file, so the view is
+     *          valid until the VectorDiskHash is destroyed. Otherwise, it is
+     *          valid until the next lookup or write.
+     * THROWS: vdh_key_error if !is_member(key).
+     *         exception on operation failure.
+     */
+	ValueRange lookup_range(const std::string &key);
+
+    /**
+     * EFFECTS: Calls on_values(index, values) for each of 'keys', in order,
+     *          where 'values' points to the view lookup_range(keys[index])
+     *          would return, or is nullptr if !is_member(keys[index]). Keys
+     *          are looked up a batch at a time, whose memory accesses
+     *          overlap, which is faster than a lookup per key when the table
+     *          is not in the CPU cache. Views are valid as for lookup_range().
+     * THROWS: exception on operation failure.
+     */
+	template <typename F>
+	void lookup_many(const std::vector<std::string> &keys, F on_values);
+
+    /**
+     * EFFECTS: Prefetches the values of 'keys', as lookup_many() does, so
+     *          looking them up soon after is faster. Absent keys are
+     *          ignored.
+     * THROWS: exception on operation failure.
+     */
+	void prefetch(const std::vector<std::string> &keys);
+
     /**
      * EFFECTS: Randomly samples 'k' values associated with 'key'
      *          (with replacement).
@@ -122,44 +298,202 @@ class VectorDiskHash {
 	std::vector<std::string> lookup_sample(const std::string &key, size_t k);
 
 	/**
-     * EFFECTS: Allocates fixed amount of storage for values associated with
-     *          'key'.
+     * EFFECTS: Allocates fixed amount of storage for 'n_values' values
+     *          associated with 'key', which total 'bytes_to_reserve' bytes.
      * THROWS: vdh_mode_error if VectorDiskHash is read-only.
      *         vdh_key_error if key.size() > get_options().max_key_size
      *                    OR if is_member(key).
      *         exception on operation failure.
      */
-	void reserve(const std::string &key, size_t bytes_to_reserve);
+	void reserve(
+	    const std::string &key,
+	    size_t n_values,
+	    size_t bytes_to_reserve);
+
+    /**
+     * EFFECTS: Writes a static index of the keys next to the table, which
+     *          VectorDiskHashes opened read-only afterwards use for lookups.
+     *          The table is rewritten once, with each key at the position of
+     *          its slot in the index, so a lookup through the index hashes
+     *          the key to its slot and compares the key there once, instead
+     *          of probing the table.
+     * THROWS: vdh_mode_error if the VectorDiskHash is writable, since keys
+     *                        added later would be missing from the index.
+     *         vdh_internal_error if the index cannot be written.
+     */
+	void build_static_index();
+
+    /**
+     * EFFECTS: Returns whether the table has a static index.
+     */
+	bool has_static_index() const;
+
+    /**
+     * EFFECTS: Returns the path of the static index of the table at
+     *          'table_path'.
+     */
+	static std::string get_static_index_path(const std::string &table_path);
+
+	VectorDiskHash(const VectorDiskHash&) = delete;
+	VectorDiskHash& operator=(const VectorDiskHash&) = delete;
 
    private:
 	const char KEY_DELIMITER = '\n';
 	const char VALUE_DELIMITER = '\t';
+	static constexpr size_t LOOKUP_BATCH_SIZE = 64;
+
+	/*
+	 * Values are stored in the heap of 'table', a region of bytes after its
+	 * slots, so a lookup reads the key and its values from one mapped file.
+	 * The heap begins with a line holding FORMAT_MAGIC, the format version,
+	 * and max_key_size.
+	 *
+	 * Tables made before format version 3 store values in a separate file,
+	 * 'mapped_file', which begins with the same line, and are read-only.
+	 * Files made before format version 2 begin with a line holding only
+	 * max_key_size, and store values as text.
+	 *
+	 * Since format version 2, the values of each key are stored as:
+	 * - The number of values, n, as a 4-byte little-endian integer.
+	 * - The number of values space is reserved for, capacity >= n, likewise.
+	 * - The end offset of each value in the payload, likewise, capacity times.
+	 * - The payload: the values, back to back.
+	 */
+	const std::string FORMAT_MAGIC = "vdh";
+	const unsigned FORMAT_VERSION = 3;
+	const unsigned MIN_SEPARATE_FORMAT_VERSION = 2;
+	const size_t ENTRY_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+	/*
+	 * The static index begins with a line holding STATIC_INDEX_MAGIC and its
+	 * format version, then a MinimalPerfectHash of the keys, about 3.5 bits
+	 * per key. The key at each position of 'table' is the key of that slot,
+	 * so the index stores nothing else. Version 1 indexes also stored each
+	 * key's position. Creating a table deletes any index left by an older one.
+	 */
+	inline static const std::string STATIC_INDEX_SUFFIX = ".mph";
+	const std::string STATIC_INDEX_MAGIC = "vdhmph";
+	const unsigned STATIC_INDEX_VERSION = 2;
 
-    /* Stores location of a serialized vector of strings in 'file'. */
+    /*
+     * Stores the location of a serialized vector of strings in the heap of
+     * 'table', or in 'mapped_file' for tables made before format version 3.
+     */
 	struct Location {
 		std::streampos start;
 		std::streampos write_location;
 		size_t bytes_reserved;
 	};
 
+	/* Tracks how many values were written into a reserve()d key's space. */
+	struct ReservedValues {
+		uint32_t n_values;
+		uint32_t capacity;
+	};
+
 	/* Stores options used to create the SDH. */
 	Options options;
 
-	/* Stores serialized values. */
-	std::fstream file;
+	/* Stores the format version of the values. */
+	unsigned format_version;
 
-	/* Maps keys to the locations of serialized values in 'file'. */
+	/* Maps the values of tables made before format version 3 into memory. */
+	std::unique_ptr<MappedFile> mapped_file;
+
+	/* Maps keys to the locations of their serialized values. */
 	std::shared_ptr<dht::DiskHash<Location>> table;
-	
-	/* Stores the newest non-reserve()d key. */
-	std::string eof_key;
 
-	bool open_file(const std::string &file_path, std::_Ios_Openmode mask);
+	/* Stores the static index of a read-only VectorDiskHash, if any. */
+	std::unique_ptr<MappedFile> static_index_file;
+	std::unique_ptr<MinimalPerfectHash> static_index;
+
+	/* Stores the reserve()d keys of a writable VectorDiskHash. */
+	std::unordered_map<std::string, ReservedValues> reserved;
+
+	/* Stores the key, value end offsets, and values gathered by push(). */
+	std::string pushed_key;
+	std::vector<uint32_t> pushed_ends;
+	std::string pushed_payload;
+
 	bool open_table(
 	    const std::string &open_table,
 	    const size_t max_key_size,
 	    dht::OpenMode mask);
-	std::string read_serialized_vector(const std::string& key);
+	bool create_table(
+	    const std::string &table_path,
+	    const size_t max_key_size,
+	    const size_t capacity);
+	void read_header(std::string_view data);
+	void open_static_index();
+	void make_resident();
+	static size_t location_start(const Location *loc);
+	Location *find_location(const std::string &key) const;
+	void find_locations(
+	    const std::vector<std::string> &keys,
+	    size_t start,
+	    size_t n,
+	    std::vector<Location *> &locations);
+	ValueRange read_values(const std::string &key);
+	ValueRange parse_values(std::string_view entry) const;
+	void write_values(
+	    const std::string &key,
+	    const std::vector<uint32_t> &ends,
+	    std::string_view payload);
+	void write_reserved(const std::string &key, std::string_view value);
+	void commit_pushed();
+	std::string_view values_view() const;
+	size_t file_size() const;
+	void write_at_end(std::string_view data);
+	void write_filler_at_end(size_t size);
+	void write_at(size_t offset, std::string_view data);
 };
 
-#endif
\ No newline at end of file
+/*************************************************/
+/*************************************************/
+/****         Template Implementation         ****/
+/*************************************************/
+/*************************************************/
+
+inline size_t VectorDiskHash::location_start(const Location *loc) {
+	// Tables made before diskhash version 1.4 may not align their Locations.
+	std::streampos start;
+	memcpy(&start, reinterpret_cast<const char *>(loc) + offsetof(Location, start), sizeof(start));
+	return std::streamoff(start);
+}
+
+template <typename F>
+inline void VectorDiskHash::lookup_many(
+    const std::vector<std::string> &keys,
+    F on_values) {
+	// Values gathered by push() must be written before they can be read.
+	flush();
+
+	std::vector<Location *> locations;
+	for (size_t start = 0; start < keys.size(); start += LOOKUP_BATCH_SIZE) {
+		size_t n = std::min(LOOKUP_BATCH_SIZE, keys.size() - start);
+		find_locations(keys, start, n, locations);
+		for (size_t i = 0; i < n; i++) {
+			if (!locations[i]) {
+				on_values(start + i, static_cast<const ValueRange *>(nullptr));
+				continue;
+			}
+			std::string_view data = values_view();
+			size_t entry_start = location_start(locations[i]);
+			if (entry_start > data.size()) {
+				throw vdh_internal_error(options, "Value Past End of File");
+			}
+			ValueRange values = parse_values(data.substr(entry_start));
+			on_values(start + i, static_cast<const ValueRange *>(&values));
+		}
+	}
+}
+
+template <typename F>
+inline void VectorDiskHash::for_each_key(F on_key) const {
+	size_t n_keys = table->size();
+	for (size_t i = 0; i < n_keys; i++) {
+		on_key(std::string(table->key_at(i)));
+	}
+}
+
+#endif
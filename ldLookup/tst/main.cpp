@@ -1,140 +1,513 @@
-// #include <cassert>
-// #include <string>
-
-// #include "vdh.hpp"
-
-// const std::string TEST_FILE = "exclude/test_file.vdhdat";
-// const std::string TEST_TABLE = "exclude/test_table.vdhdht";
-// const size_t TEST_KEY_SIZE = 16;
-
-// const Options TEST_TABLE_OPTS {
-//     TEST_FILE, TEST_TABLE, TEST_KEY_SIZE, false
-// };
-
-// const Options TEST_TABLE_CREATE_OPTS {
-//     TEST_FILE, TEST_TABLE, TEST_KEY_SIZE, true
-// };
-
-
-// void check_append_empty_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_append_max_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_append_empty_value(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_append_max_value_to_reserved_non_tail_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_append_max_value_to_reserved_tail_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_append_overlong_key(const VectorDiskHash& vdh) {
-    
-// }
-
-// void check_append_overlong_value_to_reserved_non_tail_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_append_overlong_value_to_reserved_tail_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_non_tail_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_reserve_empty_key(const VectorDiskHash& vdh) {
-    
-// }
-
-// void check_reserve_max_key(const VectorDiskHash& vdh) {
-    
-// }
-
-// void check_reserve_overlong_key(const VectorDiskHash& vdh) {
-    
-// }
-
-// void check_reserved_tail_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_reserved_non_tail_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_tail_key(const VectorDiskHash& vdh) {
-
-// }
-
-// void check_create_duplicate_table() {
-//     Options opts = TEST_TABLE_CREATE_OPTS;
-//     try {
-//         VectorDiskHash vdh(opts);
-//         assert(false);
-//     } catch (std::exception& ignore) {
-//         ;
-//     }
-
-//     Options opts_2 = opts;
-//     opts_2.file_path = "exclude/path_that_doesnt_exist_ae0a0c98";
-//     try {
-//         VectorDiskHash vdh(opts_2);
-//         assert(false);
-//     } catch (std::exception& ignore) {
-//         ;
-//     }
-
-//     Options opts_3 = opts;
-//     opts_3.table_path = "exclude/path_that_doesnt_exist_ae0a0c98";
-//     try {
-//         VectorDiskHash vdh(opts_3);
-//         assert(false);
-//     } catch (std::exception& ignore) {
-//         ;
-//     }
-// }
-
-// void check_open_existing_table_with_incorrect_key_size() {
-//     Options opts = TEST_TABLE_OPTS;
-//     opts.max_key_size = 32;
-
-//     try {
-//         VectorDiskHash vdh(opts);
-//         assert(false);
-//     } catch (std::exception& ignore) {
-//         ;
-//     }
-// }
-
-// void check_can_open_existing_table() {
-//     Options opts = TEST_TABLE_OPTS;
-//     VectorDiskHash test_vdh(TEST_TABLE_OPTS);
-
-//     opts.max_key_size = 0;
-//     VectorDiskHash test_vdh2(opts);
-// }
-
-// int main() {
-//     // Destroy test_vdh before running table opening tests.
-//     {
-//         VectorDiskHash test_vdh(TEST_TABLE_CREATE_OPTS);
-//     }
-    
-//     check_create_duplicate_table();
-//     check_open_existing_table_with_incorrect_key_size();
-//     check_can_open_existing_table();
-// }
+#include <stdint.h>  // uint16_t, uint32_t, uint64_t
+#include <string.h>  // memcpy
+#include <unistd.h>  // getpid
+
+#include <cassert>
+#include <cmath>       // std::fabs, NAN
+#include <filesystem>  // std::filesystem
+#include <fstream>     // std::ifstream
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "mph.hpp"
+#include "posting_codec.hpp"
+#include "tables.hpp"
+#include "vdh.hpp"
+
+namespace fs = std::filesystem;
+
+/*
+ * Tables in 'DATA_DIR' were written by earlier versions of ldLookup:
+ * - diskhash_1_<minor>.dht: a diskhash of version 1.<minor>, with keys of
+ *   up to 16 bytes, that maps "key<i>" to the uint64_t i * 3 + 1 for each
+ *   i < DATA_N_KEYS, inserted in order.
+ * - vdh_format_<version>.vdhdat/.vdhdht: a VectorDiskHash of that format
+ *   version, whose diskhash is of version 1.1 (format 1) or 1.4 (format 2),
+ *   and that maps "rs<i>" to make_values(i) for each i < DATA_N_VDH_KEYS.
+ */
+const fs::path DATA_DIR = "tst/data";
+const size_t DATA_N_KEYS = 300;
+const size_t DATA_N_VDH_KEYS = 50;
+
+/* Tests write their tables here, and remove it when they are done. */
+const fs::path TEST_DIR =
+    fs::temp_directory_path() / ("ldLookup_tests_" + std::to_string(getpid()));
+
+template <typename E, typename F>
+void check_throws(F f) {
+    try {
+        f();
+    } catch (E& ignore) {
+        return;
+    }
+    assert(false);
+}
+
+std::vector<std::string> make_values(size_t i) {
+    std::vector<std::string> values;
+    for (size_t j = 0; j <= i % 4; j++) {
+        values.push_back("v" + std::to_string(i) + "_" + std::to_string(j));
+    }
+    return values;
+}
+
+// Returns the magic string at the start of the diskhash at 'path'.
+std::string read_magic(const fs::path& path) {
+    std::ifstream file(path, std::ios_base::binary);
+    std::string magic(15, '\0');
+    file.read(magic.data(), magic.size());
+    return magic;
+}
+
+std::vector<uint32_t> decode_all(std::string_view encoded, size_t max_ordinals=SIZE_MAX) {
+    std::vector<uint32_t> decoded;
+    decode_postings(encoded, max_ordinals, [&](uint32_t ordinal) {
+        decoded.push_back(ordinal);
+    });
+    return decoded;
+}
+
+void check_postings_round_trip() {
+    std::vector<std::vector<uint32_t>> lists = {
+        {},
+        {7},
+        // A full block of equal ordinals packs with width 0.
+        std::vector<uint32_t>(POSTING_BLOCK_SIZE, 0),
+        // Differences of 2^31 and -1 zigzag to the full 32 bits.
+        {0x80000000u, 0, UINT32_MAX, 1},
+    };
+    // Partial last blocks, with ordinals that go up and down.
+    for (size_t n : { POSTING_BLOCK_SIZE - 1, POSTING_BLOCK_SIZE + 1, 3 * POSTING_BLOCK_SIZE + 17 }) {
+        std::vector<uint32_t> ordinals;
+        for (size_t i = 0; i < n; i++) {
+            ordinals.push_back(static_cast<uint32_t>((i * 7919) % 1000 + i * 3));
+        }
+        lists.push_back(ordinals);
+    }
+
+    for (const auto& ordinals : lists) {
+        std::string encoded;
+        encode_postings(ordinals, encoded);
+        assert(count_postings(encoded) == ordinals.size());
+        assert(decode_all(encoded) == ordinals);
+
+        // Decoding a prefix stops after it.
+        size_t n = std::min<size_t>(ordinals.size(), POSTING_BLOCK_SIZE + 1);
+        std::vector<uint32_t> prefix(ordinals.begin(), ordinals.begin() + n);
+        assert(decode_all(encoded, n) == prefix);
+
+        // Truncated lists are rejected rather than read past their end.
+        if (!ordinals.empty()) {
+            check_throws<posting_codec_error>([&]() {
+                decode_all(std::string_view(encoded).substr(0, encoded.size() - 1));
+            });
+        }
+    }
+
+    // An empty list is its length alone.
+    std::string encoded;
+    encode_postings({}, encoded);
+    assert(encoded == std::string(1, '\0'));
+
+    // A width 0 block is its width byte alone, after a 2-byte length.
+    encoded.clear();
+    encode_postings(std::vector<uint32_t>(POSTING_BLOCK_SIZE, 0), encoded);
+    assert(encoded.size() == 3 && encoded[2] == 0);
+
+    // A width 32 block holds 4 bytes per ordinal.
+    encoded.clear();
+    encode_postings({0x80000000u, 0, UINT32_MAX, 1}, encoded);
+    assert(encoded.size() == 1 + 1 + 4 * sizeof(uint32_t) && encoded[1] == 32);
+
+    check_throws<posting_codec_error>([]() { count_postings(""); });
+}
+
+void check_quantize_r2() {
+    assert(quantize_r2(0.0) == 0);
+    assert(quantize_r2(-0.5) == 0);
+    assert(quantize_r2(NAN) == 0);
+    assert(quantize_r2(1.0) == R2_SCALE);
+    assert(quantize_r2(1.5) == R2_SCALE);
+    assert(dequantize_r2(0) == 0.0);
+    assert(dequantize_r2(R2_SCALE) == 1.0);
+
+    uint16_t previous = 0;
+    for (size_t i = 0; i <= 10000; i++) {
+        double r2 = i / 10000.0;
+        uint16_t quantized = quantize_r2(r2);
+        assert(quantized >= previous);
+        assert(std::fabs(dequantize_r2(quantized) - r2) <= 0.5 / R2_SCALE);
+        assert(quantize_r2(dequantize_r2(quantized)) == quantized);
+        previous = quantized;
+    }
+}
+
+void check_minimal_perfect_hash() {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 10000; i++) {
+        keys.push_back("rs" + std::to_string(i));
+    }
+    std::vector<std::string_view> key_views(keys.begin(), keys.end());
+    MinimalPerfectHash index(key_views);
+    assert(index.size() == keys.size());
+
+    // Every key has its own slot, and a deserialized map agrees.
+    std::string serialized(index.serialized());
+    MinimalPerfectHash loaded(serialized);
+    assert(loaded.size() == keys.size());
+    std::vector<bool> used(keys.size(), false);
+    for (const std::string& key : keys) {
+        size_t slot = index.lookup(key);
+        assert(slot < keys.size() && !used[slot]);
+        assert(loaded.lookup(key) == slot);
+        used[slot] = true;
+    }
+
+    // Absent keys map to some slot or to none, and some to none.
+    size_t n_not_found = 0;
+    for (size_t i = 0; i < 10000; i++) {
+        size_t slot = index.lookup("absent" + std::to_string(i));
+        assert(slot == MinimalPerfectHash::NOT_FOUND || slot < keys.size());
+        n_not_found += slot == MinimalPerfectHash::NOT_FOUND;
+    }
+    assert(n_not_found > 0);
+
+    MinimalPerfectHash empty(std::vector<std::string_view>{});
+    assert(empty.size() == 0);
+    assert(empty.lookup("rs0") == MinimalPerfectHash::NOT_FOUND);
+
+    check_throws<mph_error>([]() {
+        MinimalPerfectHash duplicates(std::vector<std::string_view>{ "rs1", "rs1" });
+    });
+    check_throws<mph_error>([&]() {
+        MinimalPerfectHash truncated(std::string_view(serialized).substr(0, serialized.size() / 2));
+    });
+}
+
+// Reads the value at 'value', which tables made before diskhash version 1.4
+// may not align.
+uint64_t read_value(const uint64_t* value) {
+    uint64_t result;
+    memcpy(&result, value, sizeof(result));
+    return result;
+}
+
+// Checks that 'table' maps "key<i>" to i * 3 + 1, in order, for i < n_keys.
+void check_diskhash_keys(dht::DiskHash<uint64_t>& table, size_t n_keys) {
+    assert(table.size() == n_keys);
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < n_keys; i++) {
+        std::string key = "key" + std::to_string(i);
+        uint64_t* value = table.lookup(key.c_str());
+        assert(value && read_value(value) == i * 3 + 1);
+
+        uint64_t* indexed_value;
+        assert(table.key_at(i, &indexed_value) == key);
+        assert(indexed_value == value);
+        keys.push_back(key);
+    }
+    assert(!table.lookup("key"));
+    assert(!table.lookup(("key" + std::to_string(n_keys)).c_str()));
+
+    std::vector<const char*> key_data;
+    std::vector<size_t> key_sizes;
+    for (const std::string& key : keys) {
+        key_data.push_back(key.data());
+        key_sizes.push_back(key.size());
+    }
+    key_data.push_back("absent");
+    key_sizes.push_back(6);
+    std::vector<uint64_t*> results(key_data.size());
+    table.lookup_many(key_data.data(), key_sizes.data(), key_data.size(), results.data());
+    for (size_t i = 0; i < n_keys; i++) {
+        assert(results[i] && read_value(results[i]) == i * 3 + 1);
+    }
+    assert(!results[n_keys]);
+}
+
+void check_diskhash_old_versions() {
+    for (const std::string minor : { "1", "2", "3" }) {
+        fs::path path = DATA_DIR / ("diskhash_1_" + minor + ".dht");
+        assert(read_magic(path) == "DiskBasedHash1" + minor);
+        dht::DiskHash<uint64_t> table(path.c_str(), 16, dht::DHOpenRO);
+        check_diskhash_keys(table, DATA_N_KEYS);
+    }
+}
+
+void check_diskhash_round_trip() {
+    // Tables of version 1.4 have keys in their nodes and no heap. Inserting
+    // more keys than a table was created for grows it.
+    fs::path path = TEST_DIR / "table_1_4.dht";
+    {
+        auto table = dht::DiskHash<uint64_t>::create(path.c_str(), 16, 10);
+        for (uint64_t i = 0; i < DATA_N_KEYS; i++) {
+            uint64_t value = i * 3 + 1;
+            bool inserted = table.insert(("key" + std::to_string(i)).c_str(), value);
+            assert(inserted);
+        }
+        bool inserted = table.insert("key0", 0);
+        assert(!inserted);
+        check_throws<std::runtime_error>([&]() {
+            table.insert("key_that_is_too_long", 0);
+        });
+        check_diskhash_keys(table, DATA_N_KEYS);
+    }
+    assert(read_magic(path) == "DiskBasedHash14");
+    {
+        dht::DiskHash<uint64_t> table(path.c_str(), 16, dht::DHOpenRO);
+        check_diskhash_keys(table, DATA_N_KEYS);
+    }
+
+    // Tables of version 1.5 keep keys of 32 bytes or more in their heap,
+    // and 1.6 keeps them in their nodes. Both heaps hold blobs, whose
+    // offsets survive the table growing.
+    for (int key_size : { 16, 64 }) {
+        path = TEST_DIR / ("table_heap_" + std::to_string(key_size) + ".dht");
+        std::string prefix(key_size == 64 ? 40 : 0, 'k');
+        std::vector<uint64_t> offsets;
+        {
+            auto table = dht::DiskHash<uint64_t>::create_with_heap(path.c_str(), key_size, 10);
+            assert(table.has_heap() && table.heap_size() == 0);
+            for (uint64_t i = 0; i < DATA_N_KEYS; i++) {
+                std::string blob(i % 7, static_cast<char>('a' + i % 26));
+                offsets.push_back(table.heap_append(blob.data(), blob.size()));
+                bool inserted = table.insert((prefix + "key" + std::to_string(i)).c_str(), i * 3 + 1);
+                assert(inserted);
+            }
+        }
+        assert(read_magic(path) == (key_size == 64 ? "DiskBasedHash15" : "DiskBasedHash16"));
+
+        dht::DiskHash<uint64_t> table(path.c_str(), key_size, dht::DHOpenRO);
+        assert(table.size() == DATA_N_KEYS);
+        for (uint64_t i = 0; i < DATA_N_KEYS; i++) {
+            std::string key = prefix + "key" + std::to_string(i);
+            uint64_t* value = table.lookup(key.c_str());
+            assert(value && *value == i * 3 + 1);
+            assert(table.key_at(i) == key);
+            std::string blob(i % 7, static_cast<char>('a' + i % 26));
+            if (!blob.empty()) {
+                assert(std::string_view(table.heap_at(offsets[i]), blob.size()) == blob);
+            }
+        }
+        assert(!table.lookup((prefix + "absent").c_str()));
+    }
+}
+
+void check_diskhash_grows_past_max_probe_length() {
+    // Keys whose hashes are this small share the first home slot of any
+    // table of up to 'max_slots' slots.
+    const uint64_t max_slots = 1 << 13;
+    const size_t n_keys = 300;  // More than MAX_PROBE_LENGTH (255) + 1.
+    std::vector<std::string> keys;
+    for (size_t i = 0; keys.size() < n_keys; i++) {
+        std::string key = std::to_string(i);
+        if (dht_hash_key(key.data(), key.size(), 14) < UINT64_MAX / max_slots) {
+            keys.push_back(key);
+        }
+    }
+
+    fs::path path = TEST_DIR / "table_probes.dht";
+    HashTableOpts opts;
+    opts.key_maxlen = 16;
+    opts.object_datalen = sizeof(uint64_t);
+    HashTable* table = dht_create(path.c_str(), opts, 1000, 0, nullptr);
+    assert(table);
+    size_t capacity = dht_reserve(table, 1, nullptr);
+    for (size_t i = 0; i < n_keys; i++) {
+        uint64_t value = i;
+        int inserted = dht_insert(table, keys[i].c_str(), &value, nullptr);
+        assert(inserted == 1);
+    }
+
+    // The table grew rather than probe further, and kept insertion order.
+    assert(dht_reserve(table, 1, nullptr) > capacity);
+    assert(dht_size(table) == n_keys);
+    for (size_t i = 0; i < n_keys; i++) {
+        const uint64_t* value = static_cast<const uint64_t*>(dht_lookup(table, keys[i].c_str()));
+        assert(value && *value == i);
+        assert(dht_probe_length(table, keys[i].data(), keys[i].size()) <= 256);
+
+        const char* key;
+        assert(dht_indexed_lookup(table, i, &key) == value);
+        assert(key == keys[i]);
+    }
+    dht_free(table);
+}
+
+// Checks that 'vdh' maps "rs<i>" to make_values(i) for i < n_keys.
+void check_vdh_values(VectorDiskHash& vdh, size_t n_keys) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < n_keys; i++) {
+        std::string key = "rs" + std::to_string(i);
+        assert(vdh.is_member(key));
+        assert(vdh.lookup(key) == make_values(i));
+        ValueRange values = vdh.lookup_range(key);
+        assert(std::vector<std::string>(values.begin(), values.end()) == make_values(i));
+        keys.push_back(key);
+    }
+    keys.push_back("absent");
+    assert(!vdh.is_member("absent"));
+    check_throws<vdh_key_error>([&]() { vdh.lookup("absent"); });
+
+    size_t n_visited = 0;
+    vdh.lookup_many(keys, [&](size_t index, const ValueRange* values) {
+        assert(index == n_visited++);
+        if (index == n_keys) {
+            assert(!values);
+        } else {
+            assert(values);
+            assert(std::vector<std::string>(values->begin(), values->end()) == make_values(index));
+        }
+    });
+    assert(n_visited == keys.size());
+
+    std::set<std::string> visited;
+    vdh.for_each_key([&](const std::string& key) { visited.insert(key); });
+    assert(visited.size() >= n_keys && visited.count("rs0"));
+}
+
+void check_vdh_round_trip() {
+    const size_t n_keys = 200;
+    Options opts = {
+        (TEST_DIR / "vdh.vdhdat").string(), (TEST_DIR / "vdh.vdhdht").string(), 16, true, 10
+    };
+    {
+        VectorDiskHash vdh(opts);
+        for (size_t i = 0; i < n_keys; i++) {
+            std::string key = "rs" + std::to_string(i);
+            if (i % 3 == 0) {
+                for (const std::string& value : make_values(i)) {
+                    vdh.push(key, value);
+                }
+            } else if (i % 3 == 1) {
+                vdh.append(key, make_values(i));
+            } else {
+                size_t n_bytes = 0;
+                for (const std::string& value : make_values(i)) {
+                    n_bytes += value.size();
+                }
+                vdh.reserve(key, i % 4 + 1, n_bytes);
+            }
+        }
+        for (size_t i = 2; i < n_keys; i += 3) {
+            std::string key = "rs" + std::to_string(i);
+            for (const std::string& value : make_values(i)) {
+                vdh.append(key, value);
+            }
+            check_throws<vdh_value_error>([&]() { vdh.append(key, "x"); });
+        }
+        vdh.append("empty", std::vector<std::string>{});
+        check_throws<vdh_key_error>([&]() { vdh.push("a_key_that_is_too_long", "x"); });
+        vdh.flush();
+        check_vdh_values(vdh, n_keys);
+    }
+
+    // Format 3 keeps everything in the table.
+    assert(!fs::exists(opts.file_path));
+    assert(read_magic(opts.table_path) == "DiskBasedHash16");
+    opts.create = false;
+    opts.max_key_size = 0;
+    {
+        VectorDiskHash vdh(opts);
+        check_vdh_values(vdh, n_keys);
+        assert(vdh.lookup("empty").empty());
+        check_throws<vdh_mode_error>([&]() { vdh.append("rs0", "x"); });
+        assert(!vdh.has_static_index());
+        vdh.build_static_index();
+        assert(vdh.has_static_index());
+        check_vdh_values(vdh, n_keys);
+    }
+    {
+        VectorDiskHash vdh(opts);
+        check_vdh_values(vdh, n_keys);
+        assert(vdh.lookup("empty").empty());
+    }
+}
+
+void check_vdh_old_formats() {
+    for (const std::string version : { "1", "2" }) {
+        // Copy the tables, since building a static index rewrites them.
+        Options opts = {
+            (TEST_DIR / ("vdh_format_" + version + ".vdhdat")).string(),
+            (TEST_DIR / ("vdh_format_" + version + ".vdhdht")).string(),
+            0,
+            false
+        };
+        fs::copy_file(DATA_DIR / fs::path(opts.file_path).filename(), opts.file_path);
+        fs::copy_file(DATA_DIR / fs::path(opts.table_path).filename(), opts.table_path);
+
+        {
+            VectorDiskHash vdh(opts);
+            check_vdh_values(vdh, DATA_N_VDH_KEYS);
+            assert(vdh.lookup_range("rs0").has_offsets() == (version == "2"));
+            vdh.build_static_index();
+        }
+        VectorDiskHash vdh(opts);
+        assert(vdh.has_static_index());
+        check_vdh_values(vdh, DATA_N_VDH_KEYS);
+    }
+}
+
+void check_strata_version() {
+    Histogram<size_t> n_surrogates_strata;
+    n_surrogates_strata.increase_count(10);
+    Histogram<double> maf_strata;
+    maf_strata.increase_count(0.25);
+    IndexVariantSummary on_bounds = { "rs1", 0.25, 10 };
+
+    // Variants on a stratum bound belong to that stratum.
+    std::string file_path = (TEST_DIR / "strata.vdhdat").string();
+    std::string table_path = (TEST_DIR / "strata.vdhdht").string();
+    {
+        StrataTable strata(file_path, table_path, n_surrogates_strata, maf_strata);
+        assert(strata.get_stratum(on_bounds) == "10 0.250000");
+        strata.append(on_bounds);
+        strata.flush();
+    }
+    {
+        StrataTable strata(file_path, table_path);
+        assert(strata.get_stratum(on_bounds) == "10 0.250000");
+        assert(strata.lookup(on_bounds) == std::vector<std::string>{ "rs1" });
+    }
+
+    // Tables without a version put them in the stratum below, and tables of
+    // an unknown version are rejected.
+    for (const std::string version : { "", "9" }) {
+        std::string old_table_path = (TEST_DIR / ("strata_" + version + ".vdhdht")).string();
+        {
+            VectorDiskHash vdh({ "", old_table_path, 64, true });
+            if (!version.empty()) {
+                vdh.append("__STRATA_VERSION_KEY__", version);
+            }
+            vdh.append("__N_SURROGATES_KEY__", std::vector<std::string>{ "0", "10" });
+            vdh.append("__MAF_KEY__", std::vector<std::string>{ "0.000000", "0.250000" });
+        }
+        if (version.empty()) {
+            StrataTable strata(file_path, old_table_path);
+            assert(strata.get_stratum(on_bounds) == "0 0.000000");
+        } else {
+            check_throws<strata_version_error>([&]() {
+                StrataTable strata(file_path, old_table_path);
+            });
+        }
+    }
+}
 
 int main() {
-    return 0;
-}
\ No newline at end of file
+    fs::remove_all(TEST_DIR);
+    fs::create_directory(TEST_DIR);
+
+    check_postings_round_trip();
+    check_quantize_r2();
+    check_minimal_perfect_hash();
+    check_diskhash_old_versions();
+    check_diskhash_round_trip();
+    check_diskhash_grows_past_max_probe_length();
+    check_vdh_round_trip();
+    check_vdh_old_formats();
+    check_strata_version();
+
+    fs::remove_all(TEST_DIR);
+}
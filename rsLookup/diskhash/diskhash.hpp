@@ -1,6 +1,7 @@
 #ifndef DISKHASH_HPP_INCLUDE_GUARD__
 #define DISKHASH_HPP_INCLUDE_GUARD__
 
+#include <algorithm>
 #include <stdexcept>
 #include <cinttypes>
 #include <type_traits>
@@ -14,6 +15,9 @@
 
 namespace dht {
 enum OpenMode { DHOpenRO, DHOpenRW, DHOpenRWNoCreate };
+// How much of a table is brought into memory when it is opened (see
+// HashTableResidency)
+enum Residency { DHDefault, DHLazy, DHPopulate, DHLocked, DHHugePages };
 
 template <typename T>
 struct DiskHash {
@@ -21,9 +25,9 @@ struct DiskHash {
             "DiskHash only works for POD (plain old data) types that can be mempcy()ed around");
     public:
         /***
-         * Open a diskhash from disk
+         * Open a diskhash from disk, bringing it into memory as 'r' says
          */
-        DiskHash(const char* fname, const int keysize, OpenMode m):ht_(0) {
+        DiskHash(const char* fname, const int keysize, OpenMode m, Residency r = DHDefault):ht_(0) {
             char* err = nullptr;
             int flags;
             if (m == DHOpenRO) {
@@ -43,29 +47,121 @@ struct DiskHash {
                 std::free(err);
                 throw std::runtime_error(error);
             }
+            try {
+                set_residency(r);
+            } catch (...) {
+                dht_free(ht_);
+                ht_ = 0;
+                throw;
+            }
         }
         DiskHash(DiskHash&& other):ht_(other.ht_) { other.ht_ = 0; }
 
+        /***
+         * Create a new diskhash sized for 'capacity' elements
+         *
+         * Inserting up to 'capacity' elements almost never grows (and so
+         * rewrites) the table. The table is filled to at most
+         * 'max_load_percent' of its slots (0 for the default; see
+         * dht_create). The file must not exist.
+         */
+        static DiskHash create(const char* fname, const int keysize, size_t capacity, size_t max_load_percent = 0) {
+            return create_table(dht_create, fname, keysize, capacity, max_load_percent);
+        }
+
+        /***
+         * Create a new diskhash, as create(), whose file ends in a heap of
+         * blobs (see dht_create_with_heap) for values of any length
+         */
+        static DiskHash create_with_heap(const char* fname, const int keysize, size_t capacity, size_t max_load_percent = 0) {
+            return create_table(dht_create_with_heap, fname, keysize, capacity, max_load_percent);
+        }
+
         ~DiskHash() {
             if (ht_) dht_free(ht_);
         }
 
+        /**
+         * Bring the table into memory as 'r' says (see dht_set_residency).
+         * On failure, the table is still usable, as it was.
+         */
+        void set_residency(Residency r) {
+            if (!ht_) return;
+            char* err = nullptr;
+            if (dht_set_residency(ht_, static_cast<HashTableResidency>(r), &err) != 0) {
+                if (!err) throw std::bad_alloc();
+                std::string error = "Error loading file '" + std::string(ht_->fname_) + "' into memory: " + std::string(err);
+                std::free(err);
+                throw std::runtime_error(error);
+            }
+        }
+
         /**
          * Check if key is a member
          */
         bool is_member(const char* key) const { return const_cast<DiskHash<T>*>(this)->lookup(key); }
+        bool is_member(const char* key, size_t len) const { return const_cast<DiskHash<T>*>(this)->lookup(key, len); }
 
         /**
          * Return a pointer to the element (if present, otherwise nullptr).
          *
          * Note that if the diskhash was not opened in read-write mode, then
          * the memory will not be writeable.
+         *
+         * Tables of versions before 1.4 may hold elements at addresses that
+         * are only 4-byte aligned, so read them through memcpy.
          */
         T* lookup(const char* key) {
             if (!ht_) return nullptr;
             return static_cast<T*>(dht_lookup(ht_, key));
         }
 
+        /**
+         * Return a pointer to the element whose key is the first 'len'
+         * characters of 'key' (if present, otherwise nullptr).
+         */
+        T* lookup(const char* key, size_t len) {
+            if (!ht_) return nullptr;
+            return static_cast<T*>(dht_lookup_len(ht_, key, len));
+        }
+
+        /**
+         * Set results[i] to lookup(keys[i], lens[i]) for each i < n, looking
+         * the keys up a batch at a time so their memory accesses overlap
+         * (see dht_lookup_many)
+         */
+        void lookup_many(const char* const* keys, const size_t* lens, size_t n, T** results) const {
+            void* batch[64];
+            for (size_t start = 0; start < n; start += 64) {
+                const size_t batch_size = std::min<size_t>(n - start, 64);
+                if (ht_) {
+                    dht_lookup_many(ht_, keys + start, lens + start, batch_size, batch);
+                } else {
+                    std::fill(batch, batch + batch_size, nullptr);
+                }
+                for (size_t i = 0; i < batch_size; ++i) {
+                    results[start + i] = static_cast<T*>(batch[i]);
+                }
+            }
+        }
+
+        /**
+         * Return the number of elements
+         */
+        size_t size() const { return ht_ ? dht_size(ht_) : 0; }
+
+        /**
+         * Return the key of the ix-th inserted element (0 <= ix < size()),
+         * and set *val (if val is not nullptr) to point to the element.
+         */
+        const char* key_at(size_t ix, T** val = nullptr) const {
+            const char* key = nullptr;
+            void* data = ht_ ? dht_indexed_lookup(ht_, ix, &key) : nullptr;
+            if (!data) throw std::out_of_range("DiskHash index out of range");
+            if (val) *val = static_cast<T*>(data);
+            return key;
+        }
+
         /**
          * Insert an element
          *
@@ -83,12 +179,132 @@ struct DiskHash {
             throw std::runtime_error(error);
         }
 
+        /**
+         * Return whether the table has a heap of blobs
+         */
+        bool has_heap() const { return ht_ && dht_heap_at(ht_, 0); }
+
+        /**
+         * Return the number of bytes in the heap (0 if there is none)
+         */
+        size_t heap_size() const { return ht_ ? dht_heap_size(ht_) : 0; }
+
+        /**
+         * Append 'len' bytes of data (zeros if data is nullptr) to the heap,
+         * and return their offset in it
+         *
+         * The table may be remapped, which invalidates the pointers returned
+         * by lookup() and heap_at().
+         */
+        uint64_t heap_append(const void* data, size_t len) {
+            char* err = nullptr;
+            uint64_t offset = 0;
+            if (dht_heap_append(ht_, data, len, &offset, &err) == 0) return offset;
+            if (!err) { throw std::bad_alloc(); }
+            std::string error = "Error appending to heap: " + std::string(err);
+            std::free(err);
+            throw std::runtime_error(error);
+        }
+
+        /**
+         * Return a pointer to the heap at 'offset'
+         */
+        char* heap_at(uint64_t offset) const {
+            void* p = ht_ ? dht_heap_at(ht_, offset) : nullptr;
+            if (!p) throw std::out_of_range("DiskHash heap offset out of range");
+            return static_cast<char*>(p);
+        }
+
         DiskHash(const DiskHash&) = delete;
         DiskHash& operator=(const DiskHash&) = delete;
     private:
+        explicit DiskHash(HashTable* ht):ht_(ht) { }
+
+        static DiskHash create_table(HashTable* (*create_fn)(const char*, HashTableOpts, size_t, size_t, char**),
+                const char* fname, const int keysize, size_t capacity, size_t max_load_percent) {
+            char* err = nullptr;
+            HashTableOpts opts;
+            opts.key_maxlen = keysize;
+            opts.object_datalen = sizeof(T);
+            HashTable* ht = create_fn(fname, opts, capacity, max_load_percent, &err);
+            if (!ht) {
+                if (!err) throw std::bad_alloc();
+                std::string error = "Error creating file '" + std::string(fname) + "': " + std::string(err);
+                std::free(err);
+                throw std::runtime_error(error);
+            }
+            return DiskHash(ht);
+        }
+
         HashTable* ht_;
 };
 
+/**
+ * Bulk-load a new diskhash from a stream of elements of unknown length
+ *
+ * Elements are written sequentially to a temporary file, and the table is
+ * only written, at its final size, by finish(). Until then, the file at fname
+ * (if any) is left as it is. A builder that is not finished leaves no files
+ * behind.
+ */
+template <typename T>
+struct DiskHashBuilder {
+    static_assert(std::is_trivially_copyable<T>::value,
+            "DiskHashBuilder only works for POD (plain old data) types that can be mempcy()ed around");
+    public:
+        DiskHashBuilder(const char* fname, const int keysize, size_t max_load_percent = 0):hb_(0) {
+            char* err = nullptr;
+            HashTableOpts opts;
+            opts.key_maxlen = keysize;
+            opts.object_datalen = sizeof(T);
+            hb_ = dht_builder_open(fname, opts, max_load_percent, &err);
+            if (!hb_) {
+                if (!err) throw std::bad_alloc();
+                std::string error = "Error creating file '" + std::string(fname) + "': " + std::string(err);
+                std::free(err);
+                throw std::runtime_error(error);
+            }
+        }
+        DiskHashBuilder(DiskHashBuilder&& other):hb_(other.hb_) { other.hb_ = 0; }
+
+        ~DiskHashBuilder() {
+            if (hb_) dht_builder_free(hb_);
+        }
+
+        /**
+         * Add an element
+         *
+         * If a key is added more than once, only its first element is kept.
+         */
+        void add(const char* key, const T& val) {
+            char* err = nullptr;
+            if (dht_builder_add(hb_, key, &val, &err) == 1) return;
+            if (!err) throw std::bad_alloc();
+            std::string error = "Error adding key '" + std::string(key) + "': " + std::string(err);
+            std::free(err);
+            throw std::runtime_error(error);
+        }
+
+        /**
+         * Write the table. The builder cannot be used afterwards.
+         */
+        void finish() {
+            char* err = nullptr;
+            const int icode = dht_builder_finish(hb_, &err);
+            hb_ = 0;
+            if (icode == 0) return;
+            if (!err) throw std::bad_alloc();
+            std::string error = "Error writing table: " + std::string(err);
+            std::free(err);
+            throw std::runtime_error(error);
+        }
+
+        DiskHashBuilder(const DiskHashBuilder&) = delete;
+        DiskHashBuilder& operator=(const DiskHashBuilder&) = delete;
+    private:
+        HashTableBuilder* hb_;
+};
+
 }
 
 #endif /* DISKHASH_HPP_INCLUDE_GUARD__ */
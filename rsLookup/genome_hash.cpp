@@ -40,6 +40,9 @@ const int alleles_col = 9;
 const int key_maxlen = 15;
 const int key_maxlen_big = 20;
 
+// rsIDs read from a file are looked up this many at a time
+const size_t rsid_batch_size = 256;
+
 
 // Check if string in list
 bool in_list(vector<string> s, string key) {
@@ -94,7 +97,9 @@ vector<string> str_split(const std::string& str, char delim = ' ')
 // Creates the hash table from the tab-separated file using RSID number string as key
 int create_rsid_table(const char *source_name, const char* rsid_table_name, ostream *log_file) {
 	cout << "Creating table from rsID to position...\n";
-	DiskHash<SNPData> ht(rsid_table_name, key_maxlen, dht::DHOpenRW);
+	// The number of rsIDs is not known in advance, so the table is
+	// bulk-loaded once they have all been read.
+	DiskHashBuilder<SNPData> ht(rsid_table_name, key_maxlen);
 	string line;
 	ifstream filebase;
 	filebase.open(string(source_name));
@@ -129,9 +134,10 @@ int create_rsid_table(const char *source_name, const char* rsid_table_name, ostr
 		char stored_arr[MAX_DATA_LENGTH] = {};
 		strcpy(stored_arr, stored_data.c_str());
 		strcpy(item.data, stored_arr);
-		const char *rsid_num_part = rsid_str.substr(2, rsid_str.length()).c_str();
-		const bool inserted = ht.insert(rsid_num_part, item);
+		const string rsid_num_part = rsid_str.substr(2, rsid_str.length());
+		ht.add(rsid_num_part.c_str(), item);
 	}
+	ht.finish();
 	filebase.close();
 	return 0;
 }
@@ -279,7 +285,7 @@ int create_cpa_table_pointer(const char *source_name, const char* rsid_table_nam
 	cout << "Creating table from position to rsID...\n";
 	// Create diskhash file plus a text file with ".data" appended to filename
 	// The diskhash will point to locations in the .data file.
-	DiskHash<size_t> ht(rsid_table_name, key_maxlen_big, dht::DHOpenRW);
+	DiskHashBuilder<size_t> ht(rsid_table_name, key_maxlen_big);
 	string line;
 	ifstream filebase;
 	filebase.open(string(source_name));
@@ -324,7 +330,7 @@ int create_cpa_table_pointer(const char *source_name, const char* rsid_table_nam
 				prev_pos = s_file.tellp();
 			prev_position = startpos;
 			prev_chromosome = chromosome;
-				const bool inserted = ht.insert(b_key.c_str(), prev_pos);
+				ht.add(b_key.c_str(), prev_pos);
 				line_break = "\n";
 			}
 			else s_file << "\t";
@@ -336,24 +342,20 @@ int create_cpa_table_pointer(const char *source_name, const char* rsid_table_nam
 		}
 	}
 	s_file << line_break;
+	ht.finish();
 	filebase.close();
 	s_file.close();
 	return 0;
 }
 
-// Gets the rsID from the hash table and prints to standard out the chromosome, starting position, and alleles
-int get_rsid(const char *rsid_table_name, const char* rsid_param, ostream *log_file) {
-	// Format check rsNNNNNNNNN
-	if (!(strlen(rsid_param) > 2 && tolower(rsid_param[0]) == 'r' && tolower(rsid_param[1]) == 's')) {
-		cout << "Invalid RSID requested" << endl;
-		return 1;
-	}
-	DiskHash<SNPData> ht(rsid_table_name, key_maxlen, dht::DHOpenRO);
-	string rsid(rsid_param);
-	const char *rsid_num_part = rsid.substr(2, rsid.length()).c_str();
-	SNPData *member;
-	if (ht.is_member(rsid_num_part)) {
-		member = ht.lookup(rsid_num_part);
+// Format check rsNNNNNNNNN
+bool is_rsid(const string &rsid) {
+	return rsid.length() > 2 && tolower(rsid[0]) == 'r' && tolower(rsid[1]) == 's';
+}
+
+// Prints to standard out the chromosome, starting position, and alleles of an rsID, given its table entry (NULL if not found)
+int print_rsid(const string &rsid, const SNPData *member, ostream *log_file) {
+	if (member) {
 		string result = member->data;
 		vector<string> pieces = str_split(result, '\t');
 		string chromosome = pieces[0];
@@ -370,6 +372,39 @@ int get_rsid(const char *rsid_table_name, const char* rsid_param, ostream *log_f
 	return 0;
 }
 
+// Gets the rsID from the hash table and prints to standard out the chromosome, starting position, and alleles
+int get_rsid(const char *rsid_table_name, const char* rsid_param, ostream *log_file) {
+	string rsid(rsid_param);
+	if (!is_rsid(rsid)) {
+		cout << "Invalid RSID requested" << endl;
+		return 1;
+	}
+	DiskHash<SNPData> ht(rsid_table_name, key_maxlen, dht::DHOpenRO);
+	string rsid_num_part = rsid.substr(2);
+	return print_rsid(rsid, ht.lookup(rsid_num_part.c_str(), rsid_num_part.length()), log_file);
+}
+
+// Looks up a batch of rsIDs in the hash table at once, and prints them as get_rsid does, in order
+void get_rsid_batch(DiskHash<SNPData> &ht, const vector<string> &rsids, ostream *log_file) {
+	vector<string> num_parts;
+	vector<const char*> keys;
+	vector<size_t> lens;
+	for (const string &rsid : rsids) {
+		if (is_rsid(rsid)) num_parts.push_back(rsid.substr(2));
+	}
+	for (const string &num_part : num_parts) {
+		keys.push_back(num_part.c_str());
+		lens.push_back(num_part.length());
+	}
+	vector<SNPData*> members(keys.size());
+	ht.lookup_many(keys.data(), lens.data(), keys.size(), members.data());
+	size_t next_member = 0;
+	for (const string &rsid : rsids) {
+		if (!is_rsid(rsid)) cout << "Invalid RSID requested" << endl;
+		else print_rsid(rsid, members[next_member++], log_file);
+	}
+}
+
 // Look up chromosome/position/alleles and print RSID(s) [pointer version]
 int get_cpa_pointers(const char *data_file_name, const char *rsid_table_name, const char * chromosome_c, const char *position_c, const char *allele_c, ostream *log_file) {
 	DiskHash<size_t> ht(rsid_table_name, key_maxlen_big, dht::DHOpenRO);
@@ -420,10 +455,17 @@ int get_cpa_pointers(const char *data_file_name, const char *rsid_table_name, co
 void get_rsid_file(const string &filename, const string &source, ostream *log_file) {
 	ifstream file;
 	file.open(filename);
+	DiskHash<SNPData> ht(source.c_str(), key_maxlen, dht::DHOpenRO);
 	string rsid;
+	vector<string> rsids;
 	while (file >> rsid) {
-		get_rsid(source.c_str(), rsid.c_str(), log_file);
+		rsids.push_back(rsid);
+		if (rsids.size() == rsid_batch_size) {
+			get_rsid_batch(ht, rsids, log_file);
+			rsids.clear();
+		}
 	}
+	get_rsid_batch(ht, rsids, log_file);
 	file.close();
 }
 